@@ -0,0 +1,41 @@
+#include "autosaver.h"
+
+#include <iostream>
+#include <memory>
+#include <utility>
+
+#include "cpputils/graphics/thread_priority.h"
+
+Autosaver::~Autosaver() { Wait(); }
+
+bool Autosaver::Start(const std::string& filename,
+                      const graphics::Image& image,
+                      const graphics::ProjectFile::Metadata& metadata,
+                      std::function<void()> on_saved) {
+  if (saving_) return false;
+  if (thread_.joinable()) thread_.join();
+  std::shared_ptr<graphics::ImageSnapshot> snapshot = project_.Snapshot(image);
+  saving_ = true;
+  thread_ = std::thread([this, filename, snapshot, metadata,
+                         on_saved = std::move(on_saved)] {
+    graphics::LowerThreadPriority();
+    succeeded_ = project_.Save(filename, *snapshot, metadata);
+    if (!succeeded_) {
+      std::cout << "Autosave to " << filename << " failed" << std::endl;
+    } else if (on_saved) {
+      on_saved();
+    }
+    saving_ = false;
+  });
+  return true;
+}
+
+void Autosaver::Follow(const graphics::ProjectFile& project) {
+  Wait();
+  project_.OpenLike(project);
+}
+
+bool Autosaver::Wait() {
+  if (thread_.joinable()) thread_.join();
+  return succeeded_;
+}
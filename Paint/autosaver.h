@@ -0,0 +1,52 @@
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "cpputils/graphics/image.h"
+#include "cpputils/graphics/project_file.h"
+
+#ifndef AUTOSAVER_H
+#define AUTOSAVER_H
+
+// Saves an image to a project file on a low-priority background thread. The
+// image is snapshotted copy-on-write, so drawing carries on during a save,
+// and each save only writes the tiles that changed since the previous one.
+class Autosaver {
+ public:
+  Autosaver() = default;
+  Autosaver(const Autosaver&) = delete;
+  Autosaver& operator=(const Autosaver&) = delete;
+
+  // Waits for any save in progress.
+  ~Autosaver();
+
+  // Starts saving |image| and |metadata| to the project |filename|, unless
+  // the previous save is still running. Returns false if it is. |on_saved|,
+  // if set, is called on the saving thread once the save has succeeded.
+  bool Start(const std::string& filename, const graphics::Image& image,
+             const graphics::ProjectFile::Metadata& metadata,
+             std::function<void()> on_saved = nullptr);
+
+  // Makes the next save start from |project|, once any save in progress is
+  // done. While the image is still the one attached to or saved in
+  // |project|, saves then only snapshot the tiles changed since, leaving the
+  // rest unread, and copy the others from its file.
+  void Follow(const graphics::ProjectFile& project);
+
+  // Returns true while a save is running.
+  bool IsSaving() const { return saving_; }
+
+  // Waits for the save in progress, if any. Returns false if the last save
+  // failed.
+  bool Wait();
+
+ private:
+  // Only used by thread_ while a save runs, and by Start otherwise.
+  graphics::ProjectFile project_;
+  std::thread thread_;
+  std::atomic<bool> saving_{false};
+  bool succeeded_ = true;
+};
+
+#endif  // AUTOSAVER_H
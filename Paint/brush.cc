@@ -12,3 +12,5 @@ void Brush::MoveTo(int x, int y, graphics::Image& image) {
 }
 
 void Brush::SetWidth(int width) { width_ = width; }
+
+int Brush::GetWidth() const { return width_; }
@@ -19,6 +19,9 @@ class Brush : public ColorTool, public PathTool {
   // Change the thickness of the brush.
   void SetWidth(int width);
 
+  // Get the thickness of the brush.
+  int GetWidth() const;
+
  private:
   int width_ = 10;
 };
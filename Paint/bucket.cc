@@ -1,17 +1,13 @@
 #include "bucket.h"
 
-#include <queue>
-
-class Point {
- public:
-  Point(int x, int y) : x(x), y(y){};
-  int x;
-  int y;
-};
-
 void Bucket::Fill(int x, int y, graphics::Image& image) {
+  Fill(x, y, image, arena_);
+  arena_.Release();
+}
+
+void Bucket::Fill(int x, int y, graphics::Image& image, StrokeArena& arena) {
   // RecursiveFill(x, y, image.GetColor(x, y), GetColor(), image);
-  IterativeFill(x, y, image.GetColor(x, y), GetColor(), image);
+  IterativeFill(x, y, image.GetColor(x, y), GetColor(), image, arena);
 }
 
 void Bucket::RecursiveFill(int x, int y, graphics::Color start,
@@ -31,25 +27,28 @@ void Bucket::RecursiveFill(int x, int y, graphics::Color start,
 }
 
 void Bucket::IterativeFill(int x, int y, graphics::Color start,
-                           graphics::Color fill, graphics::Image& image) {
+                           graphics::Color fill, graphics::Image& image,
+                           StrokeArena& arena) {
   if (start == fill) return;
-  std::queue<Point> pixels_to_check;
-  Point initial(x, y);
-  pixels_to_check.push(initial);
-  while (pixels_to_check.size() > 0) {
-    Point point = pixels_to_check.front();
-    pixels_to_check.pop();
-    if (point.x < 0 || point.y < 0 || point.x >= image.GetWidth() ||
-        point.y >= image.GetWidth()) {
-      continue;
-    }
-    if (image.GetColor(point.x, point.y) != start) {
+  const int width = image.GetWidth();
+  const int height = image.GetHeight();
+  if (x < 0 || y < 0 || x >= width || y >= height) return;
+  // A stack visits the same pixels as a queue would, but only ever grows one
+  // buffer instead of allocating queue blocks.
+  std::pmr::vector<int> pixels_to_check(&arena);
+  pixels_to_check.push_back(y * width + x);
+  while (!pixels_to_check.empty()) {
+    const int index = pixels_to_check.back();
+    pixels_to_check.pop_back();
+    const int point_x = index % width;
+    const int point_y = index / width;
+    if (image.GetColor(point_x, point_y) != start) {
       continue;
     }
-    image.SetColor(point.x, point.y, fill);
-    pixels_to_check.push(Point(point.x - 1, point.y));
-    pixels_to_check.push(Point(point.x + 1, point.y));
-    pixels_to_check.push(Point(point.x, point.y - 1));
-    pixels_to_check.push(Point(point.x, point.y + 1));
+    image.SetColor(point_x, point_y, fill);
+    if (point_x > 0) pixels_to_check.push_back(index - 1);
+    if (point_x < width - 1) pixels_to_check.push_back(index + 1);
+    if (point_y > 0) pixels_to_check.push_back(index - width);
+    if (point_y < height - 1) pixels_to_check.push_back(index + width);
   }
 }
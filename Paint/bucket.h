@@ -1,5 +1,8 @@
+#include <vector>
+
 #include "color_tool.h"
 #include "cpputils/graphics/image.h"
+#include "stroke_arena.h"
 
 #ifndef BUCKET_H
 #define BUCKET_H
@@ -12,13 +15,23 @@ class Bucket : public ColorTool {
   // Fill an image starting at (x, y).
   void Fill(int x, int y, graphics::Image& image);
 
+  // Fill an image starting at (x, y), keeping temporary data in |arena|
+  // until the caller releases it.
+  void Fill(int x, int y, graphics::Image& image, StrokeArena& arena);
+
   // Recursive Fill helper.
   void RecursiveFill(int x, int y, graphics::Color start, graphics::Color fill,
                      graphics::Image& image);
 
-  // Iterative Fill helper.
+  // Iterative Fill helper, which keeps the pixels waiting to be checked in
+  // |arena|.
   void IterativeFill(int x, int y, graphics::Color start, graphics::Color fill,
-                     graphics::Image& image);
+                     graphics::Image& image, StrokeArena& arena);
+
+ private:
+  // For fills without an arena of their own. Released after each fill, and
+  // kept so that repeated fills reuse the same memory.
+  StrokeArena arena_;
 };
 
 #endif  // BUCKET_H
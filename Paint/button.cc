@@ -20,6 +20,8 @@ int Button::GetHeight() const { return height_; }
 
 ButtonListener* Button::GetListener() const { return listener_; }
 
+bool Button::IsPressed() const { return is_pressed_; }
+
 bool Button::DidHandleEvent(const graphics::MouseEvent& event) {
   if (event.GetMouseAction() == graphics::MouseAction::kDragged) {
     // Nothing changes during a drag.
@@ -21,6 +21,7 @@ class Button {
 
  protected:
   ButtonListener* GetListener() const;
+  bool IsPressed() const;
 
  private:
   int x_;
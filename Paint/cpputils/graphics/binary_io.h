@@ -0,0 +1,61 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#ifndef GRAPHICS_BINARY_IO_H
+#define GRAPHICS_BINARY_IO_H
+
+namespace graphics {
+
+/**
+ * Closes a FILE when the File holding it goes away.
+ */
+struct FileCloser {
+  void operator()(FILE* file) const { fclose(file); }
+};
+using File = std::unique_ptr<FILE, FileCloser>;
+
+/**
+ * Appends |value| to |out| as 4 or 8 little-endian bytes.
+ */
+inline void PutLE32(std::vector<uint8_t>* out, uint32_t value) {
+  for (int i = 0; i < 4; i++) out->push_back((value >> (8 * i)) & 0xFF);
+}
+
+inline void PutLE64(std::vector<uint8_t>* out, uint64_t value) {
+  for (int i = 0; i < 8; i++) out->push_back((value >> (8 * i)) & 0xFF);
+}
+
+/**
+ * Writes |value| to |p| as 4 or 8 little-endian bytes.
+ */
+inline void PutLE32(uint8_t* p, uint32_t value) {
+  for (int i = 0; i < 4; i++) p[i] = (value >> (8 * i)) & 0xFF;
+}
+
+inline void PutLE64(uint8_t* p, uint64_t value) {
+  for (int i = 0; i < 8; i++) p[i] = (value >> (8 * i)) & 0xFF;
+}
+
+/**
+ * Reads the 4 or 8 little-endian bytes at |p|.
+ */
+inline uint32_t GetLE32(const uint8_t* p) {
+  return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+         static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+inline uint64_t GetLE64(const uint8_t* p) {
+  return GetLE32(p) | static_cast<uint64_t>(GetLE32(p + 4)) << 32;
+}
+
+}  // namespace graphics
+
+#endif  // GRAPHICS_BINARY_IO_H
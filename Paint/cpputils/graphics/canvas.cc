@@ -0,0 +1,534 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "canvas.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#include "image_hash.h"
+#include "pixel_pool.h"
+
+namespace graphics {
+
+namespace {
+
+constexpr uint8_t kWhite = 255;
+
+// Rounds |value| / |divisor| down, also for negative values.
+int64_t FloorDiv(int64_t value, int64_t divisor) {
+  return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor);
+}
+
+// Appends |length| - |base| to |out| in the LZ length encoding: nothing if
+// it fit in the token, else bytes of 255 and a final byte below 255.
+void PutLength(std::vector<uint8_t>* out, size_t length, size_t base) {
+  if (length < base) return;
+  length -= base;
+  for (; length >= 255; length -= 255) out->push_back(255);
+  out->push_back(length);
+}
+
+// Appends a sequence of |literal_count| bytes from |literals| followed by a
+// match of |match_length| bytes starting |offset| bytes back, if not 0.
+void PutSequence(std::vector<uint8_t>* out, const uint8_t* literals,
+                 size_t literal_count, size_t offset, size_t match_length) {
+  const size_t match_code = match_length ? match_length - 4 : 0;
+  out->push_back(std::min<size_t>(literal_count, 15) << 4 |
+                 std::min<size_t>(match_code, 15));
+  PutLength(out, literal_count, 15);
+  out->insert(out->end(), literals, literals + literal_count);
+  if (!match_length) return;
+  out->push_back(offset & 0xFF);
+  out->push_back(offset >> 8);
+  PutLength(out, match_code, 15);
+}
+
+// Compresses |size| bytes of |in| with a simple LZ77 codec, in the spirit of
+// LZ4: a sequence of tokens whose high and low nibbles hold the number of
+// literal bytes that follow and the length of the match after them, less 4.
+// Each match is a 16-bit offset back into the output. Both lengths continue
+// in extra bytes when the nibble is 15. The last sequence has no match.
+std::vector<uint8_t> CompressLz(const uint8_t* in, size_t size) {
+  constexpr int kHashBits = 12;
+  constexpr size_t kMaxOffset = 0xFFFF;
+  std::vector<uint8_t> out;
+  std::vector<int64_t> table(1 << kHashBits, -1);
+  size_t anchor = 0;
+  size_t position = 0;
+  while (position + 4 <= size) {
+    uint32_t word;
+    memcpy(&word, in + position, 4);
+    const uint32_t hash = (word * 2654435761u) >> (32 - kHashBits);
+    const int64_t candidate = table[hash];
+    table[hash] = position;
+    if (candidate < 0 || position - candidate > kMaxOffset ||
+        memcmp(in + candidate, in + position, 4) != 0) {
+      position++;
+      continue;
+    }
+    size_t length = 4;
+    while (position + length < size &&
+           in[candidate + length] == in[position + length]) {
+      length++;
+    }
+    PutSequence(&out, in + anchor, position - anchor, position - candidate,
+                length);
+    position += length;
+    anchor = position;
+  }
+  PutSequence(&out, in + anchor, size - anchor, 0, 0);
+  return out;
+}
+
+// Reads a length continued from a token nibble, see PutLength.
+bool GetLength(const uint8_t** in, const uint8_t* end, size_t* length) {
+  if (*length < 15) return true;
+  uint8_t byte;
+  do {
+    if (*in == end) return false;
+    byte = *(*in)++;
+    *length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+// Decompresses the output of CompressLz into exactly |size| bytes of |out|.
+// Returns false if |in| is malformed or does not hold |size| bytes.
+bool DecompressLz(const uint8_t* in, size_t in_size, uint8_t* out,
+                  size_t size) {
+  const uint8_t* const end = in + in_size;
+  size_t written = 0;
+  while (in < end) {
+    const uint8_t token = *in++;
+    size_t literal_count = token >> 4;
+    if (!GetLength(&in, end, &literal_count) ||
+        literal_count > static_cast<size_t>(end - in) ||
+        literal_count > size - written) {
+      return false;
+    }
+    memcpy(out + written, in, literal_count);
+    in += literal_count;
+    written += literal_count;
+    if (in == end) break;
+    if (end - in < 2) return false;
+    const size_t offset = in[0] | in[1] << 8;
+    in += 2;
+    size_t match_length = token & 0x0F;
+    if (!GetLength(&in, end, &match_length)) return false;
+    match_length += 4;
+    if (offset == 0 || offset > written || match_length > size - written) {
+      return false;
+    }
+    // Byte by byte, since a match may overlap the bytes it produces.
+    for (size_t i = 0; i < match_length; i++, written++) {
+      out[written] = out[written - offset];
+    }
+  }
+  return written == size;
+}
+
+}  // namespace
+
+Canvas::~Canvas() { StopCompression(); }
+
+bool Canvas::View(Image& viewport, int width, int height, int64_t x,
+                  int64_t y) {
+  if (width < 1 || height < 1 || x < -kLimit || y < -kLimit ||
+      x > kLimit - width || y > kLimit - height) {
+    return false;
+  }
+  Commit();
+  viewport_ = &viewport;
+  view_x_ = x;
+  view_y_ = y;
+  view_width_ = width;
+  view_height_ = height;
+  viewport.InitializeFromTiles(width, height, this);
+  view_generations_.resize(static_cast<size_t>(viewport.GetTileColumns()) *
+                           viewport.GetTileRows());
+  for (int row = 0; row < viewport.GetTileRows(); row++) {
+    for (int column = 0; column < viewport.GetTileColumns(); column++) {
+      view_generations_[row * viewport.GetTileColumns() + column] =
+          viewport.GetTileGeneration(column, row);
+    }
+  }
+  return true;
+}
+
+void Canvas::Commit() {
+  if (!viewport_ || viewport_->GetWidth() != view_width_ ||
+      viewport_->GetHeight() != view_height_) {
+    return;
+  }
+  PixelBuffer planes(kTileBytes);
+  for (int row = 0; row < viewport_->GetTileRows(); row++) {
+    for (int column = 0; column < viewport_->GetTileColumns(); column++) {
+      const int index = row * viewport_->GetTileColumns() + column;
+      const uint64_t generation = viewport_->GetTileGeneration(column, row);
+      if (generation == view_generations_[index]) continue;
+      view_generations_[index] = generation;
+      const int x = column * Image::kTileSize;
+      const int y = row * Image::kTileSize;
+      const int width = std::min(Image::kTileSize, view_width_ - x);
+      const int height = std::min(Image::kTileSize, view_height_ - y);
+      const size_t plane_size = static_cast<size_t>(width) * height;
+      uint8_t* const channels[3] = {planes.data(), planes.data() + plane_size,
+                                    planes.data() + 2 * plane_size};
+      viewport_->CopyTile(column, row, channels);
+      std::lock_guard<std::mutex> lock(mutex_);
+      WriteRect(view_x_ + x, view_y_ + y, width, height, channels, width);
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (compressor_.joinable() && GetStoredBytes() > memory_budget_) {
+    over_budget_ = true;
+    wake_.notify_one();
+  }
+}
+
+Color Canvas::GetColor(int64_t x, int64_t y) {
+  if (viewport_ && viewport_->GetWidth() == view_width_ &&
+      viewport_->GetHeight() == view_height_ && x >= view_x_ &&
+      y >= view_y_ && x < view_x_ + view_width_ &&
+      y < view_y_ + view_height_) {
+    return viewport_->GetColor(x - view_x_, y - view_y_);
+  }
+  if (x < -kLimit || y < -kLimit || x >= kLimit || y >= kLimit) {
+    return Color(kWhite, kWhite, kWhite);
+  }
+  uint8_t rgb[3];
+  uint8_t* const channels[3] = {&rgb[0], &rgb[1], &rgb[2]};
+  std::lock_guard<std::mutex> lock(mutex_);
+  ReadRect(x, y, 1, 1, channels, 1);
+  return Color(rgb[0], rgb[1], rgb[2]);
+}
+
+size_t Canvas::GetTileCount() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return tiles_.size();
+}
+
+size_t Canvas::GetMemoryUsage() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return GetStoredBytes();
+}
+
+Canvas::MemoryStats Canvas::GetMemoryStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  MemoryStats stats;
+  stats.tiles = tiles_.size();
+  for (const auto& tile : tiles_) {
+    if (tile.second.packed) {
+      stats.compressed_tiles++;
+    } else if (!tile.second.pixels) {
+      stats.uniform_tiles++;
+    }
+  }
+  stats.unique_tiles = copies_;
+  stats.compressed_bytes = packed_bytes_;
+  stats.bytes = GetStoredBytes();
+  stats.dense_bytes = tiles_.size() * kTileBytes;
+  return stats;
+}
+
+bool Canvas::GetPaintedBounds(int64_t* x0, int64_t* y0, int64_t* x1,
+                              int64_t* y1) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (tiles_.empty()) return false;
+  int64_t min_column = INT64_MAX;
+  int64_t min_row = INT64_MAX;
+  int64_t max_column = INT64_MIN;
+  int64_t max_row = INT64_MIN;
+  for (const auto& tile : tiles_) {
+    const int64_t column = static_cast<int32_t>(tile.first >> 32);
+    const int64_t row = static_cast<int32_t>(tile.first & 0xFFFFFFFF);
+    min_column = std::min(min_column, column);
+    min_row = std::min(min_row, row);
+    max_column = std::max(max_column, column);
+    max_row = std::max(max_row, row);
+  }
+  *x0 = min_column * Image::kTileSize;
+  *y0 = min_row * Image::kTileSize;
+  *x1 = (max_column + 1) * Image::kTileSize - 1;
+  *y1 = (max_row + 1) * Image::kTileSize - 1;
+  return true;
+}
+
+bool Canvas::ReadTile(int column, int row, int width, int height,
+                      uint8_t* const channels[3], int stride) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return ReadRect(view_x_ + static_cast<int64_t>(column) * Image::kTileSize,
+                  view_y_ + static_cast<int64_t>(row) * Image::kTileSize,
+                  width, height, channels, stride);
+}
+
+uint64_t Canvas::Key(int64_t column, int64_t row) {
+  return static_cast<uint64_t>(static_cast<uint32_t>(column)) << 32 |
+         static_cast<uint32_t>(row);
+}
+
+bool Canvas::ReadRect(int64_t x, int64_t y, int width, int height,
+                      uint8_t* const channels[3], int stride) {
+  const int64_t size = Image::kTileSize;
+  const Clock::time_point now = Clock::now();
+  std::vector<uint8_t> thawed;
+  bool read = true;
+  for (int64_t row = FloorDiv(y, size); row * size < y + height; row++) {
+    const int64_t top = std::max(y, row * size);
+    const int64_t bottom = std::min(y + height, (row + 1) * size);
+    for (int64_t column = FloorDiv(x, size); column * size < x + width;
+         column++) {
+      const int64_t left = std::max(x, column * size);
+      const int64_t right = std::min(x + width, (column + 1) * size);
+      auto tile = tiles_.find(Key(column, row));
+      bool readable = true;
+      if (tile != tiles_.end() && tile->second.packed) {
+        // Stored raw if it did not compress, see CompressColdTiles.
+        const Packed& packed = *tile->second.packed;
+        thawed.resize(kTileBytes);
+        if (packed.size() == kTileBytes) {
+          memcpy(thawed.data(), packed.data(), kTileBytes);
+        } else {
+          readable = DecompressLz(packed.data(), packed.size(), thawed.data(),
+                                  kTileBytes);
+        }
+        if (readable) {
+          StoreTile(tile->first, thawed.data());
+        } else {
+          std::cout << "Could not decompress the canvas tile at " << column
+                    << ", " << row << std::endl;
+          read = false;
+        }
+      } else if (tile != tiles_.end()) {
+        tile->second.used = now;
+      }
+      for (int c = 0; c < 3; c++) {
+        for (int64_t ty = top; ty < bottom; ty++) {
+          uint8_t* out = channels[c] + (ty - y) * stride + (left - x);
+          if (tile == tiles_.end() || !readable) {
+            memset(out, kWhite, right - left);
+          } else if (!tile->second.pixels) {
+            memset(out, tile->second.color[c], right - left);
+          } else {
+            memcpy(out,
+                   tile->second.pixels->values + c * kTilePixels +
+                       (ty - row * size) * size + (left - column * size),
+                   right - left);
+          }
+        }
+      }
+    }
+  }
+  return read;
+}
+
+void Canvas::WriteRect(int64_t x, int64_t y, int width, int height,
+                       const uint8_t* const channels[3], int stride) {
+  const int64_t size = Image::kTileSize;
+  PixelBuffer values(kTileBytes);
+  for (int64_t row = FloorDiv(y, size); row * size < y + height; row++) {
+    const int64_t top = std::max(y, row * size);
+    const int64_t bottom = std::min(y + height, (row + 1) * size);
+    for (int64_t column = FloorDiv(x, size); column * size < x + width;
+         column++) {
+      const int64_t left = std::max(x, column * size);
+      const int64_t right = std::min(x + width, (column + 1) * size);
+      // Shared pixels never change, so build the new ones aside.
+      uint8_t* const planes[3] = {values.data(), values.data() + kTilePixels,
+                                  values.data() + 2 * kTilePixels};
+      if (!ReadRect(column * size, row * size, size, size, planes, size)) {
+        continue;
+      }
+      for (int c = 0; c < 3; c++) {
+        for (int64_t ty = top; ty < bottom; ty++) {
+          memcpy(planes[c] + (ty - row * size) * size + (left - column * size),
+                 channels[c] + (ty - y) * stride + (left - x), right - left);
+        }
+      }
+      StoreTile(Key(column, row), values.data());
+    }
+  }
+}
+
+void Canvas::StoreTile(uint64_t key, const uint8_t* values) {
+  bool uniform = true;
+  for (int c = 0; c < 3 && uniform; c++) {
+    const uint8_t* plane = values + c * kTilePixels;
+    uniform = std::all_of(plane, plane + kTilePixels,
+                          [&](uint8_t v) { return v == plane[0]; });
+  }
+  if (uniform && values[0] == kWhite && values[kTilePixels] == kWhite &&
+      values[2 * kTilePixels] == kWhite) {
+    tiles_.erase(key);
+    return;
+  }
+  Tile& tile = tiles_[key];
+  tile.used = Clock::now();
+  if (uniform) {
+    for (int c = 0; c < 3; c++) tile.color[c] = values[c * kTilePixels];
+    tile.pixels.reset();
+    tile.packed.reset();
+    return;
+  }
+
+  const uint64_t hash = HashBytes(values, kTileBytes);
+  auto found = shared_.find(hash);
+  std::shared_ptr<const Pixels> pixels;
+  if (found != shared_.end()) pixels = found->second.lock();
+  if (pixels && memcmp(pixels->values, values, kTileBytes) == 0) {
+    tile.pixels = std::move(pixels);
+    tile.packed.reset();
+    return;
+  }
+  void* memory = PixelPool::Get().Allocate(sizeof(Pixels));
+  if (!memory) throw std::bad_alloc();
+  Pixels* copy = new (memory) Pixels;
+  copy->hash = hash;
+  memcpy(copy->values, values, kTileBytes);
+  // An expired entry is a miss and is replaced. On a hash collision the new
+  // copy is simply not shared.
+  const bool indexed = !pixels;
+  pixels.reset(copy, [this, indexed](const Pixels* p) {
+    auto entry = indexed ? shared_.find(p->hash) : shared_.end();
+    if (entry != shared_.end() && entry->second.expired()) shared_.erase(entry);
+    copies_--;
+    PixelPool::Get().Free(
+        reinterpret_cast<uint8_t*>(const_cast<Pixels*>(p)), sizeof(Pixels));
+  });
+  if (indexed) shared_[hash] = pixels;
+  copies_++;
+  tile.pixels = std::move(pixels);
+  tile.packed.reset();
+}
+
+size_t Canvas::GetStoredBytes() const {
+  return copies_ * kTileBytes + packed_bytes_;
+}
+
+void Canvas::StartCompression(double cold_seconds, size_t memory_budget) {
+  StopCompression();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = false;
+    over_budget_ = false;
+    cold_seconds_ = std::max(0.0, cold_seconds);
+    memory_budget_ = memory_budget;
+  }
+  compressor_ = std::thread(&Canvas::CompressLoop, this);
+}
+
+void Canvas::StopCompression() {
+  if (!compressor_.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  compressor_.join();
+}
+
+size_t Canvas::CompressColdTiles(double cold_seconds, size_t memory_budget) {
+  // Copies of pixels to compress, with the last time any tile used them.
+  // References to copies must be dropped with mutex_ held, as dropping the
+  // last one updates shared_.
+  std::vector<std::pair<Clock::time_point, std::shared_ptr<const Pixels>>>
+      cold;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unordered_map<const Pixels*, size_t> indices;
+    for (const auto& tile : tiles_) {
+      const std::shared_ptr<const Pixels>& pixels = tile.second.pixels;
+      if (!pixels) continue;
+      auto index = indices.emplace(pixels.get(), cold.size());
+      if (index.second) {
+        cold.emplace_back(tile.second.used, pixels);
+      } else {
+        Clock::time_point& used = cold[index.first->second].first;
+        used = std::max(used, tile.second.used);
+      }
+    }
+    std::sort(cold.begin(), cold.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+    const Clock::time_point cutoff =
+        Clock::now() - std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<double>(cold_seconds));
+    // Counts each copy as freed in full. If compression saves less, the
+    // next pass catches up.
+    size_t bytes = GetStoredBytes();
+    size_t count = 0;
+    while (count < cold.size() &&
+           (cold[count].first <= cutoff || bytes > memory_budget)) {
+      bytes -= kTileBytes;
+      count++;
+    }
+    cold.resize(count);
+  }
+  if (cold.empty()) return 0;
+
+  // Shared pixels never change, so they can be compressed unlocked.
+  std::vector<Packed> packed;
+  for (const auto& copy : cold) {
+    packed.push_back(CompressLz(copy.second->values, kTileBytes));
+    if (packed.back().size() >= kTileBytes) {
+      packed.back().assign(copy.second->values,
+                           copy.second->values + kTileBytes);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t compressed = 0;
+  {
+    std::unordered_map<const Pixels*, size_t> indices;
+    std::vector<std::shared_ptr<const Packed>> shared_packed;
+    for (size_t i = 0; i < cold.size(); i++) {
+      indices.emplace(cold[i].second.get(), i);
+      packed_bytes_ += packed[i].size();
+      shared_packed.emplace_back(
+          new Packed(std::move(packed[i])), [this](const Packed* p) {
+            packed_bytes_ -= p->size();
+            delete p;
+          });
+    }
+    for (auto& tile : tiles_) {
+      auto index = indices.find(tile.second.pixels.get());
+      // Skip tiles used while compressing.
+      if (index == indices.end() ||
+          tile.second.used > cold[index->second].first) {
+        continue;
+      }
+      tile.second.packed = shared_packed[index->second];
+      tile.second.pixels.reset();
+      compressed++;
+    }
+  }
+  cold.clear();
+  return compressed;
+}
+
+void Canvas::CompressLoop() {
+  // Looks for cold tiles a few times per |cold_seconds_|, and at least once
+  // a second.
+  std::unique_lock<std::mutex> lock(mutex_);
+  const std::chrono::duration<double> period(
+      std::clamp(cold_seconds_ / 4, 0.01, 1.0));
+  while (true) {
+    wake_.wait_for(lock, period, [this] { return stopping_ || over_budget_; });
+    if (stopping_) return;
+    over_budget_ = false;
+    const double cold_seconds = cold_seconds_;
+    const size_t memory_budget = memory_budget_;
+    lock.unlock();
+    const size_t compressed = CompressColdTiles(cold_seconds, memory_budget);
+    lock.lock();
+    // Each pass may free less than it hoped, so go on while it helps.
+    over_budget_ = compressed > 0 && GetStoredBytes() > memory_budget_;
+  }
+}
+
+}  // namespace graphics
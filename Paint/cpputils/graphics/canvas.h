@@ -0,0 +1,233 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "image.h"
+
+#ifndef GRAPHICS_CANVAS_H
+#define GRAPHICS_CANVAS_H
+
+namespace graphics {
+
+/**
+ * An unbounded canvas, stored as a sparse map of square tiles of
+ * Image::kTileSize pixels. Only tiles that have been painted take up memory;
+ * everywhere else the canvas reads as white, so memory grows with the
+ * painted area rather than with its bounding box.
+ *
+ * The canvas is edited through a viewport: an ordinary Image showing the
+ * part of the canvas at some origin, see View. The viewport is drawn on with
+ * the usual Image functions, in coordinates relative to that origin. It
+ * reads each tile from the canvas the first time the tile is needed, and the
+ * tiles it changed are written back on Commit or when the view moves. Tiles
+ * that end up all white are freed again.
+ *
+ * Most tiles of real drawings are a single color or repeat one another, so
+ * tiles of a single color are stored as just that color, and identical
+ * tiles share one copy of their pixels, found by hashing them. A shared copy
+ * is never changed: writing to a tile builds its new pixels and shares them
+ * in turn. See GetMemoryStats for the savings.
+ *
+ * Tiles that go unused for a while can be compressed in the background, see
+ * StartCompression, and are decompressed when next read or written.
+ *
+ * Canvas coordinates range from -kLimit to kLimit - 1 in both directions.
+ */
+class Canvas : public TileSource {
+ public:
+  static constexpr int64_t kLimit = int64_t{1} << 37;
+
+  Canvas() = default;
+  Canvas(const Canvas&) = delete;
+  Canvas& operator=(const Canvas&) = delete;
+  ~Canvas();
+
+  /**
+   * Commits the viewport, if any, and makes |viewport| show the |width| by
+   * |height| pixels of the canvas whose top left corner is at (|x|, |y|).
+   * The canvas must outlive the view: |viewport| must be initialized or
+   * loaded again before the canvas is destroyed. |viewport| must not be
+   * moved from while it is the viewport. Returns false, changing
+   * nothing, if the size is less than 1 or the view goes past kLimit.
+   */
+  bool View(Image& viewport, int width, int height, int64_t x, int64_t y);
+
+  /**
+   * Writes the tiles of the viewport that changed since it was last viewed
+   * or committed back to the canvas. Does nothing if the viewport was
+   * initialized or loaded with another size since.
+   */
+  void Commit();
+
+  /**
+   * Returns the canvas coordinates of the viewport's top left corner.
+   */
+  int64_t GetViewX() const { return view_x_; }
+  int64_t GetViewY() const { return view_y_; }
+
+  /**
+   * Returns the color at (|x|, |y|) on the canvas, including changes to the
+   * viewport that are not committed yet.
+   */
+  Color GetColor(int64_t x, int64_t y);
+
+  /**
+   * Counts of painted tiles and the memory they take up.
+   */
+  struct MemoryStats {
+    // Painted tiles, and how many of them are a single color.
+    size_t tiles = 0;
+    size_t uniform_tiles = 0;
+    // Distinct copies of pixels shared by the other tiles.
+    size_t unique_tiles = 0;
+    // Tiles held compressed, and the bytes of compressed data.
+    size_t compressed_tiles = 0;
+    size_t compressed_bytes = 0;
+    // The bytes of pixels stored, compressed or not, and those that storing
+    // every painted tile in full would take.
+    size_t bytes = 0;
+    size_t dense_bytes = 0;
+  };
+
+  /**
+   * Returns the number of tiles that are painted.
+   */
+  size_t GetTileCount() const;
+
+  /**
+   * Returns the bytes of pixels stored for the painted tiles.
+   */
+  size_t GetMemoryUsage() const;
+
+  MemoryStats GetMemoryStats() const;
+
+  /**
+   * Sets |x0|, |y0| and |x1|, |y1| to the top left and bottom right corners
+   * of the smallest tile-aligned rectangle covering every painted tile.
+   * Returns false if no tile is painted.
+   */
+  bool GetPaintedBounds(int64_t* x0, int64_t* y0, int64_t* x1,
+                        int64_t* y1) const;
+
+  /**
+   * Starts a background thread that compresses the tiles not read or
+   * written for |cold_seconds|. While the canvas uses more than
+   * |memory_budget| bytes, see GetMemoryUsage, it also compresses the least
+   * recently used tiles sooner, checking after each Commit. A compressed
+   * tile is decompressed the first time it is used again. Restarts the
+   * thread if it is running.
+   */
+  void StartCompression(double cold_seconds,
+                        size_t memory_budget = SIZE_MAX);
+
+  /**
+   * Stops the background thread, leaving the tiles as they are.
+   */
+  void StopCompression();
+
+  /**
+   * Compresses, right away, the tiles that the background thread would:
+   * those unused for |cold_seconds|, then the least recently used ones
+   * until the canvas fits in |memory_budget| bytes. Returns the number of
+   * tiles compressed.
+   */
+  size_t CompressColdTiles(double cold_seconds,
+                           size_t memory_budget = SIZE_MAX);
+
+  // Overridden from TileSource, for the viewport.
+  bool ReadTile(int column, int row, int width, int height,
+                uint8_t* const channels[3], int stride) override;
+
+ private:
+  static constexpr int kTilePixels = Image::kTileSize * Image::kTileSize;
+  static constexpr size_t kTileBytes = 3 * kTilePixels;
+
+  // Pixels shared by identical tiles: three planes of kTilePixels values.
+  struct Pixels {
+    uint64_t hash;
+    uint8_t values[kTileBytes];
+  };
+
+  using Clock = std::chrono::steady_clock;
+  using Packed = std::vector<uint8_t>;
+
+  // A painted tile: either |pixels|, or |packed| if it is cold, or all
+  // |color| if both are null. |used| is when it was last read or written.
+  struct Tile {
+    std::shared_ptr<const Pixels> pixels;
+    std::shared_ptr<const Packed> packed;
+    uint8_t color[3];
+    Clock::time_point used;
+  };
+
+  // Packs the tile |column| and |row| into a map key.
+  static uint64_t Key(int64_t column, int64_t row);
+
+  // Copies the |width| by |height| pixels of the canvas at (|x|, |y|) into
+  // |channels|, in which rows are |stride| values apart, decompressing the
+  // tiles that are compressed. Returns false if one of them does not
+  // decompress; its pixels are then read as white, and it stays compressed.
+  bool ReadRect(int64_t x, int64_t y, int width, int height,
+                uint8_t* const channels[3], int stride);
+
+  // Copies |channels| into the canvas at (|x|, |y|), like ReadRect reads
+  // it, allocating and freeing tiles as needed. Tiles that ReadRect cannot
+  // read are left as they are.
+  void WriteRect(int64_t x, int64_t y, int width, int height,
+                 const uint8_t* const channels[3], int stride);
+
+  // Stores the tile pixels in |values| as the tile at |key|: as a color if
+  // they are uniform, or else in the copy shared by identical tiles.
+  void StoreTile(uint64_t key, const uint8_t* values);
+
+  // Returns the bytes of pixels stored. mutex_ must be held.
+  size_t GetStoredBytes() const;
+
+  // Runs on compressor_, compressing cold tiles from time to time.
+  void CompressLoop();
+
+  // Guards the members below, which are shared with compressor_.
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stopping_ = false;
+  bool over_budget_ = false;
+  double cold_seconds_ = 0;
+  size_t memory_budget_ = SIZE_MAX;
+
+  // Every distinct copy of tile pixels, by hash, and how many copies there
+  // are, hash collisions included. A copy removes itself once no tile uses
+  // it. Likewise for the bytes of compressed tiles. Declared before tiles_,
+  // so that they outlive the tiles.
+  std::unordered_map<uint64_t, std::weak_ptr<const Pixels>> shared_;
+  size_t copies_ = 0;
+  size_t packed_bytes_ = 0;
+
+  // Painted tiles, by Key.
+  std::unordered_map<uint64_t, Tile> tiles_;
+
+  // The viewport, where it is, and its tile generations as of the last
+  // View or Commit. Unowned.
+  Image* viewport_ = nullptr;
+  int64_t view_x_ = 0;
+  int64_t view_y_ = 0;
+  int view_width_ = 0;
+  int view_height_ = 0;
+  std::vector<uint64_t> view_generations_;
+
+  std::thread compressor_;
+};
+
+}  // namespace graphics
+
+#endif  // GRAPHICS_CANVAS_H
@@ -5,12 +5,20 @@
 // https://opensource.org/licenses/MIT.
 
 #include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <thread>
+#include <utility>
 
 #include "cimg/CImg.h"
 #include "image.h"
+#include "mapped_file.h"
+#include "small_image.h"
 
 using std::cout;
 using std::endl;
@@ -20,7 +28,103 @@ namespace graphics {
 
 namespace {
 constexpr int MAX_PIXEL_VALUE = 255;
+
+// Replaces |*image| with an uninitialized image of |width| by |height|
+// pixels, sharing a buffer from the pixel pool that replaces |*pixels|.
+// Returns false, changing nothing, if out of memory.
+bool AllocatePooled(int width, int height,
+                    std::unique_ptr<cimg_library::CImg<uint8_t>>* image,
+                    PixelBuffer* pixels) {
+  PixelBuffer buffer(static_cast<size_t>(width) * height * 3);
+  if (!buffer) return false;
+  *image = std::make_unique<cimg_library::CImg<uint8_t>>(
+      buffer.data(), width, height, 1, 3, /*is_shared=*/true);
+  *pixels = std::move(buffer);
+  return true;
+}
+
+// Returns a decoder callback that replaces |*image| with an uninitialized
+// image of the decoded size, see AllocatePooled, and hands out its planes.
+image_io::PlaneAllocator AllocateInto(
+    std::unique_ptr<cimg_library::CImg<uint8_t>>* image, PixelBuffer* pixels) {
+  return [image, pixels](int width, int height, uint8_t* channels[3]) {
+    if (!AllocatePooled(width, height, image, pixels)) return false;
+    for (int c = 0; c < 3; c++) channels[c] = (*image)->data(0, 0, 0, c);
+    return true;
+  };
+}
+
+// Makes every tile of a mapped image white the first time it is used, so
+// that unused parts of the file are never written.
+class WhiteTileSource : public TileSource {
+ public:
+  bool ReadTile(int /*column*/, int /*row*/, int width, int height,
+                uint8_t* const channels[3], int stride) override {
+    for (int c = 0; c < 3; c++) {
+      for (int y = 0; y < height; y++) {
+        memset(channels[c] + static_cast<size_t>(y) * stride, MAX_PIXEL_VALUE,
+               width);
+      }
+    }
+    return true;
+  }
+};
+
+WhiteTileSource white_tiles;
+
+// Larger images are scaled down to fit when shown, so that showing one never
+// reads all of it.
+constexpr int kMaxDisplaySize = 2048;
+
+bool EndsWith(const string& text, const string& suffix) {
+  return text.size() >= suffix.size() &&
+         text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
 }
+}  // namespace
+
+struct Image::FileOperation {
+  ~FileOperation() {
+    cancelled = true;
+    if (thread.joinable()) thread.join();
+  }
+
+  // Passed to the codecs as their progress callback.
+  bool Report(double fraction) {
+    progress = fraction;
+    return !cancelled;
+  }
+
+  string filename;
+  FileEventListener* listener = nullptr;
+  bool is_load = false;
+
+  // Set by the thread that started the operation.
+  std::atomic<bool> cancelled{false};
+
+  // Set by the worker thread. |success| and |loaded| are only read once
+  // |done| is true.
+  std::atomic<double> progress{0};
+  std::atomic<bool> done{false};
+  bool success = false;
+  std::unique_ptr<cimg_library::CImg<uint8_t>> loaded;
+  PixelBuffer loaded_pixels;
+
+  // Only used by ProcessFileEvents.
+  double reported_progress = -1;
+
+  // Started last, once everything above is set up.
+  std::thread thread;
+};
+
+// The pixels of images sharing them, see Image::Share.
+struct Image::SharedPixels {
+  const uint8_t* data() const {
+    return mapping ? mapping->data() : pixels.data();
+  }
+
+  std::unique_ptr<MappedFile> mapping;
+  PixelBuffer pixels;
+};
 
 Color::Color(int red, int green, int blue) {
   if (red < 0 || red > MAX_PIXEL_VALUE) red = 0;
@@ -33,7 +137,100 @@ Color::Color(int red, int green, int blue) {
 
 Image::Image() = default;
 
-Image::~Image() = default;
+Image::~Image() { DetachSnapshots(); }
+
+Image::Image(Image&& other) { *this = std::move(other); }
+
+Image& Image::operator=(Image&& other) {
+  if (this == &other) return *this;
+  // What this image held goes away, as if it were destroyed.
+  DetachSnapshots();
+  file_operations_.clear();
+  // Snapshots of |other| read the tiles they share through its cimage_, so
+  // they wait until they read them from this image instead.
+  std::vector<std::unique_lock<std::mutex>> locks;
+  for (const std::shared_ptr<ImageSnapshot>& snapshot : other.snapshots_) {
+    locks.emplace_back(snapshot->mutex_);
+  }
+  width_ = std::exchange(other.width_, 0);
+  height_ = std::exchange(other.height_, 0);
+  mapping_ = std::move(other.mapping_);
+  pixels_ = std::move(other.pixels_);
+  shared_pixels_ = std::move(other.shared_pixels_);
+  cimage_ = std::move(other.cimage_);
+  display_ = std::move(other.display_);
+  display_view_ = std::move(other.display_view_);
+  display_scale_ = std::exchange(other.display_scale_, 1);
+  timer_ = std::exchange(other.timer_, 0);
+  event_source_ = std::exchange(other.event_source_, nullptr);
+  mouse_listeners_ = std::move(other.mouse_listeners_);
+  other.mouse_listeners_.clear();
+  animation_listeners_ = std::move(other.animation_listeners_);
+  other.animation_listeners_.clear();
+  latest_event_ = other.latest_event_;
+  tile_columns_ = other.tile_columns_;
+  tile_rows_ = other.tile_rows_;
+  generation_ = other.generation_;
+  tile_generations_ = std::move(other.tile_generations_);
+  tile_source_ = std::exchange(other.tile_source_, nullptr);
+  tile_loaded_ = std::move(other.tile_loaded_);
+  tiles_pending_ = std::exchange(other.tiles_pending_, 0);
+  snapshots_ = std::move(other.snapshots_);
+  other.snapshots_.clear();
+  for (const std::shared_ptr<ImageSnapshot>& snapshot : snapshots_) {
+    snapshot->image_ = this;
+  }
+  locks.clear();
+  file_operations_ = std::move(other.file_operations_);
+  other.file_operations_.clear();
+  polygon_filler_ = std::move(other.polygon_filler_);
+  // Newer generations than any it had, so that nothing mistakes what it
+  // holds next for what it held.
+  other.ResetTiles();
+  return *this;
+}
+
+Image Image::Clone() const {
+  Image copy;
+  if (!IsValid() ||
+      !AllocatePooled(width_, height_, &copy.cimage_, &copy.pixels_)) {
+    return copy;
+  }
+  CopyPixels(copy.cimage_->data());
+  copy.width_ = width_;
+  copy.height_ = height_;
+  copy.ResetTiles();
+  return copy;
+}
+
+Image Image::Share() const {
+  Image copy;
+  if (!IsValid()) return copy;
+  // Unused tiles of a mapped image stay unused in both images. Either one
+  // copies the pixels before loading them to draw.
+  if (tile_source_ != &white_tiles) LoadAllTiles();
+  if (!shared_pixels_) {
+    shared_pixels_ = std::make_shared<SharedPixels>();
+    shared_pixels_->mapping = std::move(mapping_);
+    shared_pixels_->pixels = std::move(pixels_);
+  }
+  copy.shared_pixels_ = shared_pixels_;
+  copy.cimage_ = std::make_unique<cimg_library::CImg<uint8_t>>(
+      cimage_->data(), width_, height_, 1, 3, /*is_shared=*/true);
+  copy.width_ = width_;
+  copy.height_ = height_;
+  copy.ResetTiles();
+  if (tile_source_) {
+    copy.tile_source_ = tile_source_;
+    copy.tile_loaded_ = tile_loaded_;
+    copy.tiles_pending_ = tiles_pending_;
+  }
+  return copy;
+}
+
+bool Image::IsMapped() const {
+  return mapping_ || (shared_pixels_ && shared_pixels_->mapping);
+}
 
 Image::Image(int width, int height) {
   assert(width > 0 && height > 0 && "Width and height must be at least 1");
@@ -46,15 +243,22 @@ bool Image::Load(const string& filename) {
     return false;
   }
   cimg::exception_mode(0);
-  try {
-    cimage_ = std::make_unique<cimg_library::CImg<uint8_t>>();
-    cimage_->load(filename.c_str());
-  } catch (CImgException& e) {
-    cout << "Failed to open image file " << filename << endl;
-    return false;
+  DetachSnapshots();
+  // BMP, PNG, JPEG and QOI files are decoded in process, straight into the
+  // pixel planes. Anything else goes to CImg, which may run an external
+  // converter.
+  if (!image_io::Read(filename, AllocateInto(&cimage_, &pixels_))) {
+    try {
+      cimage_ = std::make_unique<cimg_library::CImg<uint8_t>>();
+      cimage_->load(filename.c_str());
+    } catch (CImgException& e) {
+      cout << "Failed to open image file " << filename << endl;
+      return false;
+    }
   }
   width_ = cimage_->width();
   height_ = cimage_->height();
+  ResetTiles();
   if (!IsValid()) {
     cout << "Invaild image file " << filename << endl;
     return false;
@@ -62,17 +266,424 @@ bool Image::Load(const string& filename) {
   return true;
 }
 
+bool Image::LoadFast(const string& filename) {
+  if (filename.length() == 0) {
+    cout << "You must provide a non-empty filename" << endl;
+    return false;
+  }
+  cimg::exception_mode(0);
+  DetachSnapshots();
+  if (!image_io::ReadQoi(filename, AllocateInto(&cimage_, &pixels_))) {
+    cout << "Failed to open image file " << filename << endl;
+    width_ = 0;
+    height_ = 0;
+    ResetTiles();
+    return false;
+  }
+  width_ = cimage_->width();
+  height_ = cimage_->height();
+  ResetTiles();
+  return true;
+}
+
 bool Image::Initialize(int width, int height) {
   if (width < 1 || height < 1) return false;
   // Quiet exception mode.
   cimg::exception_mode(0);
-  cimage_ = std::make_unique<cimg_library::CImg<uint8_t>>(width, height, 1, 3,
-                                                          MAX_PIXEL_VALUE);
+  DetachSnapshots();
+  if (!AllocatePooled(width, height, &cimage_, &pixels_)) return false;
+  memset(cimage_->data(), MAX_PIXEL_VALUE, pixels_.size());
   width_ = width;
   height_ = height;
+  ResetTiles();
+  return true;
+}
+
+bool Image::Initialize(int width, int height,
+                       const uint8_t* const channels[3]) {
+  if (width < 1 || height < 1) return false;
+  cimg::exception_mode(0);
+  DetachSnapshots();
+  if (!AllocatePooled(width, height, &cimage_, &pixels_)) return false;
+  const size_t plane_size = static_cast<size_t>(width) * height;
+  for (int c = 0; c < 3; c++) {
+    memcpy(cimage_->data(0, 0, 0, c), channels[c], plane_size);
+  }
+  width_ = width;
+  height_ = height;
+  ResetTiles();
+  return true;
+}
+
+bool Image::InitializeMapped(int width, int height, const string& filename) {
+  if (width < 1 || height < 1) return false;
+  cimg::exception_mode(0);
+  // Before |filename| is truncated, in case it holds the current pixels.
+  DetachSnapshots();
+  auto mapping = std::make_unique<MappedFile>();
+  if (!mapping->OpenForWriting(filename,
+                               static_cast<size_t>(width) * height * 3)) {
+    cout << "Failed to map image file " << filename << endl;
+    return false;
+  }
+  cimage_ = std::make_unique<cimg_library::CImg<uint8_t>>(
+      mapping->data(), width, height, 1, 3, /*is_shared=*/true);
+  mapping_ = std::move(mapping);
+  width_ = width;
+  height_ = height;
+  ResetTiles();
+  tile_source_ = &white_tiles;
+  tiles_pending_ = tile_columns_ * tile_rows_;
+  tile_loaded_.assign(tiles_pending_, false);
+  return true;
+}
+
+bool Image::InitializeFromTiles(int width, int height, TileSource* source) {
+  if (width < 1 || height < 1 || !source) return false;
+  cimg::exception_mode(0);
+  DetachSnapshots();
+  // Left uninitialized: every tile is written by |source| before it is used.
+  if (!AllocatePooled(width, height, &cimage_, &pixels_)) return false;
+  width_ = width;
+  height_ = height;
+  ResetTiles();
+  tile_source_ = source;
+  tiles_pending_ = tile_columns_ * tile_rows_;
+  tile_loaded_.assign(tiles_pending_, false);
+  return true;
+}
+
+uint64_t Image::GetTileGeneration(int column, int row) const {
+  if (column < 0 || row < 0 || column >= tile_columns_ || row >= tile_rows_) {
+    return 0;
+  }
+  return tile_generations_[row * tile_columns_ + column];
+}
+
+bool Image::IsTileLoaded(int column, int row) const {
+  if (column < 0 || row < 0 || column >= tile_columns_ || row >= tile_rows_) {
+    return false;
+  }
+  return tile_loaded_.empty() || tile_loaded_[row * tile_columns_ + column];
+}
+
+bool Image::CopyTile(int column, int row, uint8_t* const channels[3]) const {
+  if (column < 0 || row < 0 || column >= tile_columns_ || row >= tile_rows_) {
+    return false;
+  }
+  if (IsBlankTile(column, row)) {
+    const int width = std::min(kTileSize, width_ - column * kTileSize);
+    const int height = std::min(kTileSize, height_ - row * kTileSize);
+    white_tiles.ReadTile(column, row, width, height, channels, width);
+    return true;
+  }
+  LoadTiles(column * kTileSize, row * kTileSize, column * kTileSize,
+            row * kTileSize);
+  CopyLoadedTile(column, row, channels);
+  return true;
+}
+
+void Image::CopyLoadedTile(int column, int row,
+                           uint8_t* const channels[3]) const {
+  const int x0 = column * kTileSize;
+  const int y0 = row * kTileSize;
+  const int width = std::min(kTileSize, width_ - x0);
+  const int height = std::min(kTileSize, height_ - y0);
+  for (int c = 0; c < 3; c++) {
+    for (int y = 0; y < height; y++) {
+      memcpy(channels[c] + y * width, cimage_->data(x0, y0 + y, 0, c), width);
+    }
+  }
+}
+
+std::shared_ptr<ImageSnapshot> Image::Snapshot(
+    const std::vector<uint64_t>* saved_generations) const {
+  std::shared_ptr<ImageSnapshot> snapshot(new ImageSnapshot());
+  snapshot->image_id_ = this;
+  snapshot->image_ = this;
+  snapshot->width_ = width_;
+  snapshot->height_ = height_;
+  snapshot->columns_ = tile_columns_;
+  snapshot->rows_ = tile_rows_;
+  snapshot->generations_ = tile_generations_;
+  snapshot->states_.assign(tile_generations_.size(), ImageSnapshot::kShared);
+  snapshot->preserved_.resize(tile_generations_.size());
+  const bool skip = saved_generations &&
+                    saved_generations->size() == tile_generations_.size();
+  for (int row = 0; row < tile_rows_; row++) {
+    for (int column = 0; column < tile_columns_; column++) {
+      const int index = row * tile_columns_ + column;
+      if (skip && (*saved_generations)[index] == tile_generations_[index]) {
+        snapshot->states_[index] = ImageSnapshot::kSkipped;
+      } else if (IsBlankTile(column, row)) {
+        snapshot->states_[index] = ImageSnapshot::kBlank;
+      } else {
+        LoadTiles(column * kTileSize, row * kTileSize, column * kTileSize,
+                  row * kTileSize);
+      }
+    }
+  }
+  // Drop the snapshots nobody reads any more before adding this one.
+  snapshots_.erase(
+      std::remove_if(snapshots_.begin(), snapshots_.end(),
+                     [](const std::shared_ptr<ImageSnapshot>& other) {
+                       return other.use_count() == 1;
+                     }),
+      snapshots_.end());
+  snapshots_.push_back(snapshot);
+  return snapshot;
+}
+
+size_t Image::GetMemoryUsage() const {
+  size_t bytes = pixels_.size();
+  // Pixels CImg loaded itself, and the downscaled view, are in buffers of
+  // their own.
+  if (cimage_ && !cimage_->is_shared()) bytes += cimage_->size();
+  if (display_view_) bytes += display_view_->size();
+  if (shared_pixels_ && !shared_pixels_->mapping) {
+    bytes += shared_pixels_->pixels.size() / shared_pixels_.use_count();
+  }
+  return bytes + tile_generations_.capacity() * sizeof(uint64_t) +
+         tile_loaded_.capacity() / 8 + polygon_filler_.GetMemoryUsage();
+}
+
+size_t Image::GetSnapshotMemoryUsage() const {
+  size_t bytes = 0;
+  for (const std::shared_ptr<ImageSnapshot>& snapshot : snapshots_) {
+    bytes += snapshot->GetMemoryUsage();
+  }
+  return bytes;
+}
+
+bool Image::PreserveTiles(int x0, int y0, int x1, int y1) {
+  x0 = std::max(x0, 0);
+  y0 = std::max(y0, 0);
+  x1 = std::min(x1, width_ - 1);
+  y1 = std::min(y1, height_ - 1);
+  if (x0 > x1 || y0 > y1) return true;
+  for (size_t i = 0; i < snapshots_.size();) {
+    // Nobody reads this snapshot any more.
+    if (snapshots_[i].use_count() == 1) {
+      snapshots_.erase(snapshots_.begin() + i);
+      continue;
+    }
+    ImageSnapshot& snapshot = *snapshots_[i++];
+    std::lock_guard<std::mutex> lock(snapshot.mutex_);
+    for (int row = y0 / kTileSize; row <= y1 / kTileSize; row++) {
+      for (int column = x0 / kTileSize; column <= x1 / kTileSize; column++) {
+        if (!snapshot.Preserve(column, row)) {
+          cout << "Out of memory preserving a tile for a snapshot" << endl;
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+void Image::DetachSnapshots() {
+  for (const std::shared_ptr<ImageSnapshot>& snapshot : snapshots_) {
+    if (snapshot.use_count() == 1) continue;
+    std::lock_guard<std::mutex> lock(snapshot->mutex_);
+    for (int row = 0; row < tile_rows_; row++) {
+      for (int column = 0; column < tile_columns_; column++) {
+        // The pixels are going away regardless, so a tile that cannot be
+        // kept is left out, and saving the snapshot fails.
+        if (!snapshot->Preserve(column, row)) {
+          snapshot->states_[row * snapshot->columns_ + column] =
+              ImageSnapshot::kSkipped;
+        }
+      }
+    }
+    snapshot->image_ = nullptr;
+  }
+  snapshots_.clear();
+}
+
+void Image::ResetTiles() {
+  tile_columns_ = (width_ + kTileSize - 1) / kTileSize;
+  tile_rows_ = (height_ + kTileSize - 1) / kTileSize;
+  generation_++;
+  tile_generations_.assign(tile_columns_ * tile_rows_, generation_);
+  tile_source_ = nullptr;
+  tile_loaded_.clear();
+  tiles_pending_ = 0;
+  // Release the file or buffer of earlier pixels once they moved elsewhere.
+  const uint8_t* data = cimage_ ? cimage_->data() : nullptr;
+  if (mapping_ && mapping_->data() != data) mapping_.reset();
+  if (pixels_ && pixels_.data() != data) pixels_.reset();
+  if (shared_pixels_ && shared_pixels_->data() != data) shared_pixels_.reset();
+}
+
+bool Image::Unshare() {
+  if (shared_pixels_.use_count() == 1) {
+    // The other images let go of the pixels, so they are this one's again.
+    mapping_ = std::move(shared_pixels_->mapping);
+    pixels_ = std::move(shared_pixels_->pixels);
+    shared_pixels_.reset();
+    return true;
+  }
+  std::unique_ptr<cimg_library::CImg<uint8_t>> copy;
+  PixelBuffer pixels;
+  if (!AllocatePooled(width_, height_, &copy, &pixels)) {
+    cout << "Out of memory copying shared pixels" << endl;
+    return false;
+  }
+  memcpy(copy->data(), cimage_->data(), pixels.size());
+  {
+    // Snapshots read the tiles they share through cimage_.
+    std::vector<std::unique_lock<std::mutex>> locks;
+    for (const std::shared_ptr<ImageSnapshot>& snapshot : snapshots_) {
+      locks.emplace_back(snapshot->mutex_);
+    }
+    cimage_ = std::move(copy);
+  }
+  pixels_ = std::move(pixels);
+  shared_pixels_.reset();
   return true;
 }
 
+void Image::MarkChanged(int x0, int y0, int x1, int y1) {
+  x0 = std::max(x0, 0);
+  y0 = std::max(y0, 0);
+  x1 = std::min(x1, width_ - 1);
+  y1 = std::min(y1, height_ - 1);
+  if (x0 > x1 || y0 > y1) return;
+  generation_++;
+  for (int row = y0 / kTileSize; row <= y1 / kTileSize; row++) {
+    uint64_t* generations = &tile_generations_[row * tile_columns_];
+    for (int column = x0 / kTileSize; column <= x1 / kTileSize; column++) {
+      generations[column] = generation_;
+    }
+  }
+}
+
+void Image::LoadTilesFromSource(int x0, int y0, int x1, int y1) const {
+  x0 = std::max(x0, 0);
+  y0 = std::max(y0, 0);
+  x1 = std::min(x1, width_ - 1);
+  y1 = std::min(y1, height_ - 1);
+  for (int row = y0 / kTileSize; row <= y1 / kTileSize; row++) {
+    for (int column = x0 / kTileSize; column <= x1 / kTileSize; column++) {
+      // The source is dropped as soon as the last tile is read.
+      if (!tile_source_) return;
+      const int index = row * tile_columns_ + column;
+      if (tile_loaded_[index]) continue;
+      const int tile_x = column * kTileSize;
+      const int tile_y = row * kTileSize;
+      const int width = std::min(kTileSize, width_ - tile_x);
+      const int height = std::min(kTileSize, height_ - tile_y);
+      uint8_t* const channels[3] = {cimage_->data(tile_x, tile_y, 0, 0),
+                                    cimage_->data(tile_x, tile_y, 0, 1),
+                                    cimage_->data(tile_x, tile_y, 0, 2)};
+      if (!tile_source_->ReadTile(column, row, width, height, channels,
+                                  width_)) {
+        for (int c = 0; c < 3; c++) {
+          for (int y = 0; y < height; y++) {
+            memset(channels[c] + static_cast<size_t>(y) * width_,
+                   MAX_PIXEL_VALUE, width);
+          }
+        }
+      }
+      tile_loaded_[index] = true;
+      if (--tiles_pending_ == 0) {
+        tile_source_ = nullptr;
+        tile_loaded_.clear();
+      }
+    }
+  }
+}
+
+bool Image::IsBlankTile(int column, int row) const {
+  return tile_source_ == &white_tiles &&
+         !tile_loaded_[row * tile_columns_ + column];
+}
+
+void Image::CopyPixels(uint8_t* out) const {
+  const size_t plane_size = static_cast<size_t>(width_) * height_;
+  if (tile_source_ != &white_tiles) {
+    LoadAllTiles();
+    memcpy(out, cimage_->data(), plane_size * 3);
+    return;
+  }
+  for (int row = 0; row < tile_rows_; row++) {
+    for (int column = 0; column < tile_columns_; column++) {
+      const int x0 = column * kTileSize;
+      const int y0 = row * kTileSize;
+      const int width = std::min(kTileSize, width_ - x0);
+      const int height = std::min(kTileSize, height_ - y0);
+      const size_t offset = static_cast<size_t>(y0) * width_ + x0;
+      uint8_t* const channels[3] = {out + offset, out + plane_size + offset,
+                                    out + 2 * plane_size + offset};
+      if (IsBlankTile(column, row)) {
+        white_tiles.ReadTile(column, row, width, height, channels, width_);
+        continue;
+      }
+      for (int c = 0; c < 3; c++) {
+        for (int y = 0; y < height; y++) {
+          memcpy(channels[c] + static_cast<size_t>(y) * width_,
+                 cimage_->data(x0, y0 + y, 0, c), width);
+        }
+      }
+    }
+  }
+}
+
+void Image::GetPlanesForReading(PixelBuffer* copy,
+                                const uint8_t* channels[3]) const {
+  const uint8_t* data = cimage_->data();
+  const size_t plane_size = static_cast<size_t>(width_) * height_;
+  if (tile_source_ == &white_tiles) {
+    *copy = PixelBuffer(plane_size * 3);
+    if (*copy) {
+      CopyPixels(copy->data());
+      data = copy->data();
+    } else {
+      LoadAllTiles();
+    }
+  } else {
+    LoadAllTiles();
+  }
+  for (int c = 0; c < 3; c++) channels[c] = data + c * plane_size;
+}
+
+const CImg<uint8_t>& Image::GetDisplayView() {
+  const int scale = std::max({1, (width_ - 1) / kMaxDisplaySize + 1,
+                              (height_ - 1) / kMaxDisplaySize + 1});
+  display_scale_ = scale;
+  if (scale == 1 && tile_source_ != &white_tiles) {
+    // Shown tiles are read from their source, so show them all.
+    LoadAllTiles();
+    display_view_.reset();
+    return *cimage_;
+  }
+  // Sample every |scale|th pixel, showing unused tiles as white.
+  const int width = (width_ - 1) / scale + 1;
+  const int height = (height_ - 1) / scale + 1;
+  if (!display_view_ || display_view_->width() != width ||
+      display_view_->height() != height) {
+    display_view_ = std::make_unique<CImg<uint8_t>>(width, height, 1, 3);
+  }
+  for (int y = 0; y < height; y++) {
+    const int source_y = y * scale;
+    for (int x = 0; x < width; x++) {
+      const int source_x = x * scale;
+      if (IsBlankTile(source_x / kTileSize, source_y / kTileSize)) {
+        for (int c = 0; c < 3; c++) {
+          *display_view_->data(x, y, 0, c) = MAX_PIXEL_VALUE;
+        }
+        continue;
+      }
+      LoadTiles(source_x, source_y, source_x, source_y);
+      for (int c = 0; c < 3; c++) {
+        *display_view_->data(x, y, 0, c) =
+            *cimage_->data(source_x, source_y, 0, c);
+      }
+    }
+  }
+  return *display_view_;
+}
+
 bool Image::SaveImageBmp(const string& filename) const {
   if (!IsValid()) {
     return false;
@@ -81,16 +692,159 @@ bool Image::SaveImageBmp(const string& filename) const {
     cout << "You must provide a non-empty filename" << endl;
     return false;
   }
-  cimage_->save_bmp(filename.c_str());
+  PixelBuffer copy;
+  const uint8_t* channels[3];
+  GetPlanesForReading(&copy, channels);
+  if (!image_io::WriteBmp(filename, width_, height_, channels)) {
+    cout << "Failed to save image file " << filename << endl;
+    return false;
+  }
   return true;
 }
 
+bool Image::SaveFast(const string& filename) const {
+  if (!IsValid()) {
+    return false;
+  }
+  if (filename.length() == 0) {
+    cout << "You must provide a non-empty filename" << endl;
+    return false;
+  }
+  PixelBuffer copy;
+  const uint8_t* channels[3];
+  GetPlanesForReading(&copy, channels);
+  if (!image_io::WriteQoi(filename, width_, height_, channels)) {
+    cout << "Failed to save image file " << filename << endl;
+    return false;
+  }
+  return true;
+}
+
+bool Image::SaveAsync(const string& filename, FileEventListener* listener) {
+  if (!IsValid()) {
+    return false;
+  }
+  if (filename.length() == 0) {
+    cout << "You must provide a non-empty filename" << endl;
+    return false;
+  }
+  auto operation = std::make_unique<FileOperation>();
+  operation->filename = filename;
+  operation->listener = listener;
+  // One copy of the contiguous planes is all the UI thread pays for.
+  const size_t plane_size = static_cast<size_t>(width_) * height_;
+  PixelBuffer snapshot(plane_size * 3);
+  if (!snapshot) return false;
+  CopyPixels(snapshot.data());
+  FileOperation* op = operation.get();
+  operation->thread = std::thread(
+      [op, width = width_, height = height_, plane_size,
+       snapshot = std::move(snapshot)] {
+        const uint8_t* channels[3] = {snapshot.data(),
+                                      snapshot.data() + plane_size,
+                                      snapshot.data() + 2 * plane_size};
+        auto progress = [op](double fraction) { return op->Report(fraction); };
+        const bool saved =
+            EndsWith(op->filename, ".qoi")
+                ? image_io::WriteQoi(op->filename, width, height, channels,
+                                     progress)
+                : image_io::WriteBmp(op->filename, width, height, channels, 0,
+                                     progress);
+        // A failed save leaves any existing file as it was.
+        if (saved) op->progress = 1;
+        op->success = saved;
+        op->done = true;
+      });
+  file_operations_.push_back(std::move(operation));
+  return true;
+}
+
+bool Image::LoadAsync(const string& filename, FileEventListener* listener) {
+  if (filename.length() == 0) {
+    cout << "You must provide a non-empty filename" << endl;
+    return false;
+  }
+  cimg::exception_mode(0);
+  auto operation = std::make_unique<FileOperation>();
+  operation->filename = filename;
+  operation->listener = listener;
+  operation->is_load = true;
+  FileOperation* op = operation.get();
+  operation->thread = std::thread([op] {
+    bool loaded = image_io::Read(
+        op->filename, AllocateInto(&op->loaded, &op->loaded_pixels),
+        [op](double fraction) { return op->Report(fraction); });
+    if (!loaded && !op->cancelled) {
+      // Other formats go to CImg, which cannot be cancelled.
+      try {
+        op->loaded = std::make_unique<cimg_library::CImg<uint8_t>>();
+        op->loaded->load(op->filename.c_str());
+        loaded = op->loaded->width() > 0 && op->loaded->height() > 0;
+      } catch (CImgException& e) {
+      }
+    }
+    if (loaded) op->progress = 1;
+    op->success = loaded;
+    op->done = true;
+  });
+  file_operations_.push_back(std::move(operation));
+  return true;
+}
+
+void Image::CancelFileOperations() {
+  for (auto& operation : file_operations_) {
+    operation->cancelled = true;
+  }
+}
+
+void Image::ProcessFileEvents() {
+  // Listeners are notified after the operations are updated, so that they
+  // may start new ones.
+  std::vector<std::function<void()>> notifications;
+  for (auto it = file_operations_.begin(); it != file_operations_.end();) {
+    FileOperation& op = **it;
+    const bool done = op.done;
+    const double progress = op.progress;
+    if (op.listener && progress != op.reported_progress) {
+      op.reported_progress = progress;
+      notifications.push_back([listener = op.listener, filename = op.filename,
+                               progress] {
+        listener->OnFileProgress(filename, progress);
+      });
+    }
+    if (!done) {
+      ++it;
+      continue;
+    }
+    op.thread.join();
+    // A cancelled load is discarded even if it managed to finish.
+    const bool success = op.success && !(op.is_load && op.cancelled);
+    if (success && op.is_load) {
+      DetachSnapshots();
+      cimage_ = std::move(op.loaded);
+      pixels_ = std::move(op.loaded_pixels);
+      width_ = cimage_->width();
+      height_ = cimage_->height();
+      ResetTiles();
+      Flush();
+    }
+    if (op.listener) {
+      notifications.push_back(
+          [listener = op.listener, filename = op.filename, success] {
+            listener->OnFileDone(filename, success);
+          });
+    }
+    it = file_operations_.erase(it);
+  }
+  for (const auto& notify : notifications) notify();
+}
+
 bool Image::ShowForMs(int milliseconds, const std::string& title) {
   if (!IsValid()) return false;
   if (!display_) {
     try {
-      display_ =
-          std::make_unique<cimg_library::CImgDisplay>(*cimage_, title.c_str());
+      display_ = std::make_unique<cimg_library::CImgDisplay>(GetDisplayView(),
+                                                              title.c_str());
     } catch (CImgException& ex) {
       cout << "Failed to open display" << endl;
       return false;
@@ -98,7 +852,7 @@ bool Image::ShowForMs(int milliseconds, const std::string& title) {
   } else {
     display_->set_title("%s", title.c_str());
     display_->show();
-    display_->display(*cimage_);
+    display_->display(GetDisplayView());
     if (milliseconds > 0) display_->wait(milliseconds);
   }
   return true;
@@ -110,6 +864,7 @@ bool Image::ShowUntilClosed(const string& title, int animation_ms) {
   }
   while (!display_->is_closed()) {
     ProcessEvent();
+    ProcessFileEvents();
     if (timer_ > animation_ms) {
       ProcessAnimation();
       // Reset the timer.
@@ -126,7 +881,7 @@ bool Image::ShowUntilClosed(const string& title, int animation_ms) {
 
 void Image::Flush() {
   if (display_ && !display_->is_closed()) {
-    display_->display(*cimage_);
+    display_->display(GetDisplayView());
   }
 }
 
@@ -144,6 +899,12 @@ Color Image::GetColor(int x, int y) const {
   return color;
 }
 
+const uint8_t* Image::GetChannelData(int channel) const {
+  if (!IsValid() || channel < 0 || channel > 2) return nullptr;
+  LoadAllTiles();
+  return cimage_->data(0, 0, 0, channel);
+}
+
 int Image::GetRed(int x, int y) const { return GetPixel(x, y, 0); }
 
 int Image::GetGreen(int x, int y) const { return GetPixel(x, y, 1); }
@@ -151,11 +912,16 @@ int Image::GetGreen(int x, int y) const { return GetPixel(x, y, 1); }
 int Image::GetBlue(int x, int y) const { return GetPixel(x, y, 2); }
 
 bool Image::SetColor(int x, int y, const Color& color) {
-  if (!CheckPixelInBounds(x, y)) {
+  const int values[] = {color.Red(), color.Green(), color.Blue()};
+  if (!CheckPixelInBounds(x, y) || !CheckColorInBounds(values) ||
+      !BeginChange(x, y, x, y)) {
     return false;
   }
-  return SetRed(x, y, color.Red()) && SetGreen(x, y, color.Green()) &&
-         SetBlue(x, y, color.Blue());
+  for (int c = 0; c < 3; c++) {
+    *cimage_->data(x, y, 0, c) = static_cast<uint8_t>(values[c]);
+  }
+  MarkChanged(x, y, x, y);
+  return true;
 }
 
 bool Image::SetRed(int x, int y, int r) { return SetPixel(x, y, 0, r); }
@@ -175,31 +941,20 @@ bool Image::DrawLine(int x0, int y0, int x1, int y1, int red, int green,
     return true;
   }
   if (thickness == 1) {
+    if (!BeginChange(std::min(x0, x1), std::min(y0, y1), std::max(x0, x1),
+                     std::max(y0, y1))) {
+      return false;
+    }
     cimage_->draw_line(x0, y0, x1, y1, color);
+    MarkChanged(std::min(x0, x1), std::min(y0, y1), std::max(x0, x1),
+                std::max(y0, y1));
     return true;
   }
-  // Use CImage::draw_polygon to draw a thick line.
-  const double diff_x = x0 - x1;
-  const double diff_y = y0 - y1;
-  const double theta = std::atan(-diff_y / diff_x);
-  const double hyp = thickness / 2.0;
-
-  // Convert to integer to get nearest pixel.
-  const int delta_x = hyp * std::sin(theta);
-  const int delta_y = hyp * std::cos(theta);
-
-  CImg<int> points(4, 2);
-  points(0, 0) = x0 + delta_x;
-  points(0, 1) = y0 + delta_y;
-  points(1, 0) = x0 - delta_x;
-  points(1, 1) = y0 - delta_y;
-  points(2, 0) = x1 - delta_x;
-  points(2, 1) = y1 - delta_y;
-  points(3, 0) = x1 + delta_x;
-  points(3, 1) = y1 + delta_y;
-
-  cimage_->draw_polygon(points, color);
-  return true;
+  // Draw a thick line as a filled quadrilateral around the segment.
+  int xs[4];
+  int ys[4];
+  PolygonFiller::GetThickLineCorners(x0, y0, x1, y1, thickness, xs, ys);
+  return FillPolygon(xs, ys, 4, color);
 }
 
 bool Image::DrawCircle(int x, int y, int radius, int red, int green, int blue) {
@@ -207,7 +962,11 @@ bool Image::DrawCircle(int x, int y, int radius, int red, int green, int blue) {
   if (!CheckPixelInBounds(x, y) || !CheckColorInBounds(color)) {
     return false;
   }
+  if (!BeginChange(x - radius, y - radius, x + radius, y + radius)) {
+    return false;
+  }
   cimage_->draw_circle(x, y, radius, color);
+  MarkChanged(x - radius, y - radius, x + radius, y + radius);
   return true;
 }
 
@@ -220,7 +979,9 @@ bool Image::DrawRectangle(int x, int y, int width, int height, int red,
   if (width < 0 || height < 0) {
     return false;
   }
+  if (!BeginChange(x, y, x + width - 1, y + height - 1)) return false;
   cimage_->draw_rectangle(x, y, x + width - 1, y + height - 1, color);
+  MarkChanged(x, y, x + width - 1, y + height - 1);
   return true;
 }
 
@@ -230,14 +991,75 @@ bool Image::DrawText(int x, int y, const string& text, int font_size, int red,
   if (!CheckPixelInBounds(x, y) || !CheckColorInBounds(color)) {
     return false;
   }
+  // CImg does not report the size of the text, so assume it may reach the
+  // right edge, with lines no taller than twice the font size.
+  const int lines = 1 + std::count(text.begin(), text.end(), '\n');
+  const int bottom = y + lines * 2 * std::max(font_size, 13);
+  if (!BeginChange(x, y, width_ - 1, bottom)) return false;
   cimage_->draw_text(x, y, text.c_str(), color, 0, 1, font_size);
+  MarkChanged(x, y, width_ - 1, bottom);
+  return true;
+}
+
+bool Image::DrawImage(int x, int y, const SmallImage& image) {
+  if (image.GetWidth() == 0) return false;
+  const int left = std::max(x, 0);
+  const int top = std::max(y, 0);
+  const int right = std::min(x + image.GetWidth(), width_) - 1;
+  const int bottom = std::min(y + image.GetHeight(), height_) - 1;
+  if (left > right || top > bottom) return true;
+  if (!BeginChange(left, top, right, bottom)) return false;
+  for (int c = 0; c < 3; c++) {
+    const uint8_t* from = image.GetChannelData(c) +
+                          (top - y) * image.GetWidth() + left - x;
+    for (int row = top; row <= bottom; row++) {
+      memcpy(cimage_->data(left, row, 0, c), from, right - left + 1);
+      from += image.GetWidth();
+    }
+  }
+  MarkChanged(left, top, right, bottom);
+  return true;
+}
+
+bool Image::FillPolygon(const int xs[], const int ys[], int num_points,
+                        const int color[]) {
+  const int xmin = *std::min_element(xs, xs + num_points);
+  const int xmax = *std::max_element(xs, xs + num_points);
+  const int ymin = *std::min_element(ys, ys + num_points);
+  const int ymax = *std::max_element(ys, ys + num_points);
+  if (xmax < 0 || xmin >= width_ || ymax < 0 || ymin >= height_) return true;
+  if (!BeginChange(xmin, ymin, xmax, ymax)) return false;
+  MarkChanged(xmin, ymin, xmax, ymax);
+  const size_t plane = static_cast<size_t>(width_) * height_;
+  polygon_filler_.Fill(xs, ys, num_points, width_, height_,
+                       [&](int y, int from, int to) {
+                         uint8_t* px = cimage_->data(from, y, 0);
+                         for (int channel = 0; channel < 3; channel++) {
+                           std::fill(px, px + (to - from + 1),
+                                     static_cast<uint8_t>(color[channel]));
+                           px += plane;
+                         }
+                       });
   return true;
 }
 
 void Image::ProcessEvent() {
-  int mouse_x = display_->mouse_x();
-  int mouse_y = display_->mouse_y();
-  if (display_->button() & 1 && mouse_x >= 0 && mouse_y >= 0) {
+  int mouse_x;
+  int mouse_y;
+  unsigned int buttons;
+  if (event_source_) {
+    mouse_x = event_source_->GetMouseX();
+    mouse_y = event_source_->GetMouseY();
+    buttons = event_source_->GetButtons();
+  } else if (display_) {
+    // In image coordinates, if the image is shown scaled down.
+    mouse_x = display_->mouse_x() * display_scale_;
+    mouse_y = display_->mouse_y() * display_scale_;
+    buttons = display_->button();
+  } else {
+    return;
+  }
+  if (buttons & 1 && mouse_x >= 0 && mouse_y >= 0) {
     // Left button has been pressed or moved.
     MouseAction action;
     if (latest_event_.GetMouseAction() == MouseAction::kReleased ||
@@ -254,7 +1076,7 @@ void Image::ProcessEvent() {
     for (auto listener : mouse_listeners_) {
       listener->OnMouseEvent(latest_event_);
     }
-  } else if (!(display_->button() & 1)) {
+  } else if (!(buttons & 1)) {
     // Left button is not clicked.
     if (latest_event_.GetMouseAction() == MouseAction::kDragged ||
         latest_event_.GetMouseAction() == MouseAction::kPressed) {
@@ -311,6 +1133,8 @@ bool Image::CheckColorInBounds(const int value[]) const {
 
 int Image::GetPixel(int x, int y, int channel) const {
   if (!CheckPixelInBounds(x, y)) return -1;
+  if (IsBlankTile(x / kTileSize, y / kTileSize)) return MAX_PIXEL_VALUE;
+  LoadTiles(x, y, x, y);
   const uint8_t* r = cimage_->data(x, y, channel);
   return static_cast<int>(*r);
 }
@@ -318,10 +1142,74 @@ int Image::GetPixel(int x, int y, int channel) const {
 bool Image::SetPixel(int x, int y, int channel, int value) {
   if (!CheckPixelInBounds(x, y)) return false;
   if (!CheckColorInBounds(value)) return false;
+  if (!BeginChange(x, y, x, y)) return false;
   uint8_t* px = cimage_->data(x, y, channel);
   *px = static_cast<uint8_t>(value);
+  MarkChanged(x, y, x, y);
   // Inefficient. Should we have a "flush" or similar?
   return true;
 }
 
+uint64_t ImageSnapshot::GetTileGeneration(int column, int row) const {
+  if (column < 0 || row < 0 || column >= columns_ || row >= rows_) return 0;
+  return generations_[row * columns_ + column];
+}
+
+bool ImageSnapshot::CopyTile(int column, int row,
+                             uint8_t* const channels[3]) const {
+  if (column < 0 || row < 0 || column >= columns_ || row >= rows_) {
+    return false;
+  }
+  const int index = row * columns_ + column;
+  std::lock_guard<std::mutex> lock(mutex_);
+  switch (states_[index]) {
+    case kSkipped:
+      return false;
+    case kBlank: {
+      const int width =
+          std::min(Image::kTileSize, width_ - column * Image::kTileSize);
+      const int height =
+          std::min(Image::kTileSize, height_ - row * Image::kTileSize);
+      white_tiles.ReadTile(column, row, width, height, channels, width);
+      return true;
+    }
+    case kShared:
+      image_->CopyLoadedTile(column, row, channels);
+      return true;
+    case kPreserved:
+      break;
+  }
+  const size_t plane_size = preserved_[index].size() / 3;
+  for (int c = 0; c < 3; c++) {
+    memcpy(channels[c], preserved_[index].data() + c * plane_size,
+           plane_size);
+  }
+  return true;
+}
+
+size_t ImageSnapshot::GetMemoryUsage() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t bytes = 0;
+  for (const PixelBuffer& pixels : preserved_) bytes += pixels.size();
+  return bytes;
+}
+
+bool ImageSnapshot::Preserve(int column, int row) {
+  const int index = row * columns_ + column;
+  if (states_[index] != kShared) return true;
+  const int width =
+      std::min(Image::kTileSize, width_ - column * Image::kTileSize);
+  const int height =
+      std::min(Image::kTileSize, height_ - row * Image::kTileSize);
+  const size_t plane_size = static_cast<size_t>(width) * height;
+  PixelBuffer pixels(plane_size * 3);
+  if (!pixels) return false;
+  uint8_t* const channels[3] = {pixels.data(), pixels.data() + plane_size,
+                                pixels.data() + 2 * plane_size};
+  image_->CopyLoadedTile(column, row, channels);
+  preserved_[index] = std::move(pixels);
+  states_[index] = kPreserved;
+  return true;
+}
+
 }  // namespace graphics
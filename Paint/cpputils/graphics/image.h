@@ -4,12 +4,18 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT.
 
+#include <cstdint>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "image_event.h"
+#include "image_io.h"
+#include "pixel_pool.h"
+#include "polygon_filler.h"
 
 #ifndef GRAPHICS_IMAGE_H
 #define GRAPHICS_IMAGE_H
@@ -83,8 +89,38 @@ static void PrintTo(const Color& color, std::ostream* stream) {
           << color.Blue() << ")";
 }
 
+class ImageSnapshot;
+class MappedFile;
+class SmallImage;
+
+/**
+ * Supplies the pixels of an Image one tile at a time, when they are first
+ * needed. See Image::InitializeFromTiles.
+ */
+class TileSource {
+ public:
+  virtual ~TileSource() = default;
+
+  /**
+   * Writes the pixels of the tile at |column|, |row| into |channels|: the
+   * value of channel c at (x, y) within the tile goes to
+   * channels[c][y * |stride| + x]. The tile is |width| by |height| pixels,
+   * which is Image::kTileSize except along the right and bottom edges.
+   * Returns false if the tile could not be read; it is then left white.
+   */
+  virtual bool ReadTile(int column, int row, int width, int height,
+                        uint8_t* const channels[3], int stride) = 0;
+};
+
 class Image {
  public:
+  /**
+   * Side length in pixels of the square tiles that the image tracks changes
+   * in and loads lazily from a TileSource. Tiles along the right and bottom
+   * edges are cut off by the image border.
+   */
+  static constexpr int kTileSize = 128;
+
   Image();
   ~Image();
 
@@ -93,10 +129,39 @@ class Image {
    */
   explicit Image(int width, int height);
 
-  // Disallow copy and assign.
+  // Disallow copy and assign. See Clone and Share instead.
   Image(const Image&) = delete;
   Image& operator=(const Image&) = delete;
 
+  /**
+   * Moves the pixels of |other| into this image, along with its display,
+   * listeners, snapshots and file operations, leaving |other| empty. No
+   * pixels are copied. Objects holding a pointer to |other| are not told:
+   * a TimelapseRecorder recording it, a Canvas viewing it, or a
+   * TestEventGenerator sending it events would go on using the empty
+   * |other|, so stop or destroy them before moving it.
+   */
+  Image(Image&& other);
+  Image& operator=(Image&& other);
+
+  /**
+   * Returns a copy of the image's pixels, without its display, listeners or
+   * snapshots. Returns an empty image if this one is empty or out of
+   * memory.
+   */
+  Image Clone() const;
+
+  /**
+   * Returns an image sharing this image's pixels until either image changes
+   * them, at which point it first copies them for itself. This makes
+   * passing images by value, e.g. through the steps of a filter, as cheap
+   * as passing a pointer until they draw. Tiles still to be read from a
+   * TileSource are read first, except unused tiles of a mapped image, which
+   * stay unused in both. An image that copies mapped pixels keeps its copy
+   * in memory. The images may then be used on different threads.
+   */
+  Image Share() const;
+
   /*
    * Loads an image from a file. Returns false if the image could
    * not be loaded. Note: this clears any current state, including
@@ -110,12 +175,95 @@ class Image {
    */
   bool Initialize(int width, int height);
 
+  /**
+   * Resets the image to |width| by |height| pixels copied from |channels|:
+   * three planes of |width| * |height| values each, stored row by row like
+   * GetChannelData returns them. Returns false if |width| or |height| are
+   * less than 1.
+   */
+  bool Initialize(int width, int height, const uint8_t* const channels[3]);
+
+  /**
+   * Resets the image to be a blank white image of size |width| by |height|
+   * whose pixels are stored in |filename|, through a memory mapping, instead
+   * of in memory. The operating system then only keeps the parts being drawn
+   * or shown in memory, so the image can be larger than the memory
+   * available. The file is created or truncated and starts out sparse: each
+   * tile is written white the first time it is drawn to. Reading, saving,
+   * snapshotting or showing the image treat unused tiles as white without
+   * writing them; only GetChannelData writes them all. It keeps the pixels,
+   * as three planes one after the other, until the image is initialized or
+   * loaded again, and is left in place afterwards. Returns false if |width|
+   * or |height| are less than 1 or the file could not be mapped.
+   *
+   * The file's space is not reserved, so that it stays sparse. If the disk
+   * fills up, drawing to an unused tile fails with SIGBUS rather than an
+   * error.
+   */
+  bool InitializeMapped(int width, int height, const std::string& filename);
+
+  /**
+   * Returns true if the pixels are stored in a file, see InitializeMapped.
+   */
+  bool IsMapped() const;
+
   /**
    * Saves the current image to the file with |filename| in bitmap
    * format. Returns false if saving failed.
    */
   bool SaveImageBmp(const std::string& filename) const;
 
+  /**
+   * Saves the current image to the file with |filename| in the QOI format,
+   * which is lossless, several times smaller than a bitmap and much faster to
+   * write than PNG. Use it for autosaves and files shared between tools.
+   * Returns false if saving failed.
+   */
+  bool SaveFast(const std::string& filename) const;
+
+  /**
+   * Loads an image saved with SaveFast. Returns false if the file could not
+   * be loaded or is not a QOI file. Like Load, this clears any current
+   * state.
+   */
+  bool LoadFast(const std::string& filename);
+
+  /**
+   * Starts saving the current image to |filename| on a background thread and
+   * returns without waiting for it. The pixels are copied first, so drawing
+   * afterwards does not change what is saved. Saves in the QOI format if
+   * |filename| ends in ".qoi", and as a bitmap otherwise. If |listener| is
+   * not null, it is told about progress and completion by ProcessFileEvents
+   * and must stay alive until then. Returns false if the save could not be
+   * started.
+   */
+  bool SaveAsync(const std::string& filename,
+                 FileEventListener* listener = nullptr);
+
+  /**
+   * Starts loading |filename| on a background thread and returns without
+   * waiting for it. The image keeps its current pixels until
+   * ProcessFileEvents finds the load complete, swaps in the new pixels and
+   * notifies |listener|, if not null. |listener| must stay alive until then.
+   * Returns false if the load could not be started.
+   */
+  bool LoadAsync(const std::string& filename,
+                 FileEventListener* listener = nullptr);
+
+  /**
+   * Asks all unfinished SaveAsync and LoadAsync operations to stop. Their
+   * listeners are still notified, without success. A cancelled load leaves
+   * the image unchanged, and a save that stops early leaves any existing
+   * file as it was.
+   */
+  void CancelFileOperations();
+
+  /**
+   * Returns true until every SaveAsync and LoadAsync operation has been
+   * reported done by ProcessFileEvents.
+   */
+  bool HasPendingFileOperations() const { return !file_operations_.empty(); }
+
   /**
    * Shows the current image. Returns false if the image could not be shown.
    */
@@ -178,6 +326,86 @@ class Image {
    */
   int GetHeight() const { return height_; }
 
+  /**
+   * Returns the values of |channel| (0 for red, 1 for green, 2 for blue) for
+   * the whole image, stored row by row: the value at (x, y) is at index
+   * y * GetWidth() + x. Useful for fast loops over every pixel. Returns
+   * nullptr if the image is not valid or |channel| is out of range. Every
+   * tile is read first, which for a mapped image writes all its unused
+   * tiles; prefer GetColor or CopyTile to read parts of one.
+   */
+  const uint8_t* GetChannelData(int channel) const;
+
+  /**
+   * Resets the image to |width| by |height| pixels that are read from
+   * |source| one tile at a time, the first time each tile is read, drawn to
+   * or shown. This makes opening very large images nearly instant. |source|
+   * is not owned and must stay alive until every tile has been read or the
+   * image is initialized or loaded again. Returns false if |width| or
+   * |height| are less than 1.
+   */
+  bool InitializeFromTiles(int width, int height, TileSource* source);
+
+  /**
+   * Returns the number of tile columns and rows covering the image.
+   */
+  int GetTileColumns() const { return tile_columns_; }
+  int GetTileRows() const { return tile_rows_; }
+
+  /**
+   * Returns a number that grows every time a pixel in the tile at |column|,
+   * |row| changes, so comparing it to an earlier value tells whether the
+   * tile changed since. Tiles read from a TileSource do not count as
+   * changed. Returns 0 if the tile is out of range.
+   */
+  uint64_t GetTileGeneration(int column, int row) const;
+
+  /**
+   * Returns the newest tile generation of any tile.
+   */
+  uint64_t GetGeneration() const { return generation_; }
+
+  /**
+   * Returns false while the tile at |column|, |row| has yet to be read from
+   * the TileSource given to InitializeFromTiles.
+   */
+  bool IsTileLoaded(int column, int row) const;
+
+  /**
+   * Copies the tile at |column|, |row| into three planes of |channels|, each
+   * holding the tile's width times height values row by row, reading it from
+   * the TileSource first if needed. Returns false if the tile is out of
+   * range.
+   */
+  bool CopyTile(int column, int row, uint8_t* const channels[3]) const;
+
+  /**
+   * Takes a copy-on-write snapshot of the image's tiles, to be read on
+   * another thread while this one keeps drawing. No pixels are copied up
+   * front: the snapshot shares each tile with the image until the image is
+   * about to change it, and only then copies the tile's old pixels. If
+   * |saved_generations| holds a generation for every tile, tiles whose
+   * generation still matches it are left out of the snapshot, so that a
+   * snapshot of what changed since an earlier save costs nothing more. Tiles
+   * that are included but not yet read from a TileSource are read first.
+   */
+  std::shared_ptr<ImageSnapshot> Snapshot(
+      const std::vector<uint64_t>* saved_generations = nullptr) const;
+
+  /**
+   * Returns the bytes the image holds in memory for its pixels and their
+   * tile bookkeeping. Pixels mapped from a file, see InitializeMapped, are
+   * left out, since the system can page them out on its own. Pixels shared
+   * with other images, see Share, are split evenly between them.
+   */
+  size_t GetMemoryUsage() const;
+
+  /**
+   * Returns the bytes of old tiles that the image's snapshots copied before
+   * it changed them, see Snapshot.
+   */
+  size_t GetSnapshotMemoryUsage() const;
+
   /**
    * Gets the color at pixel at position (x, y) in the image.
    * Returns (-1, -1, -1) if (x, y) is out of bounds.
@@ -296,6 +524,13 @@ class Image {
   bool DrawText(int x, int y, const std::string& text, int font_size, int red,
                 int green, int blue);
 
+  /**
+   * Copies the pixels of |image| with its top left corner at (|x|, |y|),
+   * leaving out the parts outside this image. Returns false if |image| is
+   * empty.
+   */
+  bool DrawImage(int x, int y, const SmallImage& image);
+
   /**
    * Adds a MouseEventListener to this image. This MouseEventListener's OnMouseEvent
    * function will be called whenever the display receives left-button mouse
@@ -340,20 +575,100 @@ class Image {
     }
   }
 
- private:
-  friend class TestEventGenerator;
-
-  CImgDisplay* GetDisplayForTesting() {
-    if (!display_) return nullptr;
-    return display_.get();
-  }
+  /**
+   * Makes the image read the mouse state from |source| instead of from its
+   * display, so that mouse listeners can be driven without showing the
+   * image. Pass nullptr to read from the display again. |source| is not
+   * owned and must stay alive while it is set.
+   */
+  void SetEventSource(EventSource* source) { event_source_ = source; }
 
+  /**
+   * Reads the current mouse state from the event source, or from the display
+   * if there is none, and notifies the mouse listeners of the resulting
+   * press, drag, release or move, if any. ShowUntilClosed calls this
+   * repeatedly; call it directly after changing an event source's state.
+   * Does nothing if there is neither an event source nor a display.
+   */
   void ProcessEvent();
 
+  /**
+   * Notifies all animation listeners of one animation step, as
+   * ShowUntilClosed does every animation interval.
+   */
   void ProcessAnimation();
 
+  /**
+   * Notifies FileEventListeners of the progress and completion of SaveAsync
+   * and LoadAsync operations, and swaps in the pixels of completed loads.
+   * ShowUntilClosed calls this repeatedly.
+   */
+  void ProcessFileEvents();
+
+ private:
+  friend class ImageSnapshot;
+
   bool IsValid() const { return height_ > 0 && width_ > 0; }
 
+  // A SaveAsync or LoadAsync in progress.
+  struct FileOperation;
+
+  // Marks every tile as changed and loaded, after the pixels were replaced.
+  void ResetTiles();
+
+  // Marks the tiles overlapping the rectangle from (x0, y0) to (x1, y1),
+  // inclusive and clipped to the image, as changed.
+  void MarkChanged(int x0, int y0, int x1, int y1);
+
+  // Reads any tiles overlapping the rectangle from (x0, y0) to (x1, y1) that
+  // are still waiting for the TileSource. Cheap if there are none.
+  void LoadTiles(int x0, int y0, int x1, int y1) const {
+    if (tile_source_) LoadTilesFromSource(x0, y0, x1, y1);
+  }
+  void LoadAllTiles() const { LoadTiles(0, 0, width_ - 1, height_ - 1); }
+  void LoadTilesFromSource(int x0, int y0, int x1, int y1) const;
+
+  // Gets the tiles overlapping the rectangle from (x0, y0) to (x1, y1) ready
+  // to be drawn to: copies the pixels if they are shared with other images,
+  // reads the tiles from the TileSource if needed, and copies them into any
+  // snapshot still sharing them. Cheap if there are no snapshots. Returns
+  // false if out of memory for either copy, leaving the tiles unchanged.
+  bool BeginChange(int x0, int y0, int x1, int y1) {
+    if (shared_pixels_ && !Unshare()) return false;
+    LoadTiles(x0, y0, x1, y1);
+    return snapshots_.empty() || PreserveTiles(x0, y0, x1, y1);
+  }
+  bool PreserveTiles(int x0, int y0, int x1, int y1);
+
+  // Gives the image pixels of its own, in place of the ones it shares with
+  // other images, see Share. Returns false if out of memory.
+  bool Unshare();
+
+  // Makes every snapshot copy the tiles it still shares, before the pixels
+  // are replaced or freed.
+  void DetachSnapshots();
+
+  // Copies the tile at |column|, |row|, which must be loaded, like CopyTile.
+  void CopyLoadedTile(int column, int row, uint8_t* const channels[3]) const;
+
+  // Returns true if the tile at |column|, |row| of a mapped image was never
+  // used, so it reads as white without being loaded.
+  bool IsBlankTile(int column, int row) const;
+
+  // Copies the pixels into |out|, as three planes one after the other, with
+  // blank tiles white and left unloaded.
+  void CopyPixels(uint8_t* out) const;
+
+  // Points |channels| at the planes, or at a copy of them in |copy| if the
+  // image has blank tiles, so that reading every pixel writes nothing.
+  void GetPlanesForReading(PixelBuffer* copy,
+                           const uint8_t* channels[3]) const;
+
+  // Returns the pixels to show: cimage_ itself, or display_view_ with blank
+  // tiles white and, if the image is larger than the display allows, every
+  // display_scale_th pixel.
+  const CImg<uint8_t>& GetDisplayView();
+
   bool CheckPixelInBounds(int x, int y) const;
 
   bool CheckColorInBounds(int value) const;
@@ -364,12 +679,33 @@ class Image {
 
   bool SetPixel(int x, int y, int channel, int value);
 
+  // Fills the polygon with |num_points| vertices at (|xs|[i], |ys|[i]) with
+  // polygon_filler_, which does not allocate once its buffers have grown.
+  // Returns false if out of memory, see BeginChange.
+  bool FillPolygon(const int xs[], const int ys[], int num_points,
+                   const int color[]);
+
   int width_ = 0;
   int height_ = 0;
+  // The file holding the pixels of a mapped image, or the pooled buffer
+  // holding them otherwise, which cimage_ shares. Once Share is called, they
+  // move to shared_pixels_, which the images sharing them hold. Declared
+  // first so that they are released last. Sharing the pixels is not a
+  // visible change, hence mutable.
+  struct SharedPixels;
+  mutable std::unique_ptr<MappedFile> mapping_;
+  mutable PixelBuffer pixels_;
+  mutable std::shared_ptr<SharedPixels> shared_pixels_;
   std::unique_ptr<CImg<uint8_t>> cimage_;
   std::unique_ptr<CImgDisplay> display_;
+  std::unique_ptr<CImg<uint8_t>> display_view_;
+  int display_scale_ = 1;
   int timer_ = 0;
 
+  // Where ProcessEvent reads the mouse state from instead of display_, if set.
+  // Unowned.
+  EventSource* event_source_ = nullptr;
+
   // Mouse listeners. Unowned.
   std::set<MouseEventListener*> mouse_listeners_;
 
@@ -377,6 +713,104 @@ class Image {
   std::set<AnimationEventListener*> animation_listeners_;
 
   MouseEvent latest_event_ = MouseEvent(0, 0, MouseAction::kReleased);
+
+  // Per-tile change tracking, row by row. See GetTileGeneration.
+  int tile_columns_ = 0;
+  int tile_rows_ = 0;
+  uint64_t generation_ = 0;
+  std::vector<uint64_t> tile_generations_;
+
+  // Where tiles that are not loaded yet come from, while there are any.
+  // Unowned. Loading tiles is not a visible change, hence mutable.
+  mutable TileSource* tile_source_ = nullptr;
+  mutable std::vector<bool> tile_loaded_;
+  mutable int tiles_pending_ = 0;
+
+  // Snapshots that may still share tiles with the image. One is dropped once
+  // the image holds the only reference to it. Taking a snapshot is not a
+  // visible change, hence mutable.
+  mutable std::vector<std::shared_ptr<ImageSnapshot>> snapshots_;
+
+  // Unfinished SaveAsync and LoadAsync operations, oldest first.
+  std::vector<std::unique_ptr<FileOperation>> file_operations_;
+
+  // Scratch space for FillPolygon.
+  PolygonFiller polygon_filler_;
+};
+
+/**
+ * The tiles of an Image as they were when Image::Snapshot was called. A
+ * snapshot may be read on any one thread while the image is used on another.
+ */
+class ImageSnapshot {
+ public:
+  ImageSnapshot(const ImageSnapshot&) = delete;
+  ImageSnapshot& operator=(const ImageSnapshot&) = delete;
+
+  /**
+   * Identifies the image the snapshot was taken of. It may have been
+   * destroyed since, so the pointer is only good for comparing.
+   */
+  const Image* GetImage() const { return image_id_; }
+
+  int GetWidth() const { return width_; }
+  int GetHeight() const { return height_; }
+  int GetTileColumns() const { return columns_; }
+  int GetTileRows() const { return rows_; }
+
+  /**
+   * Returns the generation the tile at |column|, |row| had when the snapshot
+   * was taken, see Image::GetTileGeneration, or 0 if it is out of range.
+   */
+  uint64_t GetTileGeneration(int column, int row) const;
+
+  /**
+   * Copies the tile at |column|, |row| as it was when the snapshot was taken,
+   * like Image::CopyTile. Returns false if the tile is out of range or was
+   * left out of the snapshot.
+   */
+  bool CopyTile(int column, int row, uint8_t* const channels[3]) const;
+
+  /**
+   * Returns the bytes of the tiles copied out of the image so far.
+   */
+  size_t GetMemoryUsage() const;
+
+ private:
+  friend class Image;
+
+  enum TileState : uint8_t {
+    // Left out of the snapshot.
+    kSkipped,
+    // Still read from the image, which has not changed it since.
+    kShared,
+    // An unused tile of a mapped image, which reads as white.
+    kBlank,
+    // Copied into preserved_ before the image changed it.
+    kPreserved,
+  };
+
+  ImageSnapshot() = default;
+
+  // Copies the tile at |column|, |row| out of image_ into preserved_ if it is
+  // still shared. Called by the image, with mutex_ held. Returns false, and
+  // leaves the tile shared, if out of memory.
+  bool Preserve(int column, int row);
+
+  const Image* image_id_ = nullptr;
+  int width_ = 0;
+  int height_ = 0;
+  int columns_ = 0;
+  int rows_ = 0;
+  std::vector<uint64_t> generations_;
+
+  // Guards the members below, which the image changes as it draws.
+  mutable std::mutex mutex_;
+  // The image, until it is replaced or destroyed.
+  const Image* image_ = nullptr;
+  std::vector<TileState> states_;
+  // Copies of kPreserved tiles, as three planes like CopyTile writes.
+  std::vector<PixelBuffer> preserved_;
 };
 
 }  // namespace graphics
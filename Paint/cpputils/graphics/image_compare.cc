@@ -0,0 +1,236 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "image_compare.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace graphics {
+
+namespace {
+
+// Below this many pixels per thread, starting a thread costs more than it
+// saves.
+constexpr int kMinPixelsPerThread = 1 << 18;
+
+constexpr double kMaxValue = 255.0;
+
+struct BandStats {
+  int differing_pixels = 0;
+  int min_x = INT_MAX;
+  int min_y = INT_MAX;
+  int max_x = -1;
+  int max_y = -1;
+  uint64_t squared_error = 0;
+  int64_t compared_pixels = 0;
+  bool complete = true;
+};
+
+// Compares one row of |width| pixels. Returns the number of differing pixels
+// and widens [|first|, |last|] to include them. Adds the squared error of all
+// channels to |squared_error|.
+int CompareRow(const uint8_t* const expected[3], const uint8_t* const actual[3],
+               int width, const int tolerance[3], int* first, int* last,
+               uint64_t* squared_error) {
+  int count = 0;
+  int x = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i tolerances[3] = {
+      _mm_set1_epi8(static_cast<char>(tolerance[0])),
+      _mm_set1_epi8(static_cast<char>(tolerance[1])),
+      _mm_set1_epi8(static_cast<char>(tolerance[2]))};
+  __m128i error_sum = zero;
+  int pending = 0;
+  auto flush_error_sum = [&]() {
+    uint32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), error_sum);
+    *squared_error +=
+        static_cast<uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+    error_sum = zero;
+    pending = 0;
+  };
+  for (; x + 16 <= width; x += 16) {
+    int mask = 0;
+    for (int c = 0; c < 3; c++) {
+      const __m128i e =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(expected[c] + x));
+      const __m128i a =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(actual[c] + x));
+      // |e - a| using saturating subtraction in both directions.
+      const __m128i diff =
+          _mm_or_si128(_mm_subs_epu8(e, a), _mm_subs_epu8(a, e));
+      const __m128i over = _mm_subs_epu8(diff, tolerances[c]);
+      mask |= ~_mm_movemask_epi8(_mm_cmpeq_epi8(over, zero)) & 0xFFFF;
+      const __m128i low = _mm_unpacklo_epi8(diff, zero);
+      const __m128i high = _mm_unpackhi_epi8(diff, zero);
+      error_sum = _mm_add_epi32(
+          error_sum,
+          _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high)));
+    }
+    if (mask) {
+      count += __builtin_popcount(mask);
+      *first = std::min(*first, x + __builtin_ctz(mask));
+      *last = std::max(*last, x + 31 - __builtin_clz(mask));
+    }
+    // Per channel, each 32-bit lane gains two squares from each of the low
+    // and high halves, so at most 12 * 255^2 per step. After 2048 steps that
+    // is 1,598,054,400, still under INT32_MAX.
+    if (++pending == 2048) flush_error_sum();
+  }
+  flush_error_sum();
+#endif
+  for (; x < width; x++) {
+    bool differs = false;
+    for (int c = 0; c < 3; c++) {
+      const int diff = std::abs(expected[c][x] - actual[c][x]);
+      *squared_error += diff * diff;
+      differs |= diff > tolerance[c];
+    }
+    if (differs) {
+      count++;
+      *first = std::min(*first, x);
+      *last = std::max(*last, x);
+    }
+  }
+  return count;
+}
+
+// Compares rows |start_row| to |end_row| of the planes of |width| pixels wide
+// images. Only reads the planes, which CompareImages gets before starting any
+// thread, since getting them may read tiles into the images.
+void CompareBand(const uint8_t* const expected[3],
+                 const uint8_t* const actual[3], int width,
+                 const CompareOptions& options, int start_row, int end_row,
+                 std::atomic<int>* total_differing, std::atomic<bool>* stop,
+                 BandStats* stats) {
+  const int tolerance[] = {options.tolerance.Red(), options.tolerance.Green(),
+                           options.tolerance.Blue()};
+  const uint8_t* expected_rows[3];
+  const uint8_t* actual_rows[3];
+  for (int y = start_row; y < end_row; y++) {
+    if (stop->load(std::memory_order_relaxed)) {
+      stats->complete = false;
+      return;
+    }
+    const size_t offset = static_cast<size_t>(y) * width;
+    for (int c = 0; c < 3; c++) {
+      expected_rows[c] = expected[c] + offset;
+      actual_rows[c] = actual[c] + offset;
+    }
+    int first = INT_MAX;
+    int last = -1;
+    const int count = CompareRow(expected_rows, actual_rows, width, tolerance,
+                                 &first, &last, &stats->squared_error);
+    stats->compared_pixels += width;
+    if (count == 0) continue;
+    stats->differing_pixels += count;
+    stats->min_x = std::min(stats->min_x, first);
+    stats->max_x = std::max(stats->max_x, last);
+    stats->min_y = std::min(stats->min_y, y);
+    stats->max_y = std::max(stats->max_y, y);
+    const int total = total_differing->fetch_add(count) + count;
+    if (options.early_exit && total > options.max_differing_pixels) {
+      stop->store(true, std::memory_order_relaxed);
+    }
+  }
+}
+
+}  // namespace
+
+CompareResult CompareImages(const Image& expected, const Image& actual,
+                            const CompareOptions& options) {
+  CompareResult result;
+  const int width = expected.GetWidth();
+  const int height = expected.GetHeight();
+  if (width != actual.GetWidth() || height != actual.GetHeight()) {
+    return result;
+  }
+  result.same_size = true;
+  if (width < 1 || height < 1) {
+    result.match = true;
+    result.complete = true;
+    result.psnr = std::numeric_limits<double>::infinity();
+    return result;
+  }
+
+  const uint8_t* expected_planes[3];
+  const uint8_t* actual_planes[3];
+  for (int c = 0; c < 3; c++) {
+    expected_planes[c] = expected.GetChannelData(c);
+    actual_planes[c] = actual.GetChannelData(c);
+    if (!expected_planes[c] || !actual_planes[c]) return result;
+  }
+
+  int threads = options.threads;
+  if (threads < 1) {
+    const int64_t pixels = static_cast<int64_t>(width) * height;
+    threads = static_cast<int>(std::min<int64_t>(
+        std::max(1u, std::thread::hardware_concurrency()),
+        pixels / kMinPixelsPerThread));
+  }
+  threads = std::max(1, std::min(threads, height));
+
+  std::atomic<int> total_differing(0);
+  std::atomic<bool> stop(false);
+  std::vector<BandStats> bands(threads);
+  const int rows_per_band = (height + threads - 1) / threads;
+  if (threads == 1) {
+    CompareBand(expected_planes, actual_planes, width, options, 0, height,
+                &total_differing, &stop, &bands[0]);
+  } else {
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+      const int start_row = i * rows_per_band;
+      const int end_row = std::min(height, start_row + rows_per_band);
+      workers.emplace_back(CompareBand, expected_planes, actual_planes, width,
+                           std::cref(options), start_row, end_row,
+                           &total_differing, &stop, &bands[i]);
+    }
+    for (std::thread& worker : workers) worker.join();
+  }
+
+  uint64_t squared_error = 0;
+  int64_t compared_pixels = 0;
+  result.complete = true;
+  result.min_x = INT_MAX;
+  result.min_y = INT_MAX;
+  for (const BandStats& band : bands) {
+    result.differing_pixels += band.differing_pixels;
+    result.min_x = std::min(result.min_x, band.min_x);
+    result.min_y = std::min(result.min_y, band.min_y);
+    result.max_x = std::max(result.max_x, band.max_x);
+    result.max_y = std::max(result.max_y, band.max_y);
+    result.complete &= band.complete;
+    squared_error += band.squared_error;
+    compared_pixels += band.compared_pixels;
+  }
+  if (result.differing_pixels == 0) {
+    result.min_x = 0;
+    result.min_y = 0;
+  }
+  result.match = result.differing_pixels <= options.max_differing_pixels;
+  if (squared_error == 0) {
+    result.psnr = std::numeric_limits<double>::infinity();
+  } else {
+    const double mse =
+        static_cast<double>(squared_error) / (compared_pixels * 3.0);
+    result.psnr = 10.0 * std::log10(kMaxValue * kMaxValue / mse);
+  }
+  return result;
+}
+
+}  // namespace graphics
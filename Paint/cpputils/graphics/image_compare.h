@@ -0,0 +1,75 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "image.h"
+
+#ifndef GRAPHICS_IMAGE_COMPARE_H
+#define GRAPHICS_IMAGE_COMPARE_H
+
+namespace graphics {
+
+/**
+ * Options for CompareImages.
+ */
+struct CompareOptions {
+  // Largest per-channel difference that still counts as equal. For example
+  // a tolerance of Color(2, 2, 2) accepts (100, 50, 0) vs (102, 49, 1).
+  Color tolerance = Color(0, 0, 0);
+
+  // The images match if at most this many pixels differ.
+  int max_differing_pixels = 0;
+
+  // If true, stops comparing as soon as more than |max_differing_pixels|
+  // pixels differ. The result is then incomplete: the statistics only
+  // cover the part of the images that was compared.
+  bool early_exit = true;
+
+  // Number of threads to compare with, or 0 to pick automatically based on
+  // the image size and available hardware.
+  int threads = 0;
+};
+
+/**
+ * The outcome of CompareImages.
+ */
+struct CompareResult {
+  // True if the images have the same size and at most
+  // CompareOptions::max_differing_pixels pixels differ.
+  bool match = false;
+
+  // False if the images have different dimensions. No pixels are compared.
+  bool same_size = false;
+
+  // False if the comparison stopped early, see CompareOptions::early_exit.
+  bool complete = false;
+
+  // Number of pixels where at least one channel differs by more than the
+  // tolerance.
+  int differing_pixels = 0;
+
+  // Bounding box of the differing pixels, inclusive. Only meaningful if
+  // |differing_pixels| is greater than 0.
+  int min_x = 0;
+  int min_y = 0;
+  int max_x = -1;
+  int max_y = -1;
+
+  // Peak signal-to-noise ratio in dB over all channels. Infinity if the
+  // compared pixels are identical.
+  double psnr = 0;
+};
+
+/**
+ * Compares |expected| and |actual| pixel by pixel. The comparison walks the
+ * images row by row, compares 16 pixels at a time where SIMD is available and
+ * splits large images into row bands compared on separate threads.
+ */
+CompareResult CompareImages(const Image& expected, const Image& actual,
+                            const CompareOptions& options = CompareOptions());
+
+}  // namespace graphics
+
+#endif  // GRAPHICS_IMAGE_COMPARE_H
@@ -4,6 +4,8 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT.
 
+#include <string>
+
 #ifndef GRAPHICS_IMAGE_EVENT_H
 #define GRAPHICS_IMAGE_EVENT_H
 
@@ -67,6 +69,72 @@ class AnimationEventListener {
   virtual void OnAnimationStep() = 0;
 };
 
+/**
+ * Abstract interface for following Image::SaveAsync and Image::LoadAsync.
+ * Both functions are called on the thread that shows the image, from
+ * Image::ProcessFileEvents, which Image::ShowUntilClosed calls regularly.
+ */
+class FileEventListener {
+ public:
+  // Called as |filename| is written or read, with |progress| going from 0 to
+  // 1. Progress may skip steps if the image is not processing events.
+  virtual void OnFileProgress(const std::string& /*filename*/,
+                              double /*progress*/) {}
+
+  // Called once the save or load of |filename| is over. |success| is false
+  // if it failed or was cancelled. After a successful load the image already
+  // holds the new pixels.
+  virtual void OnFileDone(const std::string& filename, bool success) = 0;
+};
+
+/**
+ * Abstract source of the raw mouse state that an Image turns into
+ * MouseEvents. By default an Image reads the mouse state of its display. Use
+ * Image::SetEventSource to read from another source instead, for example to
+ * replay recorded or synthetic input without a display.
+ */
+class EventSource {
+ public:
+  // The mouse position within the image, negative if outside of it.
+  virtual int GetMouseX() const = 0;
+  virtual int GetMouseY() const = 0;
+
+  // Bitmask of the mouse buttons currently down: 1 for the left button, 2
+  // for the right button and 4 for the middle button.
+  virtual unsigned int GetButtons() const = 0;
+};
+
+/**
+ * An EventSource held in memory, whose state is set directly. Call
+ * Image::ProcessEvent after each change to deliver the resulting
+ * MouseEvents to the image's listeners.
+ */
+class InjectedEventSource : public EventSource {
+ public:
+  int GetMouseX() const override { return x_; }
+  int GetMouseY() const override { return y_; }
+  unsigned int GetButtons() const override { return buttons_; }
+
+  void SetMouse(int x, int y) {
+    x_ = x;
+    y_ = y;
+  }
+
+  // Presses or releases the buttons in the |button| bitmask.
+  void SetButton(unsigned int button, bool is_pressed) {
+    if (is_pressed) {
+      buttons_ |= button;
+    } else {
+      buttons_ &= ~button;
+    }
+  }
+
+ private:
+  int x_ = -1;
+  int y_ = -1;
+  unsigned int buttons_ = 0;
+};
+
 }  // namespace graphics
 
 #endif  // GRAPHICS_IMAGE_EVENT_H
@@ -0,0 +1,141 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "image_hash.h"
+
+namespace graphics {
+
+namespace {
+
+// xxHash64 constants, see https://github.com/Cyan4973/xxHash.
+constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+// Seed for the second half of a 128-bit hash.
+constexpr uint64_t kHighSeed = 0x5061696E74486173ULL;
+
+inline uint64_t RotateLeft(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+// Reads little-endian values regardless of the host byte order.
+inline uint64_t Read64(const uint8_t* p) {
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; i--) value = (value << 8) | p[i];
+  return value;
+}
+
+inline uint32_t Read32(const uint8_t* p) {
+  return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+         static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+inline uint64_t Round(uint64_t accumulator, uint64_t input) {
+  accumulator += input * kPrime2;
+  accumulator = RotateLeft(accumulator, 31);
+  return accumulator * kPrime1;
+}
+
+inline uint64_t MergeRound(uint64_t accumulator, uint64_t value) {
+  accumulator ^= Round(0, value);
+  return accumulator * kPrime1 + kPrime4;
+}
+
+uint64_t HashPlanes(const Image& image, uint64_t seed) {
+  const uint8_t header[] = {
+      static_cast<uint8_t>(image.GetWidth()),
+      static_cast<uint8_t>(image.GetWidth() >> 8),
+      static_cast<uint8_t>(image.GetWidth() >> 16),
+      static_cast<uint8_t>(image.GetWidth() >> 24),
+      static_cast<uint8_t>(image.GetHeight()),
+      static_cast<uint8_t>(image.GetHeight() >> 8),
+      static_cast<uint8_t>(image.GetHeight() >> 16),
+      static_cast<uint8_t>(image.GetHeight() >> 24)};
+  uint64_t hash = HashBytes(header, sizeof(header), seed);
+  const size_t plane_size =
+      static_cast<size_t>(image.GetWidth()) * image.GetHeight();
+  for (int channel = 0; channel < 3; channel++) {
+    const uint8_t* plane = image.GetChannelData(channel);
+    if (!plane) break;
+    hash = HashBytes(plane, plane_size, hash);
+  }
+  return hash;
+}
+
+}  // namespace
+
+std::string ImageHash128::ToString() const {
+  static const char kDigits[] = "0123456789abcdef";
+  std::string result(32, '0');
+  for (int i = 0; i < 16; i++) {
+    result[15 - i] = kDigits[(high >> (4 * i)) & 0xF];
+    result[31 - i] = kDigits[(low >> (4 * i)) & 0xF];
+  }
+  return result;
+}
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  const uint8_t* const end = p + size;
+  uint64_t hash;
+  if (size >= 32) {
+    // Four independent lanes keep several multiplies in flight at once.
+    uint64_t v1 = seed + kPrime1 + kPrime2;
+    uint64_t v2 = seed + kPrime2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - kPrime1;
+    const uint8_t* const limit = end - 32;
+    do {
+      v1 = Round(v1, Read64(p));
+      v2 = Round(v2, Read64(p + 8));
+      v3 = Round(v3, Read64(p + 16));
+      v4 = Round(v4, Read64(p + 24));
+      p += 32;
+    } while (p <= limit);
+    hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) +
+           RotateLeft(v4, 18);
+    hash = MergeRound(hash, v1);
+    hash = MergeRound(hash, v2);
+    hash = MergeRound(hash, v3);
+    hash = MergeRound(hash, v4);
+  } else {
+    hash = seed + kPrime5;
+  }
+  hash += size;
+  for (; p + 8 <= end; p += 8) {
+    hash ^= Round(0, Read64(p));
+    hash = RotateLeft(hash, 27) * kPrime1 + kPrime4;
+  }
+  if (p + 4 <= end) {
+    hash ^= static_cast<uint64_t>(Read32(p)) * kPrime1;
+    hash = RotateLeft(hash, 23) * kPrime2 + kPrime3;
+    p += 4;
+  }
+  for (; p < end; p++) {
+    hash ^= *p * kPrime5;
+    hash = RotateLeft(hash, 11) * kPrime1;
+  }
+  hash ^= hash >> 33;
+  hash *= kPrime2;
+  hash ^= hash >> 29;
+  hash *= kPrime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+uint64_t HashImage(const Image& image) { return HashPlanes(image, 0); }
+
+ImageHash128 HashImage128(const Image& image) {
+  ImageHash128 hash;
+  hash.low = HashPlanes(image, 0);
+  hash.high = HashPlanes(image, kHighSeed);
+  return hash;
+}
+
+}  // namespace graphics
@@ -0,0 +1,55 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "image.h"
+
+#ifndef GRAPHICS_IMAGE_HASH_H
+#define GRAPHICS_IMAGE_HASH_H
+
+namespace graphics {
+
+/**
+ * A 128-bit content hash, see HashImage128.
+ */
+struct ImageHash128 {
+  uint64_t high = 0;
+  uint64_t low = 0;
+
+  bool operator==(const ImageHash128& other) const {
+    return high == other.high && low == other.low;
+  }
+  bool operator!=(const ImageHash128& other) const { return !(*this == other); }
+
+  // Returns the hash as 32 lowercase hex digits, e.g. for use in filenames.
+  std::string ToString() const;
+};
+
+/**
+ * Returns the 64-bit xxHash64 of |size| bytes at |data|, starting from
+ * |seed|. The result does not depend on the platform or the run.
+ */
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+/**
+ * Returns a 64-bit hash of the dimensions and pixels of |image|. Images with
+ * the same size and pixels always have the same hash, across runs and
+ * platforms. An invalid image hashes as a 0 by 0 image.
+ */
+uint64_t HashImage(const Image& image);
+
+/**
+ * Like HashImage, but with 128 bits for stores with very many images where
+ * 64-bit collisions become a concern. About twice as slow as HashImage.
+ */
+ImageHash128 HashImage128(const Image& image);
+
+}  // namespace graphics
+
+#endif  // GRAPHICS_IMAGE_HASH_H
@@ -0,0 +1,771 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "image_io.h"
+#include "binary_io.h"
+#include "mapped_file.h"
+
+#include <jerror.h>
+#include <jpeglib.h>
+#include <png.h>
+#include <setjmp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace graphics {
+
+namespace image_io {
+
+namespace {
+
+// Rows are converted and written in chunks of about this many bytes.
+constexpr size_t kChunkBytes = 4 << 20;
+
+// Below this many bytes per thread, converting on one thread is faster.
+constexpr size_t kMinBytesPerThread = 1 << 20;
+
+// Codecs that work pixel by pixel report progress about this often.
+constexpr size_t kProgressPixels = 1 << 20;
+// Codecs that work row by row report progress about this often.
+constexpr int kProgressRows = 64;
+
+constexpr int kBmpFileHeaderSize = 14;
+constexpr int kBmpInfoHeaderSize = 40;
+constexpr int kBmpHeaderSize = kBmpFileHeaderSize + kBmpInfoHeaderSize;
+constexpr uint32_t kBmpRgb = 0;
+constexpr uint32_t kBmpBitFields = 3;
+// Pixels per meter, about 72 DPI.
+constexpr uint32_t kBmpResolution = 2835;
+
+void PutLE16(uint8_t* p, uint16_t value) {
+  p[0] = value & 0xFF;
+  p[1] = value >> 8;
+}
+
+uint16_t GetLE16(const uint8_t* p) { return p[0] | p[1] << 8; }
+
+// Writes |filename| through a temporary file next to it, which replaces it
+// only when Commit succeeds. A failed or cancelled write leaves any existing
+// file as it was, and errors such as a full disk come back as false.
+class AtomicWriter {
+ public:
+  explicit AtomicWriter(const std::string& filename)
+      : filename_(filename),
+        temporary_(filename + ".tmp"),
+        fd_(open(temporary_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) {}
+  AtomicWriter(const AtomicWriter&) = delete;
+  AtomicWriter& operator=(const AtomicWriter&) = delete;
+
+  ~AtomicWriter() {
+    if (fd_ < 0) return;
+    close(fd_);
+    unlink(temporary_.c_str());
+  }
+
+  bool IsOpen() const { return fd_ >= 0; }
+
+  bool Write(const uint8_t* data, size_t size) {
+    if (fd_ < 0) return false;
+    while (size > 0) {
+      const ssize_t written = write(fd_, data, size);
+      if (written < 0) {
+        if (errno == EINTR) continue;
+        return false;
+      }
+      data += written;
+      size -= written;
+    }
+    return true;
+  }
+
+  // Closes the temporary file and renames it over |filename|.
+  bool Commit() {
+    const bool closed = close(std::exchange(fd_, -1)) == 0;
+    if (!closed || rename(temporary_.c_str(), filename_.c_str()) != 0) {
+      unlink(temporary_.c_str());
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  const std::string filename_;
+  const std::string temporary_;
+  int fd_;
+};
+
+// Returns false if |progress| asks to cancel.
+bool Report(const Progress& progress, double fraction) {
+  return !progress || progress(fraction);
+}
+
+int PickThreads(int threads, size_t chunk_bytes, int rows) {
+  if (threads < 1) {
+    threads = std::max<size_t>(1, std::min<size_t>(
+                                      std::thread::hardware_concurrency(),
+                                      chunk_bytes / kMinBytesPerThread));
+  }
+  return std::max(1, std::min(threads, rows));
+}
+
+// Calls |convert| on consecutive bands of rows covering [0, |rows|), on up
+// to |threads| threads at once.
+void ForEachBand(int rows, int threads,
+                 const std::function<void(int, int)>& convert) {
+  if (threads <= 1) {
+    convert(0, rows);
+    return;
+  }
+  const int rows_per_band = (rows + threads - 1) / threads;
+  std::vector<std::thread> workers;
+  for (int start = 0; start < rows; start += rows_per_band) {
+    workers.emplace_back(convert, start, std::min(rows, start + rows_per_band));
+  }
+  for (std::thread& worker : workers) worker.join();
+}
+
+// Copies one row of interleaved RGB values into row |y| of |channels|.
+void SplitRgbRow(const uint8_t* in, int width, int y,
+                 uint8_t* const channels[3]) {
+  const size_t offset = static_cast<size_t>(y) * width;
+  uint8_t* red = channels[0] + offset;
+  uint8_t* green = channels[1] + offset;
+  uint8_t* blue = channels[2] + offset;
+  for (int x = 0; x < width; x++) {
+    red[x] = in[0];
+    green[x] = in[1];
+    blue[x] = in[2];
+    in += 3;
+  }
+}
+
+// libpng and libjpeg report errors by calling back into us; we jump back out
+// of the decoder instead of letting them print and exit.
+void PngError(png_structp png, png_const_charp) {
+  longjmp(png_jmpbuf(png), 1);
+}
+
+void PngWarning(png_structp, png_const_charp) {}
+
+struct JpegErrorManager {
+  jpeg_error_mgr manager;
+  jmp_buf jump;
+};
+
+void JpegError(j_common_ptr info) {
+  longjmp(reinterpret_cast<JpegErrorManager*>(info->err)->jump, 1);
+}
+
+// Treats running out of data as an error; libjpeg would otherwise only warn
+// and return the rest of the image as gray.
+void JpegMessage(j_common_ptr info, int level) {
+  if (level < 0 && info->err->msg_code == JWRN_JPEG_EOF) {
+    longjmp(reinterpret_cast<JpegErrorManager*>(info->err)->jump, 1);
+  }
+}
+
+// Everything ReadPng and ReadJpeg need after setjmp() lives here, declared
+// before the jump point, so that nothing is skipped over by a longjmp.
+struct DecodeState {
+  File file;
+  uint8_t* channels[3] = {nullptr, nullptr, nullptr};
+  std::vector<uint8_t> rows;
+  std::vector<uint8_t*> row_pointers;
+};
+
+constexpr int kQoiHeaderSize = 14;
+constexpr uint8_t kQoiEnd[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+constexpr uint8_t kQoiOpIndex = 0x00;
+constexpr uint8_t kQoiOpDiff = 0x40;
+constexpr uint8_t kQoiOpLuma = 0x80;
+constexpr uint8_t kQoiOpRun = 0xC0;
+constexpr uint8_t kQoiOpRgb = 0xFE;
+constexpr uint8_t kQoiOpRgba = 0xFF;
+constexpr uint8_t kQoiTagMask = 0xC0;
+constexpr int kQoiMaxRun = 62;
+// QOI files are limited to 400 million pixels by the reference decoder.
+constexpr uint64_t kQoiMaxPixels = 400000000;
+
+struct QoiPixel {
+  uint8_t red = 0;
+  uint8_t green = 0;
+  uint8_t blue = 0;
+  uint8_t alpha = 255;
+  bool operator==(const QoiPixel& other) const {
+    return red == other.red && green == other.green && blue == other.blue &&
+           alpha == other.alpha;
+  }
+};
+
+inline int QoiHash(const QoiPixel& pixel) {
+  return (pixel.red * 3 + pixel.green * 5 + pixel.blue * 7 +
+          pixel.alpha * 11) %
+         64;
+}
+
+void PutBE32(uint8_t* p, uint32_t value) {
+  for (int i = 0; i < 4; i++) p[i] = (value >> (24 - 8 * i)) & 0xFF;
+}
+
+uint32_t GetBE32(const uint8_t* p) {
+  return static_cast<uint32_t>(p[0]) << 24 |
+         static_cast<uint32_t>(p[1]) << 16 |
+         static_cast<uint32_t>(p[2]) << 8 | static_cast<uint32_t>(p[3]);
+}
+
+// The most bytes one pixel takes to encode: a run ending and an RGB chunk.
+constexpr size_t kQoiMaxPixelBytes = 5;
+
+// Encodes the planes as QOI into |buffer| of |capacity| bytes, at least
+// kQoiHeaderSize. Whenever it is nearly full, and at the end, the bytes
+// encoded since the last time are passed to |flush|, which returns false on
+// error, and encoding carries on from the start of |buffer|. With a capacity
+// of the worst case 14 + width * height * 4 + 8 bytes, |flush| is only
+// called once, at the end. Returns the encoded size, or 0 if cancelled or
+// |flush| failed.
+template <typename Flush>
+size_t EncodeQoiInto(int width, int height, const uint8_t* const channels[3],
+                     const Progress& progress, uint8_t* buffer,
+                     size_t capacity, const Flush& flush) {
+  size_t flushed = 0;
+  auto make_room = [&](uint8_t*& p, size_t bytes) {
+    if (static_cast<size_t>(buffer + capacity - p) >= bytes) return true;
+    if (!flush(buffer, p - buffer)) return false;
+    flushed += p - buffer;
+    p = buffer;
+    return true;
+  };
+  uint8_t* p = buffer;
+  memcpy(p, "qoif", 4);
+  PutBE32(p + 4, width);
+  PutBE32(p + 8, height);
+  p[12] = 3;  // RGB
+  p[13] = 0;  // sRGB with linear alpha
+  p += kQoiHeaderSize;
+
+  QoiPixel index[64] = {};
+  for (QoiPixel& entry : index) entry.alpha = 0;
+  QoiPixel previous;
+  int run = 0;
+  const size_t size = static_cast<size_t>(width) * height;
+  const uint8_t* red = channels[0];
+  const uint8_t* green = channels[1];
+  const uint8_t* blue = channels[2];
+  for (size_t i = 0; i < size; i++) {
+    if (i % kProgressPixels == 0 &&
+        !Report(progress, static_cast<double>(i) / size)) {
+      return 0;
+    }
+    if (!make_room(p, kQoiMaxPixelBytes)) return 0;
+    QoiPixel pixel;
+    pixel.red = red[i];
+    pixel.green = green[i];
+    pixel.blue = blue[i];
+    if (pixel == previous) {
+      if (++run == kQoiMaxRun) {
+        *p++ = kQoiOpRun | (run - 1);
+        run = 0;
+      }
+      continue;
+    }
+    if (run > 0) {
+      *p++ = kQoiOpRun | (run - 1);
+      run = 0;
+    }
+    const int hash = QoiHash(pixel);
+    if (index[hash] == pixel) {
+      *p++ = kQoiOpIndex | hash;
+    } else {
+      index[hash] = pixel;
+      const int8_t dr = static_cast<int8_t>(pixel.red - previous.red);
+      const int8_t dg = static_cast<int8_t>(pixel.green - previous.green);
+      const int8_t db = static_cast<int8_t>(pixel.blue - previous.blue);
+      const int8_t dr_dg = dr - dg;
+      const int8_t db_dg = db - dg;
+      if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+        *p++ = kQoiOpDiff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+      } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+                 db_dg >= -8 && db_dg <= 7) {
+        *p++ = kQoiOpLuma | (dg + 32);
+        *p++ = (dr_dg + 8) << 4 | (db_dg + 8);
+      } else {
+        *p++ = kQoiOpRgb;
+        *p++ = pixel.red;
+        *p++ = pixel.green;
+        *p++ = pixel.blue;
+      }
+    }
+    previous = pixel;
+  }
+  if (!make_room(p, (run > 0) + sizeof(kQoiEnd))) return 0;
+  if (run > 0) *p++ = kQoiOpRun | (run - 1);
+  memcpy(p, kQoiEnd, sizeof(kQoiEnd));
+  p += sizeof(kQoiEnd);
+  if (!flush(buffer, p - buffer)) return 0;
+  return flushed + (p - buffer);
+}
+
+// Decodes the QOI image in [|data|, |data| + |size|) into the planes provided
+// by |allocate|.
+bool DecodeQoiFrom(const uint8_t* data, size_t size,
+                   const PlaneAllocator& allocate, const Progress& progress) {
+  if (size < kQoiHeaderSize + sizeof(kQoiEnd) || memcmp(data, "qoif", 4) != 0) {
+    return false;
+  }
+  const uint32_t width = GetBE32(data + 4);
+  const uint32_t height = GetBE32(data + 8);
+  const int file_channels = data[12];
+  if (width == 0 || height == 0 || width > INT32_MAX || height > INT32_MAX ||
+      static_cast<uint64_t>(width) * height > kQoiMaxPixels ||
+      (file_channels != 3 && file_channels != 4)) {
+    return false;
+  }
+  uint8_t* channels[3] = {nullptr, nullptr, nullptr};
+  if (!allocate(width, height, channels)) return false;
+  uint8_t* red = channels[0];
+  uint8_t* green = channels[1];
+  uint8_t* blue = channels[2];
+
+  QoiPixel index[64] = {};
+  for (QoiPixel& entry : index) entry.alpha = 0;
+  QoiPixel pixel;
+  const uint8_t* p = data + kQoiHeaderSize;
+  // Chunks never start inside the end marker.
+  const uint8_t* const end = data + size - sizeof(kQoiEnd);
+  const size_t pixels = static_cast<size_t>(width) * height;
+  size_t next_report = 0;
+  for (size_t i = 0; i < pixels;) {
+    if (i >= next_report) {
+      if (!Report(progress, static_cast<double>(i) / pixels)) return false;
+      next_report += kProgressPixels;
+    }
+    // The longest chunk is 5 bytes, and the end marker is 8, so reading one
+    // chunk never runs past the end of the data.
+    if (p >= end) return false;
+    const uint8_t op = *p++;
+    int run = 1;
+    if (op == kQoiOpRgb) {
+      pixel.red = p[0];
+      pixel.green = p[1];
+      pixel.blue = p[2];
+      p += 3;
+    } else if (op == kQoiOpRgba) {
+      pixel.red = p[0];
+      pixel.green = p[1];
+      pixel.blue = p[2];
+      pixel.alpha = p[3];
+      p += 4;
+    } else {
+      switch (op & kQoiTagMask) {
+        case kQoiOpIndex:
+          pixel = index[op];
+          break;
+        case kQoiOpDiff:
+          pixel.red += ((op >> 4) & 3) - 2;
+          pixel.green += ((op >> 2) & 3) - 2;
+          pixel.blue += (op & 3) - 2;
+          break;
+        case kQoiOpLuma: {
+          const int dg = (op & 0x3F) - 32;
+          pixel.red += dg - 8 + ((*p >> 4) & 0x0F);
+          pixel.green += dg;
+          pixel.blue += dg - 8 + (*p & 0x0F);
+          p++;
+          break;
+        }
+        default:
+          run = (op & 0x3F) + 1;
+          break;
+      }
+    }
+    index[QoiHash(pixel)] = pixel;
+    const size_t last = std::min(pixels, i + run);
+    for (; i < last; i++) {
+      red[i] = pixel.red;
+      green[i] = pixel.green;
+      blue[i] = pixel.blue;
+    }
+  }
+  return true;
+}
+
+// Decodes like ReadJpeg. If |fit_size| is positive, libjpeg scales the image
+// down in its DCT by the largest factor of 1/2, 1/4 or 1/8 that leaves the
+// longer side at least |fit_size|, which skips most of the decoding work.
+bool DecodeJpeg(const std::string& filename, const PlaneAllocator& allocate,
+                const Progress& progress, int fit_size) {
+  DecodeState state;
+  state.file.reset(fopen(filename.c_str(), "rb"));
+  if (!state.file) return false;
+  jpeg_decompress_struct info;
+  JpegErrorManager error;
+  info.err = jpeg_std_error(&error.manager);
+  error.manager.error_exit = JpegError;
+  error.manager.emit_message = JpegMessage;
+  if (setjmp(error.jump)) {
+    jpeg_destroy_decompress(&info);
+    return false;
+  }
+  jpeg_create_decompress(&info);
+  jpeg_stdio_src(&info, state.file.get());
+  jpeg_read_header(&info, TRUE);
+  info.out_color_space = JCS_RGB;
+  if (fit_size > 0) {
+    const unsigned int longer = std::max(info.image_width, info.image_height);
+    info.scale_num = 1;
+    info.scale_denom = 8;
+    while (info.scale_denom > 1 &&
+           longer / info.scale_denom < static_cast<unsigned int>(fit_size)) {
+      info.scale_denom /= 2;
+    }
+  }
+  jpeg_start_decompress(&info);
+  const int width = info.output_width;
+  const int height = info.output_height;
+  if (info.output_components != 3 ||
+      !allocate(width, height, state.channels)) {
+    jpeg_destroy_decompress(&info);
+    return false;
+  }
+
+  // libjpeg decodes up to rec_outbuf_height rows per call.
+  const int batch = std::max(1, info.rec_outbuf_height);
+  state.rows.resize(static_cast<size_t>(width) * 3 * batch);
+  state.row_pointers.resize(batch);
+  for (int i = 0; i < batch; i++) {
+    state.row_pointers[i] = state.rows.data() + static_cast<size_t>(i) *
+                                                    width * 3;
+  }
+  while (info.output_scanline < info.output_height) {
+    const int first = info.output_scanline;
+    if (first % kProgressRows < batch &&
+        !Report(progress, static_cast<double>(first) / height)) {
+      jpeg_destroy_decompress(&info);
+      return false;
+    }
+    const int rows =
+        jpeg_read_scanlines(&info, state.row_pointers.data(), batch);
+    for (int i = 0; i < rows; i++) {
+      SplitRgbRow(state.row_pointers[i], width, first + i, state.channels);
+    }
+  }
+  jpeg_finish_decompress(&info);
+  jpeg_destroy_decompress(&info);
+  return true;
+}
+
+}  // namespace
+
+bool WriteBmp(const std::string& filename, int width, int height,
+              const uint8_t* const channels[3], int threads,
+              const Progress& progress) {
+  if (width < 1 || height < 1) return false;
+  // Rows are padded to a multiple of 4 bytes.
+  const size_t stride = (static_cast<size_t>(width) * 3 + 3) & ~size_t{3};
+  const uint64_t data_size = static_cast<uint64_t>(stride) * height;
+  if (data_size + kBmpHeaderSize > UINT32_MAX) return false;
+
+  uint8_t header[kBmpHeaderSize] = {'B', 'M'};
+  PutLE32(header + 2, static_cast<uint32_t>(data_size + kBmpHeaderSize));
+  PutLE32(header + 10, kBmpHeaderSize);
+  PutLE32(header + 14, kBmpInfoHeaderSize);
+  PutLE32(header + 18, width);
+  // A positive height means rows are stored bottom to top.
+  PutLE32(header + 22, height);
+  PutLE16(header + 26, 1);
+  PutLE16(header + 28, 24);
+  PutLE32(header + 30, kBmpRgb);
+  PutLE32(header + 34, static_cast<uint32_t>(data_size));
+  PutLE32(header + 38, kBmpResolution);
+  PutLE32(header + 42, kBmpResolution);
+
+  AtomicWriter file(filename);
+  if (!file.Write(header, sizeof(header))) return false;
+
+  const int rows_per_chunk =
+      static_cast<int>(std::max<size_t>(1, kChunkBytes / stride));
+  // Zero-initialized, so row padding stays zero.
+  std::vector<uint8_t> chunk(stride * std::min(rows_per_chunk, height));
+  const int chunk_threads =
+      PickThreads(threads, chunk.size(), std::min(rows_per_chunk, height));
+  for (int first = 0; first < height; first += rows_per_chunk) {
+    const int rows = std::min(rows_per_chunk, height - first);
+    ForEachBand(rows, chunk_threads, [&](int start, int end) {
+      for (int i = start; i < end; i++) {
+        const size_t offset =
+            static_cast<size_t>(height - 1 - first - i) * width;
+        const uint8_t* red = channels[0] + offset;
+        const uint8_t* green = channels[1] + offset;
+        const uint8_t* blue = channels[2] + offset;
+        uint8_t* out = chunk.data() + i * stride;
+        for (int x = 0; x < width; x++) {
+          out[0] = blue[x];
+          out[1] = green[x];
+          out[2] = red[x];
+          out += 3;
+        }
+      }
+    });
+    if (!file.Write(chunk.data(), stride * rows) ||
+        !Report(progress, static_cast<double>(first + rows) / height)) {
+      return false;
+    }
+  }
+  return file.Commit();
+}
+
+bool ReadBmp(const std::string& filename, const PlaneAllocator& allocate,
+             const Progress& progress) {
+  File file(fopen(filename.c_str(), "rb"));
+  if (!file) return false;
+  uint8_t header[kBmpHeaderSize + 12];
+  const size_t header_read = fread(header, 1, sizeof(header), file.get());
+  if (header_read < kBmpHeaderSize || header[0] != 'B' || header[1] != 'M') {
+    return false;
+  }
+  const uint32_t data_offset = GetLE32(header + 10);
+  const uint32_t info_size = GetLE32(header + 14);
+  const int32_t width = static_cast<int32_t>(GetLE32(header + 18));
+  const int32_t signed_height = static_cast<int32_t>(GetLE32(header + 22));
+  const int bits_per_pixel = GetLE16(header + 28);
+  const uint32_t compression = GetLE32(header + 30);
+  if (info_size < kBmpInfoHeaderSize || width < 1 || signed_height == 0 ||
+      signed_height == INT32_MIN) {
+    return false;
+  }
+  if (bits_per_pixel != 24 && bits_per_pixel != 32) return false;
+  if (compression == kBmpBitFields) {
+    // Only the usual 32-bit BGRX layout.
+    if (bits_per_pixel != 32 || header_read < sizeof(header) ||
+        GetLE32(header + 54) != 0x00FF0000 ||
+        GetLE32(header + 58) != 0x0000FF00 ||
+        GetLE32(header + 62) != 0x000000FF) {
+      return false;
+    }
+  } else if (compression != kBmpRgb) {
+    return false;
+  }
+  const bool top_down = signed_height < 0;
+  const int height = top_down ? -signed_height : signed_height;
+  const int bytes_per_pixel = bits_per_pixel / 8;
+  const size_t stride =
+      (static_cast<size_t>(width) * bytes_per_pixel + 3) & ~size_t{3};
+  // Check that the pixels the header promises are there before allocating
+  // for them, so a short or corrupt file cannot ask for gigabytes.
+  struct stat info;
+  if (fstat(fileno(file.get()), &info) != 0) return false;
+  const size_t file_size = info.st_size;
+  if (data_offset > file_size ||
+      (file_size - data_offset) / stride < static_cast<size_t>(height)) {
+    return false;
+  }
+
+  uint8_t* channels[3] = {nullptr, nullptr, nullptr};
+  if (!allocate(width, height, channels)) return false;
+  if (fseek(file.get(), data_offset, SEEK_SET) != 0) return false;
+
+  const int rows_per_chunk =
+      static_cast<int>(std::max<size_t>(1, kChunkBytes / stride));
+  std::vector<uint8_t> chunk(stride * std::min(rows_per_chunk, height));
+  const int chunk_threads =
+      PickThreads(0, chunk.size(), std::min(rows_per_chunk, height));
+  for (int first = 0; first < height; first += rows_per_chunk) {
+    const int rows = std::min(rows_per_chunk, height - first);
+    if (fread(chunk.data(), stride, rows, file.get()) !=
+        static_cast<size_t>(rows)) {
+      return false;
+    }
+    ForEachBand(rows, chunk_threads, [&](int start, int end) {
+      for (int i = start; i < end; i++) {
+        const int y = top_down ? first + i : height - 1 - first - i;
+        const size_t offset = static_cast<size_t>(y) * width;
+        uint8_t* red = channels[0] + offset;
+        uint8_t* green = channels[1] + offset;
+        uint8_t* blue = channels[2] + offset;
+        const uint8_t* in = chunk.data() + i * stride;
+        for (int x = 0; x < width; x++) {
+          blue[x] = in[0];
+          green[x] = in[1];
+          red[x] = in[2];
+          in += bytes_per_pixel;
+        }
+      }
+    });
+    if (!Report(progress, static_cast<double>(first + rows) / height)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ReadPng(const std::string& filename, const PlaneAllocator& allocate,
+             const Progress& progress) {
+  DecodeState state;
+  state.file.reset(fopen(filename.c_str(), "rb"));
+  if (!state.file) return false;
+  png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr,
+                                           PngError, PngWarning);
+  if (!png) return false;
+  png_infop info = png_create_info_struct(png);
+  if (!info || setjmp(png_jmpbuf(png))) {
+    png_destroy_read_struct(&png, &info, nullptr);
+    return false;
+  }
+  png_init_io(png, state.file.get());
+  png_read_info(png, info);
+
+  // Have libpng expand everything to 8-bit RGB.
+  png_set_expand(png);
+  png_set_strip_16(png);
+  png_set_strip_alpha(png);
+  png_set_gray_to_rgb(png);
+  const int passes = png_set_interlace_handling(png);
+  png_read_update_info(png, info);
+  const int width = png_get_image_width(png, info);
+  const int height = png_get_image_height(png, info);
+  if (png_get_rowbytes(png, info) != static_cast<size_t>(width) * 3 ||
+      !allocate(width, height, state.channels)) {
+    png_destroy_read_struct(&png, &info, nullptr);
+    return false;
+  }
+
+  if (passes == 1) {
+    // Decode one row at a time, straight into the planes.
+    state.rows.resize(static_cast<size_t>(width) * 3);
+    for (int y = 0; y < height; y++) {
+      if (y % kProgressRows == 0 &&
+          !Report(progress, static_cast<double>(y) / height)) {
+        png_destroy_read_struct(&png, &info, nullptr);
+        return false;
+      }
+      png_read_row(png, state.rows.data(), nullptr);
+      SplitRgbRow(state.rows.data(), width, y, state.channels);
+    }
+  } else {
+    // Interlaced images need the whole image in memory to combine passes.
+    state.rows.resize(static_cast<size_t>(width) * 3 * height);
+    state.row_pointers.resize(height);
+    for (int y = 0; y < height; y++) {
+      state.row_pointers[y] = state.rows.data() + static_cast<size_t>(y) *
+                                                      width * 3;
+    }
+    png_read_image(png, state.row_pointers.data());
+    for (int y = 0; y < height; y++) {
+      SplitRgbRow(state.row_pointers[y], width, y, state.channels);
+    }
+  }
+  png_read_end(png, nullptr);
+  png_destroy_read_struct(&png, &info, nullptr);
+  return true;
+}
+
+bool ReadJpeg(const std::string& filename, const PlaneAllocator& allocate,
+              const Progress& progress) {
+  return DecodeJpeg(filename, allocate, progress, 0);
+}
+
+bool WriteQoi(const std::string& filename, int width, int height,
+              const uint8_t* const channels[3], const Progress& progress) {
+  if (width < 1 || height < 1 ||
+      static_cast<uint64_t>(width) * height > kQoiMaxPixels) {
+    return false;
+  }
+  const size_t max_size = kQoiHeaderSize +
+                          static_cast<size_t>(width) * height * 4 +
+                          sizeof(kQoiEnd);
+  AtomicWriter file(filename);
+  if (!file.IsOpen()) return false;
+  std::vector<uint8_t> buffer(std::min(max_size, kChunkBytes));
+  const size_t size = EncodeQoiInto(
+      width, height, channels, progress, buffer.data(), buffer.size(),
+      [&file](const uint8_t* data, size_t size) {
+        return file.Write(data, size);
+      });
+  return size > 0 && file.Commit();
+}
+
+bool EncodeQoi(int width, int height, const uint8_t* const channels[3],
+               std::vector<uint8_t>* out) {
+  if (width < 1 || height < 1 ||
+      static_cast<uint64_t>(width) * height > kQoiMaxPixels) {
+    return false;
+  }
+  // resize() keeps the capacity, so reusing |out| avoids reallocating.
+  out->resize(kQoiHeaderSize + static_cast<size_t>(width) * height * 4 +
+              sizeof(kQoiEnd));
+  out->resize(EncodeQoiInto(width, height, channels, nullptr, out->data(),
+                            out->size(),
+                            [](const uint8_t*, size_t) { return true; }));
+  return true;
+}
+
+bool DecodeQoi(const uint8_t* data, size_t size,
+               const PlaneAllocator& allocate) {
+  return DecodeQoiFrom(data, size, allocate, nullptr);
+}
+
+bool ReadQoi(const std::string& filename, const PlaneAllocator& allocate,
+             const Progress& progress) {
+  MappedFile file;
+  if (!file.OpenForReading(filename)) return false;
+  madvise(file.data(), file.size(), MADV_SEQUENTIAL);
+  return DecodeQoiFrom(file.data(), file.size(), allocate, progress);
+}
+
+bool Read(const std::string& filename, const PlaneAllocator& allocate,
+          const Progress& progress) {
+  uint8_t signature[8] = {};
+  {
+    File file(fopen(filename.c_str(), "rb"));
+    if (!file || fread(signature, 1, sizeof(signature), file.get()) < 4) {
+      return false;
+    }
+  }
+  if (signature[0] == 'B' && signature[1] == 'M') {
+    return ReadBmp(filename, allocate, progress);
+  }
+  static const uint8_t kPngSignature[8] = {0x89, 'P',  'N',  'G',
+                                           '\r', '\n', 0x1A, '\n'};
+  if (memcmp(signature, kPngSignature, sizeof(kPngSignature)) == 0) {
+    return ReadPng(filename, allocate, progress);
+  }
+  if (signature[0] == 0xFF && signature[1] == 0xD8 && signature[2] == 0xFF) {
+    return ReadJpeg(filename, allocate, progress);
+  }
+  if (memcmp(signature, "qoif", 4) == 0) {
+    return ReadQoi(filename, allocate, progress);
+  }
+  return false;
+}
+
+bool ReadPreview(const std::string& filename, int fit_size,
+                 const PlaneAllocator& allocate) {
+  uint8_t signature[3] = {};
+  {
+    File file(fopen(filename.c_str(), "rb"));
+    if (!file || fread(signature, 1, sizeof(signature), file.get()) < 3) {
+      return false;
+    }
+  }
+  if (signature[0] == 0xFF && signature[1] == 0xD8 && signature[2] == 0xFF) {
+    return DecodeJpeg(filename, allocate, nullptr, fit_size);
+  }
+  return Read(filename, allocate);
+}
+
+}  // namespace image_io
+
+}  // namespace graphics
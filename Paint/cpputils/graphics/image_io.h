@@ -0,0 +1,126 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifndef GRAPHICS_IMAGE_IO_H
+#define GRAPHICS_IMAGE_IO_H
+
+namespace graphics {
+
+// Native image file codecs used by graphics::Image. They work directly on
+// planar RGB buffers like the one Image stores its pixels in: three planes of
+// width * height values each, row by row, for red, green and blue.
+namespace image_io {
+
+/**
+ * Called by decoders once the image dimensions are known. Should point
+ * |channels| at three writable planes of |width| * |height| values each and
+ * return true, or return false to abort decoding.
+ */
+using PlaneAllocator =
+    std::function<bool(int width, int height, uint8_t* channels[3])>;
+
+/**
+ * Optionally passed to the codecs below, and called now and then with the
+ * |fraction| of the image encoded or decoded so far. Returning false cancels
+ * the operation, which then returns false.
+ */
+using Progress = std::function<bool(double fraction)>;
+
+/**
+ * Writes the |width| by |height| image in |channels| to |filename| as a
+ * 24-bit uncompressed BMP. Rows are converted in large chunks, split across
+ * |threads| threads (0 picks automatically), and written with one call per
+ * chunk to a temporary file that replaces |filename| once complete. Returns
+ * false, leaving an existing file as it was, if it could not be written.
+ */
+bool WriteBmp(const std::string& filename, int width, int height,
+              const uint8_t* const channels[3], int threads = 0,
+              const Progress& progress = nullptr);
+
+/**
+ * Reads the uncompressed 24 or 32-bit BMP in |filename| into the planes
+ * provided by |allocate|. Returns false if the file could not be read or uses
+ * a BMP variant this decoder does not handle, such as palettes or RLE.
+ */
+bool ReadBmp(const std::string& filename, const PlaneAllocator& allocate,
+             const Progress& progress = nullptr);
+
+/**
+ * Decodes the PNG in |filename| with libpng into the planes provided by
+ * |allocate|. Palette, grayscale and 16-bit images are converted to 8-bit
+ * RGB, and any alpha channel is dropped. Returns false on any error.
+ */
+bool ReadPng(const std::string& filename, const PlaneAllocator& allocate,
+             const Progress& progress = nullptr);
+
+/**
+ * Decodes the JPEG in |filename| with libjpeg into the planes provided by
+ * |allocate|. Returns false on any error.
+ */
+bool ReadJpeg(const std::string& filename, const PlaneAllocator& allocate,
+              const Progress& progress = nullptr);
+
+/**
+ * Writes the |width| by |height| image in |channels| to |filename| in the
+ * QOI format (https://qoiformat.org): a lossless run, index and difference
+ * encoding that is far smaller than BMP and far faster than PNG. The file is
+ * written through a temporary file that replaces it only once complete, so
+ * a failed or cancelled save leaves an existing file as it was. Returns
+ * false on any error.
+ */
+bool WriteQoi(const std::string& filename, int width, int height,
+              const uint8_t* const channels[3],
+              const Progress& progress = nullptr);
+
+/**
+ * Encodes the |width| by |height| image in |channels| as QOI into |out|,
+ * replacing its contents. Returns false if the size is out of range.
+ */
+bool EncodeQoi(int width, int height, const uint8_t* const channels[3],
+               std::vector<uint8_t>* out);
+
+/**
+ * Decodes the QOI image in the |size| bytes at |data| into the planes
+ * provided by |allocate|. Returns false on any error.
+ */
+bool DecodeQoi(const uint8_t* data, size_t size,
+               const PlaneAllocator& allocate);
+
+/**
+ * Decodes the QOI file |filename| through a memory mapping into the planes
+ * provided by |allocate|. Any alpha channel is dropped. Returns false on any
+ * error.
+ */
+bool ReadQoi(const std::string& filename, const PlaneAllocator& allocate,
+             const Progress& progress = nullptr);
+
+/**
+ * Picks a decoder above from the first bytes of |filename| and decodes it
+ * into the planes provided by |allocate|. Returns false if the format is not
+ * recognized or decoding failed.
+ */
+bool Read(const std::string& filename, const PlaneAllocator& allocate,
+          const Progress& progress = nullptr);
+
+/**
+ * Like Read, for images that will only be shown scaled down to fit in
+ * |fit_size| by |fit_size| pixels. JPEGs are decoded at 1/2, 1/4 or 1/8
+ * scale when their longer side still covers |fit_size|, which is several
+ * times faster. Other formats are decoded at full size.
+ */
+bool ReadPreview(const std::string& filename, int fit_size,
+                 const PlaneAllocator& allocate);
+
+}  // namespace image_io
+
+}  // namespace graphics
+
+#endif  // GRAPHICS_IMAGE_IO_H
@@ -0,0 +1,232 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "indexed_image.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+#include "cimg/CImg.h"
+#include "image_io.h"
+
+namespace graphics {
+
+IndexedImage::IndexedImage() = default;
+
+IndexedImage::~IndexedImage() = default;
+
+bool IndexedImage::Initialize(int width, int height,
+                              const Color& background) {
+  if (width < 1 || height < 1) return false;
+  PixelBuffer pixels(static_cast<size_t>(width) * height);
+  if (!pixels) return false;
+  memset(pixels.data(), 0, pixels.size());
+  cimage_ = std::make_unique<CImg<uint8_t>>(pixels.data(), width, height, 1,
+                                            1, /*is_shared=*/true);
+  pixels_ = std::move(pixels);
+  width_ = width;
+  height_ = height;
+  palette_.assign(1, background);
+  return true;
+}
+
+bool IndexedImage::FromImage(const Image& image) {
+  const int width = image.GetWidth();
+  const int height = image.GetHeight();
+  const uint8_t* channels[3];
+  for (int c = 0; c < 3; c++) {
+    channels[c] = image.GetChannelData(c);
+    if (!channels[c]) return false;
+  }
+  PixelBuffer pixels(static_cast<size_t>(width) * height);
+  if (!pixels) return false;
+  std::vector<Color> palette;
+  std::unordered_map<uint32_t, uint8_t> indices;
+  // Drawings come in runs of one color, so check the last one first.
+  uint32_t last_rgb = 0;
+  uint8_t last_index = 0;
+  for (size_t i = 0; i < pixels.size(); i++) {
+    const uint32_t rgb = channels[0][i] << 16 | channels[1][i] << 8 |
+                         channels[2][i];
+    if (palette.empty() || rgb != last_rgb) {
+      auto found = indices.find(rgb);
+      if (found == indices.end()) {
+        if (palette.size() == kMaxColors) return false;
+        found = indices.emplace(rgb, palette.size()).first;
+        palette.emplace_back(channels[0][i], channels[1][i], channels[2][i]);
+      }
+      last_rgb = rgb;
+      last_index = found->second;
+    }
+    pixels.data()[i] = last_index;
+  }
+  cimage_ = std::make_unique<CImg<uint8_t>>(pixels.data(), width, height, 1,
+                                            1, /*is_shared=*/true);
+  pixels_ = std::move(pixels);
+  width_ = width;
+  height_ = height;
+  palette_ = std::move(palette);
+  return true;
+}
+
+bool IndexedImage::ToImage(Image& image) const {
+  if (!pixels_) return false;
+  const size_t plane_size = pixels_.size();
+  PixelBuffer planes(plane_size * 3);
+  if (!planes) return false;
+  uint8_t* const channels[3] = {planes.data(), planes.data() + plane_size,
+                                planes.data() + 2 * plane_size};
+  Expand(channels);
+  return image.Initialize(width_, height_, channels);
+}
+
+bool IndexedImage::SaveImageBmp(const std::string& filename) const {
+  if (!pixels_) return false;
+  const size_t plane_size = pixels_.size();
+  PixelBuffer planes(plane_size * 3);
+  if (!planes) return false;
+  uint8_t* const channels[3] = {planes.data(), planes.data() + plane_size,
+                                planes.data() + 2 * plane_size};
+  Expand(channels);
+  return image_io::WriteBmp(filename, width_, height_, channels);
+}
+
+int IndexedImage::AddColor(const Color& color) {
+  auto found = std::find(palette_.begin(), palette_.end(), color);
+  if (found != palette_.end()) return found - palette_.begin();
+  if (palette_.size() == kMaxColors) return -1;
+  palette_.push_back(color);
+  return palette_.size() - 1;
+}
+
+bool IndexedImage::SetPaletteColor(int index, const Color& color) {
+  if (index < 0 || index >= static_cast<int>(palette_.size())) return false;
+  palette_[index] = color;
+  return true;
+}
+
+int IndexedImage::GetIndex(int x, int y) const {
+  if (!CheckPixelInBounds(x, y)) return -1;
+  return pixels_.data()[static_cast<size_t>(y) * width_ + x];
+}
+
+Color IndexedImage::GetColor(int x, int y) const {
+  const int index = GetIndex(x, y);
+  return index < 0 ? Color(0, 0, 0) : palette_[index];
+}
+
+bool IndexedImage::SetColor(int x, int y, const Color& color) {
+  if (!CheckPixelInBounds(x, y)) return false;
+  const int index = AddColor(color);
+  if (index < 0) return false;
+  pixels_.data()[static_cast<size_t>(y) * width_ + x] = index;
+  return true;
+}
+
+bool IndexedImage::DrawLine(int x0, int y0, int x1, int y1,
+                            const Color& color, int thickness) {
+  if (thickness < 1 || !CheckPixelInBounds(x0, y0) ||
+      !CheckPixelInBounds(x1, y1)) {
+    return false;
+  }
+  const int index = AddColor(color);
+  if (index < 0) return false;
+  if (x0 == x1 && y0 == y1) return true;
+  const uint8_t value[] = {static_cast<uint8_t>(index)};
+  if (thickness == 1) {
+    cimage_->draw_line(x0, y0, x1, y1, value);
+    return true;
+  }
+  // The same quadrilateral as Image::DrawLine.
+  int xs[4];
+  int ys[4];
+  PolygonFiller::GetThickLineCorners(x0, y0, x1, y1, thickness, xs, ys);
+  polygon_filler_.Fill(xs, ys, 4, width_, height_,
+                       [&](int y, int from, int to) {
+                         memset(cimage_->data(from, y), index, to - from + 1);
+                       });
+  return true;
+}
+
+bool IndexedImage::DrawCircle(int x, int y, int radius, const Color& color) {
+  if (!CheckPixelInBounds(x, y)) return false;
+  const int index = AddColor(color);
+  if (index < 0) return false;
+  const uint8_t value[] = {static_cast<uint8_t>(index)};
+  cimage_->draw_circle(x, y, radius, value);
+  return true;
+}
+
+bool IndexedImage::DrawRectangle(int x, int y, int width, int height,
+                                 const Color& color) {
+  if (!CheckPixelInBounds(x, y) || width < 0 || height < 0) return false;
+  const int index = AddColor(color);
+  if (index < 0) return false;
+  const uint8_t value[] = {static_cast<uint8_t>(index)};
+  cimage_->draw_rectangle(x, y, x + width - 1, y + height - 1, value);
+  return true;
+}
+
+bool IndexedImage::Fill(int x, int y, const Color& color) {
+  if (!CheckPixelInBounds(x, y)) return false;
+  const int index = AddColor(color);
+  if (index < 0) return false;
+  uint8_t* const pixels = pixels_.data();
+  const uint8_t start = pixels[static_cast<size_t>(y) * width_ + x];
+  if (start == index) return true;
+  fill_seeds_.clear();
+  fill_seeds_.push_back(y * width_ + x);
+  while (!fill_seeds_.empty()) {
+    const int seed = fill_seeds_.back();
+    fill_seeds_.pop_back();
+    const int row = seed / width_;
+    uint8_t* const line = pixels + static_cast<size_t>(row) * width_;
+    int left = seed % width_;
+    if (line[left] != start) continue;
+    int right = left;
+    while (left > 0 && line[left - 1] == start) left--;
+    while (right < width_ - 1 && line[right + 1] == start) right++;
+    memset(line + left, index, right - left + 1);
+    // Seed each run of |start| next to the span, above and below.
+    for (int next_row : {row - 1, row + 1}) {
+      if (next_row < 0 || next_row >= height_) continue;
+      const uint8_t* next = pixels + static_cast<size_t>(next_row) * width_;
+      for (int i = left; i <= right; i++) {
+        if (next[i] == start && (i == left || next[i - 1] != start)) {
+          fill_seeds_.push_back(next_row * width_ + i);
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool IndexedImage::CheckPixelInBounds(int x, int y) const {
+  if (x < 0 || y < 0 || x >= width_ || y >= height_) {
+    std::cout << "(" << x << ", " << y << ") is out of bounds." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void IndexedImage::Expand(uint8_t* const channels[3]) const {
+  uint8_t lookup[3][kMaxColors];
+  for (size_t i = 0; i < palette_.size(); i++) {
+    lookup[0][i] = palette_[i].Red();
+    lookup[1][i] = palette_[i].Green();
+    lookup[2][i] = palette_[i].Blue();
+  }
+  const uint8_t* const pixels = pixels_.data();
+  for (int c = 0; c < 3; c++) {
+    for (size_t i = 0; i < pixels_.size(); i++) {
+      channels[c][i] = lookup[c][pixels[i]];
+    }
+  }
+}
+
+}  // namespace graphics
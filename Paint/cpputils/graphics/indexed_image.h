@@ -0,0 +1,145 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "image.h"
+#include "pixel_pool.h"
+#include "polygon_filler.h"
+
+#ifndef GRAPHICS_INDEXED_IMAGE_H
+#define GRAPHICS_INDEXED_IMAGE_H
+
+namespace graphics {
+
+/**
+ * An image whose pixels are indices into a palette of at most kMaxColors
+ * colors, one byte each, for drawings made of a few flat colors such as
+ * diagrams and pixel art. It takes a third of the memory of an Image, and
+ * strokes and fills write or compare one byte per pixel instead of three.
+ *
+ * Drawing in a color that is not in the palette adds it, which fails once
+ * the palette is full. Lines, circles and rectangles cover the same pixels
+ * as the same calls on an Image. Pixels only become RGB when the image is
+ * shown or saved, see ToImage and SaveImageBmp.
+ */
+class IndexedImage {
+ public:
+  static constexpr int kMaxColors = 256;
+
+  IndexedImage();
+  IndexedImage(const IndexedImage&) = delete;
+  IndexedImage& operator=(const IndexedImage&) = delete;
+  ~IndexedImage();
+
+  /**
+   * Resets the image to |width| by |height| pixels of |background|, which
+   * becomes the only palette entry. Returns false if the size is less
+   * than 1.
+   */
+  bool Initialize(int width, int height,
+                  const Color& background = Color(255, 255, 255));
+
+  /**
+   * Resets the image to the pixels of |image|. Returns false, leaving this
+   * image unchanged, if |image| is empty or has more than kMaxColors colors.
+   */
+  bool FromImage(const Image& image);
+
+  /**
+   * Resets |image| to the RGB pixels of this image. Returns false if this
+   * image is empty.
+   */
+  bool ToImage(Image& image) const;
+
+  /**
+   * Saves the image as a 24-bit BMP. Returns false if the image is empty or
+   * the file could not be written.
+   */
+  bool SaveImageBmp(const std::string& filename) const;
+
+  int GetWidth() const { return width_; }
+  int GetHeight() const { return height_; }
+
+  /**
+   * Returns the bytes taken by the pixels.
+   */
+  size_t GetMemoryUsage() const { return pixels_.size(); }
+
+  const std::vector<Color>& GetPalette() const { return palette_; }
+
+  /**
+   * Returns the index of |color| in the palette, adding it if needed.
+   * Returns -1 if it is not there and the palette is full.
+   */
+  int AddColor(const Color& color);
+
+  /**
+   * Changes palette entry |index| to |color|, recoloring every pixel that
+   * uses it at once. Returns false if |index| is not in the palette.
+   */
+  bool SetPaletteColor(int index, const Color& color);
+
+  /**
+   * Returns the palette index of the pixel at (|x|, |y|), or -1 if it is
+   * out of bounds.
+   */
+  int GetIndex(int x, int y) const;
+
+  /**
+   * Returns the color of the pixel at (|x|, |y|), or black if it is out of
+   * bounds.
+   */
+  Color GetColor(int x, int y) const;
+
+  /**
+   * Sets the pixel at (|x|, |y|) to |color|. Returns false if (|x|, |y|) is
+   * out of bounds or the palette is full.
+   */
+  bool SetColor(int x, int y, const Color& color);
+
+  /**
+   * Draw like the Image functions of the same name. Return false if the
+   * parameters are out of bounds or the palette is full.
+   */
+  bool DrawLine(int x0, int y0, int x1, int y1, const Color& color,
+                int thickness = 1);
+  bool DrawCircle(int x, int y, int radius, const Color& color);
+  bool DrawRectangle(int x, int y, int width, int height,
+                     const Color& color);
+
+  /**
+   * Flood fills the area of pixels with the same index as (|x|, |y|) and
+   * connected to it horizontally or vertically with |color|, one span of a
+   * row at a time. Returns false if (|x|, |y|) is out of bounds or the
+   * palette is full.
+   */
+  bool Fill(int x, int y, const Color& color);
+
+ private:
+  bool CheckPixelInBounds(int x, int y) const;
+
+  // Writes the red, green and blue planes of the image into |channels|.
+  void Expand(uint8_t* const channels[3]) const;
+
+  int width_ = 0;
+  int height_ = 0;
+  std::vector<Color> palette_;
+  // One index per pixel, row by row, which cimage_ shares to draw with.
+  PixelBuffer pixels_;
+  std::unique_ptr<CImg<uint8_t>> cimage_;
+  // Seeds of spans still to fill, kept between fills.
+  std::vector<int> fill_seeds_;
+  // Scratch space for thick lines.
+  PolygonFiller polygon_filler_;
+};
+
+}  // namespace graphics
+
+#endif  // GRAPHICS_INDEXED_IMAGE_H
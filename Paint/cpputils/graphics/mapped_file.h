@@ -0,0 +1,87 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifndef GRAPHICS_MAPPED_FILE_H
+#define GRAPHICS_MAPPED_FILE_H
+
+namespace graphics {
+
+/**
+ * A read-only or read-write memory mapping of a whole file.
+ */
+class MappedFile {
+ public:
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile() { Close(); }
+
+  /**
+   * Maps the existing, non-empty file |filename| for reading.
+   */
+  bool OpenForReading(const std::string& filename) {
+    Close();
+    fd_ = open(filename.c_str(), O_RDONLY);
+    if (fd_ < 0) return false;
+    struct stat info;
+    if (fstat(fd_, &info) != 0 || info.st_size == 0) return false;
+    return Map(info.st_size, PROT_READ);
+  }
+
+  /**
+   * Creates or truncates |filename| and maps |size| writable bytes of it.
+   */
+  bool OpenForWriting(const std::string& filename, size_t size) {
+    Close();
+    fd_ = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0 || ftruncate(fd_, size) != 0) return false;
+    return Map(size, PROT_READ | PROT_WRITE);
+  }
+
+  /**
+   * Unmaps and closes the file, if any.
+   */
+  void Close() {
+    Unmap();
+    if (fd_ >= 0) close(fd_);
+    fd_ = -1;
+  }
+
+  uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  bool Map(size_t size, int protection) {
+    void* data = mmap(nullptr, size, protection, MAP_SHARED, fd_, 0);
+    if (data == MAP_FAILED) return false;
+    data_ = static_cast<uint8_t*>(data);
+    size_ = size;
+    return true;
+  }
+
+  void Unmap() {
+    if (data_) munmap(data_, size_);
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  int fd_ = -1;
+  uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+}  // namespace graphics
+
+#endif  // GRAPHICS_MAPPED_FILE_H
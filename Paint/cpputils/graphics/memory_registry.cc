@@ -0,0 +1,150 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "memory_registry.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace graphics {
+
+int MemoryRegistry::AddSource(const std::string& path, Reporter reporter,
+                              Evictor evictor) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const int id = next_id_++;
+  sources_[id] = {SplitPath(path), std::move(reporter), std::move(evictor)};
+  return id;
+}
+
+void MemoryRegistry::RemoveSource(int id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  sources_.erase(id);
+}
+
+size_t MemoryRegistry::GetUsage(const std::string& path) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return GetUsageLocked(SplitPath(path));
+}
+
+std::vector<MemoryRegistry::Category> MemoryRegistry::GetCategories() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Keyed by the parts of the path, so that parents come before children.
+  std::map<std::vector<std::string>, Category> categories;
+  auto add = [&categories](const std::vector<std::string>& path,
+                           size_t bytes) {
+    for (size_t depth = 0; depth <= path.size(); depth++) {
+      const std::vector<std::string> parent(path.begin(),
+                                            path.begin() + depth);
+      Category& category = categories[parent];
+      category.depth = depth;
+      category.bytes += bytes;
+    }
+  };
+  for (const auto& source : sources_) {
+    add(source.second.path, source.second.reporter());
+  }
+  for (const auto& budget : budgets_) {
+    add(budget.first, 0);
+    categories[budget.first].budget = budget.second;
+  }
+  if (categories.empty()) categories[{}] = Category();
+  std::vector<Category> result;
+  for (auto& entry : categories) {
+    for (const std::string& part : entry.first) {
+      if (!entry.second.path.empty()) entry.second.path += '/';
+      entry.second.path += part;
+    }
+    result.push_back(std::move(entry.second));
+  }
+  return result;
+}
+
+void MemoryRegistry::Dump(std::ostream& out) const {
+  for (const Category& category : GetCategories()) {
+    const size_t slash = category.path.rfind('/');
+    const std::string name =
+        category.depth == 0 ? "total" : category.path.substr(slash + 1);
+    out << std::string(2 * category.depth, ' ') << name << ": "
+        << category.bytes << " bytes";
+    if (category.budget != SIZE_MAX) {
+      out << " (budget " << category.budget << " bytes)";
+    }
+    out << std::endl;
+  }
+}
+
+void MemoryRegistry::SetBudget(const std::string& path, size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (bytes == SIZE_MAX) {
+    budgets_.erase(SplitPath(path));
+  } else {
+    budgets_[SplitPath(path)] = bytes;
+  }
+}
+
+size_t MemoryRegistry::EnforceBudgets() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::pair<std::vector<std::string>, size_t>> budgets(
+      budgets_.begin(), budgets_.end());
+  // Deepest first, so that a parent over budget only evicts what its
+  // children's budgets did not.
+  std::stable_sort(budgets.begin(), budgets.end(),
+                   [](const auto& a, const auto& b) {
+                     return a.first.size() > b.first.size();
+                   });
+  size_t freed = 0;
+  for (const auto& budget : budgets) {
+    size_t usage = GetUsageLocked(budget.first);
+    // Sources may free less than asked, so ask again while they free any.
+    bool progress = true;
+    while (usage > budget.second && progress) {
+      progress = false;
+      for (const auto& source : sources_) {
+        if (usage <= budget.second) break;
+        if (!source.second.evictor ||
+            !IsUnder(source.second.path, budget.first)) {
+          continue;
+        }
+        const size_t bytes = source.second.evictor(usage - budget.second);
+        progress = progress || bytes > 0;
+        freed += bytes;
+        usage = GetUsageLocked(budget.first);
+      }
+    }
+  }
+  return freed;
+}
+
+std::vector<std::string> MemoryRegistry::SplitPath(const std::string& path) {
+  std::vector<std::string> parts;
+  size_t start = 0;
+  while (start <= path.size()) {
+    size_t end = path.find('/', start);
+    if (end == std::string::npos) end = path.size();
+    if (end > start) parts.push_back(path.substr(start, end - start));
+    start = end + 1;
+  }
+  return parts;
+}
+
+bool MemoryRegistry::IsUnder(const std::vector<std::string>& path,
+                             const std::vector<std::string>& category) {
+  return path.size() >= category.size() &&
+         std::equal(category.begin(), category.end(), path.begin());
+}
+
+size_t MemoryRegistry::GetUsageLocked(
+    const std::vector<std::string>& category) const {
+  size_t bytes = 0;
+  for (const auto& source : sources_) {
+    if (IsUnder(source.second.path, category)) {
+      bytes += source.second.reporter();
+    }
+  }
+  return bytes;
+}
+
+}  // namespace graphics
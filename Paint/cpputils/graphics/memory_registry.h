@@ -0,0 +1,131 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#ifndef GRAPHICS_MEMORY_REGISTRY_H
+#define GRAPHICS_MEMORY_REGISTRY_H
+
+namespace graphics {
+
+/**
+ * Accounts for the memory of a session, such as its images, caches and
+ * history, in a tree of categories named by paths like "canvas/pixels".
+ *
+ * Each source of memory reports its bytes when asked, so the numbers are
+ * always current and sources pay nothing between queries. A category can
+ * be given a budget, and sources that can free memory are asked to when
+ * EnforceBudgets finds it over budget.
+ *
+ * Thread-safe. Sources are called with the registry locked, so they must
+ * not call back into it.
+ */
+class MemoryRegistry {
+ public:
+  /**
+   * Returns the bytes a source holds.
+   */
+  using Reporter = std::function<size_t()>;
+
+  /**
+   * Asks a source to free about |bytes|, returning the bytes it freed.
+   */
+  using Evictor = std::function<size_t(size_t bytes)>;
+
+  MemoryRegistry() = default;
+  MemoryRegistry(const MemoryRegistry&) = delete;
+  MemoryRegistry& operator=(const MemoryRegistry&) = delete;
+
+  /**
+   * Adds a source of memory in category |path|, whose parts are separated
+   * by '/'. |reporter| returns its bytes. |evictor|, if set, is called to
+   * free some of them when a category holding the source is over budget.
+   * Several sources may share a path. Returns an id for RemoveSource.
+   */
+  int AddSource(const std::string& path, Reporter reporter,
+                Evictor evictor = nullptr);
+
+  /**
+   * Removes the source with |id|. The source must be removed before it is
+   * destroyed.
+   */
+  void RemoveSource(int id);
+
+  /**
+   * Returns the bytes held in category |path| and the ones below it, or in
+   * all of them if |path| is empty.
+   */
+  size_t GetUsage(const std::string& path = "") const;
+
+  /**
+   * A category with the bytes held in it and below it, and its budget, or
+   * SIZE_MAX if it has none. |depth| is the number of parts of |path|.
+   */
+  struct Category {
+    std::string path;
+    int depth = 0;
+    size_t bytes = 0;
+    size_t budget = SIZE_MAX;
+  };
+
+  /**
+   * Returns every category holding a source or a budget, and their parent
+   * categories, parents first and siblings in alphabetical order. The first
+   * one, with an empty path, holds everything.
+   */
+  std::vector<Category> GetCategories() const;
+
+  /**
+   * Writes the categories to |out| as an indented tree, one per line.
+   */
+  void Dump(std::ostream& out) const;
+
+  /**
+   * Limits category |path| to |bytes|, or removes its budget if |bytes| is
+   * SIZE_MAX. Budgets are only applied by EnforceBudgets.
+   */
+  void SetBudget(const std::string& path, size_t bytes);
+
+  /**
+   * Asks the sources of every category over budget, deepest categories
+   * first, to free memory until it fits or none of them can free more.
+   * Returns the bytes freed.
+   */
+  size_t EnforceBudgets();
+
+ private:
+  struct Source {
+    std::vector<std::string> path;
+    Reporter reporter;
+    Evictor evictor;
+  };
+
+  // Splits |path| into its parts, skipping empty ones.
+  static std::vector<std::string> SplitPath(const std::string& path);
+
+  // Returns true if |path| is |category| or below it.
+  static bool IsUnder(const std::vector<std::string>& path,
+                      const std::vector<std::string>& category);
+
+  // Returns the bytes in |category| and below. mutex_ must be held.
+  size_t GetUsageLocked(const std::vector<std::string>& category) const;
+
+  mutable std::mutex mutex_;
+  int next_id_ = 0;
+  std::map<int, Source> sources_;
+  std::map<std::vector<std::string>, size_t> budgets_;
+};
+
+}  // namespace graphics
+
+#endif  // GRAPHICS_MEMORY_REGISTRY_H
@@ -0,0 +1,248 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "pixel_image.h"
+
+#include <iostream>
+
+#include "cimg/CImg.h"
+
+namespace graphics {
+
+namespace {
+
+// Returns |source| blended over |destination|, both premultiplied.
+template <typename PixelT>
+inline typename PixelT::Channel BlendChannel(
+    typename PixelT::Channel destination, typename PixelT::Channel source,
+    typename PixelT::Channel source_alpha) {
+  return source + ScaleChannel(destination,
+                               static_cast<typename PixelT::Channel>(
+                                   PixelT::kMax - source_alpha));
+}
+
+}  // namespace
+
+template <typename PixelT>
+PixelImage<PixelT>::PixelImage() = default;
+
+template <typename PixelT>
+PixelImage<PixelT>::~PixelImage() = default;
+
+template <typename PixelT>
+bool PixelImage<PixelT>::Initialize(int width, int height,
+                                    const PixelT& background) {
+  if (!Allocate(width, height)) return false;
+  const size_t plane_size = GetPlaneSize();
+  for (int c = 0; c < kChannels; c++) {
+    Channel* const plane = GetChannelData(c);
+    std::fill(plane, plane + plane_size, background.channels[c]);
+  }
+  return true;
+}
+
+template <typename PixelT>
+bool PixelImage<PixelT>::FromImage(const Image& image) {
+  const uint8_t* channels[3];
+  for (int c = 0; c < 3; c++) {
+    channels[c] = image.GetChannelData(c);
+    if (!channels[c]) return false;
+  }
+  if (!Allocate(image.GetWidth(), image.GetHeight())) return false;
+  const size_t plane_size = GetPlaneSize();
+  for (int c = 0; c < kChannels; c++) {
+    Channel* const to = GetChannelData(c);
+    if (c < 3) {
+      for (size_t i = 0; i < plane_size; i++) {
+        to[i] = ConvertChannel<Channel>(channels[c][i]);
+      }
+    } else {
+      std::fill(to, to + plane_size, PixelT::kMax);
+    }
+  }
+  return true;
+}
+
+template <typename PixelT>
+bool PixelImage<PixelT>::ToImage(Image& image) const {
+  if (!pixels_) return false;
+  if constexpr (std::is_same<PixelT, Rgb8>::value) {
+    const uint8_t* const channels[3] = {GetChannelData(0), GetChannelData(1),
+                                        GetChannelData(2)};
+    return image.Initialize(width_, height_, channels);
+  } else {
+    const size_t plane_size = GetPlaneSize();
+    PixelBuffer planes(plane_size * 3);
+    if (!planes) return false;
+    uint8_t* const channels[3] = {planes.data(), planes.data() + plane_size,
+                                  planes.data() + 2 * plane_size};
+    for (int c = 0; c < 3; c++) {
+      const Channel* const from = GetChannelData(c);
+      for (size_t i = 0; i < plane_size; i++) {
+        channels[c][i] = ConvertChannel<uint8_t>(from[i]);
+      }
+    }
+    return image.Initialize(width_, height_, channels);
+  }
+}
+
+template <typename PixelT>
+auto PixelImage<PixelT>::GetChannelData(int channel) const -> const Channel* {
+  if (!pixels_ || channel < 0 || channel >= kChannels) return nullptr;
+  return reinterpret_cast<const Channel*>(pixels_.data()) +
+         channel * GetPlaneSize();
+}
+
+template <typename PixelT>
+PixelT PixelImage<PixelT>::GetPixel(int x, int y) const {
+  PixelT pixel = {};
+  if (!CheckPixelInBounds(x, y)) return pixel;
+  const size_t offset = static_cast<size_t>(y) * width_ + x;
+  for (int c = 0; c < kChannels; c++) {
+    pixel.channels[c] = GetChannelData(c)[offset];
+  }
+  return pixel;
+}
+
+template <typename PixelT>
+bool PixelImage<PixelT>::SetPixel(int x, int y, const PixelT& pixel) {
+  if (!CheckPixelInBounds(x, y)) return false;
+  const size_t offset = static_cast<size_t>(y) * width_ + x;
+  for (int c = 0; c < kChannels; c++) {
+    GetChannelData(c)[offset] = pixel.channels[c];
+  }
+  return true;
+}
+
+template <typename PixelT>
+Color PixelImage<PixelT>::GetColor(int x, int y) const {
+  const Rgb8 rgb = ConvertPixel<Rgb8>(GetPixel(x, y));
+  return Color(rgb.channels[0], rgb.channels[1], rgb.channels[2]);
+}
+
+template <typename PixelT>
+bool PixelImage<PixelT>::BlendPixel(int x, int y, const PixelT& pixel) {
+  if constexpr (!PixelT::kHasAlpha) {
+    return SetPixel(x, y, pixel);
+  } else {
+    if (!CheckPixelInBounds(x, y)) return false;
+    const size_t offset = static_cast<size_t>(y) * width_ + x;
+    for (int c = 0; c < kChannels; c++) {
+      Channel& channel = GetChannelData(c)[offset];
+      channel = BlendChannel<PixelT>(channel, pixel.channels[c],
+                                     pixel.channels[3]);
+    }
+    return true;
+  }
+}
+
+template <typename PixelT>
+bool PixelImage<PixelT>::Composite(const PixelImage& layer, int x, int y) {
+  if (!layer.pixels_ || &layer == this) return false;
+  const int left = std::max(0, x);
+  const int top = std::max(0, y);
+  const int right = std::min(width_, x + layer.width_);
+  const int bottom = std::min(height_, y + layer.height_);
+  if (left >= right || top >= bottom) return true;
+  const int span = right - left;
+  for (int row = top; row < bottom; row++) {
+    const size_t from = static_cast<size_t>(row - y) * layer.width_ + left - x;
+    const size_t to = static_cast<size_t>(row) * width_ + left;
+    if constexpr (!PixelT::kHasAlpha) {
+      for (int c = 0; c < kChannels; c++) {
+        std::copy_n(layer.GetChannelData(c) + from, span,
+                    GetChannelData(c) + to);
+      }
+    } else {
+      // A plane at a time, so that the loops vectorize.
+      const Channel* const alpha = layer.GetChannelData(3) + from;
+      for (int c = 0; c < kChannels; c++) {
+        const Channel* const source = layer.GetChannelData(c) + from;
+        Channel* const destination = GetChannelData(c) + to;
+        for (int i = 0; i < span; i++) {
+          destination[i] =
+              BlendChannel<PixelT>(destination[i], source[i], alpha[i]);
+        }
+      }
+    }
+  }
+  return true;
+}
+
+template <typename PixelT>
+bool PixelImage<PixelT>::DrawLine(int x0, int y0, int x1, int y1,
+                                  const PixelT& pixel, int thickness) {
+  if (thickness < 1 || !CheckPixelInBounds(x0, y0) ||
+      !CheckPixelInBounds(x1, y1)) {
+    return false;
+  }
+  if (x0 == x1 && y0 == y1) return true;
+  if (thickness == 1) {
+    cimage_->draw_line(x0, y0, x1, y1, pixel.channels);
+    return true;
+  }
+  // The same quadrilateral as Image::DrawLine.
+  int xs[4];
+  int ys[4];
+  PolygonFiller::GetThickLineCorners(x0, y0, x1, y1, thickness, xs, ys);
+  polygon_filler_.Fill(xs, ys, 4, width_, height_,
+                       [&](int y, int from, int to) {
+                         for (int c = 0; c < kChannels; c++) {
+                           Channel* px = cimage_->data(from, y, 0, c);
+                           std::fill(px, px + (to - from + 1),
+                                     pixel.channels[c]);
+                         }
+                       });
+  return true;
+}
+
+template <typename PixelT>
+bool PixelImage<PixelT>::DrawCircle(int x, int y, int radius,
+                                    const PixelT& pixel) {
+  if (!CheckPixelInBounds(x, y)) return false;
+  cimage_->draw_circle(x, y, radius, pixel.channels);
+  return true;
+}
+
+template <typename PixelT>
+bool PixelImage<PixelT>::DrawRectangle(int x, int y, int width, int height,
+                                       const PixelT& pixel) {
+  if (!CheckPixelInBounds(x, y) || width < 0 || height < 0) return false;
+  cimage_->draw_rectangle(x, y, x + width - 1, y + height - 1,
+                          pixel.channels);
+  return true;
+}
+
+template <typename PixelT>
+bool PixelImage<PixelT>::CheckPixelInBounds(int x, int y) const {
+  if (x < 0 || y < 0 || x >= width_ || y >= height_) {
+    std::cout << "(" << x << ", " << y << ") is out of bounds." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+template <typename PixelT>
+bool PixelImage<PixelT>::Allocate(int width, int height) {
+  if (width < 1 || height < 1) return false;
+  PixelBuffer pixels(static_cast<size_t>(width) * height * sizeof(PixelT));
+  if (!pixels) return false;
+  cimg::exception_mode(0);
+  cimage_ = std::make_unique<CImg<Channel>>(
+      reinterpret_cast<Channel*>(pixels.data()), width, height, 1, kChannels,
+      /*is_shared=*/true);
+  pixels_ = std::move(pixels);
+  width_ = width;
+  height_ = height;
+  return true;
+}
+
+template class PixelImage<Rgb8>;
+template class PixelImage<Rgba8>;
+template class PixelImage<Rgba16>;
+template class PixelImage<Rgba32F>;
+
+}  // namespace graphics
@@ -0,0 +1,289 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include "image.h"
+#include "pixel_pool.h"
+#include "polygon_filler.h"
+
+#ifndef GRAPHICS_PIXEL_IMAGE_H
+#define GRAPHICS_PIXEL_IMAGE_H
+
+namespace graphics {
+
+/**
+ * A pixel of |kChannelCount| channels of type |ChannelT|: red, green, blue
+ * and, if there are four, alpha. Integer channels go from 0 to the largest
+ * value of their type, and float channels from 0 to 1.
+ *
+ * Colors with alpha are premultiplied by it, so that blending is one
+ * multiply and add per channel.
+ */
+template <typename ChannelT, int kChannelCount>
+struct Pixel {
+  using Channel = ChannelT;
+  static constexpr int kChannels = kChannelCount;
+  static constexpr bool kHasAlpha = kChannelCount == 4;
+  static constexpr Channel kMax = std::is_floating_point<Channel>::value
+                                      ? Channel(1)
+                                      : std::numeric_limits<Channel>::max();
+
+  bool operator==(const Pixel& other) const {
+    return std::equal(channels, channels + kChannels, other.channels);
+  }
+  bool operator!=(const Pixel& other) const { return !(*this == other); }
+
+  Channel channels[kChannels];
+};
+
+using Rgb8 = Pixel<uint8_t, 3>;
+using Rgba8 = Pixel<uint8_t, 4>;
+using Rgba16 = Pixel<uint16_t, 4>;
+using Rgba32F = Pixel<float, 4>;
+
+/**
+ * Returns |value| of channel type |From| as channel type |To|, rounding to
+ * the nearest value and clamping floats to [0, 1].
+ */
+template <typename To, typename From>
+inline To ConvertChannel(From value) {
+  constexpr To to_max = Pixel<To, 1>::kMax;
+  constexpr From from_max = Pixel<From, 1>::kMax;
+  if constexpr (std::is_same<To, From>::value) {
+    return value;
+  } else if constexpr (std::is_floating_point<To>::value) {
+    return static_cast<To>(value) / static_cast<To>(from_max);
+  } else if constexpr (std::is_floating_point<From>::value) {
+    const From clamped = std::min(std::max(value, From(0)), From(1));
+    return static_cast<To>(clamped * to_max + From(0.5));
+  } else {
+    return static_cast<To>(
+        (static_cast<uint64_t>(value) * to_max + from_max / 2) / from_max);
+  }
+}
+
+/**
+ * Returns |from| as a pixel of type |To|. Alpha becomes opaque when |From|
+ * has none, and is dropped when |To| has none, which leaves the colors as
+ * if blended over black.
+ */
+template <typename To, typename From>
+inline To ConvertPixel(const From& from) {
+  using ToChannel = typename To::Channel;
+  To to;
+  for (int c = 0; c < 3; c++) {
+    to.channels[c] = ConvertChannel<ToChannel>(from.channels[c]);
+  }
+  if constexpr (To::kHasAlpha) {
+    if constexpr (From::kHasAlpha) {
+      to.channels[3] = ConvertChannel<ToChannel>(from.channels[3]);
+    } else {
+      to.channels[3] = To::kMax;
+    }
+  }
+  return to;
+}
+
+/**
+ * Returns |color| as an opaque pixel of type |PixelT|.
+ */
+template <typename PixelT>
+inline PixelT ToPixel(const Color& color) {
+  const Rgb8 rgb = {{static_cast<uint8_t>(color.Red()),
+                     static_cast<uint8_t>(color.Green()),
+                     static_cast<uint8_t>(color.Blue())}};
+  return ConvertPixel<PixelT>(rgb);
+}
+
+/**
+ * Returns |value| * |scale| / kMax for channels of type |Channel|, rounded
+ * to the nearest value for integers.
+ */
+template <typename Channel>
+inline Channel ScaleChannel(Channel value, Channel scale) {
+  if constexpr (std::is_floating_point<Channel>::value) {
+    return value * scale;
+  } else if constexpr (sizeof(Channel) == 1) {
+    // Division by 255, exact for products of two 8-bit values.
+    const uint32_t product = uint32_t{value} * scale + 128;
+    return static_cast<Channel>((product + (product >> 8)) >> 8);
+  } else {
+    // Division by 65535, exact for products of two 16-bit values.
+    const uint64_t product = uint64_t{value} * scale + 32768;
+    return static_cast<Channel>((product + (product >> 16)) >> 16);
+  }
+}
+
+/**
+ * An image of pixels of type |PixelT|, one of Rgb8, Rgba8, Rgba16 and
+ * Rgba32F, for work that needs more precision or alpha than an Image, like
+ * blending many translucent layers. Conversion, blending and drawing are
+ * compiled for each pixel type, so their inner loops do not check it.
+ *
+ * Channels are stored in planes, like Image, and lines, circles and
+ * rectangles cover the same pixels as on an Image. Use FromImage and
+ * ToImage to move pixels to and from an Image, to be shown or saved.
+ */
+template <typename PixelT>
+class PixelImage {
+ public:
+  using Channel = typename PixelT::Channel;
+  static constexpr int kChannels = PixelT::kChannels;
+
+  PixelImage();
+  PixelImage(const PixelImage&) = delete;
+  PixelImage& operator=(const PixelImage&) = delete;
+  ~PixelImage();
+
+  /**
+   * Resets the image to |width| by |height| pixels of |background|. Returns
+   * false if the size is less than 1 or out of memory.
+   */
+  bool Initialize(int width, int height, const PixelT& background);
+  bool Initialize(int width, int height) {
+    return Initialize(width, height, ToPixel<PixelT>(Color(255, 255, 255)));
+  }
+
+  /**
+   * Resets the image to the pixels of |image|, opaque. Returns false if
+   * |image| is empty.
+   */
+  bool FromImage(const Image& image);
+
+  /**
+   * Resets |image| to the colors of this image, see ConvertPixel. Returns
+   * false if this image is empty.
+   */
+  bool ToImage(Image& image) const;
+
+  /**
+   * Resets the image to the pixels of |other|, converted, see ConvertPixel.
+   * Returns false if |other| is empty.
+   */
+  template <typename OtherT>
+  bool ConvertFrom(const PixelImage<OtherT>& other);
+
+  int GetWidth() const { return width_; }
+  int GetHeight() const { return height_; }
+
+  /**
+   * Returns the bytes taken by the pixels.
+   */
+  size_t GetMemoryUsage() const { return pixels_.size(); }
+
+  /**
+   * Returns plane |channel| of the image, row by row, or nullptr if the
+   * image is empty or |channel| is out of range.
+   */
+  const Channel* GetChannelData(int channel) const;
+  Channel* GetChannelData(int channel) {
+    return const_cast<Channel*>(
+        static_cast<const PixelImage*>(this)->GetChannelData(channel));
+  }
+
+  /**
+   * Returns the pixel at (|x|, |y|), or transparent black if it is out of
+   * bounds.
+   */
+  PixelT GetPixel(int x, int y) const;
+
+  /**
+   * Sets the pixel at (|x|, |y|). Returns false if it is out of bounds.
+   */
+  bool SetPixel(int x, int y, const PixelT& pixel);
+
+  Color GetColor(int x, int y) const;
+  bool SetColor(int x, int y, const Color& color) {
+    return SetPixel(x, y, ToPixel<PixelT>(color));
+  }
+
+  /**
+   * Blends |pixel| over the pixel at (|x|, |y|). Returns false if it is out
+   * of bounds.
+   */
+  bool BlendPixel(int x, int y, const PixelT& pixel);
+
+  /**
+   * Blends |layer| over this image, with its top left corner at (|x|, |y|),
+   * and the parts outside this image left out. Returns false if |layer| is
+   * empty or this image.
+   */
+  bool Composite(const PixelImage& layer, int x, int y);
+
+  /**
+   * Draw like the Image functions of the same name, replacing the pixels
+   * covered. Return false if the parameters are out of bounds.
+   */
+  bool DrawLine(int x0, int y0, int x1, int y1, const PixelT& pixel,
+                int thickness = 1);
+  bool DrawLine(int x0, int y0, int x1, int y1, const Color& color,
+                int thickness = 1) {
+    return DrawLine(x0, y0, x1, y1, ToPixel<PixelT>(color), thickness);
+  }
+  bool DrawCircle(int x, int y, int radius, const PixelT& pixel);
+  bool DrawCircle(int x, int y, int radius, const Color& color) {
+    return DrawCircle(x, y, radius, ToPixel<PixelT>(color));
+  }
+  bool DrawRectangle(int x, int y, int width, int height,
+                     const PixelT& pixel);
+  bool DrawRectangle(int x, int y, int width, int height,
+                     const Color& color) {
+    return DrawRectangle(x, y, width, height, ToPixel<PixelT>(color));
+  }
+
+ private:
+  bool CheckPixelInBounds(int x, int y) const;
+
+  size_t GetPlaneSize() const { return static_cast<size_t>(width_) * height_; }
+
+  // Replaces the pixels with uninitialized ones of |width| by |height|.
+  bool Allocate(int width, int height);
+
+  int width_ = 0;
+  int height_ = 0;
+  // The planes of the image, which cimage_ shares to draw with.
+  PixelBuffer pixels_;
+  std::unique_ptr<CImg<Channel>> cimage_;
+  // Scratch space for thick lines.
+  PolygonFiller polygon_filler_;
+};
+
+template <typename PixelT>
+template <typename OtherT>
+bool PixelImage<PixelT>::ConvertFrom(const PixelImage<OtherT>& other) {
+  if (!other.GetChannelData(0) ||
+      !Allocate(other.GetWidth(), other.GetHeight())) {
+    return false;
+  }
+  const size_t plane_size = GetPlaneSize();
+  for (int c = 0; c < kChannels; c++) {
+    Channel* const to = GetChannelData(c);
+    if (c < OtherT::kChannels) {
+      const typename OtherT::Channel* const from = other.GetChannelData(c);
+      for (size_t i = 0; i < plane_size; i++) {
+        to[i] = ConvertChannel<Channel>(from[i]);
+      }
+    } else {
+      std::fill(to, to + plane_size, PixelT::kMax);
+    }
+  }
+  return true;
+}
+
+extern template class PixelImage<Rgb8>;
+extern template class PixelImage<Rgba8>;
+extern template class PixelImage<Rgba16>;
+extern template class PixelImage<Rgba32F>;
+
+}  // namespace graphics
+
+#endif  // GRAPHICS_PIXEL_IMAGE_H
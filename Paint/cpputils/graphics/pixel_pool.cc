@@ -0,0 +1,140 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "pixel_pool.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+
+namespace graphics {
+
+PixelPool::~PixelPool() { Trim(); }
+
+PixelPool& PixelPool::Get() {
+  // Never destroyed, since images may be destroyed after static objects.
+  static PixelPool* pool = new PixelPool();
+  return *pool;
+}
+
+size_t PixelPool::GetSizeClass(size_t size) {
+  size_t step = kAlignment;
+  while (step * 16 < size) step *= 2;
+  return std::max(kAlignment, (size + step - 1) / step * step);
+}
+
+uint8_t* PixelPool::Allocate(size_t size) {
+  const size_t size_class = GetSizeClass(size);
+  bool huge_pages;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = free_lists_.find(size_class);
+    if (found != free_lists_.end() && !found->second.empty()) {
+      uint8_t* buffer = found->second.back();
+      found->second.pop_back();
+      stats_.reuses++;
+      stats_.bytes_cached -= size_class;
+      stats_.bytes_in_use += size_class;
+      return buffer;
+    }
+    huge_pages = huge_pages_;
+  }
+  uint8_t* buffer = SystemAllocate(size_class, huge_pages);
+  if (!buffer) return nullptr;
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.system_allocations++;
+  stats_.bytes_in_use += size_class;
+  return buffer;
+}
+
+void PixelPool::Free(uint8_t* buffer, size_t size) {
+  if (!buffer) return;
+  const size_t size_class = GetSizeClass(size);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.bytes_in_use -= size_class;
+    if (stats_.bytes_cached + size_class <= cache_limit_) {
+      free_lists_[size_class].push_back(buffer);
+      stats_.bytes_cached += size_class;
+      return;
+    }
+  }
+  SystemFree(buffer, size_class);
+}
+
+void PixelPool::SetCacheLimit(size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  cache_limit_ = bytes;
+  // Free the largest buffers first, which are the cheapest to get back per
+  // byte.
+  std::vector<size_t> classes;
+  for (const auto& list : free_lists_) classes.push_back(list.first);
+  std::sort(classes.begin(), classes.end(), std::greater<size_t>());
+  for (size_t size_class : classes) {
+    if (stats_.bytes_cached <= cache_limit_) break;
+    std::vector<uint8_t*>& list = free_lists_[size_class];
+    while (!list.empty() && stats_.bytes_cached > cache_limit_) {
+      SystemFree(list.back(), size_class);
+      list.pop_back();
+      stats_.bytes_cached -= size_class;
+    }
+    if (list.empty()) free_lists_.erase(size_class);
+  }
+}
+
+void PixelPool::SetHugePages(bool enabled) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  huge_pages_ = enabled;
+}
+
+PixelPool::Stats PixelPool::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+uint8_t* PixelPool::SystemAllocate(size_t size_class, bool huge_pages) {
+  // Size classes are multiples of kAlignment, and of the page size from
+  // kMapThreshold on.
+  if (size_class < kMapThreshold) {
+    return static_cast<uint8_t*>(aligned_alloc(kAlignment, size_class));
+  }
+  huge_pages = huge_pages && size_class >= 4 * kHugePageSize;
+  const size_t mapped_size = huge_pages ? size_class + kHugePageSize
+                                        : size_class;
+  void* mapped = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapped == MAP_FAILED) return nullptr;
+  uint8_t* buffer = static_cast<uint8_t*>(mapped);
+  if (!huge_pages) return buffer;
+
+  // Unmap the ends around the first huge page boundary, so that the buffer
+  // can be backed by huge pages all the way.
+  const uintptr_t start = reinterpret_cast<uintptr_t>(buffer);
+  const uintptr_t aligned =
+      (start + kHugePageSize - 1) & ~(uintptr_t{kHugePageSize} - 1);
+  const uintptr_t end = aligned + size_class;
+  if (aligned > start) munmap(buffer, aligned - start);
+  if (start + mapped_size > end) {
+    munmap(reinterpret_cast<void*>(end), start + mapped_size - end);
+  }
+  buffer = reinterpret_cast<uint8_t*>(aligned);
+#ifdef MADV_HUGEPAGE
+  madvise(buffer, size_class, MADV_HUGEPAGE);
+#endif
+  return buffer;
+}
+
+void PixelPool::SystemFree(uint8_t* buffer, size_t size_class) {
+  if (size_class < kMapThreshold) {
+    free(buffer);
+  } else {
+    munmap(buffer, size_class);
+  }
+}
+
+}  // namespace graphics
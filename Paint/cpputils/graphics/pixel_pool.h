@@ -0,0 +1,158 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifndef GRAPHICS_PIXEL_POOL_H
+#define GRAPHICS_PIXEL_POOL_H
+
+namespace graphics {
+
+/**
+ * Recycles pixel buffers, so that images and tiles that come and go at the
+ * same sizes stop going to malloc, and large buffers stop page faulting,
+ * once the pool has warmed up.
+ *
+ * Sizes are rounded up to size classes at most an eighth apart, and freed
+ * buffers are kept on a free list per class, up to a limit on the bytes
+ * kept. Buffers are aligned to kAlignment bytes. Those of kMapThreshold
+ * bytes or more are mapped directly, and can use transparent huge pages,
+ * see SetHugePages.
+ *
+ * Thread-safe.
+ */
+class PixelPool {
+ public:
+  static constexpr size_t kAlignment = 64;
+  static constexpr size_t kMapThreshold = 1 << 20;
+  static constexpr size_t kHugePageSize = 2 << 20;
+
+  PixelPool() = default;
+  PixelPool(const PixelPool&) = delete;
+  PixelPool& operator=(const PixelPool&) = delete;
+  ~PixelPool();
+
+  /**
+   * Returns the pool that Image, its snapshots and Canvas allocate from.
+   */
+  static PixelPool& Get();
+
+  /**
+   * Returns an uninitialized buffer of at least |size| bytes, which must be
+   * given back with Free and the same |size|. Returns nullptr if out of
+   * memory.
+   */
+  uint8_t* Allocate(size_t size);
+
+  /**
+   * Puts |buffer|, allocated with |size|, back on its free list, or frees
+   * it if the free lists are full. Does nothing if |buffer| is null.
+   */
+  void Free(uint8_t* buffer, size_t size);
+
+  /**
+   * Sets how many bytes of freed buffers are kept for reuse, freeing
+   * buffers beyond that.
+   */
+  void SetCacheLimit(size_t bytes);
+
+  /**
+   * Sets whether buffers of at least kHugePageSize * 4 bytes, as used by
+   * very large canvases, are aligned to huge pages and advised to use them.
+   * Applies to buffers allocated from then on.
+   */
+  void SetHugePages(bool enabled);
+
+  /**
+   * Frees every buffer kept for reuse.
+   */
+  void Trim() { SetCacheLimit(0); }
+
+  struct Stats {
+    // Allocations served by the system, and by reusing a freed buffer.
+    size_t system_allocations = 0;
+    size_t reuses = 0;
+    // Bytes in buffers handed out, and kept for reuse.
+    size_t bytes_in_use = 0;
+    size_t bytes_cached = 0;
+  };
+
+  Stats GetStats() const;
+
+  /**
+   * Returns the size class that a buffer of |size| bytes is allocated with.
+   */
+  static size_t GetSizeClass(size_t size);
+
+ private:
+  // Allocates and frees buffers of a size class from the system.
+  static uint8_t* SystemAllocate(size_t size_class, bool huge_pages);
+  static void SystemFree(uint8_t* buffer, size_t size_class);
+
+  mutable std::mutex mutex_;
+  std::unordered_map<size_t, std::vector<uint8_t*>> free_lists_;
+  size_t cache_limit_ = 64 << 20;
+  bool huge_pages_ = false;
+  Stats stats_;
+};
+
+/**
+ * A buffer allocated from a PixelPool, given back when destroyed.
+ */
+class PixelBuffer {
+ public:
+  PixelBuffer() = default;
+
+  /**
+   * Allocates |size| uninitialized bytes from |pool|. The buffer is null if
+   * out of memory.
+   */
+  explicit PixelBuffer(size_t size, PixelPool& pool = PixelPool::Get())
+      : pool_(&pool), data_(pool.Allocate(size)), size_(data_ ? size : 0) {}
+
+  PixelBuffer(PixelBuffer&& other) { *this = std::move(other); }
+
+  PixelBuffer& operator=(PixelBuffer&& other) {
+    if (this != &other) {
+      reset();
+      pool_ = other.pool_;
+      data_ = other.data_;
+      size_ = other.size_;
+      other.data_ = nullptr;
+      other.size_ = 0;
+    }
+    return *this;
+  }
+
+  ~PixelBuffer() { reset(); }
+
+  /**
+   * Gives the buffer back to its pool.
+   */
+  void reset() {
+    if (data_) pool_->Free(data_, size_);
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+  explicit operator bool() const { return data_ != nullptr; }
+
+ private:
+  PixelPool* pool_ = nullptr;
+  uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+}  // namespace graphics
+
+#endif  // GRAPHICS_PIXEL_POOL_H
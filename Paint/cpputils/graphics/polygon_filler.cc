@@ -0,0 +1,91 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "polygon_filler.h"
+
+#include <cmath>
+#include <cstdlib>
+
+namespace graphics {
+
+void PolygonFiller::GetThickLineCorners(int x0, int y0, int x1, int y1,
+                                        int thickness, int xs[4],
+                                        int ys[4]) {
+  const double diff_x = x0 - x1;
+  const double diff_y = y0 - y1;
+  const double theta = std::atan(-diff_y / diff_x);
+  const double hyp = thickness / 2.0;
+
+  // Convert to integer to get nearest pixel.
+  const int delta_x = hyp * std::sin(theta);
+  const int delta_y = hyp * std::cos(theta);
+
+  xs[0] = x0 + delta_x;
+  xs[1] = x0 - delta_x;
+  xs[2] = x1 - delta_x;
+  xs[3] = x1 + delta_x;
+  ys[0] = y0 + delta_y;
+  ys[1] = y0 - delta_y;
+  ys[2] = y1 - delta_y;
+  ys[3] = y1 + delta_y;
+}
+
+void PolygonFiller::FindCrossings(const int xs[], const int ys[],
+                                  int num_points, int top, int rows) {
+  // resize() and assign() keep the existing capacity, so this only allocates
+  // when a taller polygon than any before is filled.
+  crossings_.resize(num_points * rows);
+  counts_.assign(rows, 0);
+
+  // Walk the edges, recording where each one crosses every row. This mirrors
+  // CImg::draw_polygon so thick lines look exactly as they did before.
+  auto sign = [](int v) { return (v > 0) - (v < 0); };
+  int n = 0;
+  int nn = 1;
+  bool go_on = true;
+  while (go_on) {
+    int an = (nn + 1) % num_points;
+    const int ex0 = xs[n];
+    const int ey0 = ys[n];
+    if (ys[nn] == ey0) {
+      while (ys[an] == ey0) {
+        nn = an;
+        an = (an + 1) % num_points;
+      }
+    }
+    const int ex1 = xs[nn];
+    const int ey1 = ys[nn];
+    int tn = an;
+    while (ys[tn] == ey1) tn = (tn + 1) % num_points;
+    if (ey0 != ey1) {
+      const int ey2 = ys[tn];
+      const int x01 = ex1 - ex0;
+      const int y01 = ey1 - ey0;
+      const int y12 = ey2 - ey1;
+      const int step = sign(y01);
+      const int tmax = std::max(1, std::abs(y01));
+      const int htmax = tmax * sign(x01) / 2;
+      const int tend = tmax - (step == sign(y12));
+      int row = ey0 - top;
+      for (int t = 0; t <= tend; ++t, row += step) {
+        if (row >= 0 && row < rows && counts_[row] < num_points) {
+          crossings_[row * num_points + counts_[row]++] =
+              ex0 + (t * x01 + htmax) / tmax;
+        }
+      }
+    }
+    go_on = nn > n;
+    n = nn;
+    nn = an;
+  }
+
+  for (int row = 0; row < rows; row++) {
+    int* crossings = &crossings_[row * num_points];
+    std::sort(crossings, crossings + counts_[row]);
+  }
+}
+
+}  // namespace graphics
@@ -0,0 +1,100 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#ifndef GRAPHICS_POLYGON_FILLER_H
+#define GRAPHICS_POLYGON_FILLER_H
+
+namespace graphics {
+
+/**
+ * Fills polygons a row span at a time, covering the same pixels as
+ * CImg::draw_polygon. Its scratch buffers are kept between fills, so that
+ * repeated fills (e.g. while dragging a thick brush) do not allocate once
+ * the buffers have grown. Copies start with empty buffers.
+ */
+class PolygonFiller {
+ public:
+  PolygonFiller() = default;
+  PolygonFiller(const PolygonFiller&) {}
+  PolygonFiller& operator=(const PolygonFiller&) { return *this; }
+  PolygonFiller(PolygonFiller&&) = default;
+  PolygonFiller& operator=(PolygonFiller&&) = default;
+
+  /**
+   * Sets |xs| and |ys| to the corners of the quadrilateral around the
+   * segment from (|x0|, |y0|) to (|x1|, |y1|) that draws it as a line
+   * |thickness| pixels thick.
+   */
+  static void GetThickLineCorners(int x0, int y0, int x1, int y1,
+                                  int thickness, int xs[4], int ys[4]);
+
+  /**
+   * Calls |fill_span|(y, from, to) for each span of the pixels from |from|
+   * to |to| inclusive on row |y| that the polygon with |num_points| vertices
+   * at (|xs|[i], |ys|[i]) covers, clipped to a |width| by |height| image.
+   */
+  template <typename FillSpan>
+  void Fill(const int xs[], const int ys[], int num_points, int width,
+            int height, FillSpan fill_span);
+
+  /**
+   * Returns the bytes of the scratch buffers.
+   */
+  size_t GetMemoryUsage() const {
+    return (crossings_.capacity() + counts_.capacity()) * sizeof(int);
+  }
+
+ private:
+  // Sets the first counts_[row] entries of row |row| of crossings_ to where
+  // the edges of the polygon cross row |top| + |row|, sorted, for each of
+  // the |rows| rows.
+  void FindCrossings(const int xs[], const int ys[], int num_points, int top,
+                     int rows);
+
+  // Per-row edge crossings, |num_points| entries to a row, and their counts.
+  std::vector<int> crossings_;
+  std::vector<int> counts_;
+};
+
+template <typename FillSpan>
+void PolygonFiller::Fill(const int xs[], const int ys[], int num_points,
+                         int width, int height, FillSpan fill_span) {
+  const int xmin = *std::min_element(xs, xs + num_points);
+  const int xmax = *std::max_element(xs, xs + num_points);
+  int ymin = *std::min_element(ys, ys + num_points);
+  int ymax = *std::max_element(ys, ys + num_points);
+  if (xmax < 0 || xmin >= width || ymax < 0 || ymin >= height) return;
+  if (ymin == ymax) {
+    fill_span(ymin, std::max(xmin, 0), std::min(xmax, width - 1));
+    return;
+  }
+  ymin = std::max(0, ymin);
+  ymax = std::min(height - 1, ymax);
+  const int rows = ymax - ymin + 1;
+  FindCrossings(xs, ys, num_points, ymin, rows);
+  for (int row = 0; row < rows; row++) {
+    const int* crossings = &crossings_[row * num_points];
+    const int count = counts_[row];
+    int previous = width;
+    for (int k = 0; k + 1 < count; k += 2) {
+      int start = crossings[k];
+      const int end = crossings[k + 1];
+      start += start == previous;
+      previous = end;
+      const int from = std::max(start, 0);
+      const int to = std::min(end, width - 1);
+      if (to >= from) fill_span(row + ymin, from, to);
+    }
+  }
+}
+
+}  // namespace graphics
+
+#endif  // GRAPHICS_POLYGON_FILLER_H
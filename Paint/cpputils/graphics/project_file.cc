@@ -0,0 +1,411 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "project_file.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+#include "binary_io.h"
+#include "image_hash.h"
+#include "image_io.h"
+
+namespace graphics {
+
+namespace {
+
+constexpr char kMagic[8] = {'T', 'P', 'A', 'I', 'N', 'T', '0', '1'};
+constexpr int kHeaderSize = 64;
+constexpr int kEntrySize = 16;
+
+// A file that needs more than twice its live data is compacted on save.
+constexpr int kMaxGarbageFactor = 2;
+
+std::vector<uint8_t> BuildHeader(int width, int height, uint64_t index_offset,
+                                 const std::vector<uint8_t>& index) {
+  std::vector<uint8_t> header(kMagic, kMagic + sizeof(kMagic));
+  PutLE32(&header, width);
+  PutLE32(&header, height);
+  PutLE32(&header, Image::kTileSize);
+  PutLE32(&header, 1);  // Layers.
+  PutLE64(&header, index_offset);
+  PutLE64(&header, index.size());
+  PutLE64(&header, HashBytes(index.data(), index.size()));
+  header.resize(kHeaderSize);
+  return header;
+}
+
+bool Write(FILE* file, const void* data, size_t size) {
+  return size == 0 || fwrite(data, size, 1, file) == 1;
+}
+
+// Flushes |file| all the way to the disk.
+bool Sync(FILE* file) { return fflush(file) == 0 && fsync(fileno(file)) == 0; }
+
+}  // namespace
+
+bool ProjectFile::Open(const std::string& filename) {
+  Close();
+  if (!file_.OpenForReading(filename) || file_.size() < kHeaderSize ||
+      memcmp(file_.data(), kMagic, sizeof(kMagic)) != 0) {
+    Close();
+    return false;
+  }
+  const uint8_t* header = file_.data();
+  const uint32_t width = GetLE32(header + 8);
+  const uint32_t height = GetLE32(header + 12);
+  const uint32_t tile_size = GetLE32(header + 16);
+  const uint32_t layers = GetLE32(header + 20);
+  const uint64_t index_offset = GetLE64(header + 24);
+  const uint64_t index_size = GetLE64(header + 32);
+  if (width < 1 || height < 1 || width > INT32_MAX || height > INT32_MAX ||
+      tile_size != Image::kTileSize || layers != 1 ||
+      index_offset < kHeaderSize || index_offset > file_.size() ||
+      index_size > file_.size() - index_offset ||
+      HashBytes(file_.data() + index_offset, index_size) !=
+          GetLE64(header + 40)) {
+    Close();
+    return false;
+  }
+  width_ = width;
+  height_ = height;
+  columns_ = (width_ + Image::kTileSize - 1) / Image::kTileSize;
+  rows_ = (height_ + Image::kTileSize - 1) / Image::kTileSize;
+
+  const uint8_t* p = file_.data() + index_offset;
+  const uint8_t* const end = p + index_size;
+  // Reads a length-prefixed string, or returns false if it does not fit.
+  auto read_string = [&p, end](std::string* out) {
+    if (end - p < 4) return false;
+    const uint32_t size = GetLE32(p);
+    p += 4;
+    if (static_cast<uint64_t>(end - p) < size) return false;
+    out->assign(reinterpret_cast<const char*>(p), size);
+    p += size;
+    return true;
+  };
+  if (end - p < 4) {
+    Close();
+    return false;
+  }
+  uint32_t metadata_count = GetLE32(p);
+  p += 4;
+  for (; metadata_count > 0; metadata_count--) {
+    std::string key;
+    std::string value;
+    if (!read_string(&key) || !read_string(&value)) {
+      Close();
+      return false;
+    }
+    metadata_[key] = value;
+  }
+  const size_t tiles = static_cast<size_t>(columns_) * rows_;
+  if (static_cast<uint64_t>(end - p) != tiles * kEntrySize) {
+    Close();
+    return false;
+  }
+  entries_.resize(tiles);
+  for (TileEntry& entry : entries_) {
+    entry.offset = GetLE64(p);
+    entry.size = GetLE32(p + 8);
+    entry.color = GetLE32(p + 12);
+    p += kEntrySize;
+    // Tile data always comes before the index that points to it.
+    if (entry.size > 0 &&
+        (entry.offset < kHeaderSize || entry.offset > index_offset ||
+         entry.size > index_offset - entry.offset)) {
+      Close();
+      return false;
+    }
+  }
+  filename_ = filename;
+  return true;
+}
+
+bool ProjectFile::OpenLike(const ProjectFile& other) {
+  if (&other == this) return !filename_.empty();
+  if (other.filename_.empty() || !Open(other.filename_) ||
+      memcmp(file_.data(), other.file_.data(), kHeaderSize) != 0) {
+    Close();
+    return false;
+  }
+  image_ = other.image_;
+  saved_generations_ = other.saved_generations_;
+  return true;
+}
+
+void ProjectFile::Close() {
+  file_.Close();
+  filename_.clear();
+  width_ = 0;
+  height_ = 0;
+  columns_ = 0;
+  rows_ = 0;
+  metadata_.clear();
+  entries_.clear();
+  image_ = nullptr;
+  saved_generations_.clear();
+}
+
+bool ProjectFile::Attach(Image& image) {
+  if (filename_.empty() || !image.InitializeFromTiles(width_, height_, this)) {
+    return false;
+  }
+  MarkSaved(image);
+  return true;
+}
+
+bool ProjectFile::Save(const std::string& filename, const Image& image,
+                       const Metadata& metadata) {
+  return Save(filename, *Snapshot(image), metadata);
+}
+
+std::shared_ptr<ImageSnapshot> ProjectFile::Snapshot(
+    const Image& image) const {
+  const bool in_sync = IsInSync(&image, image.GetWidth(), image.GetHeight());
+  return image.Snapshot(in_sync ? &saved_generations_ : nullptr);
+}
+
+bool ProjectFile::Save(const std::string& filename,
+                       const ImageSnapshot& snapshot,
+                       const Metadata& metadata) {
+  if (snapshot.GetWidth() < 1 || snapshot.GetHeight() < 1) return false;
+  if (filename == filename_ &&
+      IsInSync(snapshot.GetImage(), snapshot.GetWidth(),
+               snapshot.GetHeight())) {
+    size_t live_bytes = kHeaderSize;
+    for (const TileEntry& entry : entries_) live_bytes += entry.size;
+    if (file_.size() <= kMaxGarbageFactor * live_bytes) {
+      return Append(snapshot, metadata);
+    }
+  }
+  return Rewrite(filename, snapshot, metadata);
+}
+
+bool ProjectFile::ReadTile(int column, int row, int width, int height,
+                           uint8_t* const channels[3], int stride) {
+  if (column < 0 || row < 0 || column >= columns_ || row >= rows_) {
+    return false;
+  }
+  const TileEntry& entry = entries_[row * columns_ + column];
+  if (entry.size == 0) {
+    const uint8_t color[3] = {static_cast<uint8_t>(entry.color >> 16),
+                              static_cast<uint8_t>(entry.color >> 8),
+                              static_cast<uint8_t>(entry.color)};
+    for (int c = 0; c < 3; c++) {
+      for (int y = 0; y < height; y++) {
+        memset(channels[c] + static_cast<size_t>(y) * stride, color[c], width);
+      }
+    }
+    return true;
+  }
+  const size_t plane_size = static_cast<size_t>(width) * height;
+  decoded_.resize(plane_size * 3);
+  const bool decoded = image_io::DecodeQoi(
+      file_.data() + entry.offset, entry.size,
+      [&](int decoded_width, int decoded_height, uint8_t* planes[3]) {
+        if (decoded_width != width || decoded_height != height) return false;
+        for (int c = 0; c < 3; c++) {
+          planes[c] = decoded_.data() + c * plane_size;
+        }
+        return true;
+      });
+  if (!decoded) return false;
+  for (int c = 0; c < 3; c++) {
+    for (int y = 0; y < height; y++) {
+      memcpy(channels[c] + static_cast<size_t>(y) * stride,
+             decoded_.data() + c * plane_size + y * width, width);
+    }
+  }
+  return true;
+}
+
+bool ProjectFile::IsInSync(const Image* image, int width, int height) const {
+  return image_ == image && width == width_ && height == height_ &&
+         saved_generations_.size() == entries_.size();
+}
+
+bool ProjectFile::EncodeTile(const ImageSnapshot& snapshot, int column,
+                             int row, TileEntry* entry) {
+  const int width = std::min(Image::kTileSize,
+                             snapshot.GetWidth() - column * Image::kTileSize);
+  const int height = std::min(Image::kTileSize,
+                              snapshot.GetHeight() - row * Image::kTileSize);
+  const size_t plane_size = static_cast<size_t>(width) * height;
+  planes_.resize(plane_size * 3);
+  uint8_t* const channels[3] = {planes_.data(), planes_.data() + plane_size,
+                                planes_.data() + 2 * plane_size};
+  if (!snapshot.CopyTile(column, row, channels)) return false;
+  bool single_color = true;
+  for (int c = 0; c < 3 && single_color; c++) {
+    single_color = std::all_of(channels[c], channels[c] + plane_size,
+                               [&](uint8_t v) { return v == channels[c][0]; });
+  }
+  if (single_color) {
+    entry->size = 0;
+    entry->color = channels[0][0] << 16 | channels[1][0] << 8 | channels[2][0];
+    return true;
+  }
+  image_io::EncodeQoi(width, height, channels, &blob_);
+  entry->size = blob_.size();
+  entry->color = 0;
+  return true;
+}
+
+std::vector<uint8_t> ProjectFile::BuildIndex(
+    const Metadata& metadata, const std::vector<TileEntry>& entries) {
+  std::vector<uint8_t> index;
+  index.reserve(4 + entries.size() * kEntrySize);
+  PutLE32(&index, metadata.size());
+  for (const auto& item : metadata) {
+    PutLE32(&index, item.first.size());
+    index.insert(index.end(), item.first.begin(), item.first.end());
+    PutLE32(&index, item.second.size());
+    index.insert(index.end(), item.second.begin(), item.second.end());
+  }
+  for (const TileEntry& entry : entries) {
+    PutLE64(&index, entry.offset);
+    PutLE32(&index, entry.size);
+    PutLE32(&index, entry.color);
+  }
+  return index;
+}
+
+bool ProjectFile::Rewrite(const std::string& filename,
+                          const ImageSnapshot& snapshot,
+                          const Metadata& metadata) {
+  // Unchanged tiles are copied as they are, without decoding them.
+  const bool in_sync = IsInSync(snapshot.GetImage(), snapshot.GetWidth(),
+                                snapshot.GetHeight());
+  const int columns = snapshot.GetTileColumns();
+  const int rows = snapshot.GetTileRows();
+  std::vector<TileEntry> entries(static_cast<size_t>(columns) * rows);
+  const std::string temporary = filename + ".tmp";
+  {
+    File out(fopen(temporary.c_str(), "wb"));
+    const uint8_t placeholder[kHeaderSize] = {};
+    if (!out || !Write(out.get(), placeholder, kHeaderSize)) return false;
+    uint64_t offset = kHeaderSize;
+    for (int row = 0; row < rows; row++) {
+      for (int column = 0; column < columns; column++) {
+        const size_t i = static_cast<size_t>(row) * columns + column;
+        TileEntry& entry = entries[i];
+        const uint8_t* data;
+        if (in_sync &&
+            snapshot.GetTileGeneration(column, row) == saved_generations_[i]) {
+          entry = entries_[i];
+          data = file_.data() + entry.offset;
+        } else if (EncodeTile(snapshot, column, row, &entry)) {
+          data = blob_.data();
+        } else {
+          remove(temporary.c_str());
+          return false;
+        }
+        if (entry.size == 0) continue;
+        if (!Write(out.get(), data, entry.size)) {
+          remove(temporary.c_str());
+          return false;
+        }
+        entry.offset = offset;
+        offset += entry.size;
+      }
+    }
+    const std::vector<uint8_t> index = BuildIndex(metadata, entries);
+    const std::vector<uint8_t> header =
+        BuildHeader(snapshot.GetWidth(), snapshot.GetHeight(), offset, index);
+    if (!Write(out.get(), index.data(), index.size()) ||
+        fseek(out.get(), 0, SEEK_SET) != 0 ||
+        !Write(out.get(), header.data(), header.size()) || !Sync(out.get())) {
+      remove(temporary.c_str());
+      return false;
+    }
+  }
+  if (rename(temporary.c_str(), filename.c_str()) != 0) {
+    remove(temporary.c_str());
+    return false;
+  }
+  if (!Open(filename)) return false;
+  MarkSaved(snapshot);
+  return true;
+}
+
+bool ProjectFile::Append(const ImageSnapshot& snapshot,
+                         const Metadata& metadata) {
+  std::vector<TileEntry> entries = entries_;
+  {
+    File out(fopen(filename_.c_str(), "r+b"));
+    if (!out) return false;
+    // Another project may have saved to or replaced the file since, see
+    // OpenLike, so that entries_ no longer matches it. Write a new file,
+    // copying the unchanged tiles from the one still mapped.
+    uint8_t on_disk[kHeaderSize];
+    if (fread(on_disk, 1, kHeaderSize, out.get()) != kHeaderSize ||
+        memcmp(on_disk, file_.data(), kHeaderSize) != 0) {
+      out.reset();
+      const std::string filename = filename_;
+      return Rewrite(filename, snapshot, metadata);
+    }
+    if (fseeko(out.get(), 0, SEEK_END) != 0) return false;
+    uint64_t offset = ftello(out.get());
+    for (int row = 0; row < rows_; row++) {
+      for (int column = 0; column < columns_; column++) {
+        const size_t i = static_cast<size_t>(row) * columns_ + column;
+        if (snapshot.GetTileGeneration(column, row) == saved_generations_[i]) {
+          continue;
+        }
+        TileEntry& entry = entries[i];
+        if (!EncodeTile(snapshot, column, row, &entry)) return false;
+        if (entry.size == 0) continue;
+        if (!Write(out.get(), blob_.data(), entry.size)) return false;
+        entry.offset = offset;
+        offset += entry.size;
+      }
+    }
+    // The new tiles and index must be on disk before the header points at
+    // them. Until then the file still holds the previous version.
+    const std::vector<uint8_t> index = BuildIndex(metadata, entries);
+    const std::vector<uint8_t> header =
+        BuildHeader(width_, height_, offset, index);
+    if (!Write(out.get(), index.data(), index.size()) || !Sync(out.get()) ||
+        fseeko(out.get(), 0, SEEK_SET) != 0 ||
+        !Write(out.get(), header.data(), header.size()) || !Sync(out.get())) {
+      return false;
+    }
+  }
+  // Map the grown file.
+  const std::string filename = filename_;
+  if (!Open(filename)) return false;
+  MarkSaved(snapshot);
+  return true;
+}
+
+void ProjectFile::MarkSaved(const Image& image) {
+  image_ = &image;
+  saved_generations_.resize(entries_.size());
+  for (int row = 0; row < rows_; row++) {
+    for (int column = 0; column < columns_; column++) {
+      saved_generations_[row * columns_ + column] =
+          image.GetTileGeneration(column, row);
+    }
+  }
+}
+
+void ProjectFile::MarkSaved(const ImageSnapshot& snapshot) {
+  image_ = snapshot.GetImage();
+  saved_generations_.resize(entries_.size());
+  for (int row = 0; row < rows_; row++) {
+    for (int column = 0; column < columns_; column++) {
+      saved_generations_[row * columns_ + column] =
+          snapshot.GetTileGeneration(column, row);
+    }
+  }
+}
+
+}  // namespace graphics
@@ -0,0 +1,177 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "image.h"
+#include "mapped_file.h"
+
+#ifndef GRAPHICS_PROJECT_FILE_H
+#define GRAPHICS_PROJECT_FILE_H
+
+namespace graphics {
+
+/**
+ * A project file (.tpaint): an image stored as independently compressed
+ * tiles of Image::kTileSize pixels, plus named metadata such as tool
+ * settings.
+ *
+ * Opening a project only reads its index. Attach then makes an Image read
+ * each tile from the file the first time it is shown or drawn to, so even
+ * huge projects open almost instantly. Saving the attached image back to the
+ * same file appends just the tiles that changed since it was opened or last
+ * saved, followed by a new index.
+ *
+ * The layout, with all numbers little-endian, is:
+ *   - a 64-byte header: the magic "TPAINT01", width, height, tile size and
+ *     layer count (32 bits each), then the index offset, size and hash
+ *     (64 bits each);
+ *   - tile data: QOI-encoded tiles, in any order;
+ *   - the index: the number of metadata entries, each a length-prefixed key
+ *     and value, then one 16-byte entry per tile, row by row: the offset and
+ *     size of its data, or a size of 0 and an RGB color for tiles of a
+ *     single color.
+ * Images have a single layer, so the layer count is always 1 for now.
+ */
+class ProjectFile : public TileSource {
+ public:
+  using Metadata = std::map<std::string, std::string>;
+
+  ProjectFile() = default;
+  ProjectFile(const ProjectFile&) = delete;
+  ProjectFile& operator=(const ProjectFile&) = delete;
+
+  /**
+   * Opens the project in |filename|, reading only its header and index.
+   * Returns false, and leaves the project closed, if the file could not be
+   * read or is not a valid project.
+   */
+  bool Open(const std::string& filename);
+
+  /**
+   * Opens the file that |other| has open and takes over which image it
+   * holds, at which tile generations, so that Snapshot only takes the tiles
+   * changed since |other| attached or saved the image. Returns false, and
+   * leaves the project closed, if |other| is not open or the file changed
+   * since |other| last read or wrote it.
+   */
+  bool OpenLike(const ProjectFile& other);
+
+  /**
+   * Closes the project. Any image still reading tiles from it must be
+   * initialized or loaded again first.
+   */
+  void Close();
+
+  /**
+   * Makes |image| show the open project, reading each tile from the file
+   * the first time it is needed. The project must stay open while |image|
+   * has unread tiles, see Image::IsTileLoaded. Returns false if no project
+   * is open.
+   */
+  bool Attach(Image& image);
+
+  /**
+   * Saves |image| and |metadata| to |filename| and makes it the open
+   * project. If |filename| is already open and |image| was attached to it or
+   * last saved to it, only the tiles that changed since are written.
+   * Otherwise the whole project is written to a temporary file that then
+   * replaces |filename|. Returns false if saving failed.
+   */
+  bool Save(const std::string& filename, const Image& image,
+            const Metadata& metadata);
+
+  /**
+   * Takes the snapshot of |image| that Save needs: just the tiles that
+   * changed if the rest can be copied from the open project, or all of them.
+   * Taking it copies no pixels, see Image::Snapshot.
+   */
+  std::shared_ptr<ImageSnapshot> Snapshot(const Image& image) const;
+
+  /**
+   * Like Save, but saves a |snapshot| taken by Snapshot, with no calls on
+   * this project in between. This may run on another thread while the image
+   * is being drawn to, as long as the image does not read tiles from this
+   * project. Returns false if saving failed or the snapshot lacks tiles.
+   */
+  bool Save(const std::string& filename, const ImageSnapshot& snapshot,
+            const Metadata& metadata);
+
+  const std::string& GetFilename() const { return filename_; }
+  int GetWidth() const { return width_; }
+  int GetHeight() const { return height_; }
+  const Metadata& GetMetadata() const { return metadata_; }
+
+  /**
+   * Returns the size of the open file in bytes, or 0 if none is open.
+   */
+  size_t GetFileSize() const { return file_.size(); }
+
+  // Overridden from TileSource.
+  bool ReadTile(int column, int row, int width, int height,
+                uint8_t* const channels[3], int stride) override;
+
+ private:
+  // Where a tile's data is in the file. A |size| of 0 means the tile is all
+  // |color|, stored as 0xRRGGBB.
+  struct TileEntry {
+    uint64_t offset = 0;
+    uint32_t size = 0;
+    uint32_t color = 0;
+  };
+
+  // Returns true if |image|, |width| by |height| pixels, is the open
+  // project's image, as attached or last saved, with all its unchanged tiles
+  // still matching the file.
+  bool IsInSync(const Image* image, int width, int height) const;
+
+  // Compresses tile |column|, |row| of |snapshot| into |entry| and, unless it
+  // is a single color, |blob_|. Leaves |entry|'s offset for the caller.
+  // Returns false if the snapshot lacks the tile.
+  bool EncodeTile(const ImageSnapshot& snapshot, int column, int row,
+                  TileEntry* entry);
+
+  // Serializes |metadata| and |entries| as an index.
+  static std::vector<uint8_t> BuildIndex(const Metadata& metadata,
+                                         const std::vector<TileEntry>& entries);
+
+  bool Rewrite(const std::string& filename, const ImageSnapshot& snapshot,
+               const Metadata& metadata);
+  bool Append(const ImageSnapshot& snapshot, const Metadata& metadata);
+
+  // Remembers the tile generations of |image| or |snapshot| as the ones now
+  // on disk.
+  void MarkSaved(const Image& image);
+  void MarkSaved(const ImageSnapshot& snapshot);
+
+  std::string filename_;
+  MappedFile file_;
+  int width_ = 0;
+  int height_ = 0;
+  int columns_ = 0;
+  int rows_ = 0;
+  Metadata metadata_;
+  std::vector<TileEntry> entries_;
+
+  // The image the file holds, and the tile generations it had when it last
+  // matched the file. Unowned.
+  const Image* image_ = nullptr;
+  std::vector<uint64_t> saved_generations_;
+
+  // Scratch space for encoding one tile, and for decoding one. They are
+  // separate because encoding a tile may first read it from the file.
+  std::vector<uint8_t> planes_;
+  std::vector<uint8_t> blob_;
+  std::vector<uint8_t> decoded_;
+};
+
+}  // namespace graphics
+
+#endif  // GRAPHICS_PROJECT_FILE_H
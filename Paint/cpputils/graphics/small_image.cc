@@ -0,0 +1,175 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "small_image.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#include "cimg/CImg.h"
+
+namespace graphics {
+
+SmallImage::SmallImage(int width, int height, const Color& background) {
+  Initialize(width, height, background);
+}
+
+SmallImage::SmallImage(const SmallImage& other) { *this = other; }
+
+SmallImage& SmallImage::operator=(const SmallImage& other) {
+  if (this == &other) return *this;
+  if (other.width_ == 0) {
+    heap_.reset();
+    width_ = 0;
+    height_ = 0;
+  } else if (Allocate(other.width_, other.height_)) {
+    memcpy(GetPixels(), other.GetPixels(), GetPlaneSize() * 3);
+  }
+  return *this;
+}
+
+SmallImage::SmallImage(SmallImage&& other) { *this = std::move(other); }
+
+SmallImage& SmallImage::operator=(SmallImage&& other) {
+  if (this == &other) return *this;
+  if (other.heap_) {
+    heap_ = std::move(other.heap_);
+  } else {
+    heap_.reset();
+    memcpy(inline_, other.inline_, other.GetPlaneSize() * 3);
+  }
+  width_ = std::exchange(other.width_, 0);
+  height_ = std::exchange(other.height_, 0);
+  return *this;
+}
+
+bool SmallImage::Initialize(int width, int height, const Color& background) {
+  if (!Allocate(width, height)) return false;
+  const size_t plane_size = GetPlaneSize();
+  uint8_t* const pixels = GetPixels();
+  memset(pixels, background.Red(), plane_size);
+  memset(pixels + plane_size, background.Green(), plane_size);
+  memset(pixels + 2 * plane_size, background.Blue(), plane_size);
+  return true;
+}
+
+bool SmallImage::CopyFrom(const Image& image, int x, int y, int width,
+                          int height) {
+  if (x < 0 || y < 0 || width < 1 || height < 1 ||
+      x + width > image.GetWidth() || y + height > image.GetHeight()) {
+    return false;
+  }
+  if (!Allocate(width, height)) return false;
+  const size_t plane_size = GetPlaneSize();
+  for (int c = 0; c < 3; c++) {
+    const uint8_t* from = image.GetChannelData(c) +
+                          static_cast<size_t>(y) * image.GetWidth() + x;
+    uint8_t* to = GetPixels() + c * plane_size;
+    for (int row = 0; row < height; row++) {
+      memcpy(to, from, width);
+      from += image.GetWidth();
+      to += width;
+    }
+  }
+  return true;
+}
+
+const uint8_t* SmallImage::GetChannelData(int channel) const {
+  if (width_ == 0 || channel < 0 || channel > 2) return nullptr;
+  return GetPixels() + channel * GetPlaneSize();
+}
+
+Color SmallImage::GetColor(int x, int y) const {
+  if (!CheckPixelInBounds(x, y)) return Color(0, 0, 0);
+  const size_t plane_size = GetPlaneSize();
+  const uint8_t* const pixel = GetPixels() + y * width_ + x;
+  return Color(pixel[0], pixel[plane_size], pixel[2 * plane_size]);
+}
+
+bool SmallImage::SetColor(int x, int y, const Color& color) {
+  if (!CheckPixelInBounds(x, y)) return false;
+  const size_t plane_size = GetPlaneSize();
+  uint8_t* const pixel = GetPixels() + y * width_ + x;
+  pixel[0] = color.Red();
+  pixel[plane_size] = color.Green();
+  pixel[2 * plane_size] = color.Blue();
+  return true;
+}
+
+bool SmallImage::DrawLine(int x0, int y0, int x1, int y1, const Color& color,
+                          int thickness) {
+  if (thickness < 1 || !CheckPixelInBounds(x0, y0) ||
+      !CheckPixelInBounds(x1, y1)) {
+    return false;
+  }
+  if (x0 == x1 && y0 == y1) return true;
+  const int value[] = {color.Red(), color.Green(), color.Blue()};
+  // A view of the pixels, which does not allocate.
+  CImg<uint8_t> view(GetPixels(), width_, height_, 1, 3, /*is_shared=*/true);
+  if (thickness == 1) {
+    view.draw_line(x0, y0, x1, y1, value);
+    return true;
+  }
+  // The same quadrilateral as Image::DrawLine.
+  int xs[4];
+  int ys[4];
+  PolygonFiller::GetThickLineCorners(x0, y0, x1, y1, thickness, xs, ys);
+  uint8_t* const pixels = GetPixels();
+  const size_t plane = GetPlaneSize();
+  polygon_filler_.Fill(xs, ys, 4, width_, height_,
+                       [&](int y, int from, int to) {
+                         uint8_t* px = pixels + y * width_ + from;
+                         for (int c = 0; c < 3; c++) {
+                           memset(px, value[c], to - from + 1);
+                           px += plane;
+                         }
+                       });
+  return true;
+}
+
+bool SmallImage::DrawCircle(int x, int y, int radius, const Color& color) {
+  if (!CheckPixelInBounds(x, y)) return false;
+  const int value[] = {color.Red(), color.Green(), color.Blue()};
+  CImg<uint8_t> view(GetPixels(), width_, height_, 1, 3, /*is_shared=*/true);
+  view.draw_circle(x, y, radius, value);
+  return true;
+}
+
+bool SmallImage::DrawRectangle(int x, int y, int width, int height,
+                               const Color& color) {
+  if (!CheckPixelInBounds(x, y) || width < 0 || height < 0) return false;
+  const int value[] = {color.Red(), color.Green(), color.Blue()};
+  CImg<uint8_t> view(GetPixels(), width_, height_, 1, 3, /*is_shared=*/true);
+  view.draw_rectangle(x, y, x + width - 1, y + height - 1, value);
+  return true;
+}
+
+bool SmallImage::CheckPixelInBounds(int x, int y) const {
+  if (x < 0 || y < 0 || x >= width_ || y >= height_) {
+    std::cout << "(" << x << ", " << y << ") is out of bounds." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool SmallImage::Allocate(int width, int height) {
+  if (width < 1 || height < 1) return false;
+  const size_t size = static_cast<size_t>(width) * height * 3;
+  if (size <= sizeof(inline_)) {
+    heap_.reset();
+  } else if (!heap_ || heap_.size() < size) {
+    PixelBuffer pixels(size);
+    if (!pixels) return false;
+    heap_ = std::move(pixels);
+  }
+  width_ = width;
+  height_ = height;
+  return true;
+}
+
+}  // namespace graphics
@@ -0,0 +1,121 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <cstdint>
+
+#include "image.h"
+#include "pixel_pool.h"
+#include "polygon_filler.h"
+
+#ifndef GRAPHICS_SMALL_IMAGE_H
+#define GRAPHICS_SMALL_IMAGE_H
+
+namespace graphics {
+
+/**
+ * A small RGB image, like a button icon, brush stamp or glyph. Up to
+ * kInlinePixels pixels are stored in the object itself, so creating, copying
+ * and destroying one does not allocate, and thousands of them cost no more
+ * than their pixels. Larger ones keep their pixels in a pooled buffer.
+ *
+ * It has none of an Image's display, listeners, tiles or snapshots. Draw it
+ * onto an Image with Image::DrawImage, and copy part of an Image into it
+ * with CopyFrom. Its lines, circles and rectangles cover the same pixels as
+ * on an Image.
+ */
+class SmallImage {
+ public:
+  static constexpr int kInlinePixels = 32 * 32;
+
+  SmallImage() = default;
+
+  /**
+   * Creates a |width| by |height| image of |background|, or an empty one if
+   * the size is less than 1.
+   */
+  SmallImage(int width, int height,
+             const Color& background = Color(255, 255, 255));
+
+  SmallImage(const SmallImage& other);
+  SmallImage& operator=(const SmallImage& other);
+  SmallImage(SmallImage&& other);
+  SmallImage& operator=(SmallImage&& other);
+
+  /**
+   * Resets the image to |width| by |height| pixels of |background|. Returns
+   * false if the size is less than 1 or out of memory.
+   */
+  bool Initialize(int width, int height,
+                  const Color& background = Color(255, 255, 255));
+
+  /**
+   * Resets the image to the |width| by |height| pixels of |image| whose top
+   * left corner is at (|x|, |y|). Returns false if they are not all within
+   * |image|.
+   */
+  bool CopyFrom(const Image& image, int x, int y, int width, int height);
+
+  int GetWidth() const { return width_; }
+  int GetHeight() const { return height_; }
+
+  /**
+   * Returns true if the pixels are stored in the object itself.
+   */
+  bool IsInline() const { return !heap_; }
+
+  /**
+   * Returns the values of |channel| row by row, like
+   * Image::GetChannelData, or nullptr if the image is empty or |channel| is
+   * out of range.
+   */
+  const uint8_t* GetChannelData(int channel) const;
+
+  /**
+   * Returns the color of the pixel at (|x|, |y|), or black if it is out of
+   * bounds.
+   */
+  Color GetColor(int x, int y) const;
+
+  /**
+   * Sets the pixel at (|x|, |y|). Returns false if it is out of bounds.
+   */
+  bool SetColor(int x, int y, const Color& color);
+
+  /**
+   * Draw like the Image functions of the same name. Return false if the
+   * parameters are out of bounds.
+   */
+  bool DrawLine(int x0, int y0, int x1, int y1, const Color& color,
+                int thickness = 1);
+  bool DrawCircle(int x, int y, int radius, const Color& color);
+  bool DrawRectangle(int x, int y, int width, int height,
+                     const Color& color);
+
+ private:
+  bool CheckPixelInBounds(int x, int y) const;
+
+  uint8_t* GetPixels() { return heap_ ? heap_.data() : inline_; }
+  const uint8_t* GetPixels() const { return heap_ ? heap_.data() : inline_; }
+  size_t GetPlaneSize() const { return static_cast<size_t>(width_) * height_; }
+
+  // Makes room for |width| by |height| uninitialized pixels, reusing the
+  // storage if they fit. Returns false if the size is less than 1 or out of
+  // memory, leaving the image as it was.
+  bool Allocate(int width, int height);
+
+  int width_ = 0;
+  int height_ = 0;
+  // The pixels, as three planes, if there are more than kInlinePixels.
+  PixelBuffer heap_;
+  // The pixels, as three planes, otherwise.
+  uint8_t inline_[kInlinePixels * 3];
+  // Scratch space for thick lines.
+  PolygonFiller polygon_filler_;
+};
+
+}  // namespace graphics
+
+#endif  // GRAPHICS_SMALL_IMAGE_H
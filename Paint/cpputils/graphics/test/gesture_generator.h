@@ -0,0 +1,204 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../image_event.h"
+
+#ifndef GRAPHICS_GESTURE_GENERATOR_H
+#define GRAPHICS_GESTURE_GENERATOR_H
+
+namespace graphics {
+
+/**
+ * A MouseEvent and the time in seconds, from the start of the gesture
+ * sequence, at which it happens.
+ */
+struct TimedMouseEvent {
+  MouseEvent event;
+  double time;
+};
+
+/**
+ * Synthesizes mouse gestures for stress tests: random walks, spirals,
+ * scribbles and repeated clicks (which make the bucket fill the canvas).
+ * Every gesture is a complete press, drag and release sequence within a
+ * |width| by |height| image. Events are spaced 1 / |events_per_second|
+ * seconds apart, continuing from the end of the previous gesture. The same
+ * |seed| always produces the same gestures.
+ */
+class GestureGenerator {
+ public:
+  GestureGenerator(int width, int height, unsigned int seed = 1,
+                   int events_per_second = 1000)
+      : width_(width),
+        height_(height),
+        interval_(1.0 / events_per_second),
+        random_(seed) {}
+
+  /**
+   * Drags from a random point, moving up to |max_step| pixels in each
+   * direction per event, for |steps| events.
+   */
+  std::vector<TimedMouseEvent> RandomWalk(int steps, int max_step) {
+    std::vector<TimedMouseEvent> events;
+    std::uniform_int_distribution<int> step(-max_step, max_step);
+    int x = RandomX();
+    int y = RandomY();
+    Add(&events, x, y, MouseAction::kPressed);
+    for (int i = 0; i < steps; i++) {
+      x += step(random_);
+      y += step(random_);
+      Add(&events, x, y, MouseAction::kDragged);
+    }
+    Add(&events, x, y, MouseAction::kReleased);
+    return events;
+  }
+
+  /**
+   * Drags outwards from (|center_x|, |center_y|) in a spiral of |turns|
+   * turns ending at |max_radius|, with |points_per_turn| events per turn.
+   */
+  std::vector<TimedMouseEvent> Spiral(int center_x, int center_y,
+                                      int max_radius, int turns,
+                                      int points_per_turn = 64) {
+    std::vector<TimedMouseEvent> events;
+    Add(&events, center_x, center_y, MouseAction::kPressed);
+    const int points = turns * points_per_turn;
+    int x = center_x;
+    int y = center_y;
+    for (int i = 1; i <= points; i++) {
+      const double fraction = static_cast<double>(i) / points;
+      const double angle = 2 * M_PI * turns * fraction;
+      x = center_x + static_cast<int>(max_radius * fraction * std::cos(angle));
+      y = center_y + static_cast<int>(max_radius * fraction * std::sin(angle));
+      Add(&events, x, y, MouseAction::kDragged);
+    }
+    Add(&events, x, y, MouseAction::kReleased);
+    return events;
+  }
+
+  /**
+   * Draws |strokes| strokes, each dragging through |points_per_stroke|
+   * random points anywhere in the image, with a kMoved event between
+   * strokes.
+   */
+  std::vector<TimedMouseEvent> Scribble(int strokes, int points_per_stroke) {
+    std::vector<TimedMouseEvent> events;
+    for (int stroke = 0; stroke < strokes; stroke++) {
+      int x = RandomX();
+      int y = RandomY();
+      Add(&events, x, y, MouseAction::kMoved);
+      Add(&events, x, y, MouseAction::kPressed);
+      for (int i = 0; i < points_per_stroke; i++) {
+        x = RandomX();
+        y = RandomY();
+        Add(&events, x, y, MouseAction::kDragged);
+      }
+      Add(&events, x, y, MouseAction::kReleased);
+    }
+    return events;
+  }
+
+  /**
+   * Clicks |count| times at random points, which with the bucket tool
+   * fills large regions of the image on every click.
+   */
+  std::vector<TimedMouseEvent> Clicks(int count) {
+    std::vector<TimedMouseEvent> events;
+    for (int i = 0; i < count; i++) {
+      const int x = RandomX();
+      const int y = RandomY();
+      Add(&events, x, y, MouseAction::kPressed);
+      Add(&events, x, y, MouseAction::kReleased);
+    }
+    return events;
+  }
+
+ private:
+  int RandomX() {
+    return std::uniform_int_distribution<int>(0, width_ - 1)(random_);
+  }
+
+  int RandomY() {
+    return std::uniform_int_distribution<int>(0, height_ - 1)(random_);
+  }
+
+  // Appends an event at (x, y), clamped to the image, at the next time step.
+  void Add(std::vector<TimedMouseEvent>* events, int x, int y,
+           MouseAction action) {
+    x = std::max(0, std::min(width_ - 1, x));
+    y = std::max(0, std::min(height_ - 1, y));
+    events->push_back({MouseEvent(x, y, action), time_});
+    time_ += interval_;
+  }
+
+  int width_;
+  int height_;
+  double interval_;
+  double time_ = 0;
+  std::mt19937 random_;
+};
+
+/**
+ * Throughput and latency of a replayed gesture sequence.
+ */
+struct GestureStats {
+  int events = 0;
+  // Wall time spent replaying, in seconds.
+  double seconds = 0;
+  // Events handled per second of wall time.
+  double events_per_second = 0;
+  // Longest and average time spent handling one event, in seconds.
+  double worst_event_seconds = 0;
+  double mean_event_seconds = 0;
+};
+
+/**
+ * Sends |events| to |listener| without a display and measures how long
+ * handling each one takes. If |paced| is true, waits until each event's
+ * time before sending it, to simulate input arriving at the generator's
+ * rate; otherwise sends events back to back to find the sustainable
+ * throughput.
+ */
+GestureStats ReplayGestures(const std::vector<TimedMouseEvent>& events,
+                            MouseEventListener& listener, bool paced = false) {
+  using Clock = std::chrono::steady_clock;
+  GestureStats stats;
+  const Clock::time_point start = Clock::now();
+  double busy = 0;
+  for (const TimedMouseEvent& timed : events) {
+    if (paced) {
+      std::this_thread::sleep_until(
+          start + std::chrono::duration_cast<Clock::duration>(
+                      std::chrono::duration<double>(timed.time)));
+    }
+    const Clock::time_point before = Clock::now();
+    listener.OnMouseEvent(timed.event);
+    const double elapsed =
+        std::chrono::duration<double>(Clock::now() - before).count();
+    stats.worst_event_seconds = std::max(stats.worst_event_seconds, elapsed);
+    busy += elapsed;
+    stats.events++;
+  }
+  stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  if (stats.events > 0) {
+    stats.mean_event_seconds = busy / stats.events;
+  }
+  if (stats.seconds > 0) {
+    stats.events_per_second = stats.events / stats.seconds;
+  }
+  return stats;
+}
+
+}  // namespace graphics
+
+#endif  // GRAPHICS_GESTURE_GENERATOR_H
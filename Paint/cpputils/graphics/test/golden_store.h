@@ -0,0 +1,113 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+
+#include "../image.h"
+#include "../image_hash.h"
+#include "image_test_utils.h"
+
+#ifndef GRAPHICS_GOLDEN_STORE_H
+#define GRAPHICS_GOLDEN_STORE_H
+
+namespace graphics {
+
+/*
+ * A content-addressed store of golden (reference) images for tests.
+ *
+ * Each golden is recorded under a name. The store keeps an index from names
+ * to 128-bit content hashes in |directory|/index.txt, and the reference
+ * images themselves in |directory|/objects/<hash>.qoi, so identical goldens
+ * are only stored once.
+ *
+ * Checking an image against a golden only hashes it. The reference image is
+ * read from disk only if the hashes differ, to produce a diff.
+ */
+class GoldenStore {
+ public:
+  /*
+   * Opens the store in |directory|, creating it if needed. If
+   * |record_missing| is true, checking an image against a name that has no
+   * golden yet records the image as the golden and passes.
+   */
+  explicit GoldenStore(const std::string& directory,
+                       bool record_missing = false)
+      : directory_(directory), record_missing_(record_missing) {
+    std::filesystem::create_directories(directory_ / "objects");
+    std::ifstream index(directory_ / "index.txt");
+    std::string name;
+    std::string hash;
+    while (index >> name >> hash) {
+      index_[name] = hash;
+    }
+  }
+
+  /*
+   * Returns true if a golden was recorded under |name|.
+   */
+  bool Contains(const std::string& name) const {
+    return index_.find(name) != index_.end();
+  }
+
+  /*
+   * Records |image| as the golden for |name|, replacing any previous one.
+   * Names may not contain whitespace. Returns false if saving failed.
+   */
+  bool Record(const std::string& name, const Image& image) {
+    const std::string hash = HashImage128(image).ToString();
+    const std::filesystem::path object = ObjectPath(hash);
+    if (!std::filesystem::exists(object) &&
+        !image.SaveFast(object.string())) {
+      return false;
+    }
+    index_[name] = hash;
+    std::ofstream index(directory_ / "index.txt", std::ios::trunc);
+    for (const auto& entry : index_) {
+      index << entry.first << " " << entry.second << "\n";
+    }
+    return static_cast<bool>(index);
+  }
+
+  /*
+   * Returns true if |image| matches the golden recorded for |name|. If it
+   * does not, saves a diff of the golden and |image| in |diff_file| and
+   * returns false.
+   */
+  bool Check(const std::string& name, const Image& image,
+             const std::string& diff_file) {
+    auto entry = index_.find(name);
+    if (entry == index_.end()) {
+      if (record_missing_) return Record(name, image);
+      std::cout << "No golden image recorded for " << name << std::endl;
+      return false;
+    }
+    if (HashImage128(image).ToString() == entry->second) return true;
+
+    Image expected;
+    if (!expected.LoadFast(ObjectPath(entry->second).string())) {
+      std::cout << "Golden image for " << name << " is missing" << std::endl;
+      return false;
+    }
+    return ImagesMatch(&expected, &image, diff_file, kTypeHighlight);
+  }
+
+ private:
+  std::filesystem::path ObjectPath(const std::string& hash) const {
+    return directory_ / "objects" / (hash + ".qoi");
+  }
+
+  std::filesystem::path directory_;
+  bool record_missing_;
+  std::map<std::string, std::string> index_;
+};
+
+}  // namespace graphics
+
+#endif  // GRAPHICS_GOLDEN_STORE_H
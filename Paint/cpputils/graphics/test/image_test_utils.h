@@ -4,10 +4,12 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT.
 
+#include <cstdlib>
 #include <iostream>
 #include <string>
 
 #include "../image.h"
+#include "../image_compare.h"
 
 #ifndef IMAGE_TEST_UTILS_H
 #define IMAGE_TEST_UTILS_H
@@ -19,33 +21,38 @@ enum DiffType {
 };
 
 /*
- * Returns true if the image |expected| and |actual| are a pixel perfect
- * match. If they are not a perfect match, saves a new image in |output_file|
- * depending on the |diff_type| chosen, and returns false.
+ * Returns true if the images |expected| and |actual| match according to
+ * |options| (by default, a pixel perfect match). If they do not match, saves
+ * a new image in |output_file| depending on the |diff_type| chosen, and
+ * returns false. The diff image is only built when the images differ.
  */
-bool ImagesMatch(graphics::Image* expected, graphics::Image* actual,
-                 std::string output_file, DiffType diff_type) {
+bool ImagesMatch(const graphics::Image* expected,
+                 const graphics::Image* actual, std::string output_file,
+                 DiffType diff_type, const graphics::CompareOptions& options) {
   int width = expected->GetWidth();
   int height = expected->GetHeight();
-  if (width != actual->GetWidth() || height != actual->GetHeight()) {
+  graphics::CompareResult comparison =
+      graphics::CompareImages(*expected, *actual, options);
+  if (!comparison.same_size) {
     std::cout << "Images are different dimensions. Expected: " << width
               << " by " << height << "px" << std::endl;
     return false;
   }
+  if (comparison.match) return true;
 
   // Create the output image. If we want a side-by-side comparison, it
   // has twice the width.
   graphics::Image result(diff_type == kTypeSideBySide ? width * 2 : width,
                          height);
-  bool matching = true;
-  for (int i = 0; i < width; i++) {
-    for (int j = 0; j < height; j++) {
+  const int tolerance[] = {options.tolerance.Red(), options.tolerance.Green(),
+                           options.tolerance.Blue()};
+  for (int j = 0; j < height; j++) {
+    for (int i = 0; i < width; i++) {
       graphics::Color c_actual = actual->GetColor(i, j);
       graphics::Color c_expected = expected->GetColor(i, j);
-      if (c_actual.Red() != c_expected.Red() ||
-          c_actual.Green() != c_expected.Green() ||
-          c_actual.Blue() != c_expected.Blue()) {
-        matching = false;
+      if (std::abs(c_actual.Red() - c_expected.Red()) > tolerance[0] ||
+          std::abs(c_actual.Green() - c_expected.Green()) > tolerance[1] ||
+          std::abs(c_actual.Blue() - c_expected.Blue()) > tolerance[2]) {
         if (diff_type == kTypeHighlight) {
           // Saturate the red in the result where the channels
           // differ. This is good if the diff is likely to be
@@ -70,13 +77,30 @@ bool ImagesMatch(graphics::Image* expected, graphics::Image* actual,
     }
   }
 
-  if (matching) return true;
-  std::cout << "Images do not match. See " << output_file << " for diff."
-            << std::endl;
+  std::cout << "Images do not match";
+  if (comparison.complete) {
+    std::cout << ": " << comparison.differing_pixels
+              << " pixels differ between (" << comparison.min_x << ", "
+              << comparison.min_y << ") and (" << comparison.max_x << ", "
+              << comparison.max_y << "), PSNR " << comparison.psnr << "dB";
+  }
+  std::cout << ". See " << output_file << " for diff." << std::endl;
   result.SaveImageBmp(output_file);
   return false;
 }
 
+/*
+ * Returns true if the image |expected| and |actual| are a pixel perfect
+ * match. If they are not a perfect match, saves a new image in |output_file|
+ * depending on the |diff_type| chosen, and returns false.
+ */
+bool ImagesMatch(const graphics::Image* expected,
+                 const graphics::Image* actual, std::string output_file,
+                 DiffType diff_type) {
+  return ImagesMatch(expected, actual, output_file, diff_type,
+                     graphics::CompareOptions());
+}
+
 /*
  * Returns true if the file in |expected_file| and in |actual_file|
  * are a pixel perfect match. If they are not a perfect match, saves
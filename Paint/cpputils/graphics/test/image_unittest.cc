@@ -6,9 +6,40 @@
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <jpeglib.h>
+#include <png.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include "../canvas.h"
 #include "../image.h"
+#include "../image_compare.h"
+#include "../image_hash.h"
+#include "../image_io.h"
+#include "../indexed_image.h"
+#include "../memory_registry.h"
+#include "../pixel_image.h"
+#include "../pixel_pool.h"
+#include "../project_file.h"
+#include "../small_image.h"
+#include "../thumbnail_cache.h"
+#include "../timelapse.h"
+#include "gesture_generator.h"
+#include "golden_store.h"
 #include "image_test_utils.h"
 #include "test_event_generator.h"
 
@@ -206,6 +237,579 @@ TEST(ImageTest, DrawsLinesWithThickness) {
   EXPECT_NE(actual.GetColor(size / 2, size / 2 + std::sqrt(2 * thickness * thickness)), green);
 }
 
+namespace {
+
+std::string ReadFile(const std::string& filename) {
+  std::ifstream file(filename, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(file),
+                     std::istreambuf_iterator<char>());
+}
+
+std::vector<uint8_t> InterleaveRgb(const graphics::Image& image) {
+  std::vector<uint8_t> rgb;
+  rgb.reserve(image.GetWidth() * image.GetHeight() * 3);
+  for (int y = 0; y < image.GetHeight(); y++) {
+    for (int x = 0; x < image.GetWidth(); x++) {
+      const graphics::Color color = image.GetColor(x, y);
+      rgb.push_back(color.Red());
+      rgb.push_back(color.Green());
+      rgb.push_back(color.Blue());
+    }
+  }
+  return rgb;
+}
+
+bool WriteTestPng(const std::string& filename, const graphics::Image& image) {
+  std::vector<uint8_t> rgb = InterleaveRgb(image);
+  png_image png = {};
+  png.version = PNG_IMAGE_VERSION;
+  png.width = image.GetWidth();
+  png.height = image.GetHeight();
+  png.format = PNG_FORMAT_RGB;
+  return png_image_write_to_file(&png, filename.c_str(), 0, rgb.data(), 0,
+                                 nullptr);
+}
+
+bool WriteTestJpeg(const std::string& filename, const graphics::Image& image) {
+  std::vector<uint8_t> rgb = InterleaveRgb(image);
+  FILE* file = fopen(filename.c_str(), "wb");
+  if (!file) return false;
+  jpeg_compress_struct info;
+  jpeg_error_mgr error;
+  info.err = jpeg_std_error(&error);
+  jpeg_create_compress(&info);
+  jpeg_stdio_dest(&info, file);
+  info.image_width = image.GetWidth();
+  info.image_height = image.GetHeight();
+  info.input_components = 3;
+  info.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&info);
+  jpeg_set_quality(&info, 95, TRUE);
+  // No chroma subsampling, which would blur the hard edges.
+  info.comp_info[0].h_samp_factor = 1;
+  info.comp_info[0].v_samp_factor = 1;
+  jpeg_start_compress(&info, TRUE);
+  while (info.next_scanline < info.image_height) {
+    JSAMPROW row = rgb.data() + info.next_scanline * image.GetWidth() * 3;
+    jpeg_write_scanlines(&info, &row, 1);
+  }
+  jpeg_finish_compress(&info);
+  jpeg_destroy_compress(&info);
+  fclose(file);
+  return true;
+}
+
+// Fills |image| with smooth gradients and hard edges, like a painting.
+void PaintTestImage(graphics::Image& image) {
+  const int width = image.GetWidth();
+  const int height = image.GetHeight();
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      image.SetColor(x, y, graphics::Color(x * 255 / width, y * 255 / height,
+                                           128));
+    }
+  }
+  image.DrawCircle(width / 2, height / 2, height / 3,
+                   graphics::Color(250, 20, 20));
+  image.DrawLine(0, height - 1, width - 1, 0, graphics::Color(0, 0, 0), 5);
+}
+
+}  // namespace
+
+TEST(ImageIoTest, RoundTripsBmpWithPaddedRows) {
+  // Widths where rows need 0 to 3 bytes of padding.
+  for (int width = 1; width <= 4; width++) {
+    graphics::Image image(width, 3);
+    for (int x = 0; x < width; x++) {
+      for (int y = 0; y < 3; y++) {
+        image.SetColor(x, y, graphics::Color(x * 60, y * 100, 7));
+      }
+    }
+    ASSERT_TRUE(image.SaveImageBmp("io_test.bmp"));
+    EXPECT_EQ(ReadFile("io_test.bmp").size(), 54 + 3 * ((width * 3 + 3) / 4 * 4));
+
+    graphics::Image loaded;
+    ASSERT_TRUE(loaded.Load("io_test.bmp"));
+    EXPECT_TRUE(ImagesMatch(&image, &loaded, "RoundTripsBmp.bmp",
+                            DiffType::kTypeHighlight));
+  }
+  remove("io_test.bmp");
+}
+
+TEST(ImageIoTest, ThreadsWriteIdenticalBmp) {
+  graphics::Image image(517, 301);
+  image.DrawCircle(250, 150, 120, graphics::Color(10, 200, 30));
+  image.DrawLine(0, 0, 516, 300, graphics::Color(255, 0, 128), 9);
+  const uint8_t* channels[3] = {image.GetChannelData(0),
+                                image.GetChannelData(1),
+                                image.GetChannelData(2)};
+  ASSERT_TRUE(graphics::image_io::WriteBmp("io_one.bmp", 517, 301, channels, 1));
+  ASSERT_TRUE(graphics::image_io::WriteBmp("io_many.bmp", 517, 301, channels, 7));
+  EXPECT_EQ(ReadFile("io_one.bmp"), ReadFile("io_many.bmp"));
+  remove("io_one.bmp");
+  remove("io_many.bmp");
+}
+
+TEST(ImageIoTest, ReadsTopDown32BitBmp) {
+  // A 2x2 BI_BITFIELDS image stored top row first, with BGRX pixels.
+  const uint8_t bmp[] = {
+      'B', 'M', 82, 0, 0, 0, 0, 0, 0, 0, 66, 0, 0, 0,
+      40, 0, 0, 0, 2, 0, 0, 0, 0xFE, 0xFF, 0xFF, 0xFF, 1, 0, 32, 0,
+      3, 0, 0, 0, 16, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0xFF, 0, 0, 0xFF, 0, 0, 0xFF, 0, 0, 0,
+      1, 2, 3, 0, 4, 5, 6, 0, 7, 8, 9, 0, 10, 11, 12, 0};
+  {
+    std::ofstream file("io_test.bmp", std::ios::binary);
+    file.write(reinterpret_cast<const char*>(bmp), sizeof(bmp));
+  }
+  graphics::Image loaded;
+  ASSERT_TRUE(loaded.Load("io_test.bmp"));
+  ASSERT_EQ(loaded.GetWidth(), 2);
+  ASSERT_EQ(loaded.GetHeight(), 2);
+  EXPECT_EQ(loaded.GetColor(0, 0), graphics::Color(3, 2, 1));
+  EXPECT_EQ(loaded.GetColor(1, 0), graphics::Color(6, 5, 4));
+  EXPECT_EQ(loaded.GetColor(0, 1), graphics::Color(9, 8, 7));
+  EXPECT_EQ(loaded.GetColor(1, 1), graphics::Color(12, 11, 10));
+  remove("io_test.bmp");
+}
+
+TEST(ImageIoTest, DecodesPngInProcess) {
+  graphics::Image painting(37, 23);
+  PaintTestImage(painting);
+  ASSERT_TRUE(WriteTestPng("io_test.png", painting));
+  graphics::Image loaded;
+  ASSERT_TRUE(loaded.Load("io_test.png"));
+  EXPECT_TRUE(ImagesMatch(&painting, &loaded, "DecodesPng.bmp",
+                          DiffType::kTypeHighlight));
+
+  // The example is a 2-bit palette image.
+  graphics::Image tree;
+  ASSERT_TRUE(tree.Load("example_fractal_tree.png"));
+  EXPECT_EQ(tree.GetWidth(), 500);
+  EXPECT_EQ(tree.GetHeight(), 500);
+  remove("io_test.png");
+}
+
+TEST(ImageIoTest, DecodesJpegInProcess) {
+  graphics::Image painting(64, 48);
+  PaintTestImage(painting);
+  ASSERT_TRUE(WriteTestJpeg("io_test.jpg", painting));
+  graphics::Image loaded;
+  ASSERT_TRUE(loaded.Load("io_test.jpg"));
+
+  // JPEG is lossy, so allow small differences, mostly along the edges.
+  graphics::CompareOptions options;
+  options.tolerance = graphics::Color(24, 24, 24);
+  options.max_differing_pixels = 64 * 48 / 20;
+  EXPECT_TRUE(ImagesMatch(&painting, &loaded, "DecodesJpeg.bmp",
+                          DiffType::kTypeHighlight, options));
+  remove("io_test.jpg");
+}
+
+TEST(ImageIoTest, RejectsTruncatedFiles) {
+  graphics::Image painting(40, 30);
+  PaintTestImage(painting);
+  ASSERT_TRUE(WriteTestPng("io_test.png", painting));
+  ASSERT_TRUE(WriteTestJpeg("io_test.jpg", painting));
+  for (const std::string filename : {"io_test.png", "io_test.jpg"}) {
+    const std::string contents = ReadFile(filename);
+    std::ofstream(filename, std::ios::binary)
+        .write(contents.data(), contents.size() / 2);
+    std::vector<uint8_t> planes;
+    EXPECT_FALSE(graphics::image_io::Read(
+        filename, [&](int width, int height, uint8_t* channels[3]) {
+          planes.resize(width * height * 3);
+          for (int c = 0; c < 3; c++) {
+            channels[c] = planes.data() + c * width * height;
+          }
+          return true;
+        }))
+        << filename;
+    remove(filename.c_str());
+  }
+
+  // A bitmap header promising more pixels than the file holds is rejected
+  // before anything is allocated for them.
+  ASSERT_TRUE(painting.SaveImageBmp("io_test.bmp"));
+  std::string header = ReadFile("io_test.bmp").substr(0, 60);
+  header.replace(18, 8, std::string("\xA0\x86\x01\0\xA0\x86\x01\0", 8));
+  std::ofstream("io_test.bmp", std::ios::binary)
+      .write(header.data(), header.size());
+  bool allocated = false;
+  EXPECT_FALSE(graphics::image_io::Read(
+      "io_test.bmp", [&](int, int, uint8_t*[3]) {
+        allocated = true;
+        return false;
+      }));
+  EXPECT_FALSE(allocated);
+  remove("io_test.bmp");
+}
+
+TEST(ImageIoTest, EncodesQoi) {
+  // White is a small difference from the initial black, then a run.
+  graphics::Image image(2, 1);
+  ASSERT_TRUE(image.SaveFast("io_test.qoi"));
+  const std::string expected("qoif\0\0\0\2\0\0\0\1\3\0"
+                             "\x55\xC0"
+                             "\0\0\0\0\0\0\0\1",
+                             24);
+  EXPECT_EQ(ReadFile("io_test.qoi"), expected);
+  remove("io_test.qoi");
+}
+
+TEST(ImageIoTest, RoundTripsQoi) {
+  graphics::Image painting(211, 97);
+  PaintTestImage(painting);
+  // Long runs, and colors that only an RGB chunk can encode.
+  painting.DrawRectangle(0, 0, 150, 20, graphics::Color(3, 250, 9));
+  painting.SetColor(100, 50, graphics::Color(255, 0, 255));
+  ASSERT_TRUE(painting.SaveFast("io_test.qoi"));
+
+  graphics::Image loaded;
+  ASSERT_TRUE(loaded.LoadFast("io_test.qoi"));
+  EXPECT_TRUE(ImagesMatch(&painting, &loaded, "RoundTripsQoi.bmp",
+                          DiffType::kTypeHighlight));
+  graphics::Image sniffed;
+  ASSERT_TRUE(sniffed.Load("io_test.qoi"));
+  EXPECT_EQ(graphics::HashImage(sniffed), graphics::HashImage(painting));
+
+  // Truncated files are rejected.
+  const std::string contents = ReadFile("io_test.qoi");
+  std::ofstream("io_test.qoi", std::ios::binary)
+      .write(contents.data(), contents.size() - 20);
+  EXPECT_FALSE(loaded.LoadFast("io_test.qoi"));
+  EXPECT_EQ(loaded.GetWidth(), 0);
+  remove("io_test.qoi");
+}
+
+TEST(ImageIoTest, KeepsExistingFileWhenQoiSaveFails) {
+  // Noise encodes to over 4 MB, so it is written in several pieces.
+  graphics::Image painting(1200, 1000);
+  uint32_t seed = 1;
+  for (int y = 0; y < 1000; y++) {
+    for (int x = 0; x < 1200; x++) {
+      seed = seed * 1664525 + 1013904223;
+      painting.SetColor(x, y, graphics::Color(seed >> 24, seed >> 16 & 0xFF,
+                                              seed >> 8 & 0xFF));
+    }
+  }
+  ASSERT_TRUE(painting.SaveFast("io_test.qoi"));
+  graphics::Image loaded;
+  ASSERT_TRUE(loaded.LoadFast("io_test.qoi"));
+  EXPECT_EQ(graphics::HashImage(loaded), graphics::HashImage(painting));
+  const std::string saved = ReadFile("io_test.qoi");
+  EXPECT_GT(saved.size(), 4u << 20);
+
+  // A cancelled save leaves the last one in place, with no temporary file.
+  const uint8_t* const channels[3] = {painting.GetChannelData(0),
+                                      painting.GetChannelData(1),
+                                      painting.GetChannelData(2)};
+  graphics::Image blank(1200, 1000);
+  const uint8_t* const blank_channels[3] = {blank.GetChannelData(0),
+                                            blank.GetChannelData(1),
+                                            blank.GetChannelData(2)};
+  EXPECT_FALSE(graphics::image_io::WriteQoi(
+      "io_test.qoi", 1200, 1000, blank_channels,
+      [](double fraction) { return fraction < 0.5; }));
+  EXPECT_EQ(ReadFile("io_test.qoi"), saved);
+  EXPECT_FALSE(std::ifstream("io_test.qoi.tmp").good());
+
+  // So does a save into a directory that cannot be written.
+  EXPECT_FALSE(graphics::image_io::WriteQoi("no_such_directory/io_test.qoi",
+                                            1200, 1000, channels));
+  remove("io_test.qoi");
+}
+
+// Reports the size and speed of SaveFast and LoadFast next to SaveImageBmp
+// and Load of a bitmap.
+TEST(ImageIoTest, BenchmarksQoiAgainstBmp) {
+  const int width = 1600;
+  const int height = 1200;
+  const double megapixels = width * height / 1e6;
+  graphics::Image painting(width, height);
+  PaintTestImage(painting);
+  const int repetitions = 3;
+  using Clock = std::chrono::steady_clock;
+  auto time_ms = [&](const std::function<bool()>& run) {
+    const auto start = Clock::now();
+    for (int i = 0; i < repetitions; i++) {
+      EXPECT_TRUE(run());
+    }
+    return std::chrono::duration<double>(Clock::now() - start).count() * 1000 /
+           repetitions;
+  };
+  graphics::Image loaded;
+  const double bmp_save_ms =
+      time_ms([&] { return painting.SaveImageBmp("io_bench.bmp"); });
+  const double bmp_load_ms =
+      time_ms([&] { return loaded.Load("io_bench.bmp"); });
+  const double qoi_save_ms =
+      time_ms([&] { return painting.SaveFast("io_bench.qoi"); });
+  const double qoi_load_ms =
+      time_ms([&] { return loaded.LoadFast("io_bench.qoi"); });
+  const size_t bmp_bytes = ReadFile("io_bench.bmp").size();
+  const size_t qoi_bytes = ReadFile("io_bench.qoi").size();
+  EXPECT_LT(qoi_bytes, bmp_bytes);
+  EXPECT_EQ(graphics::HashImage(loaded), graphics::HashImage(painting));
+
+  RecordProperty("bmp_bytes", static_cast<int>(bmp_bytes));
+  RecordProperty("qoi_bytes", static_cast<int>(qoi_bytes));
+  RecordProperty("bmp_save_us_per_megapixel",
+                 static_cast<int>(bmp_save_ms * 1000 / megapixels));
+  RecordProperty("qoi_save_us_per_megapixel",
+                 static_cast<int>(qoi_save_ms * 1000 / megapixels));
+  RecordProperty("bmp_load_us_per_megapixel",
+                 static_cast<int>(bmp_load_ms * 1000 / megapixels));
+  RecordProperty("qoi_load_us_per_megapixel",
+                 static_cast<int>(qoi_load_ms * 1000 / megapixels));
+  remove("io_bench.bmp");
+  remove("io_bench.qoi");
+}
+
+// Reports how long Image::Load takes per megapixel for each native format.
+TEST(ImageIoTest, BenchmarksLoadTimePerMegapixel) {
+  const int width = 1600;
+  const int height = 1200;
+  const double megapixels = width * height / 1e6;
+  graphics::Image painting(width, height);
+  PaintTestImage(painting);
+  ASSERT_TRUE(painting.SaveImageBmp("io_bench.bmp"));
+  ASSERT_TRUE(WriteTestPng("io_bench.png", painting));
+  ASSERT_TRUE(WriteTestJpeg("io_bench.jpg", painting));
+  const int repetitions = 3;
+  for (const std::string format : {"bmp", "png", "jpg"}) {
+    const std::string filename = "io_bench." + format;
+    graphics::Image loaded;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; i++) {
+      ASSERT_TRUE(loaded.Load(filename));
+    }
+    const double seconds = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+    EXPECT_EQ(loaded.GetWidth(), width);
+    const double ms_per_megapixel = seconds * 1000 / repetitions / megapixels;
+    RecordProperty(format + "_load_us_per_megapixel",
+                   static_cast<int>(ms_per_megapixel * 1000));
+    remove(filename.c_str());
+  }
+}
+
+TEST(ImageCompareTest, IdenticalImagesMatch) {
+  // Odd sizes exercise both the 16-pixel and the per-pixel paths.
+  graphics::Image expected(101, 37);
+  graphics::Image actual(101, 37);
+  expected.DrawCircle(50, 18, 10, 10, 200, 30);
+  actual.DrawCircle(50, 18, 10, 10, 200, 30);
+  graphics::CompareResult result = graphics::CompareImages(expected, actual);
+  EXPECT_TRUE(result.match);
+  EXPECT_TRUE(result.same_size);
+  EXPECT_TRUE(result.complete);
+  EXPECT_EQ(result.differing_pixels, 0);
+  EXPECT_TRUE(std::isinf(result.psnr));
+}
+
+TEST(ImageCompareTest, DifferentSizesDoNotMatch) {
+  graphics::Image expected(10, 20);
+  graphics::Image actual(20, 10);
+  graphics::CompareResult result = graphics::CompareImages(expected, actual);
+  EXPECT_FALSE(result.match);
+  EXPECT_FALSE(result.same_size);
+}
+
+TEST(ImageCompareTest, ReportsDiffStatistics) {
+  graphics::Image expected(100, 50);
+  graphics::Image actual(100, 50);
+  actual.DrawRectangle(20, 10, 30, 5, 0, 0, 0);
+  actual.SetColor(99, 49, graphics::Color(254, 255, 255));
+
+  graphics::CompareOptions options;
+  options.early_exit = false;
+  graphics::CompareResult result =
+      graphics::CompareImages(expected, actual, options);
+  EXPECT_FALSE(result.match);
+  EXPECT_TRUE(result.complete);
+  EXPECT_EQ(result.differing_pixels, 30 * 5 + 1);
+  EXPECT_EQ(result.min_x, 20);
+  EXPECT_EQ(result.min_y, 10);
+  EXPECT_EQ(result.max_x, 99);
+  EXPECT_EQ(result.max_y, 49);
+  double mse = (30 * 5 * 3 * 255.0 * 255.0 + 1) / (100 * 50 * 3);
+  EXPECT_NEAR(result.psnr, 10 * std::log10(255.0 * 255.0 / mse), 1e-9);
+
+  // Within tolerance, only the rectangle differs.
+  options.tolerance = graphics::Color(1, 0, 0);
+  result = graphics::CompareImages(expected, actual, options);
+  EXPECT_EQ(result.differing_pixels, 30 * 5);
+  EXPECT_EQ(result.max_x, 49);
+  EXPECT_EQ(result.max_y, 14);
+
+  // Enough differing pixels are allowed.
+  options.max_differing_pixels = 30 * 5;
+  EXPECT_TRUE(graphics::CompareImages(expected, actual, options).match);
+}
+
+TEST(ImageCompareTest, ThreadsAgreeWithSingleThread) {
+  graphics::Image expected(300, 200);
+  graphics::Image actual(300, 200);
+  actual.DrawLine(0, 0, 299, 199, 0, 0, 255, 5);
+  actual.DrawCircle(150, 100, 30, 200, 10, 10);
+  graphics::CompareOptions options;
+  options.early_exit = false;
+  options.threads = 1;
+  graphics::CompareResult single =
+      graphics::CompareImages(expected, actual, options);
+  options.threads = 7;
+  graphics::CompareResult banded =
+      graphics::CompareImages(expected, actual, options);
+  EXPECT_EQ(single.differing_pixels, banded.differing_pixels);
+  EXPECT_EQ(single.min_x, banded.min_x);
+  EXPECT_EQ(single.min_y, banded.min_y);
+  EXPECT_EQ(single.max_x, banded.max_x);
+  EXPECT_EQ(single.max_y, banded.max_y);
+  EXPECT_DOUBLE_EQ(single.psnr, banded.psnr);
+}
+
+TEST(ImageCompareTest, ComparesImagesWithUnreadTiles) {
+  // The tiles of an attached project are read before the threads start.
+  graphics::Image expected(600, 400);
+  PaintTestImage(expected);
+  graphics::ProjectFile project;
+  ASSERT_TRUE(project.Save("compare_test.tpaint", expected, {}));
+  graphics::Image attached;
+  ASSERT_TRUE(project.Attach(attached));
+  EXPECT_FALSE(attached.IsTileLoaded(4, 3));
+  graphics::CompareOptions options;
+  options.threads = 4;
+  graphics::CompareResult result =
+      graphics::CompareImages(expected, attached, options);
+  EXPECT_TRUE(result.match);
+  EXPECT_TRUE(result.complete);
+  EXPECT_EQ(0, result.differing_pixels);
+  EXPECT_TRUE(attached.IsTileLoaded(4, 3));
+  remove("compare_test.tpaint");
+}
+
+TEST(ImageCompareTest, StopsEarly) {
+  graphics::Image expected(64, 64);
+  graphics::Image actual(64, 64);
+  actual.DrawRectangle(0, 0, 64, 64, 0, 0, 0);
+  graphics::CompareResult result = graphics::CompareImages(expected, actual);
+  EXPECT_FALSE(result.match);
+  EXPECT_FALSE(result.complete);
+  EXPECT_LT(result.differing_pixels, 64 * 64);
+}
+
+TEST(ImageHashTest, HashesBytesLikeXxHash64) {
+  EXPECT_EQ(graphics::HashBytes("", 0), 0xEF46DB3751D8E999ULL);
+  EXPECT_EQ(graphics::HashBytes("abc", 3), 0x44BC2CF5AD770999ULL);
+}
+
+TEST(ImageHashTest, HashDependsOnContentAndSize) {
+  graphics::Image first(40, 30);
+  graphics::Image second(40, 30);
+  first.DrawLine(0, 0, 39, 29, 10, 20, 30, 3);
+  second.DrawLine(0, 0, 39, 29, 10, 20, 30, 3);
+  EXPECT_EQ(graphics::HashImage(first), graphics::HashImage(second));
+  EXPECT_EQ(graphics::HashImage128(first), graphics::HashImage128(second));
+
+  second.SetBlue(39, 0, 254);
+  EXPECT_NE(graphics::HashImage(first), graphics::HashImage(second));
+  EXPECT_NE(graphics::HashImage128(first), graphics::HashImage128(second));
+
+  // Same pixel values, transposed dimensions.
+  graphics::Image wide(40, 30);
+  graphics::Image tall(30, 40);
+  EXPECT_NE(graphics::HashImage(wide), graphics::HashImage(tall));
+
+  // Stable across runs and platforms.
+  graphics::Image blank(2, 2);
+  EXPECT_EQ(graphics::HashImage128(blank).ToString().size(), 32);
+  EXPECT_EQ(graphics::HashImage(blank), 0x93D96A166F565D2EULL);
+}
+
+TEST(GoldenStoreTest, ChecksAgainstRecordedGoldens) {
+  const std::string directory = "golden_store_test";
+  std::filesystem::remove_all(directory);
+  graphics::Image image(30, 30);
+  image.DrawCircle(15, 15, 8, 200, 0, 100);
+  {
+    graphics::GoldenStore store(directory);
+    EXPECT_FALSE(store.Check("circle", image, "golden_diff.bmp"));
+    EXPECT_TRUE(store.Record("circle", image));
+    EXPECT_TRUE(store.Record("same_circle", image));
+    EXPECT_TRUE(store.Check("circle", image, "golden_diff.bmp"));
+  }
+
+  // The index persists, and identical goldens share one object.
+  graphics::GoldenStore store(directory);
+  EXPECT_TRUE(store.Contains("same_circle"));
+  const int objects = std::distance(
+      std::filesystem::directory_iterator(directory + "/objects"),
+      std::filesystem::directory_iterator());
+  EXPECT_EQ(objects, 1);
+
+  image.SetColor(0, 0, graphics::Color(0, 0, 0));
+  EXPECT_FALSE(store.Check("circle", image, "golden_diff.bmp"));
+  EXPECT_TRUE(std::filesystem::exists("golden_diff.bmp"));
+
+  graphics::GoldenStore recording(directory, true /* record_missing */);
+  EXPECT_TRUE(recording.Check("new", image, "golden_diff.bmp"));
+  EXPECT_TRUE(recording.Contains("new"));
+
+  std::filesystem::remove_all(directory);
+  remove("golden_diff.bmp");
+}
+
+TEST(GestureGeneratorTest, GeneratesCompleteGesturesInBounds) {
+  graphics::GestureGenerator generator(64, 48, 7 /* seed */, 1000);
+  std::vector<graphics::TimedMouseEvent> walk = generator.RandomWalk(500, 20);
+  ASSERT_EQ(walk.size(), 502);
+  EXPECT_EQ(walk.front().event.GetMouseAction(),
+            graphics::MouseAction::kPressed);
+  EXPECT_EQ(walk.back().event.GetMouseAction(),
+            graphics::MouseAction::kReleased);
+  for (size_t i = 0; i < walk.size(); i++) {
+    EXPECT_GE(walk[i].event.GetX(), 0);
+    EXPECT_LT(walk[i].event.GetX(), 64);
+    EXPECT_GE(walk[i].event.GetY(), 0);
+    EXPECT_LT(walk[i].event.GetY(), 48);
+    EXPECT_NEAR(walk[i].time, i / 1000.0, 1e-9);
+  }
+
+  // Timing continues across gestures.
+  std::vector<graphics::TimedMouseEvent> spiral =
+      generator.Spiral(32, 24, 20, 2, 10);
+  ASSERT_EQ(spiral.size(), 22);
+  EXPECT_NEAR(spiral.front().time, 0.502, 1e-9);
+
+  // Same seed, same gestures.
+  graphics::GestureGenerator again(64, 48, 7 /* seed */, 1000);
+  std::vector<graphics::TimedMouseEvent> walk_again = again.RandomWalk(500, 20);
+  for (size_t i = 0; i < walk.size(); i++) {
+    EXPECT_EQ(walk[i].event.GetX(), walk_again[i].event.GetX());
+    EXPECT_EQ(walk[i].event.GetY(), walk_again[i].event.GetY());
+  }
+}
+
+TEST(GestureGeneratorTest, ReplaysEventsToListener) {
+  class CountingListener : public graphics::MouseEventListener {
+   public:
+    void OnMouseEvent(const graphics::MouseEvent& /*event*/) override {
+      count++;
+    }
+    int count = 0;
+  };
+  CountingListener listener;
+  graphics::GestureGenerator generator(100, 100);
+  std::vector<graphics::TimedMouseEvent> events = generator.Scribble(3, 10);
+  graphics::GestureStats stats = graphics::ReplayGestures(events, listener);
+  EXPECT_EQ(listener.count, events.size());
+  EXPECT_EQ(stats.events, events.size());
+  EXPECT_GE(stats.worst_event_seconds, stats.mean_event_seconds);
+}
+
 class TestEventListener : public graphics::MouseEventListener {
  public:
   TestEventListener() = default;
@@ -222,13 +826,1580 @@ class TestEventListener : public graphics::MouseEventListener {
 };
 
 // We can send fake events if we have a reference to the image on which to send events, and we
-// are not in the ShowUntilClosed loop.
+// are not in the ShowUntilClosed loop. The image does not need to be shown.
+TEST(TileTest, TracksChangedTiles) {
+  graphics::Image image(300, 200);
+  EXPECT_EQ(image.GetTileColumns(), 3);
+  EXPECT_EQ(image.GetTileRows(), 2);
+  const uint64_t start = image.GetGeneration();
+  EXPECT_EQ(image.GetTileGeneration(2, 1), start);
+  EXPECT_EQ(image.GetTileGeneration(3, 0), 0);
+
+  image.SetColor(299, 199, graphics::Color(1, 2, 3));
+  EXPECT_GT(image.GetTileGeneration(2, 1), start);
+  EXPECT_EQ(image.GetTileGeneration(0, 0), start);
+
+  // A line across the top row of tiles touches only those.
+  image.DrawLine(10, 10, 290, 20, graphics::Color(0, 0, 0), 5);
+  for (int column = 0; column < 3; column++) {
+    EXPECT_GT(image.GetTileGeneration(column, 0), start);
+  }
+  EXPECT_EQ(image.GetTileGeneration(0, 1), start);
+}
+
+// Serves tiles of a single color per tile, and counts the tiles read.
+class CountingTileSource : public graphics::TileSource {
+ public:
+  bool ReadTile(int column, int row, int width, int height,
+                uint8_t* const channels[3], int stride) override {
+    reads_++;
+    for (int c = 0; c < 3; c++) {
+      for (int y = 0; y < height; y++) {
+        memset(channels[c] + y * stride, column * 10 + row, width);
+      }
+    }
+    return true;
+  }
+  int GetReads() const { return reads_; }
+
+ private:
+  int reads_ = 0;
+};
+
+TEST(TileTest, ReadsTilesWhenFirstNeeded) {
+  CountingTileSource source;
+  graphics::Image image;
+  ASSERT_TRUE(image.InitializeFromTiles(300, 200, &source));
+  EXPECT_EQ(source.GetReads(), 0);
+  EXPECT_FALSE(image.IsTileLoaded(1, 1));
+
+  EXPECT_EQ(image.GetColor(150, 150), graphics::Color(11, 11, 11));
+  EXPECT_EQ(source.GetReads(), 1);
+  EXPECT_TRUE(image.IsTileLoaded(1, 1));
+  const uint64_t generation = image.GetTileGeneration(1, 1);
+
+  // Drawing reads the tiles it covers first.
+  image.DrawRectangle(0, 0, 10, 10, graphics::Color(255, 0, 0));
+  EXPECT_EQ(source.GetReads(), 2);
+  EXPECT_EQ(image.GetColor(20, 20), graphics::Color(0, 0, 0));
+  EXPECT_GT(image.GetTileGeneration(0, 0), generation);
+  EXPECT_EQ(image.GetTileGeneration(1, 1), generation);
+
+  // Everything else is read at once when the whole image is needed.
+  image.GetChannelData(0);
+  EXPECT_EQ(source.GetReads(), 6);
+  EXPECT_EQ(image.GetColor(299, 199), graphics::Color(21, 21, 21));
+}
+
+TEST(TileTest, SnapshotsCopyTilesOnWrite) {
+  graphics::Image image(300, 200);
+  const graphics::Color white(255, 255, 255);
+  const graphics::Color red(255, 0, 0);
+  std::shared_ptr<graphics::ImageSnapshot> snapshot = image.Snapshot();
+  EXPECT_EQ(snapshot->GetImage(), &image);
+  image.DrawRectangle(0, 0, 20, 20, red);
+  image.SetColor(299, 199, red);
+
+  std::vector<uint8_t> tile(3 * 128 * 128);
+  uint8_t* const channels[3] = {tile.data(), tile.data() + 128 * 128,
+                                tile.data() + 2 * 128 * 128};
+  ASSERT_TRUE(snapshot->CopyTile(0, 0, channels));
+  EXPECT_EQ(tile[0], 255);
+  EXPECT_EQ(tile[128 * 128 + 1], 255);
+  ASSERT_TRUE(image.CopyTile(0, 0, channels));
+  EXPECT_EQ(tile[128 * 128 + 1], 0);
+  EXPECT_LT(snapshot->GetTileGeneration(0, 0), image.GetTileGeneration(0, 0));
+
+  // A snapshot of what changed since leaves out the other tiles.
+  std::vector<uint64_t> generations;
+  for (int row = 0; row < snapshot->GetTileRows(); row++) {
+    for (int column = 0; column < snapshot->GetTileColumns(); column++) {
+      generations.push_back(snapshot->GetTileGeneration(column, row));
+    }
+  }
+  std::shared_ptr<graphics::ImageSnapshot> changes =
+      image.Snapshot(&generations);
+  EXPECT_TRUE(changes->CopyTile(2, 1, channels));
+  EXPECT_FALSE(changes->CopyTile(1, 0, channels));
+
+  // Tiles still shared when the image is replaced are kept. The bottom right
+  // tile is 44 by 72 pixels.
+  ASSERT_TRUE(image.Initialize(10, 10));
+  uint8_t* const corner[3] = {tile.data(), tile.data() + 44 * 72,
+                              tile.data() + 2 * 44 * 72};
+  ASSERT_TRUE(changes->CopyTile(2, 1, corner));
+  const int last = 44 * 72 - 1;
+  EXPECT_EQ(graphics::Color(corner[0][last], corner[1][last], corner[2][last]),
+            red);
+}
+
+// Returns the bytes of disk space |filename| uses, which is less than its
+// size for sparse files.
+size_t GetAllocatedSize(const std::string& filename) {
+  struct stat info;
+  if (stat(filename.c_str(), &info) != 0) return 0;
+  return static_cast<size_t>(info.st_blocks) * 512;
+}
+
+TEST(TileTest, StoresMappedImagesInFiles) {
+  const std::string filename = "mapped_test.pixels";
+  graphics::Image image;
+  ASSERT_TRUE(image.InitializeMapped(300, 200, filename));
+  EXPECT_TRUE(image.IsMapped());
+  EXPECT_FALSE(image.IsTileLoaded(1, 1));
+  EXPECT_EQ(graphics::Color(255, 255, 255), image.GetColor(299, 199));
+  EXPECT_TRUE(image.DrawRectangle(10, 20, 30, 40, graphics::Color(1, 2, 3)));
+  EXPECT_TRUE(image.SetColor(299, 0, graphics::Color(4, 5, 6)));
+
+  // The file holds the red, green and blue planes.
+  std::ifstream in(filename, std::ios::binary);
+  std::vector<uint8_t> pixels((std::istreambuf_iterator<char>(in)),
+                              std::istreambuf_iterator<char>());
+  ASSERT_EQ(300 * 200 * 3, pixels.size());
+  EXPECT_EQ(1, pixels[20 * 300 + 10]);
+  EXPECT_EQ(2, pixels[300 * 200 + 59 * 300 + 39]);
+  EXPECT_EQ(6, pixels[2 * 300 * 200 + 299]);
+
+  // Snapshots and saves see the mapped pixels like any others, with the
+  // unused tiles white. Reading them writes nothing to the file.
+  const size_t allocated = GetAllocatedSize(filename);
+  graphics::ProjectFile project;
+  ASSERT_TRUE(project.Save("mapped_test.tpaint", image, {}));
+  ASSERT_TRUE(image.SaveFast("mapped_test.qoi"));
+  graphics::Image clone = image.Clone();
+  graphics::Image shared = image.Share();
+  EXPECT_EQ(graphics::Color(255, 255, 255), shared.GetColor(299, 199));
+  EXPECT_EQ(graphics::Color(4, 5, 6), shared.GetColor(299, 0));
+  std::vector<uint8_t> tile(44 * 72 * 3);
+  uint8_t* const channels[3] = {tile.data(), tile.data() + 44 * 72,
+                                tile.data() + 2 * 44 * 72};
+  ASSERT_TRUE(image.Snapshot()->CopyTile(2, 1, channels));
+  EXPECT_EQ(std::vector<uint8_t>(tile.size(), 255), tile);
+  EXPECT_FALSE(image.IsTileLoaded(2, 1));
+  EXPECT_FALSE(shared.IsTileLoaded(2, 1));
+  EXPECT_EQ(allocated, GetAllocatedSize(filename));
+
+  graphics::Image reloaded;
+  ASSERT_TRUE(project.Attach(reloaded));
+  EXPECT_TRUE(ImagesMatch(&clone, &reloaded, "MappedImage.bmp",
+                          DiffType::kTypeHighlight));
+  graphics::Image fast;
+  ASSERT_TRUE(fast.LoadFast("mapped_test.qoi"));
+  EXPECT_EQ(graphics::HashImage(fast), graphics::HashImage(clone));
+  EXPECT_EQ(graphics::Color(1, 2, 3), clone.GetColor(10, 20));
+  EXPECT_EQ(graphics::Color(255, 255, 255), clone.GetColor(299, 199));
+
+  // Drawing to the shared image copies the pixels first.
+  ASSERT_TRUE(shared.SetColor(299, 199, graphics::Color(7, 8, 9)));
+  EXPECT_EQ(graphics::Color(255, 255, 255), image.GetColor(299, 199));
+  EXPECT_FALSE(image.IsTileLoaded(2, 1));
+
+  // Initializing again moves the pixels back into memory. Failing to map
+  // leaves the image as it was.
+  ASSERT_TRUE(image.Initialize(20, 10));
+  EXPECT_FALSE(image.IsMapped());
+  EXPECT_FALSE(image.InitializeMapped(0, 10, filename));
+  EXPECT_FALSE(image.InitializeMapped(10, 10, "missing_dir/mapped.pixels"));
+  EXPECT_FALSE(image.IsMapped());
+  EXPECT_EQ(20, image.GetWidth());
+  remove(filename.c_str());
+  remove("mapped_test.tpaint");
+  remove("mapped_test.qoi");
+}
+
+// Draws on a mapped image far larger than what is drawn to, and checks that
+// only the tiles drawn to take up memory or disk space.
+TEST(TileTest, EditsMappedImagesLargerThanUsed) {
+  const std::string filename = "mapped_large.pixels";
+  graphics::Image image;
+  // 3 GB of pixels.
+  ASSERT_TRUE(image.InitializeMapped(40000, 25000, filename));
+  EXPECT_LT(GetAllocatedSize(filename), 1 << 20);
+  for (int i = 0; i < 10; i++) {
+    ASSERT_TRUE(image.DrawCircle(1000 + i * 3800, 20000, 50,
+                                 graphics::Color(0, 0, 255)));
+  }
+  EXPECT_EQ(graphics::Color(0, 0, 255), image.GetColor(1000, 20000));
+  EXPECT_EQ(graphics::Color(255, 255, 255), image.GetColor(1100, 20000));
+  EXPECT_EQ(graphics::Color(255, 255, 255), image.GetColor(39999, 24999));
+  // Each circle touches up to 4 tiles of 3 planes of 128 rows, each row on a
+  // separate page.
+  const size_t allocated = GetAllocatedSize(filename);
+  EXPECT_LT(allocated, size_t{12} * 10 * 3 * 128 * 8192);
+  RecordProperty("mapped_kb_used", static_cast<int>(allocated / 1024));
+  ASSERT_TRUE(image.Initialize(1, 1));
+  remove(filename.c_str());
+}
+
+// Returns |image| with a red pixel at (|x|, |y|), like one step of a filter
+// taking and returning images by value.
+graphics::Image MarkPixel(graphics::Image image, int x, int y) {
+  image.SetColor(x, y, graphics::Color(255, 0, 0));
+  return image;
+}
+
+TEST(ImageTest, MovesWithoutCopying) {
+  graphics::Image image(300, 200);
+  PaintTestImage(image);
+  const graphics::Color corner = image.GetColor(0, 0);
+  const uint8_t* pixels = image.GetChannelData(0);
+  std::shared_ptr<graphics::ImageSnapshot> snapshot = image.Snapshot();
+
+  graphics::Image moved(std::move(image));
+  EXPECT_EQ(pixels, moved.GetChannelData(0));
+  EXPECT_EQ(300, moved.GetWidth());
+  EXPECT_EQ(0, image.GetWidth());
+  EXPECT_EQ(nullptr, image.GetChannelData(0));
+  EXPECT_FALSE(image.SetColor(0, 0, corner));
+
+  // The snapshot follows the pixels, and keeps the old tile once changed.
+  EXPECT_TRUE(moved.SetColor(0, 0, graphics::Color(1, 2, 3)));
+  std::vector<uint8_t> tile(graphics::Image::kTileSize *
+                            graphics::Image::kTileSize * 3);
+  const size_t plane = tile.size() / 3;
+  uint8_t* const channels[3] = {tile.data(), tile.data() + plane,
+                                tile.data() + 2 * plane};
+  ASSERT_TRUE(snapshot->CopyTile(0, 0, channels));
+  EXPECT_EQ(corner.Red(), tile[0]);
+  ASSERT_TRUE(snapshot->CopyTile(2, 1, channels));
+  EXPECT_EQ(moved.GetColor(256, 128).Red(), tile[0]);
+
+  // Images can be kept in vectors, returned, and assigned over.
+  std::vector<graphics::Image> images;
+  for (int i = 0; i < 10; i++) images.emplace_back(10 + i, 10);
+  images.push_back(std::move(moved));
+  EXPECT_EQ(pixels, images.back().GetChannelData(0));
+  EXPECT_EQ(19, images[9].GetWidth());
+  image = MarkPixel(std::move(images.back()), 5, 5);
+  EXPECT_EQ(pixels, image.GetChannelData(0));
+  EXPECT_EQ(graphics::Color(255, 0, 0), image.GetColor(5, 5));
+  image = std::move(images[0]);
+  EXPECT_EQ(10, image.GetWidth());
+}
+
+TEST(ImageTest, ClonesAndSharesPixelsUntilChanged) {
+  graphics::Image image(300, 200);
+  PaintTestImage(image);
+  graphics::Image clone = image.Clone();
+  EXPECT_NE(image.GetChannelData(0), clone.GetChannelData(0));
+  EXPECT_TRUE(ImagesMatch(&image, &clone, "ClonedImage.bmp", kTypeHighlight));
+  EXPECT_EQ(0, graphics::Image().Clone().GetWidth());
+
+  // Sharing copies nothing until one of the images changes.
+  graphics::PixelPool& pool = graphics::PixelPool::Get();
+  const auto allocations = [&pool] {
+    const graphics::PixelPool::Stats stats = pool.GetStats();
+    return stats.system_allocations + stats.reuses;
+  };
+  size_t before = allocations();
+  graphics::Image shared = image.Share();
+  EXPECT_EQ(before, allocations());
+  EXPECT_EQ(image.GetChannelData(0), shared.GetChannelData(0));
+  const graphics::Color color = image.GetColor(10, 10);
+  EXPECT_TRUE(shared.SetColor(10, 10, graphics::Color(0, 0, 0)));
+  EXPECT_EQ(before + 1, allocations());
+  EXPECT_NE(image.GetChannelData(0), shared.GetChannelData(0));
+  EXPECT_EQ(color, image.GetColor(10, 10));
+  EXPECT_EQ(graphics::Color(0, 0, 0), shared.GetColor(10, 10));
+
+  // Once the others are gone, the last image changes the pixels in place.
+  const uint8_t* pixels = image.GetChannelData(0);
+  {
+    graphics::Image other = image.Share();
+    EXPECT_EQ(pixels, other.GetChannelData(0));
+  }
+  before = allocations();
+  EXPECT_TRUE(image.DrawLine(0, 0, 299, 199, graphics::Color(0, 0, 0), 3));
+  EXPECT_EQ(before, allocations());
+  EXPECT_EQ(pixels, image.GetChannelData(0));
+
+  // Mapped pixels can be shared too, and are copied into memory to change.
+  const std::string filename = "shared_test.pixels";
+  graphics::Image mapped;
+  ASSERT_TRUE(mapped.InitializeMapped(300, 200, filename));
+  graphics::Image view = mapped.Share();
+  EXPECT_TRUE(view.IsMapped());
+  EXPECT_TRUE(view.SetColor(1, 1, graphics::Color(0, 0, 0)));
+  EXPECT_FALSE(view.IsMapped());
+  EXPECT_TRUE(mapped.IsMapped());
+  EXPECT_EQ(graphics::Color(255, 255, 255), mapped.GetColor(1, 1));
+  EXPECT_TRUE(mapped.Initialize(10, 10));
+  remove(filename.c_str());
+}
+
+TEST(ImageTest, BenchmarksPassingImagesByValue) {
+  const int steps = 20;
+  graphics::Image image(2048, 2048);
+  using Clock = std::chrono::steady_clock;
+  auto time_ms = [](const std::function<void()>& run) {
+    const auto start = Clock::now();
+    run();
+    return std::chrono::duration<double>(Clock::now() - start).count() * 1000;
+  };
+  graphics::PixelPool& pool = graphics::PixelPool::Get();
+  const auto allocations = [&pool] {
+    const graphics::PixelPool::Stats stats = pool.GetStats();
+    return stats.system_allocations + stats.reuses;
+  };
+  // Each step looks at the image, and only the last one changes it.
+  std::vector<graphics::Image> cloned;
+  size_t before = allocations();
+  const double clone_ms = time_ms([&] {
+    for (int i = 0; i < steps; i++) cloned.push_back(image.Clone());
+    cloned.back() = MarkPixel(std::move(cloned.back()), 0, 0);
+  });
+  const size_t clone_allocations = allocations() - before;
+  std::vector<graphics::Image> shared;
+  before = allocations();
+  const double share_ms = time_ms([&] {
+    for (int i = 0; i < steps; i++) shared.push_back(image.Share());
+    shared.back() = MarkPixel(std::move(shared.back()), 0, 0);
+  });
+  const size_t share_allocations = allocations() - before;
+  EXPECT_TRUE(ImagesMatch(&cloned.back(), &shared.back(), "SharedSteps.bmp",
+                          kTypeHighlight));
+  EXPECT_EQ(graphics::Color(255, 255, 255), image.GetColor(0, 0));
+  // Every clone copies the pixels, while shares only copy them to change.
+  EXPECT_EQ(steps, clone_allocations);
+  EXPECT_EQ(1, share_allocations);
+  RecordProperty("clone_us", static_cast<int>(clone_ms * 1000));
+  RecordProperty("share_us", static_cast<int>(share_ms * 1000));
+}
+
+TEST(CanvasTest, AllocatesTilesOnlyWhenPainted) {
+  const graphics::Color white(255, 255, 255);
+  const graphics::Color blue(0, 0, 255);
+  graphics::Canvas canvas;
+  graphics::Image viewport;
+  const int64_t far = int64_t{5} << 32;
+  ASSERT_TRUE(canvas.View(viewport, 300, 200, -1000, far));
+  EXPECT_EQ(300, viewport.GetWidth());
+  EXPECT_EQ(white, viewport.GetColor(150, 100));
+  EXPECT_EQ(0, canvas.GetTileCount());
+
+  // Reading the viewport allocates nothing; drawing does, on commit.
+  ASSERT_TRUE(viewport.DrawRectangle(10, 10, 20, 20, blue));
+  EXPECT_EQ(blue, canvas.GetColor(-990, far + 10));
+  EXPECT_EQ(0, canvas.GetTileCount());
+  canvas.Commit();
+  EXPECT_EQ(1, canvas.GetTileCount());
+  EXPECT_EQ(3 * 128 * 128, canvas.GetMemoryUsage());
+  int64_t x0, y0, x1, y1;
+  ASSERT_TRUE(canvas.GetPaintedBounds(&x0, &y0, &x1, &y1));
+  EXPECT_EQ(-1024, x0);
+  EXPECT_EQ(far, y0);
+  EXPECT_EQ(-897, x1);
+  EXPECT_EQ(far + 127, y1);
+
+  // Moving the view by an odd amount shows the same pixels, shifted.
+  ASSERT_TRUE(canvas.View(viewport, 200, 100, -995, far - 3));
+  EXPECT_EQ(blue, viewport.GetColor(5, 13));
+  EXPECT_EQ(blue, viewport.GetColor(24, 32));
+  EXPECT_EQ(white, viewport.GetColor(25, 33));
+  EXPECT_EQ(white, viewport.GetColor(4, 12));
+  // A stroke across tile borders lands in every tile it crosses.
+  ASSERT_TRUE(viewport.DrawLine(0, 0, 198, 99, blue));
+  ASSERT_TRUE(canvas.View(viewport, 50, 50, 0, 0));
+  EXPECT_EQ(3, canvas.GetTileCount());
+  EXPECT_EQ(blue, canvas.GetColor(-995, far - 3));
+  EXPECT_EQ(blue, canvas.GetColor(-797, far + 96));
+  EXPECT_EQ(white, canvas.GetColor(-797, far - 3));
+  EXPECT_EQ(white, canvas.GetColor(0, 0));
+
+  // Painting tiles white again frees them. Only the stroke's first pixels,
+  // above the view, remain.
+  ASSERT_TRUE(canvas.View(viewport, 300, 200, -1000, far));
+  ASSERT_TRUE(viewport.DrawRectangle(0, 0, 300, 200, white));
+  canvas.Commit();
+  EXPECT_EQ(1, canvas.GetTileCount());
+  EXPECT_EQ(blue, canvas.GetColor(-995, far - 3));
+
+  EXPECT_FALSE(canvas.View(viewport, 0, 10, 0, 0));
+  EXPECT_FALSE(canvas.View(viewport, 10, 10, graphics::Canvas::kLimit - 5,
+                           0));
+  EXPECT_EQ(-1000, canvas.GetViewX());
+  viewport.Initialize(1, 1);
+}
+
+TEST(CanvasTest, SharesIdenticalAndUniformTiles) {
+  graphics::Canvas canvas;
+  graphics::Image viewport;
+  ASSERT_TRUE(canvas.View(viewport, 1024, 512, 0, 0));
+  ASSERT_TRUE(viewport.DrawRectangle(0, 0, 1024, 512,
+                                     graphics::Color(200, 0, 0)));
+  canvas.Commit();
+  graphics::Canvas::MemoryStats stats = canvas.GetMemoryStats();
+  EXPECT_EQ(32, stats.tiles);
+  EXPECT_EQ(32, stats.uniform_tiles);
+  EXPECT_EQ(0, stats.bytes);
+
+  // The same mark in every tile leaves one copy of the pixels.
+  for (int x = 0; x < 1024; x += 128) {
+    for (int y = 0; y < 512; y += 128) {
+      ASSERT_TRUE(viewport.DrawCircle(x + 64, y + 64, 30,
+                                      graphics::Color(0, 0, 200)));
+    }
+  }
+  canvas.Commit();
+  stats = canvas.GetMemoryStats();
+  EXPECT_EQ(0, stats.uniform_tiles);
+  EXPECT_EQ(1, stats.unique_tiles);
+  EXPECT_EQ(3 * 128 * 128, stats.bytes);
+  EXPECT_EQ(32 * 3 * 128 * 128, stats.dense_bytes);
+
+  // Changing one tile copies it, leaving the others as they were.
+  ASSERT_TRUE(viewport.SetColor(130, 130, graphics::Color(1, 2, 3)));
+  canvas.Commit();
+  EXPECT_EQ(2, canvas.GetMemoryStats().unique_tiles);
+  ASSERT_TRUE(canvas.View(viewport, 1024, 512, 0, 0));
+  EXPECT_EQ(graphics::Color(1, 2, 3), viewport.GetColor(130, 130));
+  EXPECT_EQ(graphics::Color(200, 0, 0), viewport.GetColor(130 + 128, 130));
+  EXPECT_EQ(graphics::Color(200, 0, 0), viewport.GetColor(10, 10));
+  EXPECT_EQ(graphics::Color(0, 0, 200), viewport.GetColor(192, 192));
+
+  // Undoing the change shares the tile again.
+  ASSERT_TRUE(viewport.SetColor(130, 130, graphics::Color(200, 0, 0)));
+  canvas.Commit();
+  EXPECT_EQ(1, canvas.GetMemoryStats().unique_tiles);
+  viewport.Initialize(1, 1);
+}
+
+// Reports how much memory deduplication saves on a drawing made of strokes
+// and solid fills, like the ones PaintProgram makes.
+TEST(CanvasTest, ReportsDeduplicationSavings) {
+  graphics::Canvas canvas;
+  graphics::Image viewport;
+  ASSERT_TRUE(canvas.View(viewport, 2048, 2048, 0, 0));
+  ASSERT_TRUE(viewport.DrawRectangle(0, 0, 2048, 1024,
+                                     graphics::Color(120, 180, 250)));
+  ASSERT_TRUE(viewport.DrawRectangle(0, 1536, 2048, 512,
+                                     graphics::Color(40, 160, 40)));
+  ASSERT_TRUE(viewport.DrawCircle(1500, 400, 200,
+                                  graphics::Color(250, 220, 0)));
+  graphics::GestureGenerator gestures(2048, 2048, 9);
+  for (const std::vector<graphics::TimedMouseEvent>& stroke :
+       {gestures.Spiral(600, 1200, 150, 3), gestures.RandomWalk(300, 15)}) {
+    for (size_t i = 1; i < stroke.size(); i++) {
+      viewport.DrawLine(stroke[i - 1].event.GetX(),
+                        stroke[i - 1].event.GetY(), stroke[i].event.GetX(),
+                        stroke[i].event.GetY(), graphics::Color(0, 0, 0), 3);
+    }
+  }
+  canvas.Commit();
+  const graphics::Canvas::MemoryStats stats = canvas.GetMemoryStats();
+  // Compared to the same drawing in an Image.
+  EXPECT_GT(2048 * 2048 * 3, 10 * stats.bytes);
+  RecordProperty("dense_kb", static_cast<int>(stats.dense_bytes / 1024));
+  RecordProperty("stored_kb", static_cast<int>(stats.bytes / 1024));
+  RecordProperty("unique_tiles", static_cast<int>(stats.unique_tiles));
+  viewport.Initialize(1, 1);
+}
+
+// Paints small marks far apart, as on a huge whiteboard, and checks that
+// memory grows with the marks rather than with the area they span.
+TEST(CanvasTest, UsesMemoryForPaintedAreaOnly) {
+  graphics::Canvas canvas;
+  graphics::Image viewport;
+  const int marks = 100;
+  for (int i = 0; i < marks; i++) {
+    const int64_t x = (i % 10) * int64_t{1000000} - 5000000;
+    const int64_t y = (i / 10) * int64_t{3000000};
+    ASSERT_TRUE(canvas.View(viewport, 500, 500, x, y));
+    ASSERT_TRUE(viewport.DrawCircle(250, 250, 10,
+                                    graphics::Color(i, 255 - i, 0)));
+  }
+  ASSERT_TRUE(canvas.View(viewport, 500, 500, 0, 0));
+  // Each circle may straddle tile borders.
+  EXPECT_LE(canvas.GetTileCount(), 4 * marks);
+  EXPECT_EQ(graphics::Color(42, 213, 0),
+            canvas.GetColor(2 * 1000000 - 5000000 + 250, 4 * 3000000 + 250));
+  RecordProperty("canvas_tiles", static_cast<int>(canvas.GetTileCount()));
+  viewport.Initialize(1, 1);
+}
+
+TEST(CanvasTest, CompressesColdTiles) {
+  graphics::Canvas canvas;
+  graphics::Image viewport;
+  ASSERT_TRUE(canvas.View(viewport, 1024, 512, 0, 0));
+  PaintTestImage(viewport);
+  ASSERT_TRUE(viewport.DrawRectangle(0, 0, 128, 128,
+                                     graphics::Color(10, 20, 30)));
+  canvas.Commit();
+  const graphics::Canvas::MemoryStats hot = canvas.GetMemoryStats();
+  std::vector<graphics::Color> colors;
+  for (int y = 0; y < 512; y += 5) {
+    for (int x = 0; x < 1024; x += 5) colors.push_back(viewport.GetColor(x, y));
+  }
+
+  EXPECT_EQ(0, canvas.CompressColdTiles(3600));
+  EXPECT_EQ(hot.tiles - hot.uniform_tiles, canvas.CompressColdTiles(0));
+  graphics::Canvas::MemoryStats stats = canvas.GetMemoryStats();
+  EXPECT_EQ(hot.tiles - hot.uniform_tiles, stats.compressed_tiles);
+  EXPECT_EQ(0, stats.unique_tiles);
+  EXPECT_EQ(stats.compressed_bytes, stats.bytes);
+  EXPECT_LT(4 * stats.bytes, hot.bytes);
+
+  // Reading decompresses tiles, both through the canvas and a viewport.
+  ASSERT_TRUE(canvas.View(viewport, 1, 1, -5000, -5000));
+  EXPECT_EQ(colors[0], canvas.GetColor(0, 0));
+  EXPECT_EQ(colors[40 * 205 + 40], canvas.GetColor(200, 200));
+  EXPECT_EQ(hot.tiles - hot.uniform_tiles - 1,
+            canvas.GetMemoryStats().compressed_tiles);
+  ASSERT_TRUE(canvas.View(viewport, 1024, 512, 0, 0));
+  size_t i = 0;
+  for (int y = 0; y < 512; y += 5) {
+    for (int x = 0; x < 1024; x += 5) {
+      ASSERT_EQ(colors[i++], viewport.GetColor(x, y)) << x << ", " << y;
+    }
+  }
+  stats = canvas.GetMemoryStats();
+  EXPECT_EQ(0, stats.compressed_tiles);
+  EXPECT_EQ(hot.unique_tiles, stats.unique_tiles);
+  EXPECT_EQ(hot.bytes, stats.bytes);
+
+  // Over budget, the least recently used tiles go first.
+  ASSERT_TRUE(canvas.View(viewport, 1, 1, -5000, -5000));
+  canvas.GetColor(1000, 500);
+  EXPECT_EQ(1, canvas.CompressColdTiles(3600, hot.bytes - 1));
+  EXPECT_EQ(hot.tiles - hot.uniform_tiles - 1,
+            canvas.CompressColdTiles(3600, 0));
+  stats = canvas.GetMemoryStats();
+  EXPECT_EQ(hot.tiles - hot.uniform_tiles, stats.compressed_tiles);
+  canvas.GetColor(1000, 500);
+  EXPECT_EQ(1, canvas.GetMemoryStats().unique_tiles);
+  viewport.Initialize(1, 1);
+}
+
+TEST(CanvasTest, CompressesInTheBackground) {
+  graphics::Canvas canvas;
+  graphics::Image viewport;
+  ASSERT_TRUE(canvas.View(viewport, 512, 512, 0, 0));
+  PaintTestImage(viewport);
+  canvas.Commit();
+  const size_t tiles = canvas.GetTileCount();
+  auto wait_for = [](const std::function<bool()>& done) {
+    for (int i = 0; i < 500; i++) {
+      if (done()) return true;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+  };
+
+  canvas.StartCompression(0.05);
+  EXPECT_TRUE(wait_for(
+      [&] { return canvas.GetMemoryStats().compressed_tiles == tiles; }));
+  canvas.StopCompression();
+
+  // A memory budget compresses tiles long before they get cold.
+  ASSERT_TRUE(canvas.View(viewport, 512, 512, 0, 0));
+  ASSERT_TRUE(viewport.DrawCircle(256, 256, 200, graphics::Color(0, 0, 0)));
+  const size_t budget = 2 * 3 * 128 * 128;
+  canvas.StartCompression(3600, budget);
+  canvas.Commit();
+  EXPECT_TRUE(wait_for([&] { return canvas.GetMemoryUsage() <= budget; }));
+  canvas.StopCompression();
+  EXPECT_EQ(graphics::Color(0, 0, 0), canvas.GetColor(256, 256));
+  viewport.Initialize(1, 1);
+}
+
+// Measures how long the first read of a compressed tile takes, compared to
+// reading tiles that are in memory.
+TEST(CanvasTest, BenchmarksColdTileFirstTouch) {
+  graphics::Canvas canvas;
+  graphics::Image viewport;
+  ASSERT_TRUE(canvas.View(viewport, 2048, 2048, 0, 0));
+  PaintTestImage(viewport);
+  graphics::GestureGenerator gestures(2048, 2048, 5);
+  const std::vector<graphics::TimedMouseEvent> stroke =
+      gestures.RandomWalk(300, 15);
+  for (size_t i = 1; i < stroke.size(); i++) {
+    viewport.DrawLine(stroke[i - 1].event.GetX(), stroke[i - 1].event.GetY(),
+                      stroke[i].event.GetX(), stroke[i].event.GetY(),
+                      graphics::Color(0, 0, 0), 3);
+  }
+  ASSERT_TRUE(canvas.View(viewport, 1, 1, -5000, -5000));
+  const size_t hot_bytes = canvas.GetMemoryUsage();
+
+  using Clock = std::chrono::steady_clock;
+  auto touch_tiles = [&]() {
+    const auto start = Clock::now();
+    for (int y = 0; y < 2048; y += 128) {
+      for (int x = 0; x < 2048; x += 128) canvas.GetColor(x, y);
+    }
+    return std::chrono::duration<double>(Clock::now() - start).count() *
+           1000000 / 256;
+  };
+  const graphics::Canvas::MemoryStats hot = canvas.GetMemoryStats();
+  const auto start = Clock::now();
+  ASSERT_EQ(hot.tiles - hot.uniform_tiles, canvas.CompressColdTiles(0));
+  const double compress_us =
+      std::chrono::duration<double>(Clock::now() - start).count() * 1000000 /
+      256;
+  const size_t cold_bytes = canvas.GetMemoryUsage();
+  const double cold_us = touch_tiles();
+  const double hot_us = touch_tiles();
+  EXPECT_LT(2 * cold_bytes, hot_bytes);
+  EXPECT_EQ(hot_bytes, canvas.GetMemoryUsage());
+  RecordProperty("compress_us", static_cast<int>(compress_us));
+  RecordProperty("first_touch_us", static_cast<int>(cold_us));
+  RecordProperty("hot_touch_us", static_cast<int>(hot_us));
+  RecordProperty("cold_kb", static_cast<int>(cold_bytes / 1024));
+  RecordProperty("hot_kb", static_cast<int>(hot_bytes / 1024));
+  viewport.Initialize(1, 1);
+}
+
+TEST(PixelPoolTest, ReusesFreedBuffers) {
+  graphics::PixelPool pool;
+  uint8_t* buffer = pool.Allocate(1000);
+  ASSERT_NE(nullptr, buffer);
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(buffer) %
+                   graphics::PixelPool::kAlignment);
+  memset(buffer, 1, 1000);
+  pool.Free(buffer, 1000);
+  // Any size of the same class gets the buffer back.
+  EXPECT_EQ(buffer, pool.Allocate(990));
+  graphics::PixelPool::Stats stats = pool.GetStats();
+  EXPECT_EQ(1, stats.system_allocations);
+  EXPECT_EQ(1, stats.reuses);
+  EXPECT_EQ(graphics::PixelPool::GetSizeClass(1000), stats.bytes_in_use);
+  EXPECT_EQ(0, stats.bytes_cached);
+  pool.Free(buffer, 990);
+
+  uint8_t* other = pool.Allocate(5000);
+  EXPECT_NE(buffer, other);
+  pool.Free(other, 5000);
+  EXPECT_EQ(graphics::PixelPool::GetSizeClass(1000) +
+                graphics::PixelPool::GetSizeClass(5000),
+            pool.GetStats().bytes_cached);
+  pool.Trim();
+  EXPECT_EQ(0, pool.GetStats().bytes_cached);
+  EXPECT_EQ(0, pool.GetStats().bytes_in_use);
+
+  // Beyond the cache limit, freed buffers go back to the system.
+  pool.SetCacheLimit(4096);
+  pool.Free(pool.Allocate(8192), 8192);
+  EXPECT_EQ(0, pool.GetStats().bytes_cached);
+}
+
+TEST(PixelPoolTest, RoundsUpToCloseSizeClasses) {
+  for (size_t size = 1; size < (size_t{64} << 20); size = size * 3 / 2 + 1) {
+    const size_t size_class = graphics::PixelPool::GetSizeClass(size);
+    EXPECT_GE(size_class, size);
+    EXPECT_LE(size_class, std::max<size_t>(64, size + size / 8 + 63));
+    EXPECT_EQ(0, size_class % graphics::PixelPool::kAlignment);
+    if (size_class >= graphics::PixelPool::kMapThreshold) {
+      EXPECT_EQ(0, size_class % 4096);
+    }
+  }
+}
+
+TEST(PixelPoolTest, AlignsLargeBuffersToHugePages) {
+  graphics::PixelPool pool;
+  pool.SetHugePages(true);
+  const size_t size = 8192 * 4096 * 3;
+  uint8_t* buffer = pool.Allocate(size);
+  ASSERT_NE(nullptr, buffer);
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(buffer) %
+                   graphics::PixelPool::kHugePageSize);
+  buffer[0] = 1;
+  buffer[size - 1] = 2;
+  pool.Free(buffer, size);
+  EXPECT_EQ(buffer, pool.Allocate(size));
+  pool.Free(buffer, size);
+}
+
+// Measures allocating, painting and freeing same-sized images, the pattern
+// of undo steps and temporary images, with and without reusing buffers.
+TEST(PixelPoolTest, BenchmarksImageChurn) {
+  graphics::PixelPool& pool = graphics::PixelPool::Get();
+  auto churn = [](int rounds, long* faults) {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    const long start_faults = usage.ru_minflt;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+      graphics::Image image(1024, 1024);
+      image.DrawRectangle(0, 0, 1024, 1024, graphics::Color(i, 0, 0));
+    }
+    const double ms = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count() *
+                      1000 / rounds;
+    getrusage(RUSAGE_SELF, &usage);
+    *faults = (usage.ru_minflt - start_faults) / rounds;
+    return ms;
+  };
+  long faults;
+  pool.SetCacheLimit(0);
+  const double unpooled_ms = churn(20, &faults);
+  const long unpooled_faults = faults;
+  pool.SetCacheLimit(64 << 20);
+  churn(1, &faults);
+  const size_t system_allocations = pool.GetStats().system_allocations;
+  const double pooled_ms = churn(20, &faults);
+  EXPECT_EQ(system_allocations, pool.GetStats().system_allocations);
+  EXPECT_LT(faults, unpooled_faults);
+  RecordProperty("pooled_us", static_cast<int>(pooled_ms * 1000));
+  RecordProperty("unpooled_us", static_cast<int>(unpooled_ms * 1000));
+  RecordProperty("pooled_faults", static_cast<int>(faults));
+  RecordProperty("unpooled_faults", static_cast<int>(unpooled_faults));
+}
+
+// Flood fills |image| from (|x|, |y|) like the Bucket tool, one pixel at a
+// time.
+void FillLikeBucket(graphics::Image& image, int x, int y,
+                    const graphics::Color& fill) {
+  const int width = image.GetWidth();
+  const int height = image.GetHeight();
+  const graphics::Color start = image.GetColor(x, y);
+  if (start == fill) return;
+  std::vector<int> pending(1, y * width + x);
+  while (!pending.empty()) {
+    const int index = pending.back();
+    pending.pop_back();
+    const int px = index % width;
+    const int py = index / width;
+    if (image.GetColor(px, py) != start) continue;
+    image.SetColor(px, py, fill);
+    if (px > 0) pending.push_back(index - 1);
+    if (px < width - 1) pending.push_back(index + 1);
+    if (py > 0) pending.push_back(index - width);
+    if (py < height - 1) pending.push_back(index + width);
+  }
+}
+
+// Draws a few flat shapes and strokes into |image|, which is an Image or an
+// IndexedImage.
+template <typename Canvas>
+void PaintFlatDrawing(Canvas& image) {
+  const graphics::Color black(0, 0, 0);
+  const graphics::Color red(220, 30, 30);
+  const graphics::Color blue(30, 30, 220);
+  image.DrawRectangle(20, 20, 200, 120, blue);
+  image.DrawCircle(300, 200, 80, red);
+  image.DrawLine(0, 0, 399, 299, black);
+  image.DrawLine(10, 290, 390, 40, black, 7);
+  image.DrawLine(50, 250, 52, 100, red, 12);
+  image.DrawLine(350, 10, 200, 11, blue, 5);
+  image.SetColor(5, 295, red);
+}
+
+TEST(IndexedImageTest, DrawsLikeImage) {
+  graphics::Image expected(400, 300);
+  PaintFlatDrawing(expected);
+  graphics::IndexedImage indexed;
+  ASSERT_TRUE(indexed.Initialize(400, 300));
+  PaintFlatDrawing(indexed);
+  EXPECT_EQ(4, indexed.GetPalette().size());
+  EXPECT_EQ(400 * 300, indexed.GetMemoryUsage());
+
+  graphics::Image actual;
+  ASSERT_TRUE(indexed.ToImage(actual));
+  EXPECT_TRUE(ImagesMatch(&expected, &actual, "IndexedDrawsLikeImage.bmp",
+                          kTypeHighlight));
+
+  // Fills compare indices, and cover the same area as the bucket would.
+  const graphics::Color green(0, 200, 0);
+  for (const auto& seed : {std::make_pair(100, 280), std::make_pair(300, 200),
+                           std::make_pair(399, 0)}) {
+    FillLikeBucket(expected, seed.first, seed.second, green);
+    ASSERT_TRUE(indexed.Fill(seed.first, seed.second, green));
+  }
+  ASSERT_TRUE(indexed.ToImage(actual));
+  EXPECT_TRUE(ImagesMatch(&expected, &actual, "IndexedFillsLikeImage.bmp",
+                          kTypeHighlight));
+  EXPECT_EQ(green, indexed.GetColor(300, 200));
+
+  // Round trips through an Image and a file.
+  graphics::IndexedImage copy;
+  ASSERT_TRUE(copy.FromImage(actual));
+  // Filling may leave palette entries that no pixel uses.
+  EXPECT_LE(copy.GetPalette().size(), indexed.GetPalette().size());
+  ASSERT_TRUE(copy.SaveImageBmp("indexed.bmp"));
+  graphics::Image loaded;
+  ASSERT_TRUE(loaded.Load("indexed.bmp"));
+  EXPECT_TRUE(ImagesMatch(&actual, &loaded, "IndexedRoundTrips.bmp",
+                          kTypeHighlight));
+  remove("indexed.bmp");
+}
+
+TEST(IndexedImageTest, HoldsUpToAPaletteOfColors) {
+  graphics::IndexedImage image;
+  ASSERT_TRUE(image.Initialize(32, 16, graphics::Color(0, 0, 0)));
+  for (int i = 1; i < graphics::IndexedImage::kMaxColors; i++) {
+    ASSERT_TRUE(image.SetColor(i % 32, i / 32, graphics::Color(i, i, 0)));
+  }
+  EXPECT_FALSE(image.SetColor(0, 0, graphics::Color(1, 2, 3)));
+  EXPECT_FALSE(image.Fill(0, 0, graphics::Color(1, 2, 3)));
+  EXPECT_TRUE(image.SetColor(0, 0, graphics::Color(7, 7, 0)));
+  EXPECT_EQ(7, image.GetIndex(0, 0));
+  EXPECT_EQ(-1, image.GetIndex(32, 0));
+
+  // Recoloring a palette entry recolors its pixels.
+  ASSERT_TRUE(image.SetPaletteColor(7, graphics::Color(9, 9, 9)));
+  EXPECT_EQ(graphics::Color(9, 9, 9), image.GetColor(0, 0));
+  EXPECT_EQ(graphics::Color(9, 9, 9), image.GetColor(7, 0));
+
+  // Images with too many colors are not converted.
+  graphics::Image rgb(300, 1);
+  for (int x = 0; x < 300; x++) {
+    rgb.SetColor(x, 0, graphics::Color(x % 256, x / 256, 0));
+  }
+  graphics::IndexedImage unchanged;
+  ASSERT_TRUE(unchanged.Initialize(1, 1));
+  EXPECT_FALSE(unchanged.FromImage(rgb));
+  EXPECT_EQ(1, unchanged.GetWidth());
+}
+
+// Compares strokes and fills on an IndexedImage and an Image of the same
+// flat drawing, and their memory.
+TEST(IndexedImageTest, BenchmarksStrokesAndFills) {
+  const int size = 1024;
+  graphics::Image image(size, size);
+  graphics::IndexedImage indexed;
+  ASSERT_TRUE(indexed.Initialize(size, size));
+  graphics::GestureGenerator gestures(size, size, 11);
+  const std::vector<graphics::TimedMouseEvent> stroke =
+      gestures.RandomWalk(400, 20);
+  using Clock = std::chrono::steady_clock;
+  auto time_ms = [](const std::function<void()>& run) {
+    const auto start = Clock::now();
+    run();
+    return std::chrono::duration<double>(Clock::now() - start).count() * 1000;
+  };
+  auto draw = [&](auto& canvas) {
+    for (size_t i = 1; i < stroke.size(); i++) {
+      canvas.DrawLine(stroke[i - 1].event.GetX(), stroke[i - 1].event.GetY(),
+                      stroke[i].event.GetX(), stroke[i].event.GetY(),
+                      graphics::Color(0, 0, 0), 9);
+    }
+  };
+  graphics::PixelPool& pool = graphics::PixelPool::Get();
+  const auto allocations = [&pool] {
+    const graphics::PixelPool::Stats stats = pool.GetStats();
+    return stats.system_allocations + stats.reuses;
+  };
+  const double image_stroke_ms = time_ms([&] { draw(image); });
+  size_t indexed_allocations = allocations();
+  const double indexed_stroke_ms = time_ms([&] { draw(indexed); });
+  indexed_allocations = allocations() - indexed_allocations;
+
+  const graphics::Color fill(250, 200, 0);
+  const double image_fill_ms =
+      time_ms([&] { FillLikeBucket(image, 0, 0, fill); });
+  const size_t fill_start = allocations();
+  const double indexed_fill_ms = time_ms([&] { indexed.Fill(0, 0, fill); });
+  indexed_allocations += allocations() - fill_start;
+
+  graphics::Image converted;
+  ASSERT_TRUE(indexed.ToImage(converted));
+  EXPECT_TRUE(ImagesMatch(&image, &converted, "IndexedBenchmark.bmp",
+                          kTypeHighlight));
+  // Strokes and fills draw in place, on a third of the memory.
+  EXPECT_EQ(0, indexed_allocations);
+  EXPECT_EQ(size * size, indexed.GetMemoryUsage());
+  EXPECT_LE(3 * indexed.GetMemoryUsage(), image.GetMemoryUsage());
+  RecordProperty("image_stroke_us", static_cast<int>(image_stroke_ms * 1000));
+  RecordProperty("indexed_stroke_us",
+                 static_cast<int>(indexed_stroke_ms * 1000));
+  RecordProperty("image_fill_us", static_cast<int>(image_fill_ms * 1000));
+  RecordProperty("indexed_fill_us", static_cast<int>(indexed_fill_ms * 1000));
+}
+
+// Draws the flat drawing into a PixelImage of |PixelT| pixels, and checks
+// that it converts to the same Image as drawing on an Image.
+template <typename PixelT>
+void ExpectPixelImageDrawsLikeImage(const graphics::Image& expected,
+                                    const std::string& name) {
+  graphics::PixelImage<PixelT> image;
+  ASSERT_TRUE(image.Initialize(400, 300));
+  PaintFlatDrawing(image);
+  EXPECT_EQ(400 * 300 * sizeof(PixelT), image.GetMemoryUsage());
+  graphics::Image actual;
+  ASSERT_TRUE(image.ToImage(actual));
+  EXPECT_TRUE(ImagesMatch(&expected, &actual, name, kTypeHighlight));
+}
+
+TEST(PixelImageTest, DrawsLikeImage) {
+  graphics::Image expected(400, 300);
+  PaintFlatDrawing(expected);
+  ExpectPixelImageDrawsLikeImage<graphics::Rgb8>(expected, "Rgb8Draws.bmp");
+  ExpectPixelImageDrawsLikeImage<graphics::Rgba8>(expected, "Rgba8Draws.bmp");
+  ExpectPixelImageDrawsLikeImage<graphics::Rgba16>(expected,
+                                                   "Rgba16Draws.bmp");
+  ExpectPixelImageDrawsLikeImage<graphics::Rgba32F>(expected,
+                                                    "Rgba32FDraws.bmp");
+}
+
+TEST(PixelImageTest, ConvertsBetweenFormats) {
+  EXPECT_EQ(65535, graphics::ConvertChannel<uint16_t>(uint8_t{255}));
+  EXPECT_EQ(257 * 128, graphics::ConvertChannel<uint16_t>(uint8_t{128}));
+  EXPECT_EQ(128, graphics::ConvertChannel<uint8_t>(uint16_t{257 * 128 + 128}));
+  EXPECT_EQ(128, graphics::ConvertChannel<uint8_t>(0.5f));
+  EXPECT_EQ(255, graphics::ConvertChannel<uint8_t>(1.5f));
+  EXPECT_EQ(0, graphics::ConvertChannel<uint8_t>(-0.5f));
+  EXPECT_FLOAT_EQ(1.0f, graphics::ConvertChannel<float>(uint16_t{65535}));
+  const graphics::Rgba8 half_red = {{128, 0, 0, 128}};
+  EXPECT_EQ((graphics::Rgb8{{128, 0, 0}}),
+            graphics::ConvertPixel<graphics::Rgb8>(half_red));
+  EXPECT_EQ((graphics::Rgba8{{1, 2, 3, 255}}),
+            graphics::ConvertPixel<graphics::Rgba8>(graphics::Rgb8{{1, 2, 3}}));
+
+  // Every 8-bit value survives a trip through wider formats.
+  graphics::Image original(256, 3);
+  for (int x = 0; x < 256; x++) {
+    original.SetColor(x, 0, graphics::Color(x, 0, 0));
+    original.SetColor(x, 1, graphics::Color(0, x, 255 - x));
+    original.SetColor(x, 2, graphics::Color(x, x, x));
+  }
+  graphics::PixelImage<graphics::Rgba16> wide;
+  ASSERT_TRUE(wide.FromImage(original));
+  EXPECT_EQ(65535, wide.GetPixel(10, 1).channels[3]);
+  graphics::PixelImage<graphics::Rgba32F> floating;
+  ASSERT_TRUE(floating.ConvertFrom(wide));
+  graphics::PixelImage<graphics::Rgba8> narrow;
+  ASSERT_TRUE(narrow.ConvertFrom(floating));
+  graphics::Image converted;
+  ASSERT_TRUE(narrow.ToImage(converted));
+  EXPECT_TRUE(ImagesMatch(&original, &converted, "PixelImageConverts.bmp",
+                          kTypeHighlight));
+
+  graphics::PixelImage<graphics::Rgb8> empty;
+  EXPECT_FALSE(empty.ToImage(converted));
+  EXPECT_FALSE(narrow.ConvertFrom(empty));
+  EXPECT_EQ(nullptr, narrow.GetChannelData(4));
+}
+
+// Composites a faint white layer over black |layers| times, and returns the
+// resulting gray level of the top left pixel, from 0 to 255.
+template <typename PixelT>
+int CompositeFaintLayers(int size, int layers, double* ms) {
+  using Channel = typename PixelT::Channel;
+  const Channel alpha = graphics::ConvertChannel<Channel>(uint8_t{3});
+  graphics::PixelImage<PixelT> image;
+  graphics::PixelImage<PixelT> layer;
+  image.Initialize(size, size, PixelT{{0, 0, 0, PixelT::kMax}});
+  layer.Initialize(size, size, PixelT{{alpha, alpha, alpha, alpha}});
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < layers; i++) image.Composite(layer, 0, 0);
+  *ms = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                      start).count() * 1000;
+  return image.GetColor(0, 0).Red();
+}
+
+TEST(PixelImageTest, BlendsWithoutBanding) {
+  // Blending white at 3/255 alpha over black approaches white, but 8-bit
+  // channels round each step and stall once it adds less than half a level.
+  double rgba8_ms;
+  double rgba16_ms;
+  double rgba32f_ms;
+  const int rgba8 = CompositeFaintLayers<graphics::Rgba8>(256, 1000, &rgba8_ms);
+  const int rgba16 =
+      CompositeFaintLayers<graphics::Rgba16>(256, 1000, &rgba16_ms);
+  const int rgba32f =
+      CompositeFaintLayers<graphics::Rgba32F>(256, 1000, &rgba32f_ms);
+  EXPECT_LT(rgba8, 230);
+  EXPECT_GE(rgba16, 254);
+  EXPECT_EQ(255, rgba32f);
+  RecordProperty("rgba8_us", static_cast<int>(rgba8_ms * 1000));
+  RecordProperty("rgba16_us", static_cast<int>(rgba16_ms * 1000));
+  RecordProperty("rgba32f_us", static_cast<int>(rgba32f_ms * 1000));
+
+  graphics::PixelImage<graphics::Rgba8> image;
+  ASSERT_TRUE(image.Initialize(4, 4));
+  EXPECT_TRUE(image.BlendPixel(1, 1, graphics::Rgba8{{0, 0, 128, 128}}));
+  EXPECT_EQ((graphics::Rgba8{{127, 127, 255, 255}}), image.GetPixel(1, 1));
+  EXPECT_FALSE(image.BlendPixel(4, 0, graphics::Rgba8{{0, 0, 0, 0}}));
+  EXPECT_FALSE(image.Composite(image, 0, 0));
+  graphics::PixelImage<graphics::Rgba8> layer;
+  ASSERT_TRUE(layer.Initialize(3, 3, graphics::Rgba8{{0, 0, 0, 255}}));
+  EXPECT_TRUE(layer.SetPixel(1, 1, graphics::Rgba8{{0, 0, 0, 0}}));
+  // Clipped to the bottom right corner, with the layer's hole at (3, 3).
+  EXPECT_TRUE(image.Composite(layer, 2, 2));
+  EXPECT_EQ(graphics::Color(0, 0, 0), image.GetColor(2, 2));
+  EXPECT_EQ(graphics::Color(255, 255, 255), image.GetColor(3, 3));
+  EXPECT_EQ(graphics::Color(255, 255, 255), image.GetColor(1, 3));
+}
+
+TEST(MemoryRegistryTest, CountsSharedAndLoadedPixels) {
+  graphics::Image image(300, 200);
+  const size_t pixels = 300 * 200 * 3;
+  const size_t bookkeeping = image.GetMemoryUsage() - pixels;
+
+  // Shared pixels are split between the images sharing them, until one of
+  // them copies its own.
+  graphics::Image shared = image.Share();
+  EXPECT_EQ(pixels / 2 + bookkeeping, image.GetMemoryUsage());
+  ASSERT_TRUE(shared.SetColor(0, 0, graphics::Color(1, 2, 3)));
+  EXPECT_EQ(pixels + bookkeeping, image.GetMemoryUsage());
+
+  // Pixels CImg loads itself count too.
+  {
+    std::ofstream ppm("memory_test.ppm", std::ios::binary);
+    ppm << "P6\n30 20\n255\n" << std::string(30 * 20 * 3, '\x40');
+  }
+  graphics::Image loaded;
+  ASSERT_TRUE(loaded.Load("memory_test.ppm"));
+  EXPECT_LE(30 * 20 * 3, loaded.GetMemoryUsage());
+  remove("memory_test.ppm");
+}
+
+TEST(MemoryRegistryTest, AddsUpCategoriesAndDumpsThem) {
+  graphics::MemoryRegistry registry;
+  EXPECT_EQ(0, registry.GetUsage());
+  graphics::Image image(300, 200);
+  size_t history = 1000;
+  registry.AddSource("canvas/pixels", [&] { return image.GetMemoryUsage(); });
+  registry.AddSource("canvas/snapshots",
+                     [&] { return image.GetSnapshotMemoryUsage(); });
+  const int id = registry.AddSource("/history//journal/",
+                                    [&] { return history; });
+  registry.AddSource("history/journal", [] { return size_t{24}; });
+
+  EXPECT_GE(registry.GetUsage("canvas/pixels"), 300 * 200 * 3);
+  EXPECT_EQ(0, registry.GetUsage("canvas/snapshots"));
+  EXPECT_EQ(1024, registry.GetUsage("history"));
+  EXPECT_EQ(1024, registry.GetUsage("history/journal"));
+  EXPECT_EQ(0, registry.GetUsage("hist"));
+  EXPECT_EQ(registry.GetUsage("canvas") + 1024, registry.GetUsage());
+
+  // Reports are current: snapshot tiles count once the image changes them.
+  std::shared_ptr<graphics::ImageSnapshot> snapshot = image.Snapshot();
+  image.SetColor(0, 0, graphics::Color(1, 2, 3));
+  EXPECT_EQ(graphics::Image::kTileSize * graphics::Image::kTileSize * 3,
+            registry.GetUsage("canvas/snapshots"));
+  history = 2000;
+  EXPECT_EQ(2024, registry.GetUsage("history"));
+
+  registry.SetBudget("history", 4096);
+  const std::vector<graphics::MemoryRegistry::Category> categories =
+      registry.GetCategories();
+  std::vector<std::string> paths;
+  for (const auto& category : categories) paths.push_back(category.path);
+  EXPECT_THAT(paths, testing::ElementsAre("", "canvas", "canvas/pixels",
+                                          "canvas/snapshots", "history",
+                                          "history/journal"));
+  EXPECT_EQ(registry.GetUsage(), categories[0].bytes);
+  EXPECT_EQ(2, categories[2].depth);
+  EXPECT_EQ(4096, categories[4].budget);
+  EXPECT_EQ(SIZE_MAX, categories[5].budget);
+
+  std::ostringstream dump;
+  registry.Dump(dump);
+  EXPECT_THAT(dump.str(),
+              testing::HasSubstr("\n  history: 2024 bytes (budget 4096 "
+                                 "bytes)\n    journal: 2024 bytes\n"));
+  EXPECT_EQ(0, dump.str().find("total: "));
+
+  registry.RemoveSource(id);
+  EXPECT_EQ(24, registry.GetUsage("history"));
+}
+
+TEST(MemoryRegistryTest, EvictsUntilCategoriesFitTheirBudgets) {
+  graphics::MemoryRegistry registry;
+  graphics::Canvas canvas;
+  graphics::Image viewport;
+  ASSERT_TRUE(canvas.View(viewport, 1024, 512, 0, 0));
+  PaintTestImage(viewport);
+  canvas.Commit();
+  ASSERT_TRUE(canvas.View(viewport, 1, 1, -5000, -5000));
+  const size_t canvas_bytes = canvas.GetMemoryUsage();
+  // The canvas compresses its least recently used tiles to free memory.
+  registry.AddSource(
+      "images/canvas", [&] { return canvas.GetMemoryUsage(); },
+      [&](size_t bytes) {
+        const size_t before = canvas.GetMemoryUsage();
+        canvas.CompressColdTiles(3600, before - std::min(before, bytes));
+        return before - canvas.GetMemoryUsage();
+      });
+  size_t cache = 1 << 20;
+  std::vector<size_t> evictions;
+  registry.AddSource(
+      "caches/thumbnails", [&] { return cache; },
+      [&](size_t bytes) {
+        evictions.push_back(bytes);
+        const size_t freed = std::min(cache, bytes);
+        cache -= freed;
+        return freed;
+      });
+  size_t fixed = 1 << 20;
+  registry.AddSource("caches/fixed", [&] { return fixed; });
+
+  // Within budget, nothing is evicted.
+  registry.SetBudget("caches", 4 << 20);
+  EXPECT_EQ(0, registry.EnforceBudgets());
+  EXPECT_TRUE(evictions.empty());
+
+  // Over budget, sources free what they can; the fixed one cannot help.
+  registry.SetBudget("caches", (1 << 20) + 1000);
+  EXPECT_EQ((1 << 20) - 1000, registry.EnforceBudgets());
+  EXPECT_THAT(evictions, testing::ElementsAre((1 << 20) - 1000));
+  registry.SetBudget("caches", 1000);
+  EXPECT_EQ(1000, registry.EnforceBudgets());
+  EXPECT_EQ(0, cache);
+  EXPECT_EQ(1 << 20, registry.GetUsage("caches"));
+
+  // Compressing tiles brings the canvas within its budget.
+  registry.SetBudget("caches", SIZE_MAX);
+  registry.SetBudget("images", canvas_bytes / 2);
+  const size_t freed = registry.EnforceBudgets();
+  EXPECT_GE(freed, canvas_bytes / 2);
+  EXPECT_LE(registry.GetUsage("images"), canvas_bytes / 2);
+  EXPECT_GT(canvas.GetMemoryStats().compressed_tiles, 0);
+  EXPECT_EQ(canvas_bytes - freed, canvas.GetMemoryUsage());
+  viewport.Initialize(1, 1);
+}
+
+// Draws a few shapes into a 32 by 32 |image|, the size of an icon.
+template <typename Canvas>
+void PaintIcon(Canvas& image) {
+  image.DrawRectangle(2, 2, 12, 10, graphics::Color(30, 30, 220));
+  image.DrawCircle(20, 20, 9, graphics::Color(220, 30, 30));
+  image.DrawLine(0, 31, 31, 0, graphics::Color(0, 0, 0), 3);
+  image.DrawLine(0, 0, 31, 20, graphics::Color(0, 120, 0));
+  image.SetColor(31, 31, graphics::Color(1, 2, 3));
+}
+
+TEST(SmallImageTest, DrawsLikeImage) {
+  graphics::Image expected(32, 32);
+  PaintIcon(expected);
+  graphics::SmallImage icon(32, 32);
+  EXPECT_TRUE(icon.IsInline());
+  PaintIcon(icon);
+  graphics::Image actual(32, 32);
+  ASSERT_TRUE(actual.DrawImage(0, 0, icon));
+  EXPECT_TRUE(ImagesMatch(&expected, &actual, "SmallImageDraws.bmp",
+                          kTypeHighlight));
+  EXPECT_EQ(graphics::Color(1, 2, 3), icon.GetColor(31, 31));
+  EXPECT_EQ(graphics::Color(0, 0, 0), icon.GetColor(32, 0));
+  EXPECT_FALSE(icon.SetColor(-1, 0, graphics::Color(0, 0, 0)));
+  EXPECT_FALSE(icon.DrawRectangle(32, 0, 1, 1, graphics::Color(0, 0, 0)));
+
+  // Larger images keep their pixels elsewhere, and draw the same.
+  graphics::Image large_expected(400, 300);
+  PaintFlatDrawing(large_expected);
+  graphics::SmallImage large(400, 300);
+  EXPECT_FALSE(large.IsInline());
+  PaintFlatDrawing(large);
+  graphics::Image large_actual(400, 300);
+  ASSERT_TRUE(large_actual.DrawImage(0, 0, large));
+  EXPECT_TRUE(ImagesMatch(&large_expected, &large_actual,
+                          "SmallImageDrawsLarge.bmp", kTypeHighlight));
+}
+
+TEST(SmallImageTest, CopiesToAndFromImages) {
+  graphics::Image image(300, 200);
+  PaintTestImage(image);
+  graphics::SmallImage stamp;
+  EXPECT_EQ(0, stamp.GetWidth());
+  EXPECT_EQ(nullptr, stamp.GetChannelData(0));
+  EXPECT_FALSE(image.DrawImage(0, 0, stamp));
+  EXPECT_FALSE(stamp.CopyFrom(image, 290, 0, 20, 20));
+  ASSERT_TRUE(stamp.CopyFrom(image, 100, 50, 20, 30));
+  EXPECT_EQ(image.GetColor(119, 79), stamp.GetColor(19, 29));
+
+  // Drawing is clipped to the image, and marks the tiles it changed.
+  graphics::Image target(64, 64);
+  const uint64_t generation = target.GetGeneration();
+  ASSERT_TRUE(target.DrawImage(-5, 50, stamp));
+  EXPECT_EQ(stamp.GetColor(5, 0), target.GetColor(0, 50));
+  EXPECT_EQ(stamp.GetColor(19, 13), target.GetColor(14, 63));
+  EXPECT_EQ(graphics::Color(255, 255, 255), target.GetColor(15, 63));
+  EXPECT_EQ(graphics::Color(255, 255, 255), target.GetColor(0, 49));
+  EXPECT_GT(target.GetTileGeneration(0, 0), generation);
+  EXPECT_TRUE(target.DrawImage(64, 0, stamp));
+
+  // Copies are independent, and moves leave the source empty.
+  graphics::SmallImage copy = stamp;
+  ASSERT_TRUE(copy.SetColor(0, 0, graphics::Color(9, 9, 9)));
+  EXPECT_EQ(image.GetColor(100, 50), stamp.GetColor(0, 0));
+  graphics::SmallImage moved = std::move(copy);
+  EXPECT_EQ(graphics::Color(9, 9, 9), moved.GetColor(0, 0));
+  EXPECT_EQ(0, copy.GetWidth());
+  graphics::SmallImage large(100, 100, graphics::Color(5, 6, 7));
+  const uint8_t* pixels = large.GetChannelData(0);
+  moved = std::move(large);
+  EXPECT_EQ(pixels, moved.GetChannelData(0));
+  EXPECT_EQ(graphics::Color(5, 6, 7), moved.GetColor(99, 99));
+  moved = stamp;
+  EXPECT_TRUE(moved.IsInline());
+  EXPECT_EQ(stamp.GetColor(10, 10), moved.GetColor(10, 10));
+}
+
+TEST(SmallImageTest, BenchmarksStamping) {
+  // Like a brush, creates a stamp, draws it and draws it onto a canvas.
+  const int count = 5000;
+  using Clock = std::chrono::steady_clock;
+  auto time_ms = [](const std::function<void()>& run) {
+    const auto start = Clock::now();
+    run();
+    return std::chrono::duration<double>(Clock::now() - start).count() * 1000;
+  };
+  graphics::Image expected(200, 200);
+  graphics::PixelPool& pool = graphics::PixelPool::Get();
+  const graphics::PixelPool::Stats image_before = pool.GetStats();
+  const double image_ms = time_ms([&] {
+    for (int i = 0; i < count; i++) {
+      graphics::Image stamp(16, 16);
+      stamp.DrawCircle(8, 8, 5, graphics::Color(i % 256, 0, 0));
+      const int x = i % 184;
+      const int y = i / 184 * 7;
+      for (int dy = 0; dy < 16; dy++) {
+        for (int dx = 0; dx < 16; dx++) {
+          expected.SetColor(x + dx, y + dy, stamp.GetColor(dx, dy));
+        }
+      }
+    }
+  });
+  const graphics::PixelPool::Stats image_after = pool.GetStats();
+  graphics::Image actual(200, 200);
+  const graphics::PixelPool::Stats before = pool.GetStats();
+  const double stamp_ms = time_ms([&] {
+    for (int i = 0; i < count; i++) {
+      graphics::SmallImage stamp(16, 16);
+      stamp.DrawCircle(8, 8, 5, graphics::Color(i % 256, 0, 0));
+      actual.DrawImage(i % 184, i / 184 * 7, stamp);
+    }
+  });
+  const graphics::PixelPool::Stats after = pool.GetStats();
+  // Each stamp Image takes a pooled buffer, while small images need none.
+  EXPECT_EQ(count, image_after.system_allocations + image_after.reuses -
+                       image_before.system_allocations - image_before.reuses);
+  EXPECT_EQ(before.system_allocations, after.system_allocations);
+  EXPECT_EQ(before.reuses, after.reuses);
+  EXPECT_TRUE(ImagesMatch(&expected, &actual, "SmallImageStamps.bmp",
+                          kTypeHighlight));
+  RecordProperty("image_stamps_us", static_cast<int>(image_ms * 1000));
+  RecordProperty("small_image_stamps_us", static_cast<int>(stamp_ms * 1000));
+}
+
+TEST(ProjectFileTest, SavesAndOpensLazily) {
+  const std::string filename = "project_test.tpaint";
+  graphics::Image painting(700, 300);
+  PaintTestImage(painting);
+  // Leave some tiles a single color.
+  painting.DrawRectangle(0, 0, 256, 128, graphics::Color(9, 8, 7));
+  graphics::ProjectFile saved;
+  ASSERT_TRUE(saved.Save(filename, painting, {{"tool", "2"}, {"note", ""}}));
+
+  graphics::ProjectFile project;
+  ASSERT_TRUE(project.Open(filename));
+  EXPECT_EQ(project.GetWidth(), 700);
+  EXPECT_EQ(project.GetHeight(), 300);
+  EXPECT_EQ(project.GetMetadata(),
+            graphics::ProjectFile::Metadata({{"note", ""}, {"tool", "2"}}));
+  graphics::Image image;
+  ASSERT_TRUE(project.Attach(image));
+  EXPECT_FALSE(image.IsTileLoaded(0, 0));
+  EXPECT_EQ(image.GetColor(5, 5), graphics::Color(9, 8, 7));
+  EXPECT_FALSE(image.IsTileLoaded(5, 2));
+  EXPECT_TRUE(ImagesMatch(&painting, &image, "ProjectSavesAndOpens.bmp",
+                          DiffType::kTypeHighlight));
+
+  // Saving again appends only the changed tile, one of 18, and a new index.
+  const size_t size = project.GetFileSize();
+  image.DrawCircle(580, 190, 20, graphics::Color(0, 0, 255));
+  painting.DrawCircle(580, 190, 20, graphics::Color(0, 0, 255));
+  ASSERT_TRUE(project.Save(filename, image, project.GetMetadata()));
+  EXPECT_GT(project.GetFileSize(), size);
+  EXPECT_LT(project.GetFileSize(), size + size / 8);
+
+  graphics::ProjectFile reopened;
+  ASSERT_TRUE(reopened.Open(filename));
+  graphics::Image reloaded;
+  ASSERT_TRUE(reopened.Attach(reloaded));
+  EXPECT_TRUE(ImagesMatch(&painting, &reloaded, "ProjectAppends.bmp",
+                          DiffType::kTypeHighlight));
+  remove(filename.c_str());
+}
+
+TEST(ProjectFileTest, SavesUnreadTilesWithoutDecoding) {
+  graphics::Image painting(400, 400);
+  PaintTestImage(painting);
+  graphics::ProjectFile project;
+  ASSERT_TRUE(project.Save("project_a.tpaint", painting, {}));
+  ASSERT_TRUE(project.Open("project_a.tpaint"));
+  graphics::Image image;
+  ASSERT_TRUE(project.Attach(image));
+
+  // Save as another file, copying tiles that were never read.
+  ASSERT_TRUE(project.Save("project_b.tpaint", image, {}));
+  EXPECT_FALSE(image.IsTileLoaded(0, 0));
+  EXPECT_EQ(project.GetFilename(), "project_b.tpaint");
+  EXPECT_TRUE(ImagesMatch(&painting, &image, "ProjectSavesAs.bmp",
+                          DiffType::kTypeHighlight));
+  remove("project_a.tpaint");
+  remove("project_b.tpaint");
+}
+
+// Saves an opened project through a second ProjectFile that follows it, as
+// the autosaver does, and checks that only the changed tiles are read.
+TEST(ProjectFileTest, SavesLikeAnotherProject) {
+  graphics::Image painting(400, 400);
+  PaintTestImage(painting);
+  graphics::ProjectFile project;
+  ASSERT_TRUE(project.Save("project_a.tpaint", painting, {}));
+  ASSERT_TRUE(project.Open("project_a.tpaint"));
+  graphics::Image image;
+  ASSERT_TRUE(project.Attach(image));
+  graphics::ProjectFile saver;
+  ASSERT_TRUE(saver.OpenLike(project));
+  EXPECT_EQ(saver.GetFilename(), "project_a.tpaint");
+
+  image.DrawCircle(300, 300, 20, graphics::Color(0, 0, 255));
+  painting.DrawCircle(300, 300, 20, graphics::Color(0, 0, 255));
+  std::shared_ptr<graphics::ImageSnapshot> snapshot = saver.Snapshot(image);
+  EXPECT_FALSE(image.IsTileLoaded(0, 0));
+  ASSERT_TRUE(saver.Save("project_b.tpaint", *snapshot, {}));
+  EXPECT_FALSE(image.IsTileLoaded(0, 0));
+  auto expect_saved = [&](const std::string& filename,
+                          const std::string& output) {
+    graphics::ProjectFile reopened;
+    ASSERT_TRUE(reopened.Open(filename));
+    graphics::Image reloaded;
+    ASSERT_TRUE(reopened.Attach(reloaded));
+    EXPECT_TRUE(ImagesMatch(&painting, &reloaded, output,
+                            DiffType::kTypeHighlight));
+  };
+  expect_saved("project_b.tpaint", "ProjectSavesLike.bmp");
+
+  // Both save to one file, each in turn after the other replaced it.
+  ASSERT_TRUE(saver.OpenLike(project));
+  image.DrawCircle(50, 50, 20, graphics::Color(255, 0, 0));
+  painting.DrawCircle(50, 50, 20, graphics::Color(255, 0, 0));
+  ASSERT_TRUE(saver.Save("project_a.tpaint", *saver.Snapshot(image), {}));
+  ASSERT_TRUE(project.Save("project_a.tpaint", image, {}));
+  ASSERT_TRUE(saver.Save("project_a.tpaint", *saver.Snapshot(image), {}));
+  expect_saved("project_a.tpaint", "ProjectSavesLikeTwice.bmp");
+
+  graphics::ProjectFile closed;
+  EXPECT_FALSE(saver.OpenLike(closed));
+  remove("project_a.tpaint");
+  remove("project_b.tpaint");
+}
+
+TEST(ProjectFileTest, RejectsCorruptFiles) {
+  graphics::Image painting(200, 200);
+  PaintTestImage(painting);
+  graphics::ProjectFile project;
+  ASSERT_TRUE(project.Save("project_test.tpaint", painting, {}));
+  std::string contents = ReadFile("project_test.tpaint");
+  contents[contents.size() - 3] ^= 1;
+  std::ofstream("project_test.tpaint", std::ios::binary)
+      .write(contents.data(), contents.size());
+  EXPECT_FALSE(project.Open("project_test.tpaint"));
+  EXPECT_FALSE(project.Open("missing.tpaint"));
+  remove("project_test.tpaint");
+}
+
+// Reports how long opening a large project takes compared to loading the
+// same image as a bitmap, and checks that opening reads no tiles.
+TEST(ProjectFileTest, BenchmarksOpeningLargeProjects) {
+  const int size = 4096;
+  graphics::Image painting(size, size);
+  PaintTestImage(painting);
+  graphics::ProjectFile saved;
+  ASSERT_TRUE(saved.Save("project_bench.tpaint", painting, {}));
+  ASSERT_TRUE(painting.SaveImageBmp("project_bench.bmp"));
+
+  using Clock = std::chrono::steady_clock;
+  auto start = Clock::now();
+  graphics::ProjectFile project;
+  graphics::Image image;
+  ASSERT_TRUE(project.Open("project_bench.tpaint"));
+  ASSERT_TRUE(project.Attach(image));
+  const double open_ms =
+      std::chrono::duration<double>(Clock::now() - start).count() * 1000;
+  start = Clock::now();
+  graphics::Image bitmap;
+  ASSERT_TRUE(bitmap.Load("project_bench.bmp"));
+  const double load_ms =
+      std::chrono::duration<double>(Clock::now() - start).count() * 1000;
+  // Opening reads no tiles until they are used.
+  const int tiles = size / graphics::Image::kTileSize;
+  auto count_loaded = [&] {
+    int loaded = 0;
+    for (int row = 0; row < tiles; row++) {
+      for (int column = 0; column < tiles; column++) {
+        loaded += image.IsTileLoaded(column, row);
+      }
+    }
+    return loaded;
+  };
+  EXPECT_EQ(0, count_loaded());
+  EXPECT_EQ(painting.GetColor(size / 2, size / 2),
+            image.GetColor(size / 2, size / 2));
+  EXPECT_EQ(1, count_loaded());
+  RecordProperty("project_open_us", static_cast<int>(open_ms * 1000));
+  RecordProperty("bmp_load_us", static_cast<int>(load_ms * 1000));
+  remove("project_bench.tpaint");
+  remove("project_bench.bmp");
+}
+
+// Saves a snapshot of a large project on another thread while the image is
+// drawn to, as an autosave would, and checks that exactly the snapshot was
+// saved.
+TEST(ProjectFileTest, SavesSnapshotsWhileDrawing) {
+  const std::string filename = "project_snapshot.tpaint";
+  graphics::Image image(2048, 2048);
+  PaintTestImage(image);
+  graphics::ProjectFile project;
+  ASSERT_TRUE(project.Save(filename, image, {}));
+  const size_t size = project.GetFileSize();
+
+  image.DrawCircle(960, 960, 30, graphics::Color(0, 128, 0));
+  ASSERT_TRUE(image.SaveFast("project_snapshot.qoi"));
+  std::shared_ptr<graphics::ImageSnapshot> snapshot =
+      project.Snapshot(image);
+  bool saved = false;
+  std::thread saver([&] { saved = project.Save(filename, *snapshot, {}); });
+  // Scribble over every tile while saving, including the ones being saved.
+  graphics::GestureGenerator gestures(2048, 2048, 5);
+  for (const graphics::TimedMouseEvent& event : gestures.Scribble(20, 30)) {
+    image.DrawCircle(event.event.GetX(), event.event.GetY(), 40,
+                     graphics::Color(200, 0, 200));
+  }
+  saver.join();
+  ASSERT_TRUE(saved);
+  // Only the tile with the circle was written.
+  EXPECT_LT(project.GetFileSize(), size + size / 8);
+
+  graphics::Image expected;
+  ASSERT_TRUE(expected.LoadFast("project_snapshot.qoi"));
+  graphics::ProjectFile reopened;
+  ASSERT_TRUE(reopened.Open(filename));
+  graphics::Image reloaded;
+  ASSERT_TRUE(reopened.Attach(reloaded));
+  EXPECT_TRUE(ImagesMatch(&expected, &reloaded, "ProjectSnapshot.bmp",
+                          DiffType::kTypeHighlight));
+  remove(filename.c_str());
+  remove("project_snapshot.qoi");
+}
+
+class TestFileEventListener : public graphics::FileEventListener {
+ public:
+  void OnFileProgress(const std::string& filename, double progress) override {
+    // Operations run side by side, so only each one's progress must grow.
+    EXPECT_GE(progress, progress_[filename]);
+    progress_[filename] = progress;
+  }
+
+  void OnFileDone(const std::string& filename, bool success) override {
+    done_files_.push_back(filename);
+    success_ = success;
+  }
+
+  double GetProgress(const std::string& filename) const {
+    auto found = progress_.find(filename);
+    return found == progress_.end() ? 0 : found->second;
+  }
+  const std::vector<std::string>& GetDoneFiles() const { return done_files_; }
+  bool GetSuccess() const { return success_; }
+
+ private:
+  std::map<std::string, double> progress_;
+  std::vector<std::string> done_files_;
+  bool success_ = false;
+};
+
+void WaitForFileOperations(graphics::Image& image) {
+  while (image.HasPendingFileOperations()) {
+    image.ProcessFileEvents();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+TEST(AsyncFileTest, SavesSnapshotInBackground) {
+  graphics::Image image(300, 200);
+  PaintTestImage(image);
+  const uint64_t hash = graphics::HashImage(image);
+  TestFileEventListener listener;
+  ASSERT_TRUE(image.SaveAsync("async_test.qoi", &listener));
+  ASSERT_TRUE(image.SaveAsync("async_test.bmp", &listener));
+  // Drawing right away does not change what is saved.
+  image.DrawRectangle(0, 0, 300, 200, graphics::Color(0, 0, 0));
+  WaitForFileOperations(image);
+
+  // The saves run side by side, so either may finish first.
+  std::vector<std::string> done = listener.GetDoneFiles();
+  std::sort(done.begin(), done.end());
+  EXPECT_EQ(done,
+            std::vector<std::string>({"async_test.bmp", "async_test.qoi"}));
+  EXPECT_TRUE(listener.GetSuccess());
+  for (const std::string filename : {"async_test.qoi", "async_test.bmp"}) {
+    EXPECT_EQ(listener.GetProgress(filename), 1) << filename;
+    graphics::Image saved;
+    ASSERT_TRUE(saved.Load(filename));
+    EXPECT_EQ(graphics::HashImage(saved), hash) << filename;
+    remove(filename.c_str());
+  }
+}
+
+TEST(AsyncFileTest, LoadsInBackground) {
+  graphics::Image painting(300, 200);
+  PaintTestImage(painting);
+  ASSERT_TRUE(painting.SaveImageBmp("async_test.bmp"));
+
+  graphics::Image image(10, 10);
+  TestFileEventListener listener;
+  ASSERT_TRUE(image.LoadAsync("async_test.bmp", &listener));
+  // Nothing changes until the load is processed.
+  EXPECT_EQ(image.GetWidth(), 10);
+  WaitForFileOperations(image);
+  ASSERT_EQ(listener.GetDoneFiles().size(), 1);
+  EXPECT_TRUE(listener.GetSuccess());
+  EXPECT_EQ(graphics::HashImage(image), graphics::HashImage(painting));
+
+  // Missing files fail without changing the image.
+  TestFileEventListener missing_listener;
+  ASSERT_TRUE(image.LoadAsync("async_missing.bmp", &missing_listener));
+  WaitForFileOperations(image);
+  ASSERT_EQ(missing_listener.GetDoneFiles().size(), 1);
+  EXPECT_FALSE(missing_listener.GetSuccess());
+  EXPECT_EQ(graphics::HashImage(image), graphics::HashImage(painting));
+  remove("async_test.bmp");
+}
+
+TEST(AsyncFileTest, CancelsSaveWithoutLosingTheOldFile) {
+  graphics::Image small(30, 20);
+  PaintTestImage(small);
+  ASSERT_TRUE(small.SaveImageBmp("async_test.bmp"));
+  const std::string saved = ReadFile("async_test.bmp");
+
+  graphics::Image painting(2000, 1500);
+  PaintTestImage(painting);
+  TestFileEventListener listener;
+  ASSERT_TRUE(painting.SaveAsync("async_test.bmp", &listener));
+  painting.CancelFileOperations();
+  WaitForFileOperations(painting);
+  ASSERT_EQ(listener.GetDoneFiles().size(), 1);
+  EXPECT_FALSE(listener.GetSuccess());
+  EXPECT_EQ(ReadFile("async_test.bmp"), saved);
+  EXPECT_FALSE(std::ifstream("async_test.bmp.tmp").good());
+  remove("async_test.bmp");
+}
+
+TEST(AsyncFileTest, CancelsLoad) {
+  graphics::Image painting(2000, 1500);
+  PaintTestImage(painting);
+  ASSERT_TRUE(painting.SaveImageBmp("async_test.bmp"));
+
+  graphics::Image image(10, 10);
+  TestFileEventListener listener;
+  ASSERT_TRUE(image.LoadAsync("async_test.bmp", &listener));
+  image.CancelFileOperations();
+  WaitForFileOperations(image);
+  ASSERT_EQ(listener.GetDoneFiles().size(), 1);
+  EXPECT_FALSE(listener.GetSuccess());
+  EXPECT_EQ(image.GetWidth(), 10);
+  remove("async_test.bmp");
+}
+
 TEST(ImageEventTest, HandlesEvents) {
   TestEventListener listener;
   int size = 100;
   graphics::Image image(size, size);
   image.AddMouseEventListener(listener);
-  image.Show();
 
   graphics::TestEventGenerator generator(&image);
   generator.MouseDown(10, 20);
@@ -269,7 +2440,52 @@ TEST(ImageEventTest, HandlesEvents) {
   EXPECT_EQ(listener.GetLatestEvent().GetMouseAction(), graphics::MouseAction::kReleased);
 
   image.RemoveMouseEventListener(listener);
-  image.Hide();
+}
+
+TEST(ImageEventTest, ReadsMouseStateFromEventSource) {
+  TestEventListener listener;
+  graphics::Image image(100, 100);
+  image.AddMouseEventListener(listener);
+
+  // Without a display or event source, nothing happens.
+  image.ProcessEvent();
+  EXPECT_EQ(listener.GetLatestEvent().GetMouseAction(),
+            graphics::MouseAction::kReleased);
+  EXPECT_EQ(listener.GetLatestEvent().GetX(), 0);
+
+  graphics::InjectedEventSource source;
+  image.SetEventSource(&source);
+  source.SetMouse(5, 6);
+  image.ProcessEvent();
+  EXPECT_EQ(listener.GetLatestEvent().GetMouseAction(),
+            graphics::MouseAction::kMoved);
+  EXPECT_EQ(listener.GetLatestEvent().GetX(), 5);
+  EXPECT_EQ(listener.GetLatestEvent().GetY(), 6);
+
+  source.SetButton(1, true);
+  image.ProcessEvent();
+  EXPECT_EQ(listener.GetLatestEvent().GetMouseAction(),
+            graphics::MouseAction::kPressed);
+
+  // Unchanged state while pressed sends no drag.
+  listener.OnMouseEvent(graphics::MouseEvent(0, 0, graphics::MouseAction::kMoved));
+  image.ProcessEvent();
+  EXPECT_EQ(listener.GetLatestEvent().GetMouseAction(),
+            graphics::MouseAction::kMoved);
+
+  source.SetMouse(7, 8);
+  image.ProcessEvent();
+  EXPECT_EQ(listener.GetLatestEvent().GetMouseAction(),
+            graphics::MouseAction::kDragged);
+
+  source.SetButton(1, false);
+  image.ProcessEvent();
+  EXPECT_EQ(listener.GetLatestEvent().GetMouseAction(),
+            graphics::MouseAction::kReleased);
+  EXPECT_EQ(listener.GetLatestEvent().GetX(), 7);
+
+  image.SetEventSource(nullptr);
+  image.RemoveMouseEventListener(listener);
 }
 
 class TestAnimationEventListener : public graphics::AnimationEventListener {
@@ -292,7 +2508,6 @@ TEST(AnimationEventTest, CallsAnimationListeners) {
   ASSERT_EQ(0, listener.GetNumEvents());
   graphics::Image image(50, 50);
   graphics::TestEventGenerator generator(&image);
-  image.Show();
 
   image.AddAnimationEventListener(listener);
   ASSERT_EQ(0, listener.GetNumEvents());
@@ -307,6 +2522,315 @@ TEST(AnimationEventTest, CallsAnimationListeners) {
   ASSERT_EQ(2, listener.GetNumEvents());
 }
 
+// Returns the red, green and blue planes of |image|, one after the other.
+std::vector<uint8_t> GetPlanes(const graphics::Image& image) {
+  std::vector<uint8_t> planes;
+  for (int c = 0; c < 3; c++) {
+    for (int y = 0; y < image.GetHeight(); y++) {
+      for (int x = 0; x < image.GetWidth(); x++) {
+        graphics::Color color = image.GetColor(x, y);
+        planes.push_back(c == 0 ? color.Red()
+                                : c == 1 ? color.Green() : color.Blue());
+      }
+    }
+  }
+  return planes;
+}
+
+std::vector<uint8_t> GetPlanes(const graphics::TimelapseReader& reader) {
+  const size_t size =
+      static_cast<size_t>(reader.GetWidth()) * reader.GetHeight();
+  std::vector<uint8_t> planes;
+  for (int c = 0; c < 3; c++) {
+    planes.insert(planes.end(), reader.GetChannels()[c],
+                  reader.GetChannels()[c] + size);
+  }
+  return planes;
+}
+
+TEST(TimelapseTest, RecordsChangedTilesOnly) {
+  const std::string filename = "timelapse_test.tlapse";
+  graphics::Image image(300, 200);
+  PaintTestImage(image);
+  graphics::TestEventGenerator generator(&image);
+  graphics::TimelapseRecorder recorder;
+  ASSERT_TRUE(recorder.Start(filename, image, 2));
+  const std::vector<uint8_t> first = GetPlanes(image);
+  recorder.Flush();
+  std::ifstream in(filename, std::ios::binary | std::ios::ate);
+  const std::streamoff full_frame = in.tellg();
+  in.close();
+
+  image.DrawRectangle(10, 10, 50, 50, graphics::Color(0, 0, 255));
+  const std::vector<uint8_t> second = GetPlanes(image);
+  generator.SendAnimationEvent();
+  generator.SendAnimationEvent();
+  // Draw over the captured tile right away, before it is written.
+  image.DrawRectangle(20, 20, 50, 50, graphics::Color(255, 255, 0));
+  const std::vector<uint8_t> third = GetPlanes(image);
+  for (int i = 0; i < 4; i++) generator.SendAnimationEvent();
+  recorder.Stop();
+  EXPECT_EQ(3, recorder.GetCapturedFrames());
+  EXPECT_EQ(0, recorder.GetSkippedFrames());
+  // Image events after stopping are ignored.
+  generator.SendAnimationEvent();
+
+  in.open(filename, std::ios::binary | std::ios::ate);
+  EXPECT_LT(in.tellg() - full_frame, full_frame / 2);
+  in.close();
+  graphics::TimelapseReader reader;
+  ASSERT_TRUE(reader.Open(filename));
+  EXPECT_EQ(300, reader.GetWidth());
+  EXPECT_EQ(200, reader.GetHeight());
+  EXPECT_EQ(2, reader.GetStepsPerFrame());
+  ASSERT_TRUE(reader.ReadFrame());
+  EXPECT_EQ(0, reader.GetStep());
+  EXPECT_TRUE(GetPlanes(reader) == first);
+  ASSERT_TRUE(reader.ReadFrame());
+  EXPECT_EQ(2, reader.GetStep());
+  EXPECT_TRUE(GetPlanes(reader) == second);
+  ASSERT_TRUE(reader.ReadFrame());
+  EXPECT_EQ(4, reader.GetStep());
+  EXPECT_TRUE(GetPlanes(reader) == third);
+  EXPECT_FALSE(reader.ReadFrame());
+  remove(filename.c_str());
+}
+
+TEST(TimelapseTest, ExportsY4mAndImages) {
+  const std::string filename = "timelapse_export.tlapse";
+  // An odd size, so the edge chroma samples cover partial blocks.
+  graphics::Image image(21, 11);
+  graphics::TestEventGenerator generator(&image);
+  graphics::TimelapseRecorder recorder;
+  ASSERT_TRUE(recorder.Start(filename, image, 1));
+  image.DrawRectangle(0, 0, 21, 11, graphics::Color(255, 0, 0));
+  generator.SendAnimationEvent();
+  recorder.Stop();
+
+  ASSERT_TRUE(graphics::ExportTimelapseToY4m(filename, "timelapse.y4m", 24));
+  std::ifstream in("timelapse.y4m", std::ios::binary);
+  const std::string video((std::istreambuf_iterator<char>(in)),
+                          std::istreambuf_iterator<char>());
+  const std::string header =
+      "YUV4MPEG2 W21 H11 F24:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n";
+  const size_t frame_size = 6 + 21 * 11 + 2 * 11 * 6;
+  ASSERT_EQ(header.size() + 2 * frame_size, video.size());
+  EXPECT_EQ(header, video.substr(0, header.size()));
+  // White, then red.
+  const std::string white = video.substr(header.size(), frame_size);
+  EXPECT_EQ("FRAME\n", white.substr(0, 6));
+  EXPECT_EQ(std::string(21 * 11, '\xFF'), white.substr(6, 21 * 11));
+  EXPECT_EQ(std::string(2 * 11 * 6, '\x80'), white.substr(6 + 21 * 11));
+  const std::string red = video.substr(header.size() + frame_size);
+  EXPECT_EQ(std::string(21 * 11, 77), red.substr(6, 21 * 11));
+  EXPECT_EQ(std::string(11 * 6, 85), red.substr(6 + 21 * 11, 11 * 6));
+  EXPECT_EQ(std::string(11 * 6, '\xFF'), red.substr(6 + 21 * 11 + 11 * 6));
+
+  EXPECT_EQ(2, graphics::ExportTimelapseToImages(filename, "timelapse_"));
+  graphics::Image frame;
+  ASSERT_TRUE(frame.Load("timelapse_00001.bmp"));
+  EXPECT_TRUE(ImagesMatch(&image, &frame, "TimelapseFrame.bmp",
+                          DiffType::kTypeHighlight));
+  EXPECT_EQ(-1, graphics::ExportTimelapseToImages("missing.tlapse", "x_"));
+  remove(filename.c_str());
+  remove("timelapse.y4m");
+  remove("timelapse_00000.bmp");
+  remove("timelapse_00001.bmp");
+}
+
+// Reports how long capturing a frame of a large image takes on the drawing
+// thread, and checks that capturing copies no pixels there.
+TEST(TimelapseTest, BenchmarksCaptureOverhead) {
+  const std::string filename = "timelapse_bench.tlapse";
+  graphics::Image image(2048, 2048);
+  PaintTestImage(image);
+  graphics::TestEventGenerator generator(&image);
+  graphics::TimelapseRecorder recorder;
+  ASSERT_TRUE(recorder.Start(filename, image, 1));
+  graphics::GestureGenerator gestures(2048, 2048, 7);
+  graphics::PixelPool& pool = graphics::PixelPool::Get();
+  const auto allocations = [&pool] {
+    const graphics::PixelPool::Stats stats = pool.GetStats();
+    return stats.system_allocations + stats.reuses;
+  };
+  using Clock = std::chrono::steady_clock;
+  Clock::duration capture_time{};
+  int frames = 0;
+  for (const graphics::TimedMouseEvent& event : gestures.Scribble(10, 20)) {
+    image.DrawCircle(event.event.GetX(), event.event.GetY(), 20,
+                     graphics::Color(0, 0, 200));
+    const size_t before = allocations();
+    const auto start = Clock::now();
+    generator.SendAnimationEvent();
+    capture_time += Clock::now() - start;
+    EXPECT_EQ(before, allocations());
+    frames++;
+    // Time captures rather than skips, which the writer thread would cause
+    // on a busy machine.
+    recorder.Flush();
+  }
+  recorder.Stop();
+  const double capture_ms =
+      std::chrono::duration<double>(capture_time).count() * 1000 / frames;
+  EXPECT_EQ(0, recorder.GetSkippedFrames());
+  RecordProperty("capture_us", static_cast<int>(capture_ms * 1000));
+  remove(filename.c_str());
+}
+
+TEST(ThumbnailCacheTest, CachesByPathAndModification) {
+  const std::string directory = "thumbnail_test_cache";
+  std::filesystem::remove_all(directory);
+  graphics::Image image(600, 400);
+  PaintTestImage(image);
+  ASSERT_TRUE(image.SaveImageBmp("thumbnail_test.bmp"));
+
+  graphics::ThumbnailCache cache(directory, 120);
+  std::shared_ptr<const graphics::ThumbnailCache::Thumbnail> thumbnail =
+      cache.Get("thumbnail_test.bmp");
+  ASSERT_NE(nullptr, thumbnail);
+  EXPECT_EQ(120, thumbnail->width);
+  EXPECT_EQ(80, thumbnail->height);
+  EXPECT_EQ(1, cache.GetDecodes());
+  // Each thumbnail pixel averages 5 by 5 pixels of the gradient.
+  EXPECT_NEAR(image.GetRed(2, 2), thumbnail->GetChannel(0)[0], 1);
+  EXPECT_NEAR(image.GetGreen(597, 397),
+              thumbnail->GetChannel(1)[120 * 80 - 1], 1);
+  EXPECT_EQ(thumbnail, cache.Get("thumbnail_test.bmp"));
+  EXPECT_EQ(1, cache.GetMemoryHits());
+  EXPECT_EQ(120 * 80 * 3, cache.GetMemoryUsage());
+
+  // A new cache reads the thumbnail back from the directory.
+  graphics::ThumbnailCache reopened(directory, 120);
+  graphics::Image loaded;
+  ASSERT_TRUE(reopened.Load("thumbnail_test.bmp", loaded));
+  EXPECT_EQ(1, reopened.GetDiskHits());
+  EXPECT_EQ(0, reopened.GetDecodes());
+  ASSERT_EQ(120, loaded.GetWidth());
+  ASSERT_EQ(80, loaded.GetHeight());
+  for (int c = 0; c < 3; c++) {
+    EXPECT_EQ(0, memcmp(thumbnail->GetChannel(c), loaded.GetChannelData(c),
+                        120 * 80));
+  }
+  // Other sizes are cached separately.
+  graphics::ThumbnailCache small(directory, 30);
+  ASSERT_NE(nullptr, small.Get("thumbnail_test.bmp"));
+  EXPECT_EQ(1, small.GetDecodes());
+
+  // Changing the image makes it decode again, everywhere.
+  image.Initialize(300, 400);
+  ASSERT_TRUE(image.SaveImageBmp("thumbnail_test.bmp"));
+  thumbnail = cache.Get("thumbnail_test.bmp");
+  ASSERT_NE(nullptr, thumbnail);
+  EXPECT_EQ(90, thumbnail->width);
+  EXPECT_EQ(2, cache.GetDecodes());
+  ASSERT_NE(nullptr, reopened.Get("thumbnail_test.bmp"));
+  EXPECT_EQ(2, reopened.GetDiskHits());
+
+  EXPECT_EQ(nullptr, cache.Get("missing.bmp"));
+  EXPECT_FALSE(cache.Load("missing.bmp", loaded));
+  EXPECT_EQ(120, loaded.GetWidth());
+  remove("thumbnail_test.bmp");
+  std::filesystem::remove_all(directory);
+}
+
+TEST(ThumbnailCacheTest, EvictsLeastRecentlyUsed) {
+  const std::string directory = "thumbnail_lru_cache";
+  std::filesystem::remove_all(directory);
+  graphics::Image image(64, 64);
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(image.SaveImageBmp("thumbnail_lru" + std::to_string(i) +
+                                   ".bmp"));
+  }
+  // Room for two 64 by 64 thumbnails.
+  graphics::ThumbnailCache cache(directory, 128, 2 * 64 * 64 * 3);
+  ASSERT_NE(nullptr, cache.Get("thumbnail_lru0.bmp"));
+  ASSERT_NE(nullptr, cache.Get("thumbnail_lru1.bmp"));
+  ASSERT_NE(nullptr, cache.Get("thumbnail_lru0.bmp"));
+  ASSERT_NE(nullptr, cache.Get("thumbnail_lru2.bmp"));
+  EXPECT_EQ(2 * 64 * 64 * 3, cache.GetMemoryUsage());
+  EXPECT_EQ(1, cache.GetMemoryHits());
+  ASSERT_NE(nullptr, cache.Get("thumbnail_lru0.bmp"));
+  EXPECT_EQ(2, cache.GetMemoryHits());
+  ASSERT_NE(nullptr, cache.Get("thumbnail_lru1.bmp"));
+  EXPECT_EQ(1, cache.GetDiskHits());
+  EXPECT_EQ(3, cache.GetDecodes());
+  for (int i = 0; i < 3; i++) {
+    remove(("thumbnail_lru" + std::to_string(i) + ".bmp").c_str());
+  }
+  std::filesystem::remove_all(directory);
+}
+
+TEST(ThumbnailCacheTest, DecodesJpegPreviewsScaledDown) {
+  graphics::Image image(1024, 768);
+  PaintTestImage(image);
+  ASSERT_TRUE(WriteTestJpeg("thumbnail_test.jpg", image));
+  int width = 0;
+  int height = 0;
+  std::vector<uint8_t> pixels;
+  auto allocate = [&](int w, int h, uint8_t* channels[3]) {
+    width = w;
+    height = h;
+    pixels.resize(static_cast<size_t>(w) * h * 3);
+    for (int c = 0; c < 3; c++) {
+      channels[c] = pixels.data() + static_cast<size_t>(c) * w * h;
+    }
+    return true;
+  };
+  ASSERT_TRUE(graphics::image_io::ReadPreview("thumbnail_test.jpg", 128,
+                                              allocate));
+  EXPECT_EQ(128, width);
+  EXPECT_EQ(96, height);
+  ASSERT_TRUE(graphics::image_io::ReadPreview("thumbnail_test.jpg", 300,
+                                              allocate));
+  EXPECT_EQ(512, width);
+  EXPECT_EQ(384, height);
+  remove("thumbnail_test.jpg");
+}
+
+// Reports how long previews of a folder of images take to show the first
+// time, from the cache directory, and from memory, and checks where each
+// came from.
+TEST(ThumbnailCacheTest, BenchmarksFolderPreviews) {
+  const std::string directory = "thumbnail_bench_cache";
+  std::filesystem::remove_all(directory);
+  const int files = 40;
+  graphics::Image image(1024, 768);
+  PaintTestImage(image);
+  std::vector<std::string> filenames;
+  for (int i = 0; i < files; i++) {
+    image.DrawCircle(i * 25, 300, 20, graphics::Color(0, 0, 0));
+    filenames.push_back("thumbnail_bench" + std::to_string(i) +
+                        (i % 2 ? ".bmp" : ".jpg"));
+    ASSERT_TRUE(i % 2 ? image.SaveImageBmp(filenames.back())
+                      : WriteTestJpeg(filenames.back(), image));
+  }
+
+  using Clock = std::chrono::steady_clock;
+  auto time_previews = [&](graphics::ThumbnailCache& cache) {
+    const auto start = Clock::now();
+    for (const std::string& filename : filenames) {
+      EXPECT_NE(nullptr, cache.Get(filename));
+    }
+    return std::chrono::duration<double>(Clock::now() - start).count() *
+           1000 / files;
+  };
+  graphics::ThumbnailCache cache(directory);
+  const double decode_ms = time_previews(cache);
+  graphics::ThumbnailCache reopened(directory);
+  const double disk_ms = time_previews(reopened);
+  const double memory_ms = time_previews(reopened);
+  EXPECT_EQ(files, cache.GetDecodes());
+  EXPECT_EQ(files, reopened.GetDiskHits());
+  EXPECT_EQ(files, reopened.GetMemoryHits());
+  // Nothing is decoded again once the cache directory holds the previews.
+  EXPECT_EQ(0, reopened.GetDecodes());
+  RecordProperty("decode_us_per_file", static_cast<int>(decode_ms * 1000));
+  RecordProperty("disk_us_per_file", static_cast<int>(disk_ms * 1000));
+  RecordProperty("memory_us_per_file", static_cast<int>(memory_ms * 1000));
+  for (const std::string& filename : filenames) remove(filename.c_str());
+  std::filesystem::remove_all(directory);
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
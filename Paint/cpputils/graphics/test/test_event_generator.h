@@ -4,7 +4,6 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT.
 
-#include "../cimg/CImg.h"
 #include "../image.h"
 
 #ifndef GRAPHICS_TEST_EVENT_GENERATOR_H
@@ -12,53 +11,57 @@
 
 namespace graphics {
 
+/**
+ * Sends mouse and animation events to an Image's listeners. Events go
+ * through the image's usual event processing but are read from an
+ * in-memory event source, so the image does not need to be shown and no
+ * display is required. The generator must be destroyed before the image
+ * is destroyed or moved from.
+ */
 class TestEventGenerator {
  public:
-  TestEventGenerator(graphics::Image* image) { image_ = image; }
+  TestEventGenerator(graphics::Image* image) {
+    image_ = image;
+    image_->SetEventSource(&source_);
+  }
+
+  ~TestEventGenerator() { image_->SetEventSource(nullptr); }
+
+  // Disallow copy and assign, the image refers to |source_|.
+  TestEventGenerator(const TestEventGenerator&) = delete;
+  TestEventGenerator& operator=(const TestEventGenerator&) = delete;
 
   void MouseDown(int x, int y) {
-    if (!image_->GetDisplayForTesting()) return;
-    cimg_library::CImgDisplay* display = image_->GetDisplayForTesting();
-    display->set_mouse(x, y);
-    display->set_button(1, true /* is pressed */);
+    source_.SetMouse(x, y);
+    source_.SetButton(1, true /* is pressed */);
     image_->ProcessEvent();
   }
 
   void MoveMouseTo(int x, int y) {
-    if (!image_->GetDisplayForTesting()) return;
-    cimg_library::CImgDisplay* display = image_->GetDisplayForTesting();
-    display->set_mouse(x, y);
+    source_.SetMouse(x, y);
     image_->ProcessEvent();
   }
 
   void MouseUp() {
-    if (!image_->GetDisplayForTesting()) return;
-    cimg_library::CImgDisplay* display = image_->GetDisplayForTesting();
-    display->set_button(1, false /* is pressed*/);
+    source_.SetButton(1, false /* is pressed*/);
     image_->ProcessEvent();
   }
 
   void RightMouseDown() {
-    if (!image_->GetDisplayForTesting()) return;
-    cimg_library::CImgDisplay* display = image_->GetDisplayForTesting();
-    display->set_button(0x2, true /* is pressed*/);
+    source_.SetButton(0x2, true /* is pressed*/);
     image_->ProcessEvent();
   }
 
   void RightMouseUp() {
-    if (!image_->GetDisplayForTesting()) return;
-    cimg_library::CImgDisplay* display = image_->GetDisplayForTesting();
-    display->set_button(0x2, false /* is pressed*/);
+    source_.SetButton(0x2, false /* is pressed*/);
     image_->ProcessEvent();
   }
 
-  void SendAnimationEvent() {
-    if (!image_->GetDisplayForTesting()) return;
-    image_->ProcessAnimation();
-  }
+  void SendAnimationEvent() { image_->ProcessAnimation(); }
 
  private:
   graphics::Image* image_;  // Unowned
+  graphics::InjectedEventSource source_;
 };
 
 }  // namespace graphics
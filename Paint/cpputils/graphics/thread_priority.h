@@ -0,0 +1,29 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <pthread.h>
+
+#ifndef GRAPHICS_THREAD_PRIORITY_H
+#define GRAPHICS_THREAD_PRIORITY_H
+
+namespace graphics {
+
+/**
+ * Lets the calling thread run only when nothing more urgent, like drawing,
+ * needs the CPU. Meant for threads that save or record in the background.
+ */
+inline void LowerThreadPriority() {
+#if defined(__linux__)
+  sched_param param = {};
+  pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#elif defined(__APPLE__)
+  pthread_set_qos_class_self_np(QOS_CLASS_BACKGROUND, 0);
+#endif
+}
+
+}  // namespace graphics
+
+#endif  // GRAPHICS_THREAD_PRIORITY_H
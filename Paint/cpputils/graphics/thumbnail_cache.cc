@@ -0,0 +1,235 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "thumbnail_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include "binary_io.h"
+#include "image_hash.h"
+#include "image_io.h"
+
+namespace graphics {
+
+namespace {
+
+constexpr char kMagic[8] = {'T', 'P', 'T', 'H', 'M', 'B', '0', '1'};
+constexpr size_t kHeaderSize = 32;
+
+// Averages each block of |width| by |height| pixels in |source| that maps
+// onto one of the |out_width| by |out_height| pixels in |out|, plane by
+// plane. The blocks differ in size by at most one pixel either way.
+void ScaleDown(int width, int height, const uint8_t* const source[3],
+               int out_width, int out_height, uint8_t* out) {
+  std::vector<int> columns(out_width + 1);
+  for (int x = 0; x <= out_width; x++) {
+    columns[x] = static_cast<int64_t>(x) * width / out_width;
+  }
+  std::vector<uint32_t> sums(width);
+  for (int c = 0; c < 3; c++) {
+    for (int y = 0; y < out_height; y++) {
+      const int y0 = static_cast<int64_t>(y) * height / out_height;
+      const int y1 = static_cast<int64_t>(y + 1) * height / out_height;
+      std::fill(sums.begin(), sums.end(), 0);
+      for (int row = y0; row < y1; row++) {
+        const uint8_t* in = source[c] + static_cast<size_t>(row) * width;
+        for (int x = 0; x < width; x++) sums[x] += in[x];
+      }
+      for (int x = 0; x < out_width; x++) {
+        uint64_t sum = 0;
+        for (int column = columns[x]; column < columns[x + 1]; column++) {
+          sum += sums[column];
+        }
+        const uint64_t count =
+            static_cast<uint64_t>(columns[x + 1] - columns[x]) * (y1 - y0);
+        *out++ = (sum + count / 2) / count;
+      }
+    }
+  }
+}
+
+}  // namespace
+
+ThumbnailCache::ThumbnailCache(const std::string& directory, int size,
+                               size_t memory_limit)
+    : directory_(directory), size_(std::max(1, size)),
+      memory_limit_(memory_limit) {}
+
+std::shared_ptr<const ThumbnailCache::Thumbnail> ThumbnailCache::Get(
+    const std::string& filename) {
+  namespace fs = std::filesystem;
+  std::error_code error;
+  const fs::path path = fs::absolute(filename, error).lexically_normal();
+  const uint64_t file_size = fs::file_size(path, error);
+  if (error) return nullptr;
+  const int64_t modified =
+      fs::last_write_time(path, error).time_since_epoch().count();
+  if (error) return nullptr;
+
+  const std::string key = path.string() + '\n' + std::to_string(modified) +
+                          '\n' + std::to_string(file_size);
+  auto found = index_.find(key);
+  if (found != index_.end()) {
+    lru_.splice(lru_.begin(), lru_, found->second);
+    memory_hits_++;
+    return found->second->second;
+  }
+
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.thumb",
+           static_cast<unsigned long long>(
+               HashBytes(key.data(), key.size(), size_)));
+  const std::string thumb = (fs::path(directory_) / name).string();
+  std::shared_ptr<Thumbnail> thumbnail =
+      ReadThumb(thumb, path.string(), modified, file_size);
+  if (thumbnail) {
+    disk_hits_++;
+  } else {
+    thumbnail = Decode(filename);
+    if (!thumbnail) return nullptr;
+    decodes_++;
+    // The thumbnail is still usable if the cache directory is not.
+    fs::create_directories(directory_, error);
+    WriteThumb(thumb, path.string(), modified, file_size, *thumbnail);
+  }
+  Remember(key, thumbnail);
+  return thumbnail;
+}
+
+bool ThumbnailCache::Load(const std::string& filename, Image& image) {
+  std::shared_ptr<const Thumbnail> thumbnail = Get(filename);
+  if (!thumbnail) return false;
+  const uint8_t* const channels[3] = {thumbnail->GetChannel(0),
+                                      thumbnail->GetChannel(1),
+                                      thumbnail->GetChannel(2)};
+  return image.Initialize(thumbnail->width, thumbnail->height, channels);
+}
+
+std::shared_ptr<ThumbnailCache::Thumbnail> ThumbnailCache::ReadThumb(
+    const std::string& path, const std::string& filename, int64_t modified,
+    uint64_t file_size) const {
+  File file(fopen(path.c_str(), "rb"));
+  if (!file) return nullptr;
+  std::vector<uint8_t> data;
+  uint8_t buffer[16384];
+  size_t read;
+  while ((read = fread(buffer, 1, sizeof(buffer), file.get())) > 0) {
+    data.insert(data.end(), buffer, buffer + read);
+  }
+  if (data.size() < kHeaderSize ||
+      memcmp(data.data(), kMagic, sizeof(kMagic)) != 0 ||
+      GetLE64(data.data() + 8) != static_cast<uint64_t>(modified) ||
+      GetLE64(data.data() + 16) != file_size ||
+      GetLE32(data.data() + 24) != static_cast<uint32_t>(size_) ||
+      GetLE32(data.data() + 28) != filename.size() ||
+      data.size() - kHeaderSize < filename.size() ||
+      memcmp(data.data() + kHeaderSize, filename.data(), filename.size()) !=
+          0) {
+    return nullptr;
+  }
+  auto thumbnail = std::make_shared<Thumbnail>();
+  const size_t offset = kHeaderSize + filename.size();
+  const bool decoded = image_io::DecodeQoi(
+      data.data() + offset, data.size() - offset,
+      [&](int width, int height, uint8_t* channels[3]) {
+        if (width > size_ || height > size_) return false;
+        thumbnail->width = width;
+        thumbnail->height = height;
+        const size_t plane_size = static_cast<size_t>(width) * height;
+        thumbnail->pixels.resize(plane_size * 3);
+        for (int c = 0; c < 3; c++) {
+          channels[c] = thumbnail->pixels.data() + c * plane_size;
+        }
+        return true;
+      });
+  return decoded ? thumbnail : nullptr;
+}
+
+bool ThumbnailCache::WriteThumb(const std::string& path,
+                                const std::string& filename, int64_t modified,
+                                uint64_t file_size,
+                                const Thumbnail& thumbnail) const {
+  std::vector<uint8_t> data(kMagic, kMagic + sizeof(kMagic));
+  PutLE64(&data, modified);
+  PutLE64(&data, file_size);
+  PutLE32(&data, size_);
+  PutLE32(&data, filename.size());
+  data.insert(data.end(), filename.begin(), filename.end());
+  std::vector<uint8_t> qoi;
+  const uint8_t* const channels[3] = {thumbnail.GetChannel(0),
+                                      thumbnail.GetChannel(1),
+                                      thumbnail.GetChannel(2)};
+  if (!image_io::EncodeQoi(thumbnail.width, thumbnail.height, channels,
+                           &qoi)) {
+    return false;
+  }
+  data.insert(data.end(), qoi.begin(), qoi.end());
+
+  const std::string temporary = path + ".tmp";
+  File file(fopen(temporary.c_str(), "wb"));
+  if (!file || fwrite(data.data(), data.size(), 1, file.get()) != 1 ||
+      fclose(file.release()) != 0) {
+    remove(temporary.c_str());
+    return false;
+  }
+  return rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+std::shared_ptr<ThumbnailCache::Thumbnail> ThumbnailCache::Decode(
+    const std::string& filename) const {
+  int width = 0;
+  int height = 0;
+  std::vector<uint8_t> pixels;
+  uint8_t* source[3];
+  const bool decoded = image_io::ReadPreview(
+      filename, size_, [&](int w, int h, uint8_t* channels[3]) {
+        width = w;
+        height = h;
+        const size_t plane_size = static_cast<size_t>(w) * h;
+        pixels.resize(plane_size * 3);
+        for (int c = 0; c < 3; c++) {
+          channels[c] = source[c] = pixels.data() + c * plane_size;
+        }
+        return true;
+      });
+  if (!decoded) return nullptr;
+
+  auto thumbnail = std::make_shared<Thumbnail>();
+  const int longer = std::max(width, height);
+  if (longer <= size_) {
+    thumbnail->width = width;
+    thumbnail->height = height;
+    thumbnail->pixels = std::move(pixels);
+    return thumbnail;
+  }
+  thumbnail->width = std::max<int64_t>(
+      1, (static_cast<int64_t>(width) * size_ + longer / 2) / longer);
+  thumbnail->height = std::max<int64_t>(
+      1, (static_cast<int64_t>(height) * size_ + longer / 2) / longer);
+  thumbnail->pixels.resize(static_cast<size_t>(thumbnail->width) *
+                           thumbnail->height * 3);
+  ScaleDown(width, height, source, thumbnail->width, thumbnail->height,
+            thumbnail->pixels.data());
+  return thumbnail;
+}
+
+void ThumbnailCache::Remember(const std::string& key,
+                              std::shared_ptr<const Thumbnail> thumbnail) {
+  memory_usage_ += thumbnail->pixels.size();
+  lru_.emplace_front(key, std::move(thumbnail));
+  index_[key] = lru_.begin();
+  // Always keep the newest one, however large.
+  while (memory_usage_ > memory_limit_ && lru_.size() > 1) {
+    memory_usage_ -= lru_.back().second->pixels.size();
+    index_.erase(lru_.back().first);
+    lru_.pop_back();
+  }
+}
+
+}  // namespace graphics
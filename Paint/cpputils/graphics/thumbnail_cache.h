@@ -0,0 +1,133 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "image.h"
+
+#ifndef GRAPHICS_THUMBNAIL_CACHE_H
+#define GRAPHICS_THUMBNAIL_CACHE_H
+
+namespace graphics {
+
+/**
+ * Caches small previews of image files, so that showing a folder of large
+ * images only decodes each of them once.
+ *
+ * Thumbnails are looked up by the file's path, modification time and size,
+ * so editing a file makes its next lookup decode it again. Recently used
+ * thumbnails are kept in memory up to a byte limit, evicting the least
+ * recently used ones first. Every thumbnail is also stored in the cache
+ * directory as a small QOI-compressed file (.thumb), which later instances
+ * read instead of the image. JPEGs are decoded at a reduced scale when
+ * possible, see image_io::ReadPreview.
+ *
+ * A .thumb file holds the magic "TPTHMB01", the image's modification time
+ * and size (64 bits each), the thumbnail size and path length (32 bits
+ * each), all little-endian, then the path and the QOI data.
+ *
+ * Not thread-safe.
+ */
+class ThumbnailCache {
+ public:
+  /**
+   * A downscaled image, |width| by |height| pixels.
+   */
+  struct Thumbnail {
+    int width = 0;
+    int height = 0;
+    // The red, green and blue planes, one after the other, row by row.
+    std::vector<uint8_t> pixels;
+
+    const uint8_t* GetChannel(int channel) const {
+      return pixels.data() + static_cast<size_t>(channel) * width * height;
+    }
+  };
+
+  /**
+   * Creates a cache of thumbnails that fit in |size| by |size| pixels,
+   * stored in |directory|, which is created when first needed. At most
+   * |memory_limit| bytes of thumbnails are kept in memory.
+   */
+  explicit ThumbnailCache(const std::string& directory, int size = 128,
+                          size_t memory_limit = 32 << 20);
+
+  ThumbnailCache(const ThumbnailCache&) = delete;
+  ThumbnailCache& operator=(const ThumbnailCache&) = delete;
+
+  /**
+   * Returns the thumbnail of the image in |filename|, scaled down to fit
+   * in GetSize() pixels while keeping its aspect ratio, or kept as is if it
+   * already fits. Returns nullptr if the image could not be read.
+   */
+  std::shared_ptr<const Thumbnail> Get(const std::string& filename);
+
+  /**
+   * Resets |image| to the thumbnail of |filename|. Returns false, leaving
+   * |image| unchanged, if the image could not be read.
+   */
+  bool Load(const std::string& filename, Image& image);
+
+  int GetSize() const { return size_; }
+
+  /**
+   * Returns the number of bytes of thumbnails held in memory.
+   */
+  size_t GetMemoryUsage() const { return memory_usage_; }
+
+  /**
+   * Returns how many lookups were served from memory, from the cache
+   * directory, and by decoding the image.
+   */
+  int GetMemoryHits() const { return memory_hits_; }
+  int GetDiskHits() const { return disk_hits_; }
+  int GetDecodes() const { return decodes_; }
+
+ private:
+  using Entry = std::pair<std::string, std::shared_ptr<const Thumbnail>>;
+
+  // Reads the .thumb file |path|, returning nullptr unless it holds the
+  // thumbnail of |filename| at |modified| and |file_size|.
+  std::shared_ptr<Thumbnail> ReadThumb(const std::string& path,
+                                       const std::string& filename,
+                                       int64_t modified,
+                                       uint64_t file_size) const;
+
+  // Writes |thumbnail| to the .thumb file |path|, through a temporary file
+  // so that readers never see a partial one.
+  bool WriteThumb(const std::string& path, const std::string& filename,
+                  int64_t modified, uint64_t file_size,
+                  const Thumbnail& thumbnail) const;
+
+  // Decodes |filename| and scales it down to a thumbnail.
+  std::shared_ptr<Thumbnail> Decode(const std::string& filename) const;
+
+  // Adds |thumbnail| to the front of lru_ and evicts entries beyond
+  // memory_limit_.
+  void Remember(const std::string& key,
+                std::shared_ptr<const Thumbnail> thumbnail);
+
+  std::string directory_;
+  int size_;
+  size_t memory_limit_;
+  size_t memory_usage_ = 0;
+  // Thumbnails in memory, most recently used first, and their keys.
+  std::list<Entry> lru_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+  int memory_hits_ = 0;
+  int disk_hits_ = 0;
+  int decodes_ = 0;
+};
+
+}  // namespace graphics
+
+#endif  // GRAPHICS_THUMBNAIL_CACHE_H
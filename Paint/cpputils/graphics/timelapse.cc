@@ -0,0 +1,396 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "timelapse.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "binary_io.h"
+#include "image_io.h"
+#include "thread_priority.h"
+
+namespace graphics {
+
+namespace {
+
+constexpr char kMagic[8] = {'T', 'L', 'A', 'P', 'S', 'E', '0', '1'};
+constexpr int kHeaderSize = 24;
+constexpr int kFrameHeaderSize = 12;
+constexpr int kTileHeaderSize = 16;
+
+// Frames captured while this many are still waiting to be written are
+// skipped, which bounds the tiles kept alive by their snapshots.
+constexpr size_t kMaxQueuedFrames = 4;
+
+// Converts full-range RGB to YCbCr as in JPEG, with 8 bits of fraction.
+uint8_t ToY(int r, int g, int b) {
+  return (77 * r + 150 * g + 29 * b + 128) >> 8;
+}
+
+uint8_t ToCb(int r, int g, int b) {
+  return std::min(255, (-43 * r - 85 * g + 128 * b + 32896) >> 8);
+}
+
+uint8_t ToCr(int r, int g, int b) {
+  return std::min(255, (128 * r - 107 * g - 21 * b + 32896) >> 8);
+}
+
+}  // namespace
+
+TimelapseRecorder::~TimelapseRecorder() { Stop(); }
+
+bool TimelapseRecorder::Start(const std::string& filename, Image& image,
+                              int steps_per_frame) {
+  Stop();
+  if (steps_per_frame < 1 || image.GetWidth() < 1 || image.GetHeight() < 1) {
+    return false;
+  }
+  file_ = fopen(filename.c_str(), "wb");
+  std::vector<uint8_t> header(kMagic, kMagic + sizeof(kMagic));
+  PutLE32(&header, image.GetWidth());
+  PutLE32(&header, image.GetHeight());
+  PutLE32(&header, Image::kTileSize);
+  PutLE32(&header, steps_per_frame);
+  if (!file_ || fwrite(header.data(), header.size(), 1, file_) != 1) {
+    std::cout << "Could not create the timelapse " << filename << std::endl;
+    if (file_) fclose(file_);
+    file_ = nullptr;
+    return false;
+  }
+  image_ = &image;
+  width_ = image.GetWidth();
+  height_ = image.GetHeight();
+  steps_per_frame_ = steps_per_frame;
+  step_ = 0;
+  captured_frames_ = 0;
+  skipped_frames_ = 0;
+  generations_.clear();
+  stopping_ = false;
+  failed_ = false;
+  writer_ = std::thread(&TimelapseRecorder::WriteLoop, this);
+  image.AddAnimationEventListener(*this);
+  Capture();
+  return true;
+}
+
+void TimelapseRecorder::Stop() {
+  if (!image_) return;
+  image_->RemoveAnimationEventListener(*this);
+  image_ = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_.notify_one();
+  writer_.join();
+  fclose(file_);
+  file_ = nullptr;
+}
+
+void TimelapseRecorder::Flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_.wait(lock, [this] { return frames_.empty() && !writing_; });
+}
+
+void TimelapseRecorder::OnAnimationStep() {
+  if (++step_ % steps_per_frame_ == 0) Capture();
+}
+
+void TimelapseRecorder::Capture() {
+  // Frames must keep the size in the header.
+  if (image_->GetWidth() != width_ || image_->GetHeight() != height_) return;
+  if (!generations_.empty() && image_->GetGeneration() == generation_) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (frames_.size() >= kMaxQueuedFrames) {
+      skipped_frames_++;
+      return;
+    }
+  }
+  std::shared_ptr<ImageSnapshot> snapshot =
+      image_->Snapshot(generations_.empty() ? nullptr : &generations_);
+  generations_.resize(static_cast<size_t>(snapshot->GetTileColumns()) *
+                      snapshot->GetTileRows());
+  for (int row = 0; row < snapshot->GetTileRows(); row++) {
+    for (int column = 0; column < snapshot->GetTileColumns(); column++) {
+      generations_[row * snapshot->GetTileColumns() + column] =
+          snapshot->GetTileGeneration(column, row);
+    }
+  }
+  generation_ = image_->GetGeneration();
+  captured_frames_++;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    frames_.push_back({step_, std::move(snapshot)});
+  }
+  work_.notify_one();
+}
+
+void TimelapseRecorder::WriteLoop() {
+  LowerThreadPriority();
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    work_.wait(lock, [this] { return stopping_ || !frames_.empty(); });
+    if (frames_.empty()) break;
+    Frame frame = std::move(frames_.front());
+    frames_.pop_front();
+    writing_ = true;
+    lock.unlock();
+    const bool written = WriteFrame(frame);
+    // Let the image stop preserving tiles for this frame.
+    frame.snapshot.reset();
+    lock.lock();
+    writing_ = false;
+    if (!written && !failed_) {
+      failed_ = true;
+      std::cout << "Could not write to the timelapse" << std::endl;
+    }
+    done_.notify_all();
+  }
+}
+
+bool TimelapseRecorder::WriteFrame(const Frame& frame) {
+  const ImageSnapshot& snapshot = *frame.snapshot;
+  frame_data_.clear();
+  PutLE64(&frame_data_, frame.step);
+  PutLE32(&frame_data_, 0);
+  uint32_t tiles = 0;
+  for (int row = 0; row < snapshot.GetTileRows(); row++) {
+    for (int column = 0; column < snapshot.GetTileColumns(); column++) {
+      const int width = std::min(
+          Image::kTileSize, snapshot.GetWidth() - column * Image::kTileSize);
+      const int height = std::min(
+          Image::kTileSize, snapshot.GetHeight() - row * Image::kTileSize);
+      const size_t plane_size = static_cast<size_t>(width) * height;
+      planes_.resize(plane_size * 3);
+      uint8_t* const channels[3] = {planes_.data(), planes_.data() + plane_size,
+                                    planes_.data() + 2 * plane_size};
+      // Tiles left out of the snapshot did not change.
+      if (!snapshot.CopyTile(column, row, channels)) continue;
+      bool single_color = true;
+      for (int c = 0; c < 3 && single_color; c++) {
+        single_color =
+            std::all_of(channels[c], channels[c] + plane_size,
+                        [&](uint8_t v) { return v == channels[c][0]; });
+      }
+      PutLE32(&frame_data_, column);
+      PutLE32(&frame_data_, row);
+      if (single_color) {
+        PutLE32(&frame_data_, 0);
+        PutLE32(&frame_data_,
+                channels[0][0] << 16 | channels[1][0] << 8 | channels[2][0]);
+      } else {
+        image_io::EncodeQoi(width, height, channels, &blob_);
+        PutLE32(&frame_data_, blob_.size());
+        PutLE32(&frame_data_, 0);
+        frame_data_.insert(frame_data_.end(), blob_.begin(), blob_.end());
+      }
+      tiles++;
+    }
+  }
+  for (int i = 0; i < 4; i++) frame_data_[8 + i] = (tiles >> (8 * i)) & 0xFF;
+  return fwrite(frame_data_.data(), frame_data_.size(), 1, file_) == 1 &&
+         fflush(file_) == 0;
+}
+
+TimelapseReader::~TimelapseReader() {
+  if (file_) fclose(file_);
+}
+
+bool TimelapseReader::Open(const std::string& filename) {
+  if (file_) fclose(file_);
+  file_ = fopen(filename.c_str(), "rb");
+  uint8_t header[kHeaderSize];
+  if (!file_ || fread(header, kHeaderSize, 1, file_) != 1 ||
+      memcmp(header, kMagic, sizeof(kMagic)) != 0) {
+    if (file_) fclose(file_);
+    file_ = nullptr;
+    return false;
+  }
+  const uint32_t width = GetLE32(header + 8);
+  const uint32_t height = GetLE32(header + 12);
+  const uint32_t tile_size = GetLE32(header + 16);
+  const uint32_t steps_per_frame = GetLE32(header + 20);
+  // Keep the planes within what an Image could hold.
+  if (width < 1 || height < 1 || width > 65535 || height > 65535 ||
+      static_cast<uint64_t>(width) * height > (1u << 28) || tile_size < 1 ||
+      tile_size > 4096 || steps_per_frame < 1 || steps_per_frame > INT32_MAX) {
+    fclose(file_);
+    file_ = nullptr;
+    return false;
+  }
+  width_ = width;
+  height_ = height;
+  tile_size_ = tile_size;
+  steps_per_frame_ = steps_per_frame;
+  step_ = 0;
+  const size_t plane_size = static_cast<size_t>(width_) * height_;
+  planes_.assign(plane_size * 3, 255);
+  for (int c = 0; c < 3; c++) channels_[c] = planes_.data() + c * plane_size;
+  return true;
+}
+
+bool TimelapseReader::ReadFrame() {
+  uint8_t header[kFrameHeaderSize];
+  if (!file_ || fread(header, kFrameHeaderSize, 1, file_) != 1) return false;
+  const uint64_t step = GetLE64(header);
+  uint32_t tiles = GetLE32(header + 8);
+  const uint32_t columns = (width_ + tile_size_ - 1) / tile_size_;
+  const uint32_t rows = (height_ + tile_size_ - 1) / tile_size_;
+  // QOI never needs more than 5 bytes a pixel, plus its header and end.
+  const uint32_t max_size = 5 * tile_size_ * tile_size_ + 22;
+  const size_t plane_size = static_cast<size_t>(width_) * height_;
+  for (; tiles > 0; tiles--) {
+    uint8_t tile_header[kTileHeaderSize];
+    if (fread(tile_header, kTileHeaderSize, 1, file_) != 1) return false;
+    const uint32_t column = GetLE32(tile_header);
+    const uint32_t row = GetLE32(tile_header + 4);
+    const uint32_t size = GetLE32(tile_header + 8);
+    const uint32_t color = GetLE32(tile_header + 12);
+    if (column >= columns || row >= rows || size > max_size) return false;
+    const int x0 = column * tile_size_;
+    const int y0 = row * tile_size_;
+    const int width = std::min(tile_size_, width_ - x0);
+    const int height = std::min(tile_size_, height_ - y0);
+    const uint8_t* source[3];
+    const uint8_t solid[3] = {static_cast<uint8_t>(color >> 16),
+                              static_cast<uint8_t>(color >> 8),
+                              static_cast<uint8_t>(color)};
+    int source_stride = width;
+    if (size == 0) {
+      source_stride = 0;
+      for (int c = 0; c < 3; c++) source[c] = &solid[c];
+    } else {
+      blob_.resize(size);
+      if (fread(blob_.data(), size, 1, file_) != 1) return false;
+      const size_t tile_plane = static_cast<size_t>(width) * height;
+      tile_.resize(tile_plane * 3);
+      const bool decoded = image_io::DecodeQoi(
+          blob_.data(), size,
+          [&](int decoded_width, int decoded_height, uint8_t* planes[3]) {
+            if (decoded_width != width || decoded_height != height) {
+              return false;
+            }
+            for (int c = 0; c < 3; c++) {
+              planes[c] = tile_.data() + c * tile_plane;
+            }
+            return true;
+          });
+      if (!decoded) return false;
+      for (int c = 0; c < 3; c++) source[c] = tile_.data() + c * tile_plane;
+    }
+    for (int c = 0; c < 3; c++) {
+      for (int y = 0; y < height; y++) {
+        uint8_t* out = planes_.data() + c * plane_size +
+                       static_cast<size_t>(y0 + y) * width_ + x0;
+        if (size == 0) {
+          memset(out, solid[c], width);
+        } else {
+          memcpy(out, source[c] + y * source_stride, width);
+        }
+      }
+    }
+  }
+  step_ = step;
+  return true;
+}
+
+bool ExportTimelapseToY4m(const std::string& timelapse, const std::string& y4m,
+                          int fps) {
+  TimelapseReader reader;
+  if (fps < 1 || !reader.Open(timelapse)) {
+    std::cout << "Failed to open timelapse " << timelapse << std::endl;
+    return false;
+  }
+  File out(fopen(y4m.c_str(), "wb"));
+  if (!out) {
+    std::cout << "Failed to save video file " << y4m << std::endl;
+    return false;
+  }
+  const int width = reader.GetWidth();
+  const int height = reader.GetHeight();
+  const std::string header = "YUV4MPEG2 W" + std::to_string(width) + " H" +
+                             std::to_string(height) + " F" +
+                             std::to_string(fps) +
+                             ":1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n";
+  if (fwrite(header.data(), header.size(), 1, out.get()) != 1) {
+    std::cout << "Failed to save video file " << y4m << std::endl;
+    return false;
+  }
+  // Chroma is averaged over 2 by 2 blocks, or what is left of them along
+  // odd edges.
+  const int chroma_width = (width + 1) / 2;
+  const int chroma_height = (height + 1) / 2;
+  const size_t luma_size = static_cast<size_t>(width) * height;
+  const size_t chroma_size = static_cast<size_t>(chroma_width) * chroma_height;
+  std::vector<uint8_t> frame(luma_size + 2 * chroma_size);
+  while (reader.ReadFrame()) {
+    const uint8_t* const* rgb = reader.GetChannels();
+    for (size_t i = 0; i < luma_size; i++) {
+      frame[i] = ToY(rgb[0][i], rgb[1][i], rgb[2][i]);
+    }
+    uint8_t* cb = frame.data() + luma_size;
+    uint8_t* cr = cb + chroma_size;
+    for (int y = 0; y < chroma_height; y++) {
+      for (int x = 0; x < chroma_width; x++) {
+        int sum[3] = {0, 0, 0};
+        int count = 0;
+        for (int dy = 0; dy < 2 && 2 * y + dy < height; dy++) {
+          for (int dx = 0; dx < 2 && 2 * x + dx < width; dx++) {
+            const size_t i =
+                static_cast<size_t>(2 * y + dy) * width + 2 * x + dx;
+            for (int c = 0; c < 3; c++) sum[c] += rgb[c][i];
+            count++;
+          }
+        }
+        const int r = (sum[0] + count / 2) / count;
+        const int g = (sum[1] + count / 2) / count;
+        const int b = (sum[2] + count / 2) / count;
+        cb[y * chroma_width + x] = ToCb(r, g, b);
+        cr[y * chroma_width + x] = ToCr(r, g, b);
+      }
+    }
+    if (fwrite("FRAME\n", 6, 1, out.get()) != 1 ||
+        fwrite(frame.data(), frame.size(), 1, out.get()) != 1) {
+      std::cout << "Failed to save video file " << y4m << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+int ExportTimelapseToImages(const std::string& timelapse,
+                            const std::string& prefix,
+                            const std::string& extension) {
+  TimelapseReader reader;
+  if ((extension != ".bmp" && extension != ".qoi") ||
+      !reader.Open(timelapse)) {
+    std::cout << "Failed to open timelapse " << timelapse << std::endl;
+    return -1;
+  }
+  int frames = 0;
+  while (reader.ReadFrame()) {
+    std::string number = std::to_string(frames);
+    number.insert(0, std::max(0, 5 - static_cast<int>(number.size())), '0');
+    const std::string filename = prefix + number + extension;
+    const bool written =
+        extension == ".qoi"
+            ? image_io::WriteQoi(filename, reader.GetWidth(),
+                                 reader.GetHeight(), reader.GetChannels())
+            : image_io::WriteBmp(filename, reader.GetWidth(),
+                                 reader.GetHeight(), reader.GetChannels());
+    if (!written) {
+      std::cout << "Failed to save image file " << filename << std::endl;
+      return -1;
+    }
+    frames++;
+  }
+  return frames;
+}
+
+}  // namespace graphics
@@ -0,0 +1,198 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "image.h"
+#include "image_event.h"
+
+#ifndef GRAPHICS_TIMELAPSE_H
+#define GRAPHICS_TIMELAPSE_H
+
+namespace graphics {
+
+/**
+ * Records a timelapse of an Image into a delta-encoded frame stream (.tlapse):
+ * every few animation steps, the tiles that changed since the previous frame
+ * are captured and appended as one frame. Idle steps add no frame at all.
+ *
+ * Capturing only takes a copy-on-write snapshot of the changed tiles, see
+ * Image::Snapshot, so it costs the drawing thread a few microseconds per
+ * frame. The tiles are compressed and written by a background thread. If it
+ * falls behind, frames are skipped and their changes go into the next one.
+ *
+ * The layout, with all numbers little-endian, is:
+ *   - a 24-byte header: the magic "TLAPSE01", then width, height, tile size
+ *     and animation steps per frame (32 bits each);
+ *   - frames: the animation step (64 bits) and number of tiles (32 bits),
+ *     then for each tile its column, row, size and color (32 bits each),
+ *     followed by |size| bytes of QOI data, or nothing if |size| is 0 and
+ *     the tile is all |color|, stored as 0xRRGGBB.
+ */
+class TimelapseRecorder : public AnimationEventListener {
+ public:
+  TimelapseRecorder() = default;
+  TimelapseRecorder(const TimelapseRecorder&) = delete;
+  TimelapseRecorder& operator=(const TimelapseRecorder&) = delete;
+  ~TimelapseRecorder();
+
+  /**
+   * Starts recording |image| into |filename|, capturing a frame every
+   * |steps_per_frame| animation steps, which ShowUntilClosed runs every
+   * kDefaultAnimationMs. The first frame holds the whole image. |image| must
+   * stay alive, and must not be moved from, until Stop is called. Returns
+   * false if the file could not be created or the arguments are invalid.
+   */
+  bool Start(const std::string& filename, Image& image, int steps_per_frame);
+
+  /**
+   * Writes out the frames captured so far and stops recording.
+   */
+  void Stop();
+
+  bool IsRecording() const { return image_ != nullptr; }
+
+  /**
+   * Waits until every frame captured so far is written.
+   */
+  void Flush();
+
+  /**
+   * Returns the number of frames captured, and of frames skipped because
+   * the background thread was still busy.
+   */
+  int GetCapturedFrames() const { return captured_frames_; }
+  int GetSkippedFrames() const { return skipped_frames_; }
+
+  // Overridden from AnimationEventListener.
+  void OnAnimationStep() override;
+
+ private:
+  struct Frame {
+    uint64_t step;
+    std::shared_ptr<ImageSnapshot> snapshot;
+  };
+
+  // Captures a frame of the tiles changed since the previous one, unless
+  // nothing changed or the writer is too far behind.
+  void Capture();
+
+  // Runs on writer_, writing out frames_ as they come.
+  void WriteLoop();
+
+  // Compresses the tiles in |frame| and writes them to file_. Returns false
+  // on a write error.
+  bool WriteFrame(const Frame& frame);
+
+  Image* image_ = nullptr;
+  int width_ = 0;
+  int height_ = 0;
+  int steps_per_frame_ = 1;
+  uint64_t step_ = 0;
+  int captured_frames_ = 0;
+  int skipped_frames_ = 0;
+  // The tile generations, and the image's generation, as of the last
+  // captured frame.
+  std::vector<uint64_t> generations_;
+  uint64_t generation_ = 0;
+
+  // Guards the members below, which are shared with writer_.
+  std::mutex mutex_;
+  std::condition_variable work_;
+  std::condition_variable done_;
+  std::deque<Frame> frames_;
+  bool writing_ = false;
+  bool stopping_ = false;
+  bool failed_ = false;
+  std::thread writer_;
+
+  // Only used by writer_ while recording.
+  FILE* file_ = nullptr;
+  std::vector<uint8_t> planes_;
+  std::vector<uint8_t> blob_;
+  std::vector<uint8_t> frame_data_;
+};
+
+/**
+ * Reads a stream written by TimelapseRecorder one frame at a time, keeping
+ * the full image as of the latest frame.
+ */
+class TimelapseReader {
+ public:
+  TimelapseReader() = default;
+  TimelapseReader(const TimelapseReader&) = delete;
+  TimelapseReader& operator=(const TimelapseReader&) = delete;
+  ~TimelapseReader();
+
+  /**
+   * Opens the stream in |filename| and reads its header. The image starts
+   * out white. Returns false if the file is missing or not a timelapse.
+   */
+  bool Open(const std::string& filename);
+
+  /**
+   * Applies the next frame to the image. Returns false at the end of the
+   * stream, or at a frame cut short, e.g. because recording crashed.
+   */
+  bool ReadFrame();
+
+  int GetWidth() const { return width_; }
+  int GetHeight() const { return height_; }
+  int GetStepsPerFrame() const { return steps_per_frame_; }
+
+  /**
+   * Returns the animation step the latest frame was captured at.
+   */
+  uint64_t GetStep() const { return step_; }
+
+  /**
+   * Returns the red, green and blue planes of the image as of the latest
+   * frame, each GetWidth() * GetHeight() values row by row.
+   */
+  const uint8_t* const* GetChannels() const { return channels_; }
+
+ private:
+  FILE* file_ = nullptr;
+  int width_ = 0;
+  int height_ = 0;
+  int tile_size_ = 0;
+  int steps_per_frame_ = 0;
+  uint64_t step_ = 0;
+  std::vector<uint8_t> planes_;
+  const uint8_t* channels_[3] = {nullptr, nullptr, nullptr};
+  std::vector<uint8_t> blob_;
+  std::vector<uint8_t> tile_;
+};
+
+/**
+ * Expands the timelapse in |timelapse| into a Y4M video in |y4m|, with one
+ * video frame per timelapse frame at |fps| frames per second, in full-range
+ * 4:2:0 YCbCr. Returns false if either file could not be used.
+ */
+bool ExportTimelapseToY4m(const std::string& timelapse, const std::string& y4m,
+                          int fps = 30);
+
+/**
+ * Expands the timelapse in |timelapse| into one image per frame, named
+ * |prefix| followed by the frame number, zero-padded to 5 digits, and
+ * |extension|: ".bmp" or ".qoi". Returns the number of images written, or -1
+ * on error.
+ */
+int ExportTimelapseToImages(const std::string& timelapse,
+                            const std::string& prefix,
+                            const std::string& extension = ".bmp");
+
+}  // namespace graphics
+
+#endif  // GRAPHICS_TIMELAPSE_H
@@ -0,0 +1,276 @@
+#include "journal.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "cpputils/graphics/binary_io.h"
+#include "cpputils/graphics/image_hash.h"
+
+namespace {
+
+constexpr char kMagic[8] = {'T', 'P', 'J', 'R', 'N', 'L', '0', '1'};
+// Each record starts with the size of the rest, then its hash.
+constexpr size_t kRecordHeaderSize = 12;
+// Sequence number, type, tool, red, green, blue, width and point count.
+constexpr size_t kFixedPayloadSize = 21;
+
+using graphics::GetLE32;
+using graphics::GetLE64;
+using graphics::PutLE32;
+using graphics::PutLE64;
+
+bool WriteAll(int fd, const uint8_t* data, size_t size) {
+  while (size > 0) {
+    const ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+// Parses the record payload of |size| bytes at |p| into |operation| and
+// |sequence|. Returns false if it is not a valid operation.
+bool ParseOperation(const uint8_t* p, size_t size, uint64_t* sequence,
+                    Journal::Operation* operation) {
+  if (size < kFixedPayloadSize) return false;
+  const uint32_t count = GetLE32(p + 17);
+  if ((size - kFixedPayloadSize) / 8 != count ||
+      (size - kFixedPayloadSize) % 8 != 0 || p[8] > Journal::Operation::kFill ||
+      p[9] > kEraser) {
+    return false;
+  }
+  *sequence = GetLE64(p);
+  operation->type = static_cast<Journal::Operation::Type>(p[8]);
+  operation->tool = static_cast<ToolType>(p[9]);
+  operation->color = graphics::Color(p[10], p[11], p[12]);
+  operation->width = static_cast<int32_t>(GetLE32(p + 13));
+  operation->points.resize(count * 2);
+  for (size_t i = 0; i < operation->points.size(); i++) {
+    operation->points[i] =
+        static_cast<int32_t>(GetLE32(p + kFixedPayloadSize + 4 * i));
+  }
+  if (operation->type == Journal::Operation::kFill) return count == 1;
+  return count > 0;
+}
+
+// Calls |visit| with the offset, size and sequence number of each intact
+// record in |data|, parsed into |operation|, up to the first one that is cut
+// short or corrupt. Returns where the intact records end, or 0 if |data| is
+// not a journal.
+template <typename Visit>
+size_t ForEachRecord(const std::vector<uint8_t>& data,
+                     Journal::Operation* operation, const Visit& visit) {
+  if (data.size() < sizeof(kMagic) ||
+      memcmp(data.data(), kMagic, sizeof(kMagic)) != 0) {
+    return 0;
+  }
+  size_t end = sizeof(kMagic);
+  while (data.size() - end >= kRecordHeaderSize) {
+    const uint32_t size = GetLE32(data.data() + end);
+    const uint8_t* payload = data.data() + end + kRecordHeaderSize;
+    uint64_t sequence;
+    if (data.size() - end - kRecordHeaderSize < size ||
+        graphics::HashBytes(payload, size) != GetLE64(data.data() + end + 4) ||
+        !ParseOperation(payload, size, &sequence, operation)) {
+      break;
+    }
+    visit(end, kRecordHeaderSize + size, sequence);
+    end += kRecordHeaderSize + size;
+  }
+  return end;
+}
+
+std::vector<uint8_t> ReadAll(const std::string& filename) {
+  std::ifstream in(filename, std::ios::binary);
+  return std::vector<uint8_t>((std::istreambuf_iterator<char>(in)),
+                              std::istreambuf_iterator<char>());
+}
+
+}  // namespace
+
+Journal::~Journal() { Close(); }
+
+bool Journal::Open(const std::string& filename, uint64_t sequence,
+                   std::vector<Operation>* tail) {
+  Close();
+  tail->clear();
+  const std::vector<uint8_t> data = ReadAll(filename);
+  // Leave any other file alone. One cut short while the magic was being
+  // written is started over.
+  if (!data.empty() &&
+      memcmp(data.data(), kMagic, std::min(data.size(), sizeof(kMagic))) !=
+          0) {
+    std::cout << filename << " is not a journal" << std::endl;
+    return false;
+  }
+
+  // Keep every intact record, up to the first one that is cut short or
+  // corrupt, and remember where they end.
+  sequence_ = sequence;
+  Operation operation;
+  const size_t end = ForEachRecord(
+      data, &operation,
+      [&](size_t /*offset*/, size_t /*size*/, uint64_t record_sequence) {
+        if (record_sequence >= sequence) {
+          tail->push_back(operation);
+          sequence_ = record_sequence + 1;
+        }
+      });
+
+  fd_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd_ < 0 || ftruncate(fd_, end) != 0 ||
+      (end == 0 && !WriteAll(fd_, reinterpret_cast<const uint8_t*>(kMagic),
+                             sizeof(kMagic))) ||
+      fdatasync(fd_) != 0) {
+    std::cout << "Could not open the journal " << filename << std::endl;
+    if (fd_ >= 0) close(fd_);
+    fd_ = -1;
+    tail->clear();
+    return false;
+  }
+  filename_ = filename;
+  written_sequence_ = sequence_;
+  rotate_ = false;
+  stopping_ = false;
+  failed_ = false;
+  writer_ = std::thread(&Journal::WriteLoop, this);
+  return true;
+}
+
+void Journal::Close() {
+  if (!IsOpen()) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_.notify_one();
+  writer_.join();
+  close(fd_);
+  fd_ = -1;
+}
+
+void Journal::Append(const Operation& operation) {
+  if (!IsOpen()) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const size_t start = pending_.size();
+    pending_.resize(start + kRecordHeaderSize);
+    PutLE64(&pending_, sequence_++);
+    pending_.push_back(operation.type);
+    pending_.push_back(operation.tool);
+    pending_.push_back(operation.color.Red());
+    pending_.push_back(operation.color.Green());
+    pending_.push_back(operation.color.Blue());
+    PutLE32(&pending_, operation.width);
+    PutLE32(&pending_, operation.points.size() / 2);
+    for (size_t i = 0; i + 1 < operation.points.size(); i += 2) {
+      PutLE32(&pending_, operation.points[i]);
+      PutLE32(&pending_, operation.points[i + 1]);
+    }
+    const uint8_t* payload = pending_.data() + start + kRecordHeaderSize;
+    const size_t size = pending_.size() - start - kRecordHeaderSize;
+    PutLE32(&pending_[start], size);
+    PutLE64(&pending_[start + 4], graphics::HashBytes(payload, size));
+  }
+  work_.notify_one();
+}
+
+void Journal::Flush() {
+  if (!IsOpen()) return;
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_.wait(lock, [this] { return written_sequence_ == sequence_; });
+}
+
+void Journal::Rotate(uint64_t sequence) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) return;
+    rotate_sequence_ = sequence;
+    rotate_ = true;
+  }
+  work_.notify_one();
+}
+
+size_t Journal::GetMemoryUsage() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pending_.capacity() + writing_.capacity();
+}
+
+void Journal::WriteLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    work_.wait(lock, [this] {
+      return stopping_ || rotate_ || !pending_.empty();
+    });
+    if (rotate_) {
+      // Records still pending go to the rewritten file afterwards.
+      const uint64_t sequence = rotate_sequence_;
+      rotate_ = false;
+      lock.unlock();
+      const bool rotated = RewriteFrom(sequence);
+      lock.lock();
+      if (!rotated) {
+        std::cout << "Could not rotate the journal " << filename_
+                  << std::endl;
+      }
+      continue;
+    }
+    if (pending_.empty()) break;
+    writing_.swap(pending_);
+    const uint64_t sequence = sequence_;
+    lock.unlock();
+    const bool written = WriteAll(fd_, writing_.data(), writing_.size()) &&
+                         fdatasync(fd_) == 0;
+    writing_.clear();
+    lock.lock();
+    if (!written && !failed_) {
+      failed_ = true;
+      std::cout << "Could not write to the journal " << filename_
+                << std::endl;
+    }
+    written_sequence_ = sequence;
+    done_.notify_all();
+  }
+}
+
+bool Journal::RewriteFrom(uint64_t sequence) {
+  const std::vector<uint8_t> data = ReadAll(filename_);
+  std::vector<uint8_t> kept(kMagic, kMagic + sizeof(kMagic));
+  Operation operation;
+  ForEachRecord(data, &operation,
+                [&](size_t offset, size_t size, uint64_t record_sequence) {
+                  if (record_sequence >= sequence) {
+                    kept.insert(kept.end(), data.begin() + offset,
+                                data.begin() + offset + size);
+                  }
+                });
+  // Write the new file next to the old one, then swap it in, so a crash
+  // at any point leaves one or the other whole.
+  const std::string temporary = filename_ + ".tmp";
+  const int fd =
+      open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  if (fd < 0) return false;
+  if (!WriteAll(fd, kept.data(), kept.size()) || fdatasync(fd) != 0 ||
+      rename(temporary.c_str(), filename_.c_str()) != 0) {
+    close(fd);
+    unlink(temporary.c_str());
+    return false;
+  }
+  // Only this thread writes to fd_, so it can be pointed at the new file
+  // in place.
+  const bool swapped = dup2(fd, fd_) >= 0;
+  close(fd);
+  return swapped;
+}
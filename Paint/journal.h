@@ -0,0 +1,115 @@
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cpputils/graphics/image.h"
+#include "tool_type.h"
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+// An append-only log of the operations applied to the canvas, used to
+// recover them after a crash. Appending only copies the operation into a
+// buffer; a background thread writes whatever has been buffered in one batch
+// and syncs it to the disk, so recording never waits for the disk.
+//
+// The file starts with the magic "TPJRNL01", followed by one record per
+// operation: its size and hash, then its sequence number, type, tool, color,
+// width and points. A record cut short by a crash is dropped on the next
+// Open, along with anything after it.
+class Journal {
+ public:
+  // One operation, as recorded.
+  struct Operation {
+    enum Type : uint8_t {
+      // A stroke that started with a mouse press at its first point.
+      kStroke = 0,
+      // A drag that went on from wherever the tool was, without a press.
+      kContinuedStroke,
+      // A bucket fill from the single point.
+      kFill,
+    };
+    Type type = kStroke;
+    ToolType tool = kPencil;
+    int width = 1;
+    graphics::Color color;
+    // The points of the stroke, or the seed of the fill, as x, y pairs.
+    std::vector<int> points;
+  };
+
+  Journal() = default;
+  Journal(const Journal&) = delete;
+  Journal& operator=(const Journal&) = delete;
+  ~Journal();
+
+  // Opens the journal in |filename| for appending, creating it if needed.
+  // The operations it already holds from sequence number |sequence| on, the
+  // first one not in the last checkpoint, are put in |tail| to be replayed.
+  // Returns false if the file could not be opened, or holds something other
+  // than a journal, which is then left as it was.
+  bool Open(const std::string& filename, uint64_t sequence,
+            std::vector<Operation>* tail);
+
+  // Writes out everything appended so far and closes the journal.
+  void Close();
+
+  bool IsOpen() const { return fd_ >= 0; }
+  const std::string& GetFilename() const { return filename_; }
+
+  // Returns the sequence number the next operation will get, which is also
+  // the number of operations applied so far.
+  uint64_t GetSequence() const { return sequence_; }
+
+  // Records |operation|. Returns right away; the record reaches the disk
+  // shortly after, together with any others appended meanwhile.
+  void Append(const Operation& operation);
+
+  // Waits until everything appended so far is on the disk.
+  void Flush();
+
+  // Drops the recorded operations before sequence number |sequence|, once a
+  // checkpoint holds them. Returns right away; the writer thread rewrites
+  // the file without them, keeping any recorded since, and swaps it in. May
+  // be called from any thread.
+  void Rotate(uint64_t sequence);
+
+  // Returns the bytes held by records waiting to be written and the batch
+  // being written.
+  size_t GetMemoryUsage() const;
+
+ private:
+  // Runs on writer_, writing pending_ out whenever it has data, and
+  // rotating the file when asked.
+  void WriteLoop();
+
+  // Runs on writer_ to replace the file with one holding only the records
+  // from |sequence| on. Returns false, keeping the file as it was, on error.
+  bool RewriteFrom(uint64_t sequence);
+
+  std::string filename_;
+  int fd_ = -1;
+
+  // Guards the members below, which are shared with writer_. sequence_ is
+  // only changed by the thread appending, so it may read it without the lock.
+  mutable std::mutex mutex_;
+  uint64_t sequence_ = 0;
+  std::condition_variable work_;
+  std::condition_variable done_;
+  // Records waiting to be written, and the batch being written. They are
+  // swapped rather than reallocated, so appending does not allocate once
+  // both have grown to fit a typical batch.
+  std::vector<uint8_t> pending_;
+  std::vector<uint8_t> writing_;
+  uint64_t written_sequence_ = 0;
+  // The sequence number to rotate the file to, if rotate_ is set.
+  uint64_t rotate_sequence_ = 0;
+  bool rotate_ = false;
+  bool stopping_ = false;
+  bool failed_ = false;
+  std::thread writer_;
+};
+
+#endif  // JOURNAL_H
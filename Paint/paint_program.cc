@@ -1,10 +1,75 @@
 #include "paint_program.h"
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
 #include <iostream>
+#include <sstream>
 
 constexpr int kBrushWidth = 20;
 constexpr int kImageSize = 500;
+// How many operations the journal records between checkpoints.
+constexpr int kCheckpointInterval = 64;
 
-PaintProgram::PaintProgram() : image_(kImageSize, kImageSize) {}
+namespace {
+
+// Reads the integers in the project setting |key| into |values|. Returns
+// false if the setting is missing or malformed.
+bool ReadSetting(const graphics::ProjectFile::Metadata& metadata,
+                 const std::string& key, std::vector<int>* values) {
+  auto setting = metadata.find(key);
+  if (setting == metadata.end()) return false;
+  std::istringstream stream(setting->second);
+  values->clear();
+  int value;
+  while (stream >> value) values->push_back(value);
+  return stream.eof() && !values->empty();
+}
+
+// Reads the journal sequence number that Checkpoint saves in the project
+// setting "journal_sequence" into |sequence|. Returns false if the setting is
+// missing, malformed or out of range.
+bool ReadSequence(const graphics::ProjectFile::Metadata& metadata,
+                  uint64_t* sequence) {
+  auto setting = metadata.find("journal_sequence");
+  // strtoull would accept leading spaces and a minus sign.
+  if (setting == metadata.end() || setting->second.empty() ||
+      !isdigit(static_cast<unsigned char>(setting->second[0]))) {
+    return false;
+  }
+  errno = 0;
+  char* end = nullptr;
+  const unsigned long long value =
+      strtoull(setting->second.c_str(), &end, 10);
+  if (errno == ERANGE || *end != '\0') return false;
+  *sequence = value;
+  return true;
+}
+
+}  // namespace
+
+PaintProgram::PaintProgram() : image_(kImageSize, kImageSize) {
+  memory_.AddSource("canvas/pixels",
+                    [this] { return image_.GetMemoryUsage(); });
+  memory_.AddSource("canvas/snapshots",
+                    [this] { return image_.GetSnapshotMemoryUsage(); });
+  memory_.AddSource(
+      "caches/pixel_pool",
+      [] { return graphics::PixelPool::Get().GetStats().bytes_cached; },
+      [](size_t) {
+        graphics::PixelPool& pool = graphics::PixelPool::Get();
+        const size_t cached = pool.GetStats().bytes_cached;
+        pool.Trim();
+        return cached - pool.GetStats().bytes_cached;
+      });
+  memory_.AddSource("caches/stroke_arena",
+                    [this] { return stroke_arena_.GetCapacity(); },
+                    [this](size_t) { return stroke_arena_.Trim(); });
+  memory_.AddSource("history/journal",
+                    [this] { return journal_.GetMemoryUsage(); });
+  memory_.AddSource("history/operation", [this] {
+    return operation_.points.capacity() * sizeof(int);
+  });
+}
 
 // Destructor cleans up by removing itself as a MouseEventListener.
 PaintProgram::~PaintProgram() { image_.RemoveMouseEventListener(*this); }
@@ -63,6 +128,109 @@ void PaintProgram::Initialize() {
 
 void PaintProgram::Start() { image_.ShowUntilClosed("TuffyPaint Program"); }
 
+void PaintProgram::SetMemoryBudget(const std::string& category,
+                                   size_t bytes) {
+  memory_.SetBudget(category, bytes);
+  memory_.EnforceBudgets();
+}
+
+bool PaintProgram::SaveProject(const std::string& filename) {
+  return project_.Save(filename, image_, GetSettings());
+}
+
+bool PaintProgram::OpenProject(const std::string& filename) {
+  if (!project_.Open(filename) || !project_.Attach(image_)) {
+    return false;
+  }
+  RestoreSettings(project_.GetMetadata());
+  // So that the savers do not read every tile of the project to save it.
+  autosaver_.Follow(project_);
+  checkpointer_.Follow(project_);
+  image_.Flush();
+  return true;
+}
+
+bool PaintProgram::OpenJournal(const std::string& filename) {
+  checkpointer_.Wait();
+  journal_.Close();
+  operation_.points.clear();
+  operations_since_checkpoint_ = 0;
+  uint64_t sequence = 0;
+  if (checkpoint_.Open(filename + ".tpaint") && checkpoint_.Attach(image_)) {
+    RestoreSettings(checkpoint_.GetMetadata());
+    autosaver_.Follow(checkpoint_);
+    checkpointer_.Follow(checkpoint_);
+    ReadSequence(checkpoint_.GetMetadata(), &sequence);
+  }
+  std::vector<Journal::Operation> tail;
+  if (!journal_.Open(filename, sequence, &tail)) {
+    return false;
+  }
+  for (const Journal::Operation& operation : tail) {
+    ApplyOperation(operation);
+  }
+  for (int i = 0; i < Button_vector.size(); i++) {
+    Button_vector[i]->Draw(image_);
+  }
+  image_.Flush();
+  return tail.empty() || Checkpoint();
+}
+
+void PaintProgram::EnableAutosave(const std::string& filename,
+                                  int interval_ms) {
+  autosave_filename_ = filename;
+  autosave_interval_ = std::chrono::milliseconds(interval_ms);
+  next_autosave_ = std::chrono::steady_clock::now() + autosave_interval_;
+}
+
+bool PaintProgram::Autosave() {
+  if (autosave_filename_.empty() ||
+      !autosaver_.Start(autosave_filename_, image_, GetSettings())) {
+    return false;
+  }
+  next_autosave_ = std::chrono::steady_clock::now() + autosave_interval_;
+  return true;
+}
+
+bool PaintProgram::WaitForAutosave() { return autosaver_.Wait(); }
+
+bool PaintProgram::StartTimelapse(const std::string& filename,
+                                  int steps_per_frame) {
+  return timelapse_.Start(filename, image_, steps_per_frame);
+}
+
+void PaintProgram::StopTimelapse() { timelapse_.Stop(); }
+
+graphics::ProjectFile::Metadata PaintProgram::GetSettings() const {
+  const graphics::Color color = brush_.GetColor();
+  graphics::ProjectFile::Metadata metadata;
+  metadata["tool"] = std::to_string(active_tool_type_);
+  metadata["color"] = std::to_string(color.Red()) + " " +
+                      std::to_string(color.Green()) + " " +
+                      std::to_string(color.Blue());
+  metadata["brush_width"] = std::to_string(brush_.GetWidth());
+  metadata["eraser_width"] = std::to_string(eraser_.GetWidth());
+  return metadata;
+}
+
+void PaintProgram::RestoreSettings(
+    const graphics::ProjectFile::Metadata& metadata) {
+  std::vector<int> values;
+  if (ReadSetting(metadata, "tool", &values) && values[0] >= kPencil &&
+      values[0] <= kEraser) {
+    SetActiveTool(static_cast<ToolType>(values[0]), nullptr);
+  }
+  if (ReadSetting(metadata, "color", &values) && values.size() == 3) {
+    SetActiveColor(graphics::Color(values[0], values[1], values[2]), nullptr);
+  }
+  if (ReadSetting(metadata, "brush_width", &values)) {
+    brush_.SetWidth(values[0]);
+  }
+  if (ReadSetting(metadata, "eraser_width", &values)) {
+    eraser_.SetWidth(values[0]);
+  }
+}
+
   // SetActiveTool Function
 void PaintProgram::SetActiveTool(ToolType type, Button* tool_button) {
   std::string ToolType;
@@ -100,7 +268,7 @@ void PaintProgram::OnMouseEvent(const graphics::MouseEvent& event) {
     case ToolType::kBucket:
       // Bucket paints on mouse down
       if (event.GetMouseAction() == graphics::MouseAction::kPressed) {
-        bucket_.Fill(event.GetX(), event.GetY(), image_);
+        bucket_.Fill(event.GetX(), event.GetY(), image_, stroke_arena_);
       }
       break;
     case ToolType::kPencil:
@@ -113,9 +281,20 @@ void PaintProgram::OnMouseEvent(const graphics::MouseEvent& event) {
       SendEventToPathTool(eraser_, event);
       break;
   }
+  if (journal_.IsOpen()) {
+    RecordEvent(event);
+  }
+  if (event.GetMouseAction() == graphics::MouseAction::kReleased) {
+    stroke_arena_.Release();
+    memory_.EnforceBudgets();
+  }
   for(int i = 0; i < Button_vector.size(); i++){
     Button_vector[i]->Draw(image_);
     }
+  if (!autosave_filename_.empty() && !autosaver_.IsSaving() &&
+      std::chrono::steady_clock::now() >= next_autosave_) {
+    Autosave();
+  }
   image_.Flush();
 }
 
@@ -127,3 +306,97 @@ void PaintProgram::SendEventToPathTool(PathTool& tool,
     tool.MoveTo(event.GetX(), event.GetY(), image_);
   }
 }
+
+void PaintProgram::RecordEvent(const graphics::MouseEvent& event) {
+  const graphics::MouseAction action = event.GetMouseAction();
+  // The bucket only acts on a press, and path tools also draw while dragged,
+  // even if the press went to a button.
+  const bool pressed = action == graphics::MouseAction::kPressed;
+  const bool dragged = action == graphics::MouseAction::kDragged &&
+                       active_tool_type_ != ToolType::kBucket;
+  if (action == graphics::MouseAction::kReleased) {
+    FinishOperation();
+  } else if (pressed || dragged) {
+    AddToOperation(event.GetX(), event.GetY(), pressed);
+  }
+  // Checkpoint between operations, when the canvas matches the journal.
+  if (operation_.points.empty() &&
+      operations_since_checkpoint_ >= kCheckpointInterval) {
+    Checkpoint();
+  }
+}
+
+void PaintProgram::AddToOperation(int x, int y, bool pressed) {
+  if (pressed || operation_.points.empty()) {
+    FinishOperation();
+    if (active_tool_type_ == ToolType::kBucket) {
+      operation_.type = Journal::Operation::kFill;
+    } else if (pressed) {
+      operation_.type = Journal::Operation::kStroke;
+    } else {
+      operation_.type = Journal::Operation::kContinuedStroke;
+    }
+    operation_.tool = active_tool_type_;
+    operation_.color = brush_.GetColor();
+    operation_.width = 1;
+    if (active_tool_type_ == ToolType::kBrush) {
+      operation_.width = brush_.GetWidth();
+    } else if (active_tool_type_ == ToolType::kEraser) {
+      operation_.width = eraser_.GetWidth();
+    }
+  }
+  operation_.points.push_back(x);
+  operation_.points.push_back(y);
+  if (operation_.type == Journal::Operation::kFill) {
+    FinishOperation();
+  }
+}
+
+void PaintProgram::FinishOperation() {
+  if (operation_.points.empty()) return;
+  journal_.Append(operation_);
+  operation_.points.clear();
+  operations_since_checkpoint_++;
+}
+
+void PaintProgram::ApplyOperation(const Journal::Operation& operation) {
+  SetActiveTool(operation.tool, nullptr);
+  SetActiveColor(operation.color, nullptr);
+  const std::vector<int>& points = operation.points;
+  if (operation.type == Journal::Operation::kFill) {
+    bucket_.Fill(points[0], points[1], image_, stroke_arena_);
+    stroke_arena_.Release();
+    return;
+  }
+  PathTool* tool = &pencil_;
+  if (operation.tool == ToolType::kBrush) {
+    brush_.SetWidth(operation.width);
+    tool = &brush_;
+  } else if (operation.tool == ToolType::kEraser) {
+    eraser_.SetWidth(operation.width);
+    tool = &eraser_;
+  }
+  for (size_t i = 0; i + 1 < points.size(); i += 2) {
+    if (i == 0 && operation.type == Journal::Operation::kStroke) {
+      tool->Start(points[i], points[i + 1], image_);
+    } else {
+      tool->MoveTo(points[i], points[i + 1], image_);
+    }
+  }
+}
+
+bool PaintProgram::Checkpoint() {
+  const uint64_t sequence = journal_.GetSequence();
+  graphics::ProjectFile::Metadata metadata = GetSettings();
+  metadata["journal_sequence"] = std::to_string(sequence);
+  // Only the copy-on-write snapshot is taken here. Encoding, syncing and
+  // rotating the journal happen on the checkpointer's thread, so painting
+  // never waits for the disk.
+  if (!checkpointer_.Start(journal_.GetFilename() + ".tpaint", image_,
+                           metadata,
+                           [this, sequence] { journal_.Rotate(sequence); })) {
+    return false;
+  }
+  operations_since_checkpoint_ = 0;
+  return true;
+}
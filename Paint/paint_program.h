@@ -1,13 +1,21 @@
+#include "autosaver.h"
 #include "brush.h"
 #include "bucket.h"
 #include "cpputils/graphics/image.h"
+#include "cpputils/graphics/memory_registry.h"
+#include "cpputils/graphics/project_file.h"
+#include "cpputils/graphics/timelapse.h"
 #include "pencil.h"
 #include "tool_type.h"
 #include "button_listener.h"
 #include "tool_button.h"
 #include "color_button.h"
+#include <chrono>
+#include <string>
 #include <vector>
 #include "eraser.h"
+#include "journal.h"
+#include "stroke_arena.h"
 
 #ifndef PAINT_PROGRAM_H
 #define PAINT_PROGRAM_H
@@ -29,6 +37,54 @@ class PaintProgram : public graphics::MouseEventListener, public ButtonListener
   // Changes the color of all the tools.
   void SetActiveColor(const graphics::Color& color, Button* color_button) override;
 
+  // Saves the canvas and tool settings as a .tpaint project. Saving to the
+  // same project again only writes the parts of the canvas that changed.
+  bool SaveProject(const std::string& filename);
+
+  // Opens a .tpaint project, restoring the canvas and tool settings. Parts
+  // of the canvas are read from the file as they are shown or drawn to.
+  bool OpenProject(const std::string& filename);
+
+  // Records every operation applied to the canvas in the journal at
+  // |filename|, with a full checkpoint of the canvas in |filename|.tpaint
+  // every so often. If they already exist, for example after a crash, the
+  // canvas is first restored from the last checkpoint and the operations
+  // recorded since. Returns false if the journal could not be opened.
+  bool OpenJournal(const std::string& filename);
+
+  // Saves the canvas and tool settings to the project |filename| in the
+  // background every |interval_ms| milliseconds while painting. Painting
+  // carries on during a save, which only writes the parts of the canvas
+  // that changed since the previous one.
+  void EnableAutosave(const std::string& filename, int interval_ms);
+
+  // Starts an autosave right away. Returns false if autosave is not enabled
+  // or the previous autosave is still running.
+  bool Autosave();
+
+  // Waits for the running autosave, if any. Returns false if it failed.
+  bool WaitForAutosave();
+
+  // Records a timelapse of the canvas into |filename|, with a frame of the
+  // parts that changed every |steps_per_frame| animation steps. Use
+  // graphics::ExportTimelapseToY4m to turn it into a video. Returns false if
+  // the file could not be created.
+  bool StartTimelapse(const std::string& filename, int steps_per_frame);
+
+  // Writes out the rest of the timelapse and stops recording.
+  void StopTimelapse();
+
+  // Accounts for the memory of the session: "canvas/pixels" and
+  // "canvas/snapshots" for the canvas and the old tiles kept for autosaves
+  // and the timelapse, "caches/pixel_pool" and "caches/stroke_arena" for
+  // memory kept for reuse, and "history/journal" and "history/operation"
+  // for operations on their way to the journal.
+  graphics::MemoryRegistry& GetMemoryRegistry() { return memory_; }
+
+  // Limits the memory of |category|, see GetMemoryRegistry, to |bytes|,
+  // freeing caches once each operation ends until it fits.
+  void SetMemoryBudget(const std::string& category, size_t bytes);
+
   // Overridden from graphics::MouseEventListener interface
   void OnMouseEvent(const graphics::MouseEvent& event) override;
 
@@ -42,21 +98,69 @@ class PaintProgram : public graphics::MouseEventListener, public ButtonListener
   // PaintBrush.
   void SendEventToPathTool(PathTool& tool, const graphics::MouseEvent& event);
 
+  // The tool settings stored in projects and checkpoints.
+  graphics::ProjectFile::Metadata GetSettings() const;
+  void RestoreSettings(const graphics::ProjectFile::Metadata& metadata);
+
+  // Adds |event| to operation_, appending it to the journal once complete.
+  void RecordEvent(const graphics::MouseEvent& event);
+  void AddToOperation(int x, int y, bool pressed);
+  void FinishOperation();
+
+  // Applies a recorded |operation| to the canvas, as it was first applied.
+  void ApplyOperation(const Journal::Operation& operation);
+
+  // Snapshots the canvas and starts saving it as a checkpoint in the
+  // background, after which the journal drops the operations it holds.
+  // Returns false if the previous checkpoint is still being saved.
+  bool Checkpoint();
+
+  // The open project, which image_ may still be reading tiles from.
+  graphics::ProjectFile project_;
+
+  // The journal's last checkpoint, which image_ may also read tiles from.
+  graphics::ProjectFile checkpoint_;
+
   // The image_ which will be the canvas for the PaintProgram.
   graphics::Image image_;
 
+  // Autosaves image_, so it must go before image_ does.
+  Autosaver autosaver_;
+  std::string autosave_filename_;
+  std::chrono::milliseconds autosave_interval_{0};
+  std::chrono::steady_clock::time_point next_autosave_;
+
+  // Records image_, so it must also go before image_ does.
+  graphics::TimelapseRecorder timelapse_;
+
   // The tools.
   Pencil pencil_;
   Bucket bucket_;
   Brush brush_;
   Eraser eraser_;
 
+  // Temporary memory of the stroke or fill in progress, released when the
+  // mouse is released.
+  StrokeArena stroke_arena_;
 
   // Unique_ptr vector for buttons.
   std::vector<std::unique_ptr<Button>> Button_vector;
 
   // Represents which tool is active.
   ToolType active_tool_type_;
+
+  // The journal, the operation being recorded, and how many operations were
+  // recorded since the last checkpoint.
+  Journal journal_;
+  Journal::Operation operation_;
+  int operations_since_checkpoint_ = 0;
+
+  // Saves checkpoints off the event path. It rotates journal_ and reads
+  // image_, so it must go before they do.
+  Autosaver checkpointer_;
+
+  // Reads the members above, so it must go before they do.
+  graphics::MemoryRegistry memory_;
 };
 
 #endif  // PAINT_PROGRAM_H
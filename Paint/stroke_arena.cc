@@ -0,0 +1,58 @@
+#include "stroke_arena.h"
+
+#include <algorithm>
+#include <cstdint>
+
+StrokeArena::StrokeArena(size_t initial_size) : initial_size_(initial_size) {
+  blocks_.reserve(8);
+  AddBlock(initial_size);
+}
+
+void StrokeArena::Release() {
+  if (blocks_.size() > 1) {
+    // One block for what the operation needed, so the next one fits.
+    const size_t size =
+        std::min(std::max(used_, blocks_.front().size), kMaxRetained);
+    blocks_.clear();
+    AddBlock(size);
+  }
+  offset_ = 0;
+  used_ = 0;
+}
+
+size_t StrokeArena::Trim() {
+  const size_t capacity = GetCapacity();
+  if (used_ > 0 || capacity <= initial_size_) return 0;
+  blocks_.clear();
+  AddBlock(initial_size_);
+  return capacity - initial_size_;
+}
+
+size_t StrokeArena::GetCapacity() const {
+  size_t capacity = 0;
+  for (const Block& block : blocks_) capacity += block.size;
+  return capacity;
+}
+
+void* StrokeArena::do_allocate(size_t bytes, size_t alignment) {
+  const Block* block = &blocks_.back();
+  uintptr_t address = reinterpret_cast<uintptr_t>(block->data.get()) + offset_;
+  size_t padding = (alignment - address % alignment) % alignment;
+  if (offset_ + padding + bytes > block->size) {
+    // Grow geometrically, so that large fills take few blocks.
+    AddBlock(std::max(bytes + alignment, 2 * block->size));
+    block = &blocks_.back();
+    address = reinterpret_cast<uintptr_t>(block->data.get());
+    padding = (alignment - address % alignment) % alignment;
+  }
+  offset_ += padding + bytes;
+  used_ += padding + bytes;
+  return reinterpret_cast<void*>(address + padding);
+}
+
+void StrokeArena::AddBlock(size_t size) {
+  // Left uninitialized, like memory from operator new.
+  blocks_.push_back(
+      {std::unique_ptr<std::byte[]>(new std::byte[size]), size});
+  offset_ = 0;
+}
@@ -0,0 +1,65 @@
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+#ifndef STROKE_ARENA_H
+#define STROKE_ARENA_H
+
+// Memory for the temporary data of one stroke or fill. Allocations are
+// bumped out of a block and never freed one by one; Release frees all of
+// them at once when the operation ends. Use it through std::pmr containers,
+// e.g. std::pmr::vector<int> points(&arena).
+//
+// When an operation outgrows the block, more blocks are added, and Release
+// replaces them with one block as large as the operation needed, up to
+// kMaxRetained bytes, so that the next operation alike does not allocate.
+class StrokeArena : public std::pmr::memory_resource {
+ public:
+  static constexpr size_t kMaxRetained = 16 << 20;
+
+  explicit StrokeArena(size_t initial_size = 64 << 10);
+  StrokeArena(const StrokeArena&) = delete;
+  StrokeArena& operator=(const StrokeArena&) = delete;
+
+  // Frees everything allocated since the last Release. Containers using the
+  // arena must be gone or cleared by then.
+  void Release();
+
+  // Returns the bytes allocated since the last Release, including padding.
+  size_t GetUsed() const { return used_; }
+
+  // Returns the bytes in blocks held by the arena.
+  size_t GetCapacity() const;
+
+  // Shrinks the arena back to its initial block if nothing is allocated,
+  // returning the bytes freed.
+  size_t Trim();
+
+ private:
+  struct Block {
+    std::unique_ptr<std::byte[]> data;
+    size_t size;
+  };
+
+  // Overridden from std::pmr::memory_resource.
+  void* do_allocate(size_t bytes, size_t alignment) override;
+  // Does nothing: memory is only freed by Release.
+  void do_deallocate(void* /*pointer*/, size_t /*bytes*/,
+                     size_t /*alignment*/) override {}
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+  // Adds a block of at least |size| bytes and makes it the current one.
+  void AddBlock(size_t size);
+
+  const size_t initial_size_;
+  std::vector<Block> blocks_;
+  // Where the next allocation goes in the last block.
+  size_t offset_ = 0;
+  size_t used_ = 0;
+};
+
+#endif  // STROKE_ARENA_H
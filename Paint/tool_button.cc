@@ -24,9 +24,16 @@ ToolButton::ToolButton(int x, int y, int width, int height,
 }
 
 void ToolButton::Draw(graphics::Image& image) {
-  Button::Draw(image);
-  image.DrawText(GetX() + kFontSize, GetY() + (GetHeight() - kFontSize) / 2,
-                 text_, 12, 0, 0, 0);
+  graphics::SmallImage& pixels =
+      IsPressed() ? pressed_pixels_ : released_pixels_;
+  if (pixels.GetWidth() == 0) {
+    Button::Draw(image);
+    image.DrawText(GetX() + kFontSize, GetY() + (GetHeight() - kFontSize) / 2,
+                   text_, 12, 0, 0, 0);
+    pixels.CopyFrom(image, GetX(), GetY(), GetWidth(), GetHeight());
+    return;
+  }
+  image.DrawImage(GetX(), GetY(), pixels);
 }
 void ToolButton::DoAction() { GetListener()->SetActiveTool(type_, this); }
 
@@ -1,4 +1,7 @@
+#include <string>
+
 #include "button.h"
+#include "cpputils/graphics/small_image.h"
 
 #ifndef TOOL_BUTTON_H
 #define TOOL_BUTTON_H
@@ -14,6 +17,11 @@ class ToolButton : public Button {
  private:
   ToolType type_;
   std::string text_;
+
+  // The button as last rendered in each state. Drawing text is expensive
+  // and allocates, so each state is rendered once and then copied.
+  graphics::SmallImage pressed_pixels_;
+  graphics::SmallImage released_pixels_;
 };
 
 #endif  // TOOL_BUTTON_H
@@ -0,0 +1,109 @@
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+// Counts heap allocations made through the global operator new so that unit
+// tests can check how much a code path allocates, e.g. per OnMouseEvent, per
+// stroke or per bucket fill.
+//
+// This header replaces the global allocation functions, so it must be
+// included by exactly one translation unit of a test binary.
+
+namespace allocation_counter {
+
+std::atomic<size_t> allocations{0};
+std::atomic<size_t> bytes{0};
+
+void* Allocate(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  bytes.fetch_add(size, std::memory_order_relaxed);
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  if (!ptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void* AllocateAligned(size_t size, std::align_val_t alignment) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  bytes.fetch_add(size, std::memory_order_relaxed);
+  const size_t align = static_cast<size_t>(alignment);
+  // aligned_alloc requires the size to be a multiple of the alignment.
+  void* ptr = std::aligned_alloc(align, (size + align - 1) / align * align);
+  if (!ptr) throw std::bad_alloc();
+  return ptr;
+}
+
+/*
+ * Records the number of allocations and allocated bytes from its creation
+ * until Allocations() or Bytes() is called. Scopes may be nested.
+ */
+class AllocationScope {
+ public:
+  AllocationScope()
+      : start_allocations_(allocations.load()), start_bytes_(bytes.load()) {}
+
+  // Number of calls to operator new since this scope was created.
+  size_t Allocations() const { return allocations.load() - start_allocations_; }
+
+  // Total bytes requested from operator new since this scope was created.
+  size_t Bytes() const { return bytes.load() - start_bytes_; }
+
+ private:
+  size_t start_allocations_;
+  size_t start_bytes_;
+};
+
+}  // namespace allocation_counter
+
+void* operator new(size_t size) { return allocation_counter::Allocate(size); }
+
+void* operator new[](size_t size) { return allocation_counter::Allocate(size); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return allocation_counter::Allocate(size);
+  } catch (const std::bad_alloc&) {
+    return nullptr;
+  }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return allocation_counter::Allocate(size);
+  } catch (const std::bad_alloc&) {
+    return nullptr;
+  }
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+  return allocation_counter::AllocateAligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+  return allocation_counter::AllocateAligned(size, alignment);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+#endif  // ALLOCATION_COUNTER_H
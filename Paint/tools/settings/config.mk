@@ -1,20 +1,20 @@
 ## Unittest name
 UTNAME		:= unittest.cc
 # Flags added to compilation step
-COMPILE_FLAGS		:= -lm -lX11 -lpthread
+COMPILE_FLAGS		:= -lm -lX11 -lpthread -lpng -ljpeg -lz
 # Flags added to unittest compilation step
-UT_COMPILE_FLAGS	:= -lm -lX11 -lpthread
+UT_COMPILE_FLAGS	:= -lm -lX11 -lpthread -lpng -ljpeg -lz
 # Flags added for mac compilation, if different from COMPILE_FLAGS
-MAC_COMPILE_FLAGS	:= -lm -I/opt/X11/include -lpthread -lX11 -lstdc++ -I/usr/X11R6/include -L/usr/X11R6/lib
+MAC_COMPILE_FLAGS	:= -lm -I/opt/X11/include -lpthread -lX11 -lstdc++ -I/usr/X11R6/include -L/usr/X11R6/lib -lpng -ljpeg -lz
 # Flags added for mac unittest compilation step, if different from UT_COMPILE_FLAGS
-MAC_UT_COMPILE_FLAGS := -lm -lpthread -lX11 -I/usr/X11R6/include -L/usr/X11R6/lib
+MAC_UT_COMPILE_FLAGS := -lm -lpthread -lX11 -I/usr/X11R6/include -L/usr/X11R6/lib -lpng -ljpeg -lz
 # Space-separated list of implementation files that should not be style/format
 # checked, i.e. library definitions from cpputils.
-OTHER_IMPLEMS	:= cpputils/graphics/image.cc
+OTHER_IMPLEMS	:= cpputils/graphics/canvas.cc cpputils/graphics/image.cc cpputils/graphics/image_compare.cc cpputils/graphics/image_hash.cc cpputils/graphics/image_io.cc cpputils/graphics/indexed_image.cc cpputils/graphics/memory_registry.cc cpputils/graphics/pixel_image.cc cpputils/graphics/pixel_pool.cc cpputils/graphics/polygon_filler.cc cpputils/graphics/project_file.cc cpputils/graphics/small_image.cc cpputils/graphics/thumbnail_cache.cc cpputils/graphics/timelapse.cc
 # Space-separated list of header files (e.g., algebra.hpp)
-HEADERS       := button.h eraser.h button_listener.h color_button.h tool_button.h tool_type.h brush.h pencil.h bucket.h path_tool.h color_tool.h paint_program.h
+HEADERS       := button.h eraser.h button_listener.h color_button.h tool_button.h tool_type.h brush.h pencil.h bucket.h path_tool.h color_tool.h paint_program.h journal.h autosaver.h stroke_arena.h
 # Space-separated list of implementation files (e.g., algebra.cpp)
-IMPLEMS       := button.cc eraser.cc color_button.cc tool_button.cc brush.cc pencil.cc bucket.cc path_tool.cc color_tool.cc paint_program.cc
+IMPLEMS       := button.cc eraser.cc color_button.cc tool_button.cc brush.cc pencil.cc bucket.cc path_tool.cc color_tool.cc paint_program.cc journal.cc autosaver.cc stroke_arena.cc
 # File containing main
 DRIVER        := main.cc
 # Expected name of executable file
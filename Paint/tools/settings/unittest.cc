@@ -1,17 +1,24 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <filesystem>
+#include <fstream>
+#include <memory_resource>
+#include <sstream>
 #include <string>
 
 #include "../../brush.h"
 #include "../../bucket.h"
 #include "../../color_button.h"
 #include "../../color_tool.h"
+#include "../../cpputils/graphics/test/gesture_generator.h"
 #include "../../cpputils/graphics/test/test_event_generator.h"
 #include "../../paint_program.h"
 #include "../../path_tool.h"
 #include "../../pencil.h"
+#include "../../stroke_arena.h"
 #include "../../tool_button.h"
+#include "../cppaudit/allocation_counter.h"
 #include "../cppaudit/gtest_ext.h"
 #include "../cppaudit/image_test_utils.h"
 
@@ -106,7 +113,6 @@ class PaintProgramTest : public testing::Test {
   void PrepareToTestMouseEvents() {
     graphics::Image* image = paint_program.GetImageForTesting();
     generator = std::make_unique<graphics::TestEventGenerator>(image);
-    image->Show();
   }
 
   void ClickButton(Button* button) {
@@ -740,6 +746,357 @@ TEST_F(PaintProgramTest, EraserDrawsAThickLineOnDrag) {
          "ensure no drawing happens on release.";
 }
 
+// Drags the active tool in a zig-zag across the canvas, starting at
+// (|x|, |y|), with one kDragged event per step.
+void DragZigZag(PaintProgram& paint_program, int x, int y, int steps) {
+  for (int i = 1; i <= steps; i++) {
+    paint_program.OnMouseEvent(graphics::MouseEvent(
+        x + i * 3, y + (i % 2) * 40, graphics::MouseAction::kDragged));
+  }
+}
+
+TEST_F(PaintProgramTest, SteadyStateDragDoesNotAllocate) {
+  for (ToolType type : {ToolType::kPencil, ToolType::kBrush,
+                        ToolType::kEraser}) {
+    paint_program.SetActiveTool(type, nullptr);
+    // The first stroke may grow scratch buffers and cache button pixels.
+    paint_program.OnMouseEvent(
+        graphics::MouseEvent(100, 250, graphics::MouseAction::kPressed));
+    DragZigZag(paint_program, 100, 250, 50);
+    paint_program.OnMouseEvent(
+        graphics::MouseEvent(250, 290, graphics::MouseAction::kReleased));
+
+    paint_program.OnMouseEvent(
+        graphics::MouseEvent(100, 250, graphics::MouseAction::kPressed));
+    allocation_counter::AllocationScope scope;
+    DragZigZag(paint_program, 100, 250, 50);
+    size_t allocations = scope.Allocations();
+    paint_program.OnMouseEvent(
+        graphics::MouseEvent(250, 290, graphics::MouseAction::kReleased));
+    EXPECT_EQ(0, allocations)
+        << "    Dragging tool type " << type << " allocated "
+        << allocations << " times over 50 kDragged events.";
+  }
+}
+
+TEST_F(PaintProgramTest, SteadyStateStrokeDoesNotAllocate) {
+  paint_program.SetActiveTool(ToolType::kBrush, nullptr);
+  for (int stroke = 0; stroke < 3; stroke++) {
+    allocation_counter::AllocationScope scope;
+    paint_program.OnMouseEvent(
+        graphics::MouseEvent(100, 200, graphics::MouseAction::kPressed));
+    DragZigZag(paint_program, 100, 200, 60);
+    paint_program.OnMouseEvent(
+        graphics::MouseEvent(280, 200, graphics::MouseAction::kReleased));
+    // Only the first stroke is allowed to warm up.
+    if (stroke > 0) {
+      EXPECT_EQ(0, scope.Allocations())
+          << "    Stroke " << stroke << " allocated " << scope.Bytes()
+          << " bytes.";
+    }
+  }
+}
+
+TEST_F(PaintProgramTest, RepeatedBucketFillDoesNotAllocate) {
+  paint_program.SetActiveTool(ToolType::kBucket, nullptr);
+  const graphics::Color colors[] = {graphics::Color(255, 0, 0),
+                                    graphics::Color(0, 0, 255)};
+  for (int fill = 0; fill < 4; fill++) {
+    paint_program.SetActiveColor(colors[fill % 2], nullptr);
+    allocation_counter::AllocationScope scope;
+    paint_program.OnMouseEvent(
+        graphics::MouseEvent(250, 300, graphics::MouseAction::kPressed));
+    paint_program.OnMouseEvent(
+        graphics::MouseEvent(250, 300, graphics::MouseAction::kReleased));
+    // The first fill sizes the fill buffer for this region.
+    if (fill > 0) {
+      EXPECT_EQ(0, scope.Allocations())
+          << "    Bucket fill " << fill << " allocated " << scope.Bytes()
+          << " bytes.";
+    }
+  }
+  EXPECT_EQ(colors[1], paint_program.GetImageForTesting()->GetColor(250, 300));
+}
+
+TEST_F(PaintProgramTest, AccountsForMemoryAndKeepsCachesInBudget) {
+  graphics::MemoryRegistry& memory = paint_program.GetMemoryRegistry();
+  EXPECT_GE(memory.GetUsage("canvas/pixels"), 500 * 500 * 3);
+  EXPECT_EQ(0, memory.GetUsage("canvas/snapshots"));
+  const size_t arena = memory.GetUsage("caches/stroke_arena");
+
+  // A large fill grows the stroke arena, which keeps the memory for the
+  // next fill.
+  paint_program.SetActiveTool(ToolType::kBucket, nullptr);
+  paint_program.SetActiveColor(graphics::Color(255, 0, 0), nullptr);
+  paint_program.OnMouseEvent(
+      graphics::MouseEvent(250, 300, graphics::MouseAction::kPressed));
+  paint_program.OnMouseEvent(
+      graphics::MouseEvent(250, 300, graphics::MouseAction::kReleased));
+  EXPECT_GT(memory.GetUsage("caches/stroke_arena"), arena);
+
+  std::ostringstream dump;
+  memory.Dump(dump);
+  for (const char* line : {"total: ", "\n  canvas: ", "\n    pixels: ",
+                           "\n  caches: ", "\n    stroke_arena: ",
+                           "\n  history: ", "\n    journal: "}) {
+    EXPECT_NE(std::string::npos, dump.str().find(line)) << line;
+  }
+
+  // Under a budget, caches are trimmed once the operation ends.
+  paint_program.SetMemoryBudget("caches", arena);
+  EXPECT_LE(memory.GetUsage("caches"), arena);
+  paint_program.SetActiveColor(graphics::Color(0, 0, 255), nullptr);
+  paint_program.OnMouseEvent(
+      graphics::MouseEvent(250, 300, graphics::MouseAction::kPressed));
+  paint_program.OnMouseEvent(
+      graphics::MouseEvent(250, 300, graphics::MouseAction::kReleased));
+  EXPECT_LE(memory.GetUsage("caches"), arena);
+  EXPECT_EQ(graphics::Color(0, 0, 255),
+            paint_program.GetImageForTesting()->GetColor(250, 300));
+}
+
+TEST(StrokeArenaTest, ReleasesAllAtOnceAndKeepsWhatItNeeded) {
+  StrokeArena arena(1024);
+  {
+    std::pmr::vector<int> values(&arena);
+    for (int i = 0; i < 10000; i++) values.push_back(i);
+    EXPECT_EQ(9999, values.back());
+  }
+  EXPECT_GT(arena.GetCapacity(), 1024);
+  const size_t used = arena.GetUsed();
+  arena.Release();
+  EXPECT_EQ(0, arena.GetUsed());
+  EXPECT_GE(arena.GetCapacity(), used);
+
+  // The same operation again fits in the block that was kept.
+  allocation_counter::AllocationScope scope;
+  {
+    std::pmr::vector<int> values(&arena);
+    for (int i = 0; i < 10000; i++) values.push_back(i);
+  }
+  arena.Release();
+  EXPECT_EQ(0, scope.Allocations())
+      << "    A repeated operation allocated " << scope.Bytes() << " bytes.";
+}
+
+// Replays a mix of synthetic gestures with every tool and records the
+// sustained throughput and worst per-event cost in unittest.xml.
+TEST_F(PaintProgramTest, StressTestsEveryToolWithSyntheticGestures) {
+  graphics::Image* image = paint_program.GetImageForTesting();
+  graphics::GestureGenerator generator(image->GetWidth(), image->GetHeight(),
+                                       42 /* seed */, 2000);
+  std::vector<graphics::TimedMouseEvent> events =
+      generator.RandomWalk(200, 15);
+  for (const std::vector<graphics::TimedMouseEvent>& gesture :
+       {generator.Spiral(250, 300, 180, 3), generator.Scribble(4, 25),
+        generator.Clicks(3)}) {
+    events.insert(events.end(), gesture.begin(), gesture.end());
+  }
+
+  const std::vector<std::pair<ToolType, std::string>> tools = {
+      {ToolType::kPencil, "pencil"},
+      {ToolType::kEraser, "eraser"},
+      {ToolType::kBrush, "brush"},
+      {ToolType::kBucket, "bucket"}};
+  for (const auto& tool : tools) {
+    paint_program.SetActiveTool(tool.first, nullptr);
+    paint_program.SetActiveColor(graphics::Color(40, 20, 230), nullptr);
+    graphics::GestureStats stats =
+        graphics::ReplayGestures(events, paint_program);
+    EXPECT_EQ(stats.events, events.size());
+    EXPECT_GT(stats.events_per_second, 0);
+    EXPECT_LE(stats.mean_event_seconds, stats.worst_event_seconds);
+    RecordProperty(tool.second + "_events_per_second",
+                   static_cast<int>(stats.events_per_second));
+    RecordProperty(tool.second + "_worst_event_us",
+                   static_cast<int>(stats.worst_event_seconds * 1e6));
+  }
+  // The brush and bucket run last, so they should have left their mark.
+  EXPECT_FALSE(ImageIsColorExceptForButtons(white));
+}
+
+TEST_F(PaintProgramTest, SavesAndReopensProjects) {
+  const std::string filename = "SavesAndReopensProjects.tpaint";
+  remove(filename.c_str());
+  const graphics::Color purple(155, 118, 204);
+  paint_program.SetActiveTool(ToolType::kBrush, nullptr);
+  paint_program.SetActiveColor(purple, nullptr);
+  graphics::ReplayGestures(
+      graphics::GestureGenerator(500, 500, 7).Spiral(250, 300, 150, 2),
+      paint_program);
+  paint_program.SetActiveTool(ToolType::kPencil, nullptr);
+  ASSERT_TRUE(paint_program.SaveProject(filename));
+
+  PaintProgram reopened;
+  reopened.Initialize();
+  ASSERT_TRUE(reopened.OpenProject(filename));
+  graphics::Image* image = reopened.GetImageForTesting();
+  // Nothing is decoded until it is needed, not even to autosave.
+  EXPECT_FALSE(image->IsTileLoaded(1, 2));
+  const std::string autosave = "SavesAndReopensProjectsAutosave.tpaint";
+  reopened.EnableAutosave(autosave, 60 * 60 * 1000);
+  ASSERT_TRUE(reopened.Autosave());
+  ASSERT_TRUE(reopened.WaitForAutosave());
+  EXPECT_FALSE(image->IsTileLoaded(1, 2));
+  remove(autosave.c_str());
+  EXPECT_TRUE(ImagesMatch(paint_program.GetImageForTesting(), image,
+                          "SavesAndReopensProjects.bmp", kTypeHighlight));
+
+  // The pencil and its color come back too.
+  reopened.OnMouseEvent(
+      graphics::MouseEvent(480, 480, graphics::MouseAction::kPressed));
+  EXPECT_EQ(image->GetColor(480, 480), purple);
+  EXPECT_EQ(image->GetColor(481, 480), white);
+
+  // Saving again only appends the changed tiles, here the pencil's and the
+  // ones with buttons, which are redrawn after every event.
+  const size_t size = std::filesystem::file_size(filename);
+  ASSERT_TRUE(reopened.SaveProject(filename));
+  EXPECT_LT(std::filesystem::file_size(filename) - size, size);
+  remove(filename.c_str());
+}
+
+TEST_F(PaintProgramTest, RecoversFromJournal) {
+  const std::string filename = "RecoversFromJournal.journal";
+  remove(filename.c_str());
+  remove((filename + ".tpaint").c_str());
+  graphics::GestureGenerator gestures(500, 500, 11);
+  const std::vector<std::pair<ToolType, std::vector<graphics::TimedMouseEvent>>>
+      operations = {{ToolType::kBrush, gestures.Scribble(6, 20)},
+                    {ToolType::kBucket, gestures.Clicks(2)},
+                    {ToolType::kPencil, gestures.Clicks(70)},
+                    {ToolType::kEraser, gestures.Spiral(250, 300, 120, 2)},
+                    {ToolType::kPencil, gestures.RandomWalk(50, 10)}};
+  {
+    PaintProgram crashed;
+    crashed.Initialize();
+    ASSERT_TRUE(crashed.OpenJournal(filename));
+    for (const auto& operation : operations) {
+      for (PaintProgram* program : {&crashed, &paint_program}) {
+        program->SetActiveTool(operation.first, nullptr);
+        program->SetActiveColor(graphics::Color(200, 30, 90), nullptr);
+        graphics::ReplayGestures(operation.second, *program);
+      }
+    }
+    // Nothing more is written on exit, so recovering after this is the same
+    // as recovering after a crash.
+  }
+  // More than kCheckpointInterval operations were recorded. The checkpoint
+  // was saved in the background, and the journal then dropped the
+  // operations it holds.
+  ASSERT_TRUE(std::filesystem::exists(filename + ".tpaint"));
+  {
+    Journal journal;
+    std::vector<Journal::Operation> tail;
+    ASSERT_TRUE(journal.Open(filename, 0, &tail));
+    EXPECT_LT(tail.size(), 64);
+    EXPECT_FALSE(tail.empty());
+  }
+  // A record torn by the crash is ignored.
+  {
+    std::ofstream journal(filename, std::ios::binary | std::ios::app);
+    journal << "\x30\x00\x00\x00torn";
+  }
+
+  {
+    // The journal is written to until the program is destroyed.
+    PaintProgram recovered;
+    recovered.Initialize();
+    ASSERT_TRUE(recovered.OpenJournal(filename));
+    EXPECT_TRUE(ImagesMatch(paint_program.GetImageForTesting(),
+                            recovered.GetImageForTesting(),
+                            "RecoversFromJournal.bmp", kTypeHighlight));
+  }
+  // Any other file is refused and left as it was.
+  {
+    std::ofstream(filename, std::ios::binary) << "not a journal";
+    Journal journal;
+    std::vector<Journal::Operation> tail;
+    EXPECT_FALSE(journal.Open(filename, 0, &tail));
+    EXPECT_EQ(std::filesystem::file_size(filename), 13u);
+  }
+  remove(filename.c_str());
+  remove((filename + ".tpaint").c_str());
+}
+
+TEST_F(PaintProgramTest, AutosavesWhilePainting) {
+  const std::string filename = "AutosavesWhilePainting.tpaint";
+  remove(filename.c_str());
+  graphics::GestureGenerator gestures(500, 500, 3);
+  const std::vector<graphics::TimedMouseEvent> spiral =
+      gestures.Spiral(250, 300, 150, 2);
+  const std::vector<graphics::TimedMouseEvent> scribble =
+      gestures.Scribble(30, 20);
+
+  // A manual autosave saves the canvas as it was when it started, however
+  // much is painted while it runs.
+  PaintProgram expected;
+  expected.Initialize();
+  graphics::ReplayGestures(spiral, expected);
+  paint_program.EnableAutosave(filename, 60 * 60 * 1000);
+  graphics::ReplayGestures(spiral, paint_program);
+  ASSERT_TRUE(paint_program.Autosave());
+  paint_program.SetActiveColor(graphics::Color(20, 225, 250), nullptr);
+  graphics::ReplayGestures(scribble, paint_program);
+  ASSERT_TRUE(paint_program.WaitForAutosave());
+  {
+    PaintProgram reopened;
+    reopened.Initialize();
+    ASSERT_TRUE(reopened.OpenProject(filename));
+    EXPECT_TRUE(ImagesMatch(expected.GetImageForTesting(),
+                            reopened.GetImageForTesting(),
+                            "AutosavesWhilePainting.bmp", kTypeHighlight));
+  }
+
+  // With no interval, every event starts an autosave unless one is running.
+  paint_program.EnableAutosave(filename, 0);
+  paint_program.SetActiveTool(ToolType::kPencil, nullptr);
+  graphics::ReplayGestures(gestures.RandomWalk(300, 15), paint_program);
+  paint_program.SetActiveTool(ToolType::kBucket, nullptr);
+  graphics::ReplayGestures(gestures.Clicks(10), paint_program);
+  ASSERT_TRUE(paint_program.WaitForAutosave());
+  ASSERT_TRUE(paint_program.Autosave());
+  ASSERT_TRUE(paint_program.WaitForAutosave());
+  PaintProgram reopened;
+  reopened.Initialize();
+  ASSERT_TRUE(reopened.OpenProject(filename));
+  EXPECT_TRUE(ImagesMatch(paint_program.GetImageForTesting(),
+                          reopened.GetImageForTesting(),
+                          "AutosavesWhilePaintingLast.bmp", kTypeHighlight));
+  remove(filename.c_str());
+}
+
+TEST_F(PaintProgramTest, RecordsTimelapse) {
+  const std::string filename = "RecordsTimelapse.tlapse";
+  graphics::GestureGenerator gestures(500, 500, 4);
+  graphics::TestEventGenerator generator(paint_program.GetImageForTesting());
+  ASSERT_TRUE(paint_program.StartTimelapse(filename, 3));
+  for (int i = 0; i < 3; i++) {
+    graphics::ReplayGestures(gestures.RandomWalk(50, 10), paint_program);
+    for (int step = 0; step < 3; step++) generator.SendAnimationEvent();
+  }
+  paint_program.StopTimelapse();
+
+  graphics::TimelapseReader reader;
+  ASSERT_TRUE(reader.Open(filename));
+  int frames = 0;
+  while (reader.ReadFrame()) frames++;
+  EXPECT_EQ(4, frames);
+  EXPECT_EQ(9, reader.GetStep());
+  graphics::Image last(reader.GetWidth(), reader.GetHeight());
+  for (int y = 0; y < last.GetHeight(); y++) {
+    for (int x = 0; x < last.GetWidth(); x++) {
+      const size_t i = static_cast<size_t>(y) * last.GetWidth() + x;
+      last.SetColor(x, y, graphics::Color(reader.GetChannels()[0][i],
+                                          reader.GetChannels()[1][i],
+                                          reader.GetChannels()[2][i]));
+    }
+  }
+  EXPECT_TRUE(ImagesMatch(paint_program.GetImageForTesting(), &last,
+                          "RecordsTimelapse.bmp", kTypeHighlight));
+  remove(filename.c_str());
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
   bool skip = true;